@@ -0,0 +1,144 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+/* times stsml_value_from_redis on large replies that never touch a redis server
+
+build from the repository root, the same way as build.sh but optimized:
+cc -O2 -o redis_reply_bench bench/redis_reply.c src/util.c src/redis.c src/parser.c lib/SimpleTinyScript/cli.c -lonion -lhiredis -lpthread -lm -DNO_CLI_MAIN=1 -DCOMPILING=1 -DSTS_GOTO_JIT
+*/
+
+#include "../src/util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/* hiredis frees replies with free by default, so hand built ones can go through freeReplyObject */
+static redisReply *bench_reply_string(size_t i)
+{
+	redisReply *ret = calloc(1, sizeof(redisReply));
+	char buffer[64];
+
+
+	ret->type = REDIS_REPLY_STRING;
+	ret->len = snprintf(buffer, sizeof(buffer), "value:%zu", i);
+	ret->str = strdup(buffer);
+
+	return ret;
+}
+
+static redisReply *bench_reply_array(int type, size_t elements)
+{
+	redisReply *ret = calloc(1, sizeof(redisReply));
+	size_t i;
+
+
+	ret->type = type;
+	ret->elements = elements;
+	ret->element = calloc(elements, sizeof(redisReply *));
+
+	for(i = 0; i < elements; ++i)
+		ret->element[i] = bench_reply_string(i);
+
+	return ret;
+}
+
+/* every element is a one element array, which would have taken a stack frame each when converting recursively */
+static redisReply *bench_reply_nested(size_t depth)
+{
+	redisReply *ret = NULL, *inner = bench_reply_string(depth);
+	size_t i;
+
+
+	for(i = 0; i < depth; ++i)
+	{
+		ret = calloc(1, sizeof(redisReply));
+
+		ret->type = REDIS_REPLY_ARRAY;
+		ret->elements = 1;
+		ret->element = calloc(1, sizeof(redisReply *));
+		ret->element[0] = inner;
+
+		inner = ret;
+	}
+
+	return ret;
+}
+
+static void bench_run(sts_script_t *script, const char *name, redisReply *reply, size_t elements, int map)
+{
+	sts_value_t *value = NULL;
+	double start, convert, destroy;
+
+
+	start = stsml_time_now();
+
+	if(!(value = map ? stsml_value_from_redis_map(script, reply) : stsml_value_from_redis(script, reply)))
+	{
+		fprintf(stderr, "could not convert %s\n", name);
+		return;
+	}
+
+	convert = stsml_time_now() - start;
+
+	start = stsml_time_now();
+	sts_value_reference_decrement(script, value);
+	destroy = stsml_time_now() - start;
+
+	printf("%-16s %9zu elements  convert %9.3f ms  %7.1f ns/element  free %9.3f ms\n", name, elements, convert * 1000.0, convert * 1000000000.0 / (double)elements, destroy * 1000.0);
+}
+
+int main(int argc, char **argv)
+{
+	size_t sizes[] = {10000, 100000, 1000000}, i;
+	sts_script_t script;
+	redisReply *reply = NULL;
+
+
+	memset(&script, 0, sizeof(sts_script_t));
+
+	for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+	{
+		reply = bench_reply_array(REDIS_REPLY_ARRAY, sizes[i]);
+		bench_run(&script, "array", reply, sizes[i], 0);
+		bench_run(&script, "hgetall pairs", reply, sizes[i], 1);
+		freeReplyObject(reply);
+
+		reply = bench_reply_array(REDIS_REPLY_MAP, sizes[i]);
+		bench_run(&script, "resp3 map", reply, sizes[i], 0);
+		freeReplyObject(reply);
+
+	}
+
+	/* hiredis and sts both free recursively, so this stays at a depth their frees can take */
+	reply = bench_reply_nested(10000);
+	bench_run(&script, "nested", reply, 10000, 0);
+	freeReplyObject(reply);
+
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,713 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+#include "cache.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <errno.h>
+#include <time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+
+#define STSML_CACHE_BUCKETS 1024
+
+/* how often a put walks the whole table for entries past their stale window */
+#define STSML_CACHE_SWEEP_INTERVAL 60.0
+
+
+typedef struct stsml_cache_entry_s
+{
+	char *key;
+	stsml_cache_page_t *page;
+
+	double expires, stale_until;
+
+	int regenerating;
+
+	/* what the page is counted as against max_bytes */
+	size_t bytes;
+
+	struct stsml_cache_entry_s *next, *lru_prev, *lru_next;
+} stsml_cache_entry_t;
+
+/* a render in progress that identical requests can wait on instead of rendering themselves */
+typedef struct stsml_cache_flight_s
+{
+	char *key;
+	stsml_cache_page_t *page;
+
+	int done;
+	unsigned int waiters;
+
+	struct stsml_cache_flight_s *next;
+} stsml_cache_flight_t;
+
+/* the ttl the last render of a script asked for with http-cache. Only these scripts are looked up and coalesced */
+typedef struct stsml_cache_path_s
+{
+	char *path;
+	double ttl;
+
+	struct stsml_cache_path_s *next;
+} stsml_cache_path_t;
+
+static struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t flight_cond;
+	stsml_cache_entry_t *buckets[STSML_CACHE_BUCKETS];
+	stsml_cache_path_t *paths[STSML_CACHE_BUCKETS];
+
+	/* most recently used first, the tail is evicted once the pages take more than max_bytes */
+	stsml_cache_entry_t *lru_head, *lru_tail;
+	size_t bytes, max_bytes;
+	double next_sweep;
+
+	stsml_cache_flight_t *flights;
+	double flight_timeout;
+
+	stsml_cache_stats_t stats;
+} cache = {.lock = PTHREAD_MUTEX_INITIALIZER, .flight_cond = PTHREAD_COND_INITIALIZER};
+
+
+static unsigned int stsml_cache_hash(const char *key)
+{
+	unsigned int hash = 2166136261u;
+
+
+	while(*key)
+	{
+		hash ^= (unsigned char)*key++;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+/* must be called with the cache lock held */
+static stsml_cache_entry_t *stsml_cache_find(const char *key, stsml_cache_entry_t ***link)
+{
+	stsml_cache_entry_t **current = &cache.buckets[stsml_cache_hash(key) % STSML_CACHE_BUCKETS];
+
+
+	for(; *current; current = &(*current)->next)
+	{
+		if(!strcmp((*current)->key, key))
+			break;
+	}
+
+	if(link)
+		*link = current;
+
+	return *current;
+}
+
+/* must be called with the cache lock held */
+static void stsml_cache_page_unref(stsml_cache_page_t *page)
+{
+	stsml_cache_header_t *header = NULL;
+
+
+	if(!page || --page->references)
+		return;
+
+	while((header = page->headers))
+	{
+		page->headers = header->next;
+
+		free(header->key);
+		free(header->value);
+		free(header);
+	}
+
+	free(page->etag);
+	free(page->gzip);
+	free(page->body);
+	free(page);
+}
+
+static void stsml_cache_lru_unlink(stsml_cache_entry_t *entry)
+{
+	if(entry->lru_prev)
+		entry->lru_prev->lru_next = entry->lru_next;
+	else
+		cache.lru_head = entry->lru_next;
+
+	if(entry->lru_next)
+		entry->lru_next->lru_prev = entry->lru_prev;
+	else
+		cache.lru_tail = entry->lru_prev;
+
+	entry->lru_prev = entry->lru_next = NULL;
+}
+
+static void stsml_cache_lru_push(stsml_cache_entry_t *entry)
+{
+	entry->lru_prev = NULL;
+	entry->lru_next = cache.lru_head;
+
+	if(cache.lru_head)
+		cache.lru_head->lru_prev = entry;
+	else
+		cache.lru_tail = entry;
+
+	cache.lru_head = entry;
+}
+
+/* takes the entry out of the table and frees it, the lock must be held */
+static void stsml_cache_remove(stsml_cache_entry_t *entry)
+{
+	stsml_cache_entry_t **link = NULL;
+
+
+	for(link = &cache.buckets[stsml_cache_hash(entry->key) % STSML_CACHE_BUCKETS]; *link; link = &(*link)->next)
+	{
+		if(*link == entry)
+		{
+			*link = entry->next;
+			break;
+		}
+	}
+
+	stsml_cache_lru_unlink(entry);
+
+	cache.bytes -= entry->bytes;
+
+	stsml_cache_page_unref(entry->page);
+	free(entry->key);
+	free(entry);
+}
+
+/* drops every entry past its stale window that nobody is refreshing. Without it a key that is never asked for again, like a page with a one off query, would stay forever */
+static void stsml_cache_sweep(double now)
+{
+	stsml_cache_entry_t *entry = NULL, *next = NULL;
+	size_t i;
+
+
+	for(i = 0; i < STSML_CACHE_BUCKETS; ++i)
+	{
+		for(entry = cache.buckets[i]; entry; entry = next)
+		{
+			next = entry->next;
+
+			if(now >= entry->stale_until && !entry->regenerating)
+				stsml_cache_remove(entry);
+		}
+	}
+
+	cache.next_sweep = now + STSML_CACHE_SWEEP_INTERVAL;
+}
+
+/* the memory a page is counted as, its key included */
+static size_t stsml_cache_page_bytes(const char *key, stsml_cache_page_t *page)
+{
+	stsml_cache_header_t *header = NULL;
+	size_t ret = sizeof(stsml_cache_entry_t) + sizeof(stsml_cache_page_t) + strlen(key) + page->size + page->gzip_size;
+
+
+	if(page->etag)
+		ret += strlen(page->etag);
+
+	for(header = page->headers; header; header = header->next)
+		ret += sizeof(stsml_cache_header_t) + strlen(header->key) + strlen(header->value);
+
+	return ret;
+}
+
+/* max_bytes bounds the pages kept, the least recently used go first */
+int stsml_cache_init(double flight_timeout, size_t max_bytes)
+{
+	memset(cache.buckets, 0, sizeof(cache.buckets));
+	memset(cache.paths, 0, sizeof(cache.paths));
+	memset(&cache.stats, 0, sizeof(cache.stats));
+
+	cache.lru_head = cache.lru_tail = NULL;
+	cache.bytes = 0;
+	cache.max_bytes = max_bytes;
+	cache.next_sweep = stsml_time_now() + STSML_CACHE_SWEEP_INTERVAL;
+
+	cache.flights = NULL;
+	cache.flight_timeout = flight_timeout;
+
+	return 0;
+}
+
+void stsml_cache_destroy(void)
+{
+	stsml_cache_entry_t *entry = NULL;
+	stsml_cache_flight_t *flight = NULL;
+	stsml_cache_path_t *path = NULL;
+	size_t i;
+
+
+	pthread_mutex_lock(&cache.lock);
+
+	while((flight = cache.flights))
+	{
+		cache.flights = flight->next;
+
+		free(flight->key);
+		free(flight);
+	}
+
+	while((entry = cache.lru_head))
+		stsml_cache_remove(entry);
+
+	for(i = 0; i < STSML_CACHE_BUCKETS; ++i)
+	{
+		while((path = cache.paths[i]))
+		{
+			cache.paths[i] = path->next;
+
+			free(path->path);
+			free(path);
+		}
+	}
+
+	pthread_mutex_unlock(&cache.lock);
+}
+
+/* returns the state of the entry. A stale entry sets regenerate for exactly one caller until the entry is put or abandoned */
+int stsml_cache_get(const char *key, stsml_cache_page_t **page, int *regenerate)
+{
+	stsml_cache_entry_t *entry = NULL;
+	int state = STSML_CACHE_MISS;
+	double now = stsml_time_now();
+
+
+	*page = NULL;
+
+	if(regenerate)
+		*regenerate = 0;
+
+	pthread_mutex_lock(&cache.lock);
+
+	if((entry = stsml_cache_find(key, NULL)))
+	{
+		if(now < entry->expires)
+			state = STSML_CACHE_FRESH;
+		else if(now < entry->stale_until)
+		{
+			state = STSML_CACHE_STALE;
+
+			if(!entry->regenerating)
+			{
+				entry->regenerating = 1;
+
+				if(regenerate)
+					*regenerate = 1;
+			}
+		}
+		else if(!entry->regenerating)
+		{
+			/* past the stale window, nobody is going to refresh this */
+			stsml_cache_remove(entry);
+		}
+
+		if(state != STSML_CACHE_MISS)
+		{
+			entry->page->references++;
+			*page = entry->page;
+
+			stsml_cache_lru_unlink(entry);
+			stsml_cache_lru_push(entry);
+		}
+	}
+
+	switch(state)
+	{
+		case STSML_CACHE_FRESH:
+			cache.stats.fresh++;
+		break;
+		case STSML_CACHE_STALE:
+			cache.stats.stale++;
+		break;
+		default:
+			cache.stats.miss++;
+	}
+
+	pthread_mutex_unlock(&cache.lock);
+
+	return state;
+}
+
+/* the cache takes over the reference passed in. A page bigger than the whole cache is not kept */
+int stsml_cache_put(const char *key, stsml_cache_page_t *page, double ttl, double stale)
+{
+	stsml_cache_entry_t *entry = NULL, **link = NULL;
+	double now = stsml_time_now();
+	size_t bytes = stsml_cache_page_bytes(key, page);
+
+
+	pthread_mutex_lock(&cache.lock);
+
+	if(now >= cache.next_sweep)
+		stsml_cache_sweep(now);
+
+	if(bytes > cache.max_bytes)
+	{
+		/* a stale copy would otherwise be served until its window runs out */
+		if((entry = stsml_cache_find(key, NULL)))
+			stsml_cache_remove(entry);
+
+		stsml_cache_page_unref(page);
+		pthread_mutex_unlock(&cache.lock);
+
+		return 1;
+	}
+
+	if(!(entry = stsml_cache_find(key, &link)))
+	{
+		if(!(entry = calloc(1, sizeof(stsml_cache_entry_t))))
+		{
+			fprintf(stderr, "could not allocate cache entry\n");
+			stsml_cache_page_unref(page);
+			pthread_mutex_unlock(&cache.lock);
+			return 1;
+		}
+
+		if(!(entry->key = strdup(key)))
+		{
+			fprintf(stderr, "could not allocate cache key\n");
+			stsml_cache_page_unref(page);
+			free(entry);
+			pthread_mutex_unlock(&cache.lock);
+			return 1;
+		}
+
+		*link = entry;
+	}
+	else
+		stsml_cache_lru_unlink(entry);
+
+	stsml_cache_page_unref(entry->page);
+
+	cache.bytes += bytes - entry->bytes;
+
+	entry->page = page;
+	entry->bytes = bytes;
+	entry->expires = now + ttl;
+	entry->stale_until = entry->expires + (stale > 0.0 ? stale : 0.0);
+	entry->regenerating = 0;
+
+	stsml_cache_lru_push(entry);
+
+	while(cache.bytes > cache.max_bytes && cache.lru_tail != entry)
+		stsml_cache_remove(cache.lru_tail);
+
+	pthread_mutex_unlock(&cache.lock);
+
+	return 0;
+}
+
+/* a regeneration failed, let the next stale hit try again */
+void stsml_cache_abandon(const char *key)
+{
+	stsml_cache_entry_t *entry = NULL;
+
+
+	pthread_mutex_lock(&cache.lock);
+
+	if((entry = stsml_cache_find(key, NULL)))
+		entry->regenerating = 0;
+
+	pthread_mutex_unlock(&cache.lock);
+}
+
+stsml_cache_page_t *stsml_cache_page_new(const char *body, size_t size, int http_status)
+{
+	stsml_cache_page_t *ret = NULL;
+
+
+	if(!(ret = calloc(1, sizeof(stsml_cache_page_t))))
+	{
+		fprintf(stderr, "could not allocate cache page\n");
+		return NULL;
+	}
+
+	if(!(ret->body = malloc(size + 1)))
+	{
+		fprintf(stderr, "could not allocate cache page body\n");
+		free(ret);
+		return NULL;
+	}
+
+	if(size)
+		memcpy(ret->body, body, size);
+
+	ret->body[size] = 0x0;
+	ret->size = size;
+	ret->http_status = http_status;
+	ret->references = 1;
+
+	return ret;
+}
+
+int stsml_cache_page_header_add(stsml_cache_page_t *page, const char *key, const char *value)
+{
+	stsml_cache_header_t *header = NULL, **link = &page->headers;
+
+
+	if(!(header = calloc(1, sizeof(stsml_cache_header_t))))
+	{
+		fprintf(stderr, "could not allocate cache header\n");
+		return 1;
+	}
+
+	if(!(header->key = strdup(key)) || !(header->value = strdup(value)))
+	{
+		fprintf(stderr, "could not copy cache header\n");
+		free(header->key);
+		free(header);
+		return 1;
+	}
+
+	/* keep the order the script set them in */
+	while(*link)
+		link = &(*link)->next;
+
+	*link = header;
+
+	return 0;
+}
+
+/* case insensitive lookup of a stored header, NULL if the page has none */
+const char *stsml_cache_page_header_get(stsml_cache_page_t *page, const char *key)
+{
+	stsml_cache_header_t *header = NULL;
+
+
+	for(header = page->headers; header; header = header->next)
+	{
+		if(!strcasecmp(header->key, key))
+			return header->value;
+	}
+
+	return NULL;
+}
+
+void stsml_cache_page_release(stsml_cache_page_t *page)
+{
+	pthread_mutex_lock(&cache.lock);
+
+	stsml_cache_page_unref(page);
+
+	pthread_mutex_unlock(&cache.lock);
+}
+
+/* remembers the ttl a render of the script asked for, 0 forgets the script */
+void stsml_cache_path_set(const char *script_path, double ttl)
+{
+	stsml_cache_path_t *path = NULL, **link = &cache.paths[stsml_cache_hash(script_path) % STSML_CACHE_BUCKETS];
+
+
+	pthread_mutex_lock(&cache.lock);
+
+	for(; *link; link = &(*link)->next)
+	{
+		if(!strcmp((*link)->path, script_path))
+			break;
+	}
+
+	if((path = *link) && ttl > 0.0)
+		path->ttl = ttl;
+	else if(path)
+	{
+		*link = path->next;
+
+		free(path->path);
+		free(path);
+	}
+	else if(ttl > 0.0)
+	{
+		/* without it the script is just never looked up, every request renders */
+		if(!(path = calloc(1, sizeof(stsml_cache_path_t))) || !(path->path = strdup(script_path)))
+		{
+			fprintf(stderr, "could not allocate cache path\n");
+			free(path);
+		}
+		else
+		{
+			path->ttl = ttl;
+			*link = path;
+		}
+	}
+
+	pthread_mutex_unlock(&cache.lock);
+}
+
+/* the ttl the last render of the script asked for, 0 if it did not call http-cache */
+double stsml_cache_path_ttl(const char *script_path)
+{
+	stsml_cache_path_t *path = NULL;
+	double ret = 0.0;
+
+
+	pthread_mutex_lock(&cache.lock);
+
+	for(path = cache.paths[stsml_cache_hash(script_path) % STSML_CACHE_BUCKETS]; path; path = path->next)
+	{
+		if(!strcmp(path->path, script_path))
+		{
+			ret = path->ttl;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&cache.lock);
+
+	return ret;
+}
+
+/* the first caller for a key leads and has to call stsml_cache_flight_end when its render is done. Everyone else waits for the leader's page until the flight timeout, a timeout of 0 never waits and renders right away */
+int stsml_cache_flight_begin(const char *key, stsml_cache_page_t **page)
+{
+	stsml_cache_flight_t *flight = NULL;
+	struct timespec deadline;
+	int ret = STSML_CACHE_FLIGHT_TIMEOUT;
+
+
+	*page = NULL;
+
+	pthread_mutex_lock(&cache.lock);
+
+	for(flight = cache.flights; flight; flight = flight->next)
+	{
+		if(!strcmp(flight->key, key))
+			break;
+	}
+
+	if(!flight)
+	{
+		if(!(flight = calloc(1, sizeof(stsml_cache_flight_t))) || !(flight->key = strdup(key)))
+		{
+			/* without a flight everyone just renders on their own */
+			fprintf(stderr, "could not allocate cache flight\n");
+			free(flight);
+			pthread_mutex_unlock(&cache.lock);
+			return STSML_CACHE_FLIGHT_LEADER;
+		}
+
+		flight->next = cache.flights;
+		cache.flights = flight;
+
+		pthread_mutex_unlock(&cache.lock);
+
+		return STSML_CACHE_FLIGHT_LEADER;
+	}
+
+	/* a single event loop would stop serving everyone while it sleeps here */
+	if(cache.flight_timeout <= 0.0)
+	{
+		pthread_mutex_unlock(&cache.lock);
+		return STSML_CACHE_FLIGHT_TIMEOUT;
+	}
+
+	stsml_deadline(&deadline, cache.flight_timeout);
+
+	flight->waiters++;
+
+	while(!flight->done)
+	{
+		if(pthread_cond_timedwait(&cache.flight_cond, &cache.lock, &deadline) == ETIMEDOUT)
+			break;
+	}
+
+	if(flight->done && flight->page)
+	{
+		flight->page->references++;
+		*page = flight->page;
+
+		cache.stats.renders_saved++;
+		ret = STSML_CACHE_FLIGHT_SHARED;
+	}
+	else if(!flight->done)
+		cache.stats.flight_timeouts++;
+
+	/* the leader already unlinked a finished flight, the last one out frees it */
+	if(!--flight->waiters && flight->done)
+	{
+		stsml_cache_page_unref(flight->page);
+		free(flight->key);
+		free(flight);
+	}
+
+	pthread_mutex_unlock(&cache.lock);
+
+	return ret;
+}
+
+/* page can be NULL if the render failed or should not be shared, the waiters will then render on their own */
+void stsml_cache_flight_end(const char *key, stsml_cache_page_t *page)
+{
+	stsml_cache_flight_t *flight = NULL, **link = NULL;
+
+
+	pthread_mutex_lock(&cache.lock);
+
+	for(link = &cache.flights; *link; link = &(*link)->next)
+	{
+		if(!strcmp((*link)->key, key))
+			break;
+	}
+
+	if((flight = *link))
+	{
+		*link = flight->next;
+
+		flight->done = 1;
+
+		if((flight->page = page))
+			page->references++;
+
+		if(!flight->waiters)
+		{
+			stsml_cache_page_unref(flight->page);
+			free(flight->key);
+			free(flight);
+		}
+		else
+			pthread_cond_broadcast(&cache.flight_cond);
+	}
+
+	pthread_mutex_unlock(&cache.lock);
+}
+
+void stsml_cache_stats(stsml_cache_stats_t *stats)
+{
+	pthread_mutex_lock(&cache.lock);
+
+	*stats = cache.stats;
+
+	pthread_mutex_unlock(&cache.lock);
+}
\ No newline at end of file
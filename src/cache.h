@@ -0,0 +1,109 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+#ifndef CACHE_H__
+#define CACHE_H__
+
+#include <stddef.h>
+#include <time.h>
+
+enum
+{
+	STSML_CACHE_MISS = 0,
+	STSML_CACHE_FRESH,
+	STSML_CACHE_STALE
+};
+
+enum
+{
+	STSML_CACHE_FLIGHT_LEADER = 0,
+	STSML_CACHE_FLIGHT_SHARED,
+	STSML_CACHE_FLIGHT_TIMEOUT
+};
+
+typedef struct stsml_cache_header_s
+{
+	char *key, *value;
+	struct stsml_cache_header_s *next;
+} stsml_cache_header_t;
+
+/* a rendered page or fragment. These are immutable once stored and reference counted so a reader can keep sending one while a background render replaces it */
+typedef struct
+{
+	char *body;
+	size_t size;
+
+	/* gzipped copy of the body, made once when the page is stored so hits are never compressed again */
+	char *gzip;
+	size_t gzip_size;
+
+	int http_status;
+
+	/* validators for conditional requests, last_modified is 0 if unknown */
+	char *etag;
+	time_t last_modified;
+
+	stsml_cache_header_t *headers;
+
+	unsigned int references;
+} stsml_cache_page_t;
+
+typedef struct
+{
+	unsigned long fresh, stale, miss, renders_saved, flight_timeouts;
+} stsml_cache_stats_t;
+
+
+int stsml_cache_init(double flight_timeout, size_t max_bytes);
+
+void stsml_cache_destroy(void);
+
+int stsml_cache_get(const char *key, stsml_cache_page_t **page, int *regenerate);
+
+int stsml_cache_put(const char *key, stsml_cache_page_t *page, double ttl, double stale);
+
+void stsml_cache_abandon(const char *key);
+
+stsml_cache_page_t *stsml_cache_page_new(const char *body, size_t size, int http_status);
+
+int stsml_cache_page_header_add(stsml_cache_page_t *page, const char *key, const char *value);
+
+const char *stsml_cache_page_header_get(stsml_cache_page_t *page, const char *key);
+
+void stsml_cache_page_release(stsml_cache_page_t *page);
+
+void stsml_cache_path_set(const char *script_path, double ttl);
+
+double stsml_cache_path_ttl(const char *script_path);
+
+int stsml_cache_flight_begin(const char *key, stsml_cache_page_t **page);
+
+void stsml_cache_flight_end(const char *key, stsml_cache_page_t *page);
+
+void stsml_cache_stats(stsml_cache_stats_t *stats);
+
+#endif
\ No newline at end of file
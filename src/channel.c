@@ -0,0 +1,261 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+#include "channel.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+
+/* every slot counts which lap of the ring it is ready for, so a producer and a consumer only ever race on the position they claim with a compare and swap */
+typedef struct
+{
+	size_t sequence;
+	void *data;
+} stsml_channel_cell_t;
+
+struct stsml_channel_s
+{
+	char *name;
+
+	stsml_channel_cell_t *cells;
+	size_t mask;
+
+	/* on their own cache lines so producers and consumers don't slow each other down */
+	char pad0[64];
+	size_t enqueue;
+	char pad1[64];
+	size_t dequeue;
+	char pad2[64];
+
+	struct stsml_channel_s *next;
+};
+
+
+/* channels are only added while the server runs, so lookups walk the list without the lock */
+static struct
+{
+	pthread_mutex_t lock;
+	stsml_channel_t *head;
+} channels = {.lock = PTHREAD_MUTEX_INITIALIZER, .head = NULL};
+
+
+/* makes a channel unless one with the name exists. Returns 1 on failure */
+int stsml_channel_create(const char *name, unsigned int capacity)
+{
+	stsml_channel_t *channel = NULL;
+	size_t size = 2, i;
+
+
+	pthread_mutex_lock(&channels.lock);
+
+	if(stsml_channel_get(name))
+	{
+		pthread_mutex_unlock(&channels.lock);
+		return 0;
+	}
+
+	/* a single cell would already look free again to the next send after one send, so the ring has at least 2 */
+	while(size < capacity)
+		size <<= 1;
+
+	if(!(channel = calloc(1, sizeof(stsml_channel_t))) || !(channel->name = strdup(name)) || !(channel->cells = calloc(size, sizeof(stsml_channel_cell_t))))
+	{
+		fprintf(stderr, "could not allocate channel '%s'\n", name);
+
+		if(channel)
+			free(channel->name);
+
+		free(channel);
+		pthread_mutex_unlock(&channels.lock);
+
+		return 1;
+	}
+
+	for(i = 0; i < size; ++i)
+		channel->cells[i].sequence = i;
+
+	channel->mask = size - 1;
+	channel->next = channels.head;
+
+	__atomic_store_n(&channels.head, channel, __ATOMIC_RELEASE);
+
+	pthread_mutex_unlock(&channels.lock);
+
+	return 0;
+}
+
+stsml_channel_t *stsml_channel_get(const char *name)
+{
+	stsml_channel_t *channel = NULL;
+
+
+	for(channel = __atomic_load_n(&channels.head, __ATOMIC_ACQUIRE); channel; channel = channel->next)
+	{
+		if(!strcmp(channel->name, name))
+			return channel;
+	}
+
+	return NULL;
+}
+
+static int stsml_channel_try_send(stsml_channel_t *channel, void *data)
+{
+	stsml_channel_cell_t *cell = NULL;
+	size_t position = __atomic_load_n(&channel->enqueue, __ATOMIC_RELAXED);
+	long diff;
+
+
+	for(;;)
+	{
+		cell = &channel->cells[position & channel->mask];
+		diff = (long)(__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) - position);
+
+		/* the slot is free on this lap, claim it */
+		if(!diff)
+		{
+			if(__atomic_compare_exchange_n(&channel->enqueue, &position, position + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		else if(diff < 0)
+			return 1; /* full, the slot still holds last lap's value */
+		else
+			position = __atomic_load_n(&channel->enqueue, __ATOMIC_RELAXED);
+	}
+
+	cell->data = data;
+	__atomic_store_n(&cell->sequence, position + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+static void *stsml_channel_try_recv(stsml_channel_t *channel)
+{
+	stsml_channel_cell_t *cell = NULL;
+	size_t position = __atomic_load_n(&channel->dequeue, __ATOMIC_RELAXED);
+	void *data = NULL;
+	long diff;
+
+
+	for(;;)
+	{
+		cell = &channel->cells[position & channel->mask];
+		diff = (long)(__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) - (position + 1));
+
+		if(!diff)
+		{
+			if(__atomic_compare_exchange_n(&channel->dequeue, &position, position + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		else if(diff < 0)
+			return NULL; /* empty */
+		else
+			position = __atomic_load_n(&channel->dequeue, __ATOMIC_RELAXED);
+	}
+
+	data = cell->data;
+	__atomic_store_n(&cell->sequence, position + channel->mask + 1, __ATOMIC_RELEASE);
+
+	return data;
+}
+
+/* there is no lock to sleep on, so waiting polls with a backoff from 50us up to 10ms */
+static int stsml_channel_wait(double deadline, useconds_t *backoff)
+{
+	if(stsml_time_now() >= deadline)
+		return 1;
+
+	usleep(*backoff);
+
+	if(*backoff < 10000)
+		*backoff *= 2;
+
+	return 0;
+}
+
+/* queues data, waiting up to timeout seconds for room. Returns 1 if the channel stayed full, the caller still owns the data then */
+int stsml_channel_send(stsml_channel_t *channel, void *data, double timeout)
+{
+	double deadline = stsml_time_now() + timeout;
+	useconds_t backoff = 50;
+
+
+	while(stsml_channel_try_send(channel, data))
+	{
+		if(timeout <= 0.0 || stsml_channel_wait(deadline, &backoff))
+			return 1;
+	}
+
+	return 0;
+}
+
+/* the oldest data in the channel, waiting up to timeout seconds for some. NULL if it stayed empty */
+void *stsml_channel_recv(stsml_channel_t *channel, double timeout)
+{
+	double deadline = stsml_time_now() + timeout;
+	useconds_t backoff = 50;
+	void *data = NULL;
+
+
+	while(!(data = stsml_channel_try_recv(channel)))
+	{
+		if(timeout <= 0.0 || stsml_channel_wait(deadline, &backoff))
+			return NULL;
+	}
+
+	return data;
+}
+
+/* only once nothing can send or receive anymore. Anything still queued goes to discard */
+void stsml_channels_destroy(void (*discard)(void *data))
+{
+	stsml_channel_t *channel = NULL;
+	void *data = NULL;
+
+
+	pthread_mutex_lock(&channels.lock);
+
+	while((channel = channels.head))
+	{
+		channels.head = channel->next;
+
+		while((data = stsml_channel_try_recv(channel)))
+			discard(data);
+
+		free(channel->cells);
+		free(channel->name);
+		free(channel);
+	}
+
+	pthread_mutex_unlock(&channels.lock);
+}
\ No newline at end of file
@@ -0,0 +1,48 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+#ifndef CHANNEL_H__
+#define CHANNEL_H__
+
+/* capacity of a channel made without one, rounded up to a power of two like any other */
+#define STSML_CHANNEL_CAPACITY 1024
+
+/* a bounded multi-producer multi-consumer queue of pointers between threads. Channels are found by name and live until shutdown */
+typedef struct stsml_channel_s stsml_channel_t;
+
+
+int stsml_channel_create(const char *name, unsigned int capacity);
+
+stsml_channel_t *stsml_channel_get(const char *name);
+
+int stsml_channel_send(stsml_channel_t *channel, void *data, double timeout);
+
+void *stsml_channel_recv(stsml_channel_t *channel, double timeout);
+
+void stsml_channels_destroy(void (*discard)(void *data));
+
+#endif
\ No newline at end of file
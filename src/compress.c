@@ -0,0 +1,408 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+#include "compress.h"
+#include "util.h"
+
+#include <zlib.h>
+#include <pthread.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+
+#define STSML_COMPRESS_BUCKETS 256
+
+
+static struct
+{
+	int level;
+	size_t min_size;
+} compression = {.level = 0, .min_size = 0};
+
+/* compressed static files, kept apart from the page cache so they neither count as page hits nor grow without bound */
+static struct
+{
+	pthread_mutex_t lock;
+	stsml_compress_file_t *buckets[STSML_COMPRESS_BUCKETS];
+
+	/* most recently sent first */
+	stsml_compress_file_t *lru_head, *lru_tail;
+	size_t bytes;
+} files = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+
+/* a level of 0 turns compression off */
+int stsml_compress_init(int level, size_t min_size)
+{
+	if(level < 0 || level > 9)
+	{
+		fprintf(stderr, "compression level has to be between 0 and 9\n");
+		return 1;
+	}
+
+	compression.level = level;
+	compression.min_size = min_size;
+
+	return 0;
+}
+
+/* checks if an Accept-Encoding header allows an encoding, honoring q=0 */
+int stsml_compress_accepts(const char *accept_encoding, int encoding)
+{
+	const char *name = stsml_compress_name(encoding), *start = NULL, *param = NULL;
+	size_t size, name_size = strlen(name);
+	int wildcard = 0, found = 0;
+
+
+	if(!accept_encoding || encoding == STSML_ENCODING_IDENTITY)
+		return encoding == STSML_ENCODING_IDENTITY;
+
+	while(*accept_encoding)
+	{
+		while(*accept_encoding && (isspace(*accept_encoding) || *accept_encoding == ','))
+			++accept_encoding;
+
+		start = accept_encoding;
+
+		while(*accept_encoding && *accept_encoding != ',' && *accept_encoding != ';' && !isspace(*accept_encoding))
+			++accept_encoding;
+
+		size = accept_encoding - start;
+
+		/* q=0 means the client does not want it */
+		param = accept_encoding;
+
+		while(*accept_encoding && *accept_encoding != ',')
+			++accept_encoding;
+
+		if((param = strstr(param, "q=")) && param < accept_encoding && atof(param + 2) <= 0.0)
+		{
+			if(size == name_size && !strncasecmp(start, name, size))
+				return 0;
+
+			continue;
+		}
+
+		if(size == name_size && !strncasecmp(start, name, size))
+			found = 1;
+		else if(size == 1 && *start == '*')
+			wildcard = 1;
+	}
+
+	return found || wildcard;
+}
+
+static int stsml_compress_mime(const char *mime)
+{
+	/* dynamic pages without a content type are html */
+	if(!mime)
+		return 1;
+
+	return !strncasecmp(mime, "text/", 5) || strstr(mime, "javascript") || strstr(mime, "json") || strstr(mime, "xml") || strstr(mime, "svg");
+}
+
+/* whether a body would be compressed for a client that accepts it, so the response has to vary on Accept-Encoding */
+int stsml_compress_possible(const char *mime, size_t size)
+{
+	return compression.level && size >= compression.min_size && stsml_compress_mime(mime);
+}
+
+/* picks the encoding to respond with, gzip is preferred since every client that matters supports it */
+int stsml_compress_negotiate(const char *accept_encoding, const char *mime, size_t size)
+{
+	if(!stsml_compress_possible(mime, size))
+		return STSML_ENCODING_IDENTITY;
+
+	if(stsml_compress_accepts(accept_encoding, STSML_ENCODING_GZIP))
+		return STSML_ENCODING_GZIP;
+
+	if(stsml_compress_accepts(accept_encoding, STSML_ENCODING_DEFLATE))
+		return STSML_ENCODING_DEFLATE;
+
+	return STSML_ENCODING_IDENTITY;
+}
+
+const char *stsml_compress_name(int encoding)
+{
+	switch(encoding)
+	{
+		case STSML_ENCODING_GZIP:
+			return "gzip";
+		case STSML_ENCODING_DEFLATE:
+			return "deflate";
+	}
+
+	return "identity";
+}
+
+char *stsml_compress(int encoding, const char *data, size_t size, size_t *compressed_size)
+{
+	z_stream stream;
+	char *ret = NULL;
+	uLong bound;
+
+
+	memset(&stream, 0, sizeof(z_stream));
+
+	/* gzip wants a gzip header, http deflate is the zlib format */
+	if(deflateInit2(&stream, compression.level ? compression.level : Z_DEFAULT_COMPRESSION, Z_DEFLATED, (encoding == STSML_ENCODING_GZIP) ? 15 + 16 : 15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+	{
+		fprintf(stderr, "could not initialize compression stream\n");
+		return NULL;
+	}
+
+	bound = deflateBound(&stream, size);
+
+	if(!(ret = malloc(bound)))
+	{
+		fprintf(stderr, "could not allocate compression buffer\n");
+		deflateEnd(&stream);
+		return NULL;
+	}
+
+	stream.next_in = (Bytef *)data;
+	stream.avail_in = size;
+	stream.next_out = (Bytef *)ret;
+	stream.avail_out = bound;
+
+	if(deflate(&stream, Z_FINISH) != Z_STREAM_END)
+	{
+		fprintf(stderr, "could not compress response\n");
+		deflateEnd(&stream);
+		free(ret);
+		return NULL;
+	}
+
+	*compressed_size = stream.total_out;
+
+	deflateEnd(&stream);
+
+	return ret;
+}
+
+/* must be called with the files lock held */
+static void stsml_compress_file_unref(stsml_compress_file_t *file)
+{
+	if(--file->references)
+		return;
+
+	free(file->key);
+	free(file->etag);
+	free(file->body);
+	free(file);
+}
+
+/* must be called with the files lock held, drops the cache's own reference */
+static void stsml_compress_file_unlink(stsml_compress_file_t *file)
+{
+	stsml_compress_file_t **link = &files.buckets[stsml_hash(file->key, strlen(file->key)) % STSML_COMPRESS_BUCKETS];
+
+
+	for(; *link && *link != file; link = &(*link)->next);
+
+	if(*link)
+		*link = file->next;
+
+	if(file->lru_prev)
+		file->lru_prev->lru_next = file->lru_next;
+	else
+		files.lru_head = file->lru_next;
+
+	if(file->lru_next)
+		file->lru_next->lru_prev = file->lru_prev;
+	else
+		files.lru_tail = file->lru_prev;
+
+	files.bytes -= file->size;
+
+	stsml_compress_file_unref(file);
+}
+
+/* files are keyed by encoding and path */
+static char *stsml_compress_file_key(int encoding, const char *path)
+{
+	const char *name = stsml_compress_name(encoding);
+	size_t size = strlen(name) + strlen(path) + 2;
+	char *ret = NULL;
+
+
+	if(!(ret = malloc(size)))
+	{
+		fprintf(stderr, "could not allocate compressed file key\n");
+		return NULL;
+	}
+
+	snprintf(ret, size, "%s:%s", name, path);
+
+	return ret;
+}
+
+/* must be called with the files lock held */
+static stsml_compress_file_t *stsml_compress_file_find(const char *key)
+{
+	stsml_compress_file_t *file = files.buckets[stsml_hash(key, strlen(key)) % STSML_COMPRESS_BUCKETS];
+
+
+	for(; file; file = file->next)
+	{
+		if(!strcmp(file->key, key))
+			break;
+	}
+
+	return file;
+}
+
+/* the cached copy of a file, only while it is younger than STSML_COMPRESS_CACHE_TTL and the file still has the same etag. Has to be released */
+stsml_compress_file_t *stsml_compress_file_get(int encoding, const char *path, const char *etag)
+{
+	stsml_compress_file_t *file = NULL;
+	char *key = NULL;
+
+
+	if(!(key = stsml_compress_file_key(encoding, path)))
+		return NULL;
+
+	pthread_mutex_lock(&files.lock);
+
+	if((file = stsml_compress_file_find(key)))
+	{
+		if(stsml_time_now() >= file->expires || strcmp(file->etag, etag))
+		{
+			stsml_compress_file_unlink(file);
+			file = NULL;
+		}
+		else
+		{
+			file->references++;
+
+			/* move it to the front */
+			if(file->lru_prev)
+			{
+				file->lru_prev->lru_next = file->lru_next;
+
+				if(file->lru_next)
+					file->lru_next->lru_prev = file->lru_prev;
+				else
+					files.lru_tail = file->lru_prev;
+
+				file->lru_prev = NULL;
+				file->lru_next = files.lru_head;
+				files.lru_head->lru_prev = file;
+				files.lru_head = file;
+			}
+		}
+	}
+
+	pthread_mutex_unlock(&files.lock);
+
+	free(key);
+
+	return file;
+}
+
+/* takes over body and returns the stored copy, which has to be released. A copy too big for the cache is still returned, just not kept */
+stsml_compress_file_t *stsml_compress_file_put(int encoding, const char *path, const char *etag, char *body, size_t size)
+{
+	stsml_compress_file_t *file = NULL, *old = NULL;
+
+
+	if(!(file = calloc(1, sizeof(stsml_compress_file_t))))
+	{
+		fprintf(stderr, "could not allocate compressed file\n");
+		free(body);
+		return NULL;
+	}
+
+	file->body = body;
+	file->size = size;
+	file->references = 1;
+	file->expires = stsml_time_now() + STSML_COMPRESS_CACHE_TTL;
+
+	if(!(file->key = stsml_compress_file_key(encoding, path)) || !(file->etag = strdup(etag)))
+	{
+		fprintf(stderr, "could not allocate compressed file\n");
+		free(file->key);
+		free(file->body);
+		free(file);
+		return NULL;
+	}
+
+	if(size > STSML_COMPRESS_CACHE_MAX)
+		return file;
+
+	pthread_mutex_lock(&files.lock);
+
+	if((old = stsml_compress_file_find(file->key)))
+		stsml_compress_file_unlink(old);
+
+	while(files.lru_tail && files.bytes + size > STSML_COMPRESS_CACHE_MAX)
+		stsml_compress_file_unlink(files.lru_tail);
+
+	/* one reference for the cache, one for the caller */
+	file->references++;
+
+	file->next = files.buckets[stsml_hash(file->key, strlen(file->key)) % STSML_COMPRESS_BUCKETS];
+	files.buckets[stsml_hash(file->key, strlen(file->key)) % STSML_COMPRESS_BUCKETS] = file;
+
+	file->lru_next = files.lru_head;
+
+	if(files.lru_head)
+		files.lru_head->lru_prev = file;
+	else
+		files.lru_tail = file;
+
+	files.lru_head = file;
+	files.bytes += size;
+
+	pthread_mutex_unlock(&files.lock);
+
+	return file;
+}
+
+void stsml_compress_file_release(stsml_compress_file_t *file)
+{
+	if(!file)
+		return;
+
+	pthread_mutex_lock(&files.lock);
+	stsml_compress_file_unref(file);
+	pthread_mutex_unlock(&files.lock);
+}
+
+void stsml_compress_destroy(void)
+{
+	pthread_mutex_lock(&files.lock);
+
+	while(files.lru_head)
+		stsml_compress_file_unlink(files.lru_head);
+
+	pthread_mutex_unlock(&files.lock);
+}
\ No newline at end of file
@@ -0,0 +1,82 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+#ifndef COMPRESS_H__
+#define COMPRESS_H__
+
+#include <stddef.h>
+
+/* static files bigger than this are never compressed in memory, only a .gz sibling is served for them */
+#define STSML_COMPRESS_MAX_FILE (8 * 1024 * 1024)
+
+/* compressed static files are kept this long, they are dropped early if the file changes */
+#define STSML_COMPRESS_CACHE_TTL 3600.0
+
+/* compressed static files together never take more than this, the least recently sent ones go first */
+#define STSML_COMPRESS_CACHE_MAX (32 * 1024 * 1024)
+
+enum
+{
+	STSML_ENCODING_IDENTITY = 0,
+	STSML_ENCODING_GZIP,
+	STSML_ENCODING_DEFLATE
+};
+
+/* a compressed copy of a static file, reference counted so it can be sent while it is replaced or evicted */
+typedef struct stsml_compress_file_s
+{
+	char *key, *etag, *body;
+	size_t size;
+
+	double expires;
+	unsigned int references;
+
+	struct stsml_compress_file_s *next, *lru_prev, *lru_next;
+} stsml_compress_file_t;
+
+
+int stsml_compress_init(int level, size_t min_size);
+
+int stsml_compress_accepts(const char *accept_encoding, int encoding);
+
+int stsml_compress_possible(const char *mime, size_t size);
+
+int stsml_compress_negotiate(const char *accept_encoding, const char *mime, size_t size);
+
+const char *stsml_compress_name(int encoding);
+
+char *stsml_compress(int encoding, const char *data, size_t size, size_t *compressed_size);
+
+stsml_compress_file_t *stsml_compress_file_get(int encoding, const char *path, const char *etag);
+
+stsml_compress_file_t *stsml_compress_file_put(int encoding, const char *path, const char *etag, char *body, size_t size);
+
+void stsml_compress_file_release(stsml_compress_file_t *file);
+
+void stsml_compress_destroy(void);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,650 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+#include "executor.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <errno.h>
+#include <time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+
+typedef struct
+{
+	stsml_executor_run_t run;
+	void *job;
+} stsml_executor_job_t;
+
+
+/* a fixed set of worker threads pulling from a bounded ring of jobs. Workers are detached because a task can run forever, so stopping only wakes the idle ones and drops what is still queued */
+static struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty, not_full;
+
+	int configured, stop, policy;
+
+	unsigned int workers;
+
+	/* set on pool threads, a job that submits more jobs must never wait for its own pool */
+	pthread_key_t in_worker;
+	int has_key;
+
+	stsml_executor_job_t *ring;
+	unsigned int depth, head, length;
+
+	void *(*worker_init)(void);
+	void (*worker_destroy)(void *worker);
+	void (*discard)(void *job);
+} executor = {.lock = PTHREAD_MUTEX_INITIALIZER, .not_empty = PTHREAD_COND_INITIALIZER, .not_full = PTHREAD_COND_INITIALIZER, .configured = 0};
+
+
+/* a job's result, kept until someone awaits it or it expires. Waiters all sleep on one condition, completions are rare next to the work behind them */
+#define STSML_FUTURE_BUCKETS 256
+
+typedef struct stsml_future_s
+{
+	unsigned long long id;
+
+	int done;
+	void *result;
+	double done_at;
+
+	void (*discard)(void *result);
+
+	struct stsml_future_s *next;
+} stsml_future_t;
+
+static struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	unsigned long long next_id;
+	double last_sweep;
+
+	stsml_future_t *buckets[STSML_FUTURE_BUCKETS];
+} futures = {.lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER, .next_id = 1, .last_sweep = 0.0};
+
+
+/* long running tasks that may only exist once per server. Setup scripts run once for every interpreter, these keep them from starting a copy per interpreter */
+typedef struct stsml_singleton_s
+{
+	char *key;
+
+	/* what the task is known by, like a timer handle. 0 until it is set */
+	unsigned long long value;
+
+	struct stsml_singleton_s *next;
+} stsml_singleton_t;
+
+static struct
+{
+	pthread_mutex_t lock;
+	stsml_singleton_t *head;
+} singletons = {.lock = PTHREAD_MUTEX_INITIALIZER, .head = NULL};
+
+
+static void *stsml_executor_thread(void *data)
+{
+	stsml_executor_job_t job;
+	void *worker = NULL;
+
+
+	pthread_detach(pthread_self());
+
+	pthread_setspecific(executor.in_worker, &executor);
+
+	/* the worker state is made once and reused for every job this thread runs */
+	if(!(worker = executor.worker_init()))
+		fprintf(stderr, "could not set up task worker, its jobs are dropped\n");
+
+	for(;;)
+	{
+		pthread_mutex_lock(&executor.lock);
+
+		while(!executor.length && !executor.stop)
+			pthread_cond_wait(&executor.not_empty, &executor.lock);
+
+		if(executor.stop)
+		{
+			pthread_mutex_unlock(&executor.lock);
+			break;
+		}
+
+		job = executor.ring[executor.head];
+
+		executor.head = (executor.head + 1) % executor.depth;
+		executor.length--;
+
+		pthread_cond_signal(&executor.not_full);
+		pthread_mutex_unlock(&executor.lock);
+
+		if(worker)
+			job.run(worker, job.job);
+		else
+			executor.discard(job.job);
+	}
+
+	if(worker)
+		executor.worker_destroy(worker);
+
+	return NULL;
+}
+
+/* starts the workers once, later calls are ignored. Returns 1 if not even one worker could be started */
+int stsml_executor_init(unsigned int workers, unsigned int depth, int policy, void *(*worker_init)(void), void (*worker_destroy)(void *worker), void (*discard)(void *job))
+{
+	pthread_t id;
+	unsigned int i;
+
+
+	pthread_mutex_lock(&executor.lock);
+
+	if(executor.configured)
+	{
+		pthread_mutex_unlock(&executor.lock);
+		return 0;
+	}
+
+	/* never deleted, detached workers can outlive the pool */
+	if(!executor.has_key)
+	{
+		if(pthread_key_create(&executor.in_worker, NULL))
+		{
+			fprintf(stderr, "could not create task worker key\n");
+			pthread_mutex_unlock(&executor.lock);
+
+			return 1;
+		}
+
+		executor.has_key = 1;
+	}
+
+	executor.depth = depth ? depth : 1;
+
+	if(!(executor.ring = calloc(executor.depth, sizeof(stsml_executor_job_t))))
+	{
+		fprintf(stderr, "could not allocate task queue\n");
+		pthread_mutex_unlock(&executor.lock);
+
+		return 1;
+	}
+
+	executor.policy = policy;
+	executor.worker_init = worker_init;
+	executor.worker_destroy = worker_destroy;
+	executor.discard = discard;
+	executor.head = executor.length = 0;
+	executor.stop = 0;
+	executor.workers = 0;
+
+	for(i = 0; i < (workers ? workers : 1); ++i)
+	{
+		if(pthread_create(&id, NULL, &stsml_executor_thread, NULL))
+		{
+			fprintf(stderr, "could not start task worker %u\n", i);
+			break;
+		}
+
+		executor.workers++;
+	}
+
+	if(!executor.workers)
+	{
+		free(executor.ring);
+		executor.ring = NULL;
+
+		pthread_mutex_unlock(&executor.lock);
+
+		return 1;
+	}
+
+	executor.configured = 1;
+
+	pthread_mutex_unlock(&executor.lock);
+
+	return 0;
+}
+
+/* the policy for a -task_policy value, -1 if there is no such policy */
+int stsml_executor_policy(const char *name)
+{
+	if(!strcasecmp(name, "block"))
+		return STSML_EXECUTOR_BLOCK;
+
+	if(!strcasecmp(name, "reject"))
+		return STSML_EXECUTOR_REJECT;
+
+	if(!strcasecmp(name, "inline"))
+		return STSML_EXECUTOR_INLINE;
+
+	return -1;
+}
+
+/* how many threads the pool runs, 1 if it is not running so callers can still divide by it */
+unsigned int stsml_executor_workers(void)
+{
+	unsigned int workers;
+
+
+	pthread_mutex_lock(&executor.lock);
+
+	workers = executor.configured && executor.workers ? executor.workers : 1;
+
+	pthread_mutex_unlock(&executor.lock);
+
+	return workers;
+}
+
+/* whether the calling thread is one of the pool's, which must never wait on jobs queued behind it */
+int stsml_executor_in_worker(void)
+{
+	return executor.has_key && pthread_getspecific(executor.in_worker) != NULL;
+}
+
+/* must be called with the executor lock held and room in the ring */
+static void stsml_executor_push(stsml_executor_run_t run, void *job)
+{
+	executor.ring[(executor.head + executor.length) % executor.depth].run = run;
+	executor.ring[(executor.head + executor.length) % executor.depth].job = job;
+	executor.length++;
+
+	pthread_cond_signal(&executor.not_empty);
+}
+
+/* queues a job, or handles a full queue by the policy. Blocking gives up after STSML_EXECUTOR_BLOCK_TIMEOUT, and a pool thread never blocks since every thread could be waiting on the others. An inline job gets a worker state of its own that is thrown away after. Returns 1 if the job was not taken, the caller still owns it then */
+int stsml_executor_submit(stsml_executor_run_t run, void *job)
+{
+	struct timespec deadline;
+	void *worker = NULL;
+	int block;
+
+
+	pthread_mutex_lock(&executor.lock);
+
+	if(!executor.configured || executor.stop)
+	{
+		pthread_mutex_unlock(&executor.lock);
+		return 1;
+	}
+
+	if((block = executor.policy == STSML_EXECUTOR_BLOCK && !pthread_getspecific(executor.in_worker)))
+		stsml_deadline(&deadline, STSML_EXECUTOR_BLOCK_TIMEOUT);
+
+	while(block && executor.length == executor.depth && !executor.stop)
+	{
+		if(pthread_cond_timedwait(&executor.not_full, &executor.lock, &deadline) == ETIMEDOUT)
+			break;
+	}
+
+	if(executor.stop || (executor.length == executor.depth && executor.policy != STSML_EXECUTOR_INLINE))
+	{
+		pthread_mutex_unlock(&executor.lock);
+		return 1;
+	}
+
+	if(executor.length == executor.depth)
+	{
+		/* inline, the caller slows down by as much as the job takes */
+		pthread_mutex_unlock(&executor.lock);
+
+		if(!(worker = executor.worker_init()))
+			return 1;
+
+		run(worker, job);
+
+		executor.worker_destroy(worker);
+
+		return 0;
+	}
+
+	stsml_executor_push(run, job);
+
+	pthread_mutex_unlock(&executor.lock);
+
+	return 0;
+}
+
+/* queues a job only if there is room right now, whatever the policy. For callers that must never wait or run a job themselves, like the timer thread. Returns 1 if the job was not taken */
+int stsml_executor_try_submit(stsml_executor_run_t run, void *job)
+{
+	pthread_mutex_lock(&executor.lock);
+
+	if(!executor.configured || executor.stop || executor.length == executor.depth)
+	{
+		pthread_mutex_unlock(&executor.lock);
+		return 1;
+	}
+
+	stsml_executor_push(run, job);
+
+	pthread_mutex_unlock(&executor.lock);
+
+	return 0;
+}
+
+/* idle workers exit, busy ones exit after their job. Jobs that never started are discarded */
+void stsml_executor_destroy(void)
+{
+	pthread_mutex_lock(&executor.lock);
+
+	if(!executor.configured)
+	{
+		pthread_mutex_unlock(&executor.lock);
+		return;
+	}
+
+	executor.stop = 1;
+
+	while(executor.length)
+	{
+		executor.discard(executor.ring[executor.head].job);
+
+		executor.head = (executor.head + 1) % executor.depth;
+		executor.length--;
+	}
+
+	free(executor.ring);
+	executor.ring = NULL;
+
+	executor.configured = 0;
+
+	pthread_cond_broadcast(&executor.not_empty);
+	pthread_cond_broadcast(&executor.not_full);
+
+	pthread_mutex_unlock(&executor.lock);
+}
+
+static stsml_future_t **stsml_future_find(unsigned long long id)
+{
+	stsml_future_t **future = NULL;
+
+
+	for(future = &futures.buckets[id % STSML_FUTURE_BUCKETS]; *future; future = &(*future)->next)
+	{
+		if((*future)->id == id)
+			break;
+	}
+
+	return future;
+}
+
+static void stsml_future_free(stsml_future_t *future)
+{
+	if(future->result)
+		future->discard(future->result);
+
+	free(future);
+}
+
+/* drops results that were never awaited. Runs at most once a second, with the lock held */
+static void stsml_futures_sweep(double now)
+{
+	stsml_future_t **future = NULL, *expired = NULL;
+	unsigned int i;
+
+
+	if(now - futures.last_sweep < 1.0)
+		return;
+
+	futures.last_sweep = now;
+
+	for(i = 0; i < STSML_FUTURE_BUCKETS; ++i)
+	{
+		for(future = &futures.buckets[i]; *future;)
+		{
+			if((*future)->done && now - (*future)->done_at >= STSML_FUTURE_RETENTION)
+			{
+				expired = *future;
+				*future = expired->next;
+
+				stsml_future_free(expired);
+			}
+			else
+				future = &(*future)->next;
+		}
+	}
+}
+
+/* 0 if there was no memory for it */
+unsigned long long stsml_future_create(void (*discard)(void *result))
+{
+	stsml_future_t *future = NULL;
+
+
+	if(!(future = calloc(1, sizeof(stsml_future_t))))
+	{
+		fprintf(stderr, "could not allocate future\n");
+		return 0;
+	}
+
+	future->discard = discard;
+
+	pthread_mutex_lock(&futures.lock);
+
+	stsml_futures_sweep(stsml_time_now());
+
+	future->id = futures.next_id++;
+	future->next = futures.buckets[future->id % STSML_FUTURE_BUCKETS];
+	futures.buckets[future->id % STSML_FUTURE_BUCKETS] = future;
+
+	pthread_mutex_unlock(&futures.lock);
+
+	return future->id;
+}
+
+/* the future owns result from here on, NULL means the job failed */
+void stsml_future_complete(unsigned long long id, void *result)
+{
+	stsml_future_t *future = NULL;
+
+
+	pthread_mutex_lock(&futures.lock);
+
+	if(!(future = *stsml_future_find(id)) || future->done)
+	{
+		pthread_mutex_unlock(&futures.lock);
+
+		fprintf(stderr, "future %llu is gone, its result is dropped\n", id);
+
+		return;
+	}
+
+	future->done = 1;
+	future->result = result;
+	future->done_at = stsml_time_now();
+
+	pthread_cond_broadcast(&futures.cond);
+	pthread_mutex_unlock(&futures.lock);
+}
+
+/* waits up to timeout seconds for the result, a negative timeout waits until it is done. The result goes to the caller and the future is gone after. Returns 0 when done, 1 on timeout and -1 if there is no such future */
+int stsml_future_await(unsigned long long id, double timeout, void **result)
+{
+	stsml_future_t **future = NULL, *done = NULL;
+	struct timespec deadline;
+
+
+	*result = NULL;
+
+	if(timeout >= 0.0)
+		stsml_deadline(&deadline, timeout);
+
+	pthread_mutex_lock(&futures.lock);
+
+	while(*(future = stsml_future_find(id)) && !(*future)->done)
+	{
+		if(timeout < 0.0)
+			pthread_cond_wait(&futures.cond, &futures.lock);
+		else if(pthread_cond_timedwait(&futures.cond, &futures.lock, &deadline))
+		{
+			pthread_mutex_unlock(&futures.lock);
+			return 1;
+		}
+	}
+
+	if(!(done = *future))
+	{
+		pthread_mutex_unlock(&futures.lock);
+		return -1;
+	}
+
+	*future = done->next;
+
+	pthread_mutex_unlock(&futures.lock);
+
+	*result = done->result;
+	free(done);
+
+	return 0;
+}
+
+void stsml_futures_destroy(void)
+{
+	stsml_future_t *future = NULL;
+	unsigned int i;
+
+
+	pthread_mutex_lock(&futures.lock);
+
+	for(i = 0; i < STSML_FUTURE_BUCKETS; ++i)
+	{
+		while((future = futures.buckets[i]))
+		{
+			futures.buckets[i] = future->next;
+			stsml_future_free(future);
+		}
+	}
+
+	pthread_cond_broadcast(&futures.cond);
+	pthread_mutex_unlock(&futures.lock);
+}
+
+
+/* returns 1 if the key was already claimed and sets value to what it was set to, otherwise claims it and returns 0. If it cannot be remembered the caller just goes ahead */
+int stsml_singleton_claim(const char *key, unsigned long long *value)
+{
+	stsml_singleton_t *singleton = NULL;
+
+
+	pthread_mutex_lock(&singletons.lock);
+
+	for(singleton = singletons.head; singleton; singleton = singleton->next)
+	{
+		if(!strcmp(singleton->key, key))
+		{
+			if(value)
+				*value = singleton->value;
+
+			pthread_mutex_unlock(&singletons.lock);
+			return 1;
+		}
+	}
+
+	if(!(singleton = calloc(1, sizeof(stsml_singleton_t))) || !(singleton->key = strdup(key)))
+	{
+		fprintf(stderr, "could not allocate singleton\n");
+		free(singleton);
+	}
+	else
+	{
+		singleton->next = singletons.head;
+		singletons.head = singleton;
+	}
+
+	pthread_mutex_unlock(&singletons.lock);
+
+	return 0;
+}
+
+void stsml_singleton_set(const char *key, unsigned long long value)
+{
+	stsml_singleton_t *singleton = NULL;
+
+
+	pthread_mutex_lock(&singletons.lock);
+
+	for(singleton = singletons.head; singleton; singleton = singleton->next)
+	{
+		if(!strcmp(singleton->key, key))
+		{
+			singleton->value = value;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&singletons.lock);
+}
+
+/* the task failed to start or went away, the next claim starts it again */
+void stsml_singleton_release(const char *key)
+{
+	stsml_singleton_t *singleton = NULL, **link = NULL;
+
+
+	pthread_mutex_lock(&singletons.lock);
+
+	for(link = &singletons.head; *link; link = &(*link)->next)
+	{
+		if(!strcmp((*link)->key, key))
+		{
+			singleton = *link;
+			*link = singleton->next;
+
+			free(singleton->key);
+			free(singleton);
+
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&singletons.lock);
+}
+
+void stsml_singletons_destroy(void)
+{
+	stsml_singleton_t *singleton = NULL;
+
+
+	pthread_mutex_lock(&singletons.lock);
+
+	while((singleton = singletons.head))
+	{
+		singletons.head = singleton->next;
+
+		free(singleton->key);
+		free(singleton);
+	}
+
+	pthread_mutex_unlock(&singletons.lock);
+}
\ No newline at end of file
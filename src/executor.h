@@ -0,0 +1,84 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+#ifndef EXECUTOR_H__
+#define EXECUTOR_H__
+
+/* defaults for the task pool, used by the -task_* flags */
+#define STSML_EXECUTOR_WORKERS 4
+#define STSML_EXECUTOR_QUEUE 1024
+
+/* what submitting does when the queue is full: wait for room, fail, or run the job on the caller's thread */
+#define STSML_EXECUTOR_BLOCK 0
+#define STSML_EXECUTOR_REJECT 1
+#define STSML_EXECUTOR_INLINE 2
+
+/* seconds the block policy waits for room before the job is rejected after all */
+#define STSML_EXECUTOR_BLOCK_TIMEOUT 5.0
+
+/* a finished result nobody awaited is thrown away after this many seconds, so fire and forget jobs don't pile up */
+#define STSML_FUTURE_RETENTION 60.0
+
+/* a job gets the state of the worker running it, made by the worker init callback when the worker starts */
+typedef void (*stsml_executor_run_t)(void *worker, void *job);
+
+
+int stsml_executor_init(unsigned int workers, unsigned int depth, int policy, void *(*worker_init)(void), void (*worker_destroy)(void *worker), void (*discard)(void *job));
+
+int stsml_executor_policy(const char *name);
+
+unsigned int stsml_executor_workers(void);
+
+int stsml_executor_in_worker(void);
+
+int stsml_executor_submit(stsml_executor_run_t run, void *job);
+
+int stsml_executor_try_submit(stsml_executor_run_t run, void *job);
+
+void stsml_executor_destroy(void);
+
+
+/* futures are found by id so the id can be handed to scripts. 0 is never an id. A result nobody takes goes to discard */
+unsigned long long stsml_future_create(void (*discard)(void *result));
+
+void stsml_future_complete(unsigned long long id, void *result);
+
+int stsml_future_await(unsigned long long id, double timeout, void **result);
+
+void stsml_futures_destroy(void);
+
+
+/* a key names a long running task, like a subscriber's pattern, script and function */
+int stsml_singleton_claim(const char *key, unsigned long long *value);
+
+void stsml_singleton_set(const char *key, unsigned long long value);
+
+void stsml_singleton_release(const char *key);
+
+void stsml_singletons_destroy(void);
+
+#endif
\ No newline at end of file
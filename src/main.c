@@ -27,6 +27,14 @@ For more information, please refer to <http://unlicense.org/>
 
 #include "util.h"
 #include "parser.h"
+#include "cache.h"
+#include "compress.h"
+#include "redis.h"
+#include "redis_cache.h"
+#include "redis_shard.h"
+#include "executor.h"
+#include "channel.h"
+#include "timer.h"
 
 #include "../lib/SimpleTinyScript/sts_embedding_extras.h"
 
@@ -37,6 +45,7 @@ For more information, please refer to <http://unlicense.org/>
 #include <onion/handler.h>
 #include <onion/dict.h>
 #include <onion/block.h>
+#include <onion/mime.h>
 
 #include <hiredis/hiredis.h>
 
@@ -52,6 +61,7 @@ For more information, please refer to <http://unlicense.org/>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
 
 
@@ -60,8 +70,63 @@ typedef struct
 {
 	char *script_path;
 	sts_value_t *args;
+
+	/* gets the task's return value for task-await, 0 for runs of task-every and task-at */
+	unsigned long long future;
+
+	/* the task-every timer that started this run, so the next run can tell whether this one is still going */
+	unsigned long long timer;
 } stsml_task_args_t;
 
+/* what a task-every or task-at timer starts. A periodic timer keeps the args and every run gets a copy, a one shot timer hands them over */
+typedef struct
+{
+	char *script_path;
+	sts_value_t *args;
+
+	int once;
+
+	/* the singleton key that keeps other interpreters from scheduling the same timer, released with the timer */
+	char *singleton;
+} stsml_timer_task_t;
+
+/* seconds a stream job can stay unacknowledged before another worker takes it over */
+#define STSML_STREAM_MIN_IDLE 60.0
+
+/* a job handed out this many times without being acknowledged is dropped, so one that always fails cannot take the workers over */
+#define STSML_STREAM_MAX_DELIVERIES 5
+
+/* a slice of a parallel-map array for one pool worker. offset is where the slice starts in the whole array */
+typedef struct
+{
+	char *script_path, *function;
+	sts_value_t *chunk;
+	unsigned int offset;
+
+	unsigned long long future;
+} stsml_map_chunk_t;
+
+/* stream worker argument struct, every worker gets its own copy */
+typedef struct
+{
+	char *stream, *group, *script_path, *function, *host;
+	int port;
+
+	unsigned int index;
+
+	/* a pending job idle for this long belonged to a consumer that died, and is taken over */
+	double min_idle;
+
+	unsigned int max_deliveries;
+} stsml_stream_worker_args_t;
+
+/* subscriber argument struct, the function is NULL when the whole script runs for every message */
+typedef struct
+{
+	char *script_path, *function, *pattern, *host;
+	int port;
+} stsml_subscriber_args_t;
+
 /* arg struct */
 typedef struct
 {
@@ -75,6 +140,47 @@ typedef struct
 	sts_scope_t *locals;
 } stsml_script_t;
 
+/* a page or fragment that needs to be re-rendered in the background */
+typedef struct stsml_render_job_s
+{
+	char *key, *script_path, *path;
+	onion_dict *query;
+
+	double ttl, stale;
+
+	struct stsml_render_job_s *next;
+} stsml_render_job_t;
+
+/* the render thread has its own interpreter so stale cache entries can be refreshed without blocking the server loop */
+typedef struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+
+	int started, stop;
+
+	stsml_render_job_t *head, *tail;
+
+	onion *onion;
+
+	char *init_path;
+} stsml_render_queue_t;
+
+/* with more than one worker onion runs a thread pool. An interpreter can't be shared between threads, so each pool thread gets its own the first time it handles a request */
+typedef struct
+{
+	pthread_mutex_t lock;
+	pthread_key_t key;
+
+	/* the thread that called onion_listen keeps using the main ctx */
+	pthread_t main_thread;
+
+	struct stsml_worker_s *head;
+
+	char *init_path;
+} stsml_workers_t;
+
 
 typedef struct
 {
@@ -90,13 +196,70 @@ typedef struct
 
 	redisContext *redis_ctx;
 
-	sts_value_t *cleanup, *response_str, *response_file, *respond_redirect;
+	/* set by redis-connect-async, takes over from redis_ctx */
+	stsml_redis_t *redis;
+
+	/* set by redis-connect with a list of servers */
+	stsml_redis_shards_t *redis_shards;
+
+	/* only active while a page renders, so tasks never see a stale read */
+	stsml_redis_memo_t redis_memo;
+
+	sts_value_t *cleanup, *response_str, *response_file, *respond_redirect, *response_headers;
 
 	int http_status;
 
 	char *last_resort;
+
+	/* validators for conditional requests. If the script sets one that the client already has, nothing more is written */
+	char *etag;
+	time_t last_modified;
+	int not_modified;
+
+	/* set by http-cache, a ttl of 0 means the page is not cached */
+	double cache_ttl, cache_stale;
+
+	/* background renders have no request, so the path and query are kept here instead */
+	const char *request_path;
+	const onion_dict *request_query;
+
+	/* fragment asts live until the next render just like the page ast */
+	sts_node_t **fragment_asts;
+	unsigned int fragment_asts_size;
+
+	stsml_render_queue_t *render_queue;
+
+	stsml_workers_t *workers;
 } stsml_ctx_t;
 
+/* a task script a pool worker already parsed. It is parsed again only when the file changes */
+typedef struct stsml_task_ast_s
+{
+	char *path;
+
+	time_t mtime;
+	off_t size;
+
+	sts_node_t *ast;
+
+	struct stsml_task_ast_s *next;
+} stsml_task_ast_t;
+
+typedef struct stsml_worker_s
+{
+	stsml_ctx_t ctx;
+	sts_script_t script;
+	stsml_parser_ctx_t parser;
+
+	/* only task pool workers keep these, they survive the reset between tasks */
+	stsml_task_ast_t *task_asts;
+
+	struct stsml_worker_s *next;
+} stsml_worker_t;
+
+/* names this server in redis stream consumer groups, -stream_consumer or the port. Set once before any script runs */
+static const char *stream_consumer = "";
+
 
 char *read_file(sts_script_t *script, char *file, unsigned int *size);
 char *import(sts_script_t *script, char *file);
@@ -107,6 +270,28 @@ sts_value_t *cli_actions(sts_script_t *script, sts_value_t *action, sts_node_t *
 sts_value_t *server_actions(sts_script_t *script, sts_value_t *action, sts_node_t *args, sts_scope_t *locals, sts_value_t **previous);
 char *stsml_import(sts_script_t *script, char *file);
 
+int stsml_ctx_setup(stsml_ctx_t *ctx, sts_script_t *script, stsml_parser_ctx_t *parser, onion *on, char *init_path);
+void stsml_ctx_teardown(stsml_ctx_t *ctx);
+int stsml_ctx_response_init(stsml_ctx_t *ctx);
+void stsml_ctx_response_cleanup(stsml_ctx_t *ctx, char *script_path);
+int stsml_render(stsml_ctx_t *ctx, char *script_path, sts_node_t **ast, char **error);
+stsml_cache_page_t *stsml_cache_page_from_ctx(stsml_ctx_t *ctx);
+int stsml_render_queue_push(stsml_render_queue_t *queue, const char *key, const char *script_path, const char *path, const onion_dict *query, double ttl, double stale);
+int stsml_render_fragment(stsml_ctx_t *ctx, const char *key, char *script_path, double ttl, double stale);
+void stsml_ctx_etag(stsml_ctx_t *ctx);
+int stsml_request_not_modified(onion_request *req, const char *etag, time_t last_modified);
+int stsml_respond_validators(onion_request *req, onion_response *res, const char *etag, time_t last_modified);
+onion_connection_status stsml_respond_file(const char *path, onion_request *req, onion_response *res, int conditional);
+int stsml_response_encoding(onion_request *req, onion_response *res, const char *mime, const char *content_encoding, size_t size);
+const char *stsml_etag_encoding(const char *etag, int encoding, char *buffer, size_t size);
+void stsml_respond_body(onion_response *res, int encoding, const char *body, size_t size, const char *gzip, size_t gzip_size);
+const char *stsml_ctx_header_get(stsml_ctx_t *ctx, const char *key);
+stsml_ctx_t *stsml_worker_ctx(stsml_ctx_t *ctx);
+int stsml_redis_run(stsml_ctx_t *ctx, stsml_redis_args_t *commands, unsigned int count, redisReply **replies);
+size_t stsml_ctx_write_reply(stsml_ctx_t *ctx, redisReply *reply);
+void stsml_workers_teardown(stsml_workers_t *workers);
+void stsml_task_run(void *worker_pass, void *data);
+
 onion_connection_status respond_index(void *data, onion_request *req, onion_response *res)
 {
 	struct stat st;
@@ -161,232 +346,418 @@ onion_connection_status respond_file_specific(void *data, onion_request *req, on
 		if(!stat(  (strlen(onion_request_get_fullpath(req)) <= 1) ? "." : ( &onion_request_get_fullpath(req)[(onion_request_get_fullpath(req)[0] == '/') ? 1 : 0] ) , &st) && S_ISREG(st.st_mode))
 		{
 			ONION_DEBUG("responding as a file '%s'", onion_request_get_fullpath(req));
-			onion_shortcut_response_file((strlen(onion_request_get_fullpath(req)) <= 1) ? "." : ( &onion_request_get_fullpath(req)[(onion_request_get_fullpath(req)[0] == '/') ? 1 : 0] ), req, res);
 
-			return OCS_PROCESSED;
+			return stsml_respond_file((strlen(onion_request_get_fullpath(req)) <= 1) ? "." : ( &onion_request_get_fullpath(req)[(onion_request_get_fullpath(req)[0] == '/') ? 1 : 0] ), req, res, 1);
 		}
 	}
 
 	return OCS_NOT_PROCESSED;
 }
 
-onion_connection_status respond_stsml(void *data, onion_request *req, onion_response *res)
+void stsml_cache_key_append(void *data, const char *key, const char *value, int flags)
 {
-	size_t size;
-	char *script_file = NULL, *parsed_stsml = NULL, *script_path = NULL, *temp_str = NULL, *redirect = NULL;
-	unsigned int line = 0, offset = 0;
-	stsml_ctx_t *stsml_ctx = (stsml_ctx_t *)data;
-	sts_value_t *ret_val = NULL;
-	sts_map_row_t *row = NULL;
-	stsml_script_t *local_ctx = NULL;
+	char **key_str = data;
 
 
-	script_path = (char *)&(onion_request_get_fullpath(req)[(onion_request_get_fullpath(req)[0] == '/') ? 1 : 0]);
+	stsml_asprintf(key_str, "%s%s=%s&", *key_str, key, value ? value : "");
+}
 
-	/* only respond if a .stsml file */
-	if(strlen(onion_request_get_fullpath(req)) > 1 && strrchr(script_path, '.') && !strcmp(strrchr(script_path, '.'), ".stsml"))
-	{
-		ONION_INFO("executing script %s", script_path);
+/* pages are cached by their path and query */
+char *stsml_cache_key(onion_request *req)
+{
+	char *ret = NULL;
 
 
-		/* setup stsml ctx */
+	stsml_asprintf(&ret, "page:%s?", onion_request_get_fullpath(req));
 
-		stsml_ctx->req = req;
-		stsml_ctx->res = res;
-		stsml_ctx->http_status = 200;
+	if(ret && onion_request_get_query_dict(req))
+		onion_dict_preorder(onion_request_get_query_dict(req), &stsml_cache_key_append, &ret);
 
+	return ret;
+}
 
-		if(stsml_ctx->script->script)
-			sts_ast_delete(stsml_ctx->script, stsml_ctx->script->script);
+void stsml_respond_page(stsml_cache_page_t *page, onion_request *req, onion_response *res)
+{
+	stsml_cache_header_t *header = NULL;
+	char etag[96];
+	int encoding;
 
 
-		if(!(stsml_ctx->response_str = sts_value_create(stsml_ctx->script, STS_STRING)))
-		{
-			ONION_ERROR("could not initialize stsml ctx");
-			return OCS_NOT_PROCESSED;
-		}
+	onion_response_set_code(res, page->http_status);
 
-		if(!(stsml_ctx->response_file = sts_value_create(stsml_ctx->script, STS_STRING)))
-		{
-			ONION_ERROR("could not initialize stsml ctx");
-			return OCS_NOT_PROCESSED;
-		}
+	for(header = page->headers; header; header = header->next)
+		onion_response_set_header(res, header->key, header->value);
 
-		if(!(stsml_ctx->respond_redirect = sts_value_create(stsml_ctx->script, STS_STRING)))
-		{
-			ONION_ERROR("could not initialize stsml ctx");
-			return OCS_NOT_PROCESSED;
-		}
+	encoding = stsml_response_encoding(req, res, stsml_cache_page_header_get(page, "Content-Type"), stsml_cache_page_header_get(page, "Content-Encoding"), page->size);
 
-		if(!(stsml_ctx->cleanup = sts_value_create(stsml_ctx->script, STS_ARRAY)))
-		{
-			ONION_ERROR("could not initialize stsml ctx");
-			return OCS_NOT_PROCESSED;
-		}
+	if(!stsml_respond_validators(req, res, stsml_etag_encoding(page->etag, encoding, etag, sizeof(etag)), page->last_modified))
+		stsml_respond_body(res, encoding, page->body, page->size, page->gzip, page->gzip_size);
+}
+
+/* checks whether the client already has a response with these validators */
+int stsml_request_not_modified(onion_request *req, const char *etag, time_t last_modified)
+{
+	const char *header = NULL;
+	time_t since;
+
+
+	if(!req || ((onion_request_get_flags(req) & OR_METHODS) != OR_GET && (onion_request_get_flags(req) & OR_METHODS) != OR_HEAD))
+		return 0;
+
+	/* If-None-Match wins over If-Modified-Since when both are sent */
+	if((header = onion_request_get_header(req, "If-None-Match")))
+		return etag && stsml_etag_match(header, etag);
+
+	return last_modified > 0 && (header = onion_request_get_header(req, "If-Modified-Since")) && (since = stsml_http_date_parse(header)) != -1 && last_modified <= since;
+}
+
+/* sets the validators on the response and turns it into a 304 if the client already has them. Returns 1 if no body should be sent */
+int stsml_respond_validators(onion_request *req, onion_response *res, const char *etag, time_t last_modified)
+{
+	char date[64];
+
+
+	if(etag)
+		onion_response_set_header(res, "ETag", etag);
+
+	if(last_modified > 0)
+		onion_response_set_header(res, "Last-Modified", stsml_http_date(last_modified, date, sizeof(date)));
+
+	if(!stsml_request_not_modified(req, etag, last_modified))
+		return 0;
+
+	onion_response_set_code(res, 304);
+
+	return 1;
+}
+
+/* negotiates the encoding of a response body and marks the response as varying on it when compression is possible */
+int stsml_response_encoding(onion_request *req, onion_response *res, const char *mime, const char *content_encoding, size_t size)
+{
+	/* the script already encoded the body itself */
+	if(content_encoding)
+		return STSML_ENCODING_IDENTITY;
+
+	if(!stsml_compress_possible(mime, size))
+		return STSML_ENCODING_IDENTITY;
+
+	onion_response_set_header(res, "Vary", "Accept-Encoding");
+
+	return stsml_compress_negotiate(onion_request_get_header(req, "Accept-Encoding"), mime, size);
+}
+
+/* a compressed body is not byte for byte the same as the plain one, so its etag is weakened. Weak comparison still lets it match the script's own etag */
+const char *stsml_etag_encoding(const char *etag, int encoding, char *buffer, size_t size)
+{
+	if(!etag || encoding == STSML_ENCODING_IDENTITY || !strncmp(etag, "W/", 2))
+		return etag;
 
-		/* read script file */
+	snprintf(buffer, size, "W/%s", etag);
 
-		if(!(script_file = read_file(stsml_ctx->script, script_path, (unsigned int *)&size)))
+	return buffer;
+}
+
+/* finds a header the script set on the response, NULL if it did not */
+const char *stsml_ctx_header_get(stsml_ctx_t *ctx, const char *key)
+{
+	unsigned int i;
+
+
+	for(i = 0; ctx->response_headers && i + 1 < ctx->response_headers->array.length; i += 2)
+	{
+		if(!strcasecmp(ctx->response_headers->array.data[i]->string.data, key))
+			return ctx->response_headers->array.data[i + 1]->string.data;
+	}
+
+	return NULL;
+}
+
+/* writes a body in the negotiated encoding. An already gzipped copy can be passed so it is not compressed again */
+void stsml_respond_body(onion_response *res, int encoding, const char *body, size_t size, const char *gzip, size_t gzip_size)
+{
+	char *compressed = NULL;
+	size_t compressed_size = 0;
+
+
+	if(encoding == STSML_ENCODING_GZIP && gzip)
+	{
+		body = gzip;
+		size = gzip_size;
+	}
+	else if(encoding != STSML_ENCODING_IDENTITY)
+	{
+		if((compressed = stsml_compress(encoding, body, size, &compressed_size)))
 		{
-			ONION_ERROR("could not read script file at %s", script_path);
-			return OCS_NOT_PROCESSED;
+			body = compressed;
+			size = compressed_size;
 		}
+		else
+			encoding = STSML_ENCODING_IDENTITY;
+	}
+
+	if(encoding != STSML_ENCODING_IDENTITY)
+		onion_response_set_header(res, "Content-Encoding", stsml_compress_name(encoding));
+
+	onion_response_set_length(res, size);
+	onion_response_write(res, body, size);
+
+	free(compressed);
+}
 
-		/* parse stsml into sts */
+/* responds with a compressed copy of a file when the client takes one, and answers conditional requests for it from the file's metadata. Compressible files are compressed once and kept, within STSML_COMPRESS_CACHE_MAX bytes, until they change. Everything else, partial responses and HEAD requests are left to onion */
+onion_connection_status stsml_respond_file(const char *path, onion_request *req, onion_response *res, int conditional)
+{
+	struct stat st, gzip_st;
+	char etag[64], encoded_etag[96], buffer[16384], *gzip_path = NULL, *data = NULL, *body = NULL;
+	const char *mime = onion_mime_get(path);
+	stsml_compress_file_t *compressed = NULL;
+	FILE *file = NULL;
+	size_t size;
+	int encoding = STSML_ENCODING_IDENTITY, gzip = 0;
+
+
+	/* a HEAD request is not worth compressing the whole file for */
+	if(onion_request_get_header(req, "Range") || (onion_request_get_flags(req) & OR_METHODS) == OR_HEAD)
+		return onion_shortcut_response_file(path, req, res);
 
-		stsml_parser_init(stsml_ctx->parser);
+	if(stat(path, &st) || !S_ISREG(st.st_mode))
+		return OCS_NOT_PROCESSED;
 
-		if(!(temp_str = stsml_parser_pwd_from_file(script_path)))
+
+	/* a precompressed sibling at least as new as the file is sent as is, even with compression turned off */
+	if(stsml_compress_accepts(onion_request_get_header(req, "Accept-Encoding"), STSML_ENCODING_GZIP))
+	{
+		stsml_asprintf(&gzip_path, "%s.gz", path);
+
+		if(gzip_path && !stat(gzip_path, &gzip_st) && S_ISREG(gzip_st.st_mode) && gzip_st.st_mtime >= st.st_mtime && (file = fopen(gzip_path, "rb")))
 		{
-			ONION_ERROR("could not parse stsml into sts script %s", script_path);
-			free(script_file);
+			gzip = 1;
 
-			/* TODO make custom error responses */
-			onion_response_set_code(res, 500);
-			onion_response_printf(res, "could not parse stsml '%s' into sts script", script_path);
+			onion_response_set_header(res, "Vary", "Accept-Encoding");
+			onion_response_set_header(res, "Content-Encoding", "gzip");
+
+			snprintf(etag, sizeof(etag), "\"%lx-%lx-gzip\"", (unsigned long)gzip_st.st_size, (unsigned long)gzip_st.st_mtime);
+			st.st_size = gzip_st.st_size;
 		}
 
-		if(stsml_parser_run(stsml_ctx->parser, script_file, temp_str))
+		free(gzip_path);
+	}
+
+	if(!gzip)
+	{
+		if(st.st_size <= STSML_COMPRESS_MAX_FILE)
+			encoding = stsml_response_encoding(req, res, mime, NULL, st.st_size);
+
+		/* a plain file is onion's job, it does its own validators */
+		if(encoding == STSML_ENCODING_IDENTITY || !(file = fopen(path, "rb")))
+			return onion_shortcut_response_file(path, req, res);
+
+		snprintf(etag, sizeof(etag), "\"%lx-%lx\"", (unsigned long)st.st_size, (unsigned long)st.st_mtime);
+	}
+
+	onion_response_set_header(res, "Content-Type", mime ? mime : "application/octet-stream");
+
+	if(conditional && stsml_respond_validators(req, res, stsml_etag_encoding(etag, encoding, encoded_etag, sizeof(encoded_etag)), st.st_mtime))
+	{
+		fclose(file);
+		return OCS_PROCESSED;
+	}
+
+
+	if(encoding != STSML_ENCODING_IDENTITY)
+	{
+		/* the cached copy is only good while the file still has the same etag */
+		if(!(compressed = stsml_compress_file_get(encoding, path, etag)) && (data = malloc(st.st_size + 1)) && fread(data, 1, st.st_size, file) == (size_t)st.st_size && (body = stsml_compress(encoding, data, st.st_size, &size)))
+			compressed = stsml_compress_file_put(encoding, path, etag, body, size);
+
+		free(data);
+
+		if(compressed)
 		{
-			ONION_ERROR("could not parse stsml into sts script %s", script_path);
-			free(script_file);
-			free(temp_str);
+			onion_response_set_header(res, "Content-Encoding", stsml_compress_name(encoding));
+			onion_response_set_length(res, compressed->size);
+			onion_response_write(res, compressed->body, compressed->size);
 
-			/* TODO make custom error responses */
-			onion_response_set_code(res, 500);
-			onion_response_printf(res, "could not parse stsml '%s' into sts script", script_path);
+			stsml_compress_file_release(compressed);
+			fclose(file);
 
 			return OCS_PROCESSED;
 		}
 
-		free(temp_str);
+		/* could not compress it, send it plain */
+		rewind(file);
+	}
 
+	onion_response_set_length(res, st.st_size);
 
-		parsed_stsml = stsml_ctx->parser->assembled;
+	while((size = fread(buffer, 1, sizeof(buffer), file)) > 0)
+	{
+		if(onion_response_write(res, buffer, size) < 0)
+			break;
+	}
 
-		/* printf("DEBUG PARSED VIEW: '%s' '%s'\n", script_file, parsed_stsml); */
+	fclose(file);
 
-		/* look for local struct */
+	return OCS_PROCESSED;
+}
 
-		if(!stsml_ctx->script_locals || !(row = sts_map_get(&stsml_ctx->script_locals, script_path, strlen(script_path))))
-		{
-			/* if it does not exist, make a new one */
-			ONION_INFO("creating new locals struct for script %s", script_path);
+onion_connection_status respond_stsml(void *data, onion_request *req, onion_response *res)
+{
+	char *script_path = NULL, *redirect = NULL, *cache_key = NULL, *error = NULL, etag[96];
+	stsml_ctx_t *stsml_ctx = (stsml_ctx_t *)data;
+	stsml_cache_page_t *page = NULL;
+	int regenerate = 0, leader = 0, encoding = STSML_ENCODING_IDENTITY;
 
-			if(!(local_ctx = calloc(1, sizeof(stsml_script_t))))
-			{
-				ONION_ERROR("could not create locals for %s", script_path);
-				free(script_file);
-				free(parsed_stsml);
 
-				/* TODO make custom error responses */
-				onion_response_set_code(res, 500);
-				onion_response_printf(res, "could not parse script '%s', line: %u, character offset: %u", script_path, line, offset);
+	script_path = (char *)&(onion_request_get_fullpath(req)[(onion_request_get_fullpath(req)[0] == '/') ? 1 : 0]);
 
-				return OCS_PROCESSED;
-			}
+	/* only respond if a .stsml file */
+	if(strlen(onion_request_get_fullpath(req)) > 1 && strrchr(script_path, '.') && !strcmp(strrchr(script_path, '.'), ".stsml"))
+	{
+		/* every pool thread renders with its own interpreter */
+		if(!(stsml_ctx = stsml_worker_ctx(stsml_ctx)))
+			return OCS_INTERNAL_ERROR;
 
-			if(!(row = sts_map_add_set(&stsml_ctx->script_locals, script_path, strlen(script_path), local_ctx)))
-			{
-				ONION_ERROR("could not add new locals to stsml locals for %s", script_path);
-				free(script_file);
-				free(parsed_stsml);
-				free(local_ctx);
+		ONION_INFO("executing script %s", script_path);
 
-				/* TODO make custom error responses */
-				onion_response_set_code(res, 500);
-				onion_response_printf(res, "could not parse script '%s', line: %u, character offset: %u", script_path, line, offset);
 
-				return OCS_PROCESSED;
-			}
+		/* serve from the page cache if the page asked to be cached with http-cache the last time it rendered. Other pages never touch the cache */
 
-			row->type = STS_ROW_VOID;
+		if((onion_request_get_flags(req) & OR_METHODS) == OR_GET && stsml_cache_path_ttl(script_path) > 0.0 && (cache_key = stsml_cache_key(req)))
+		{
+			switch(stsml_cache_get(cache_key, &page, &regenerate))
+			{
+				case STSML_CACHE_STALE:
+					if(regenerate && stsml_render_queue_push(stsml_ctx->render_queue, cache_key, script_path, onion_request_get_path(req), onion_request_get_query_dict(req), 0.0, 0.0))
+						stsml_cache_abandon(cache_key);
+				/* fall through */
+				case STSML_CACHE_FRESH:
+					ONION_DEBUG("responding with cached page %s", cache_key);
+
+					stsml_respond_page(page, req, res);
+					stsml_cache_page_release(page);
+					free(cache_key);
+
+					return OCS_PROCESSED;
+			}
 
-			/* need to make globals the uplevel */
-			if(!(local_ctx->locals = sts_scope_push(stsml_ctx->script, stsml_ctx->script->globals)))
+			/* identical requests wait on whoever is already rendering this page */
+			switch(stsml_cache_flight_begin(cache_key, &page))
 			{
-				ONION_ERROR("could not push new locals to stsml locals for %s", script_path);
-				free(script_file);
-				free(parsed_stsml);
-				free(local_ctx);
+				case STSML_CACHE_FLIGHT_SHARED:
+					ONION_DEBUG("responding with coalesced page %s", cache_key);
 
-				
-				onion_response_set_code(res, 500);
-				onion_response_printf(res, "could not parse script '%s', line: %u, character offset: %u", script_path, line, offset);
+					stsml_respond_page(page, req, res);
+					stsml_cache_page_release(page);
+					free(cache_key);
 
-				return OCS_PROCESSED;
+					return OCS_PROCESSED;
+				case STSML_CACHE_FLIGHT_LEADER:
+					leader = 1;
+				break;
 			}
 		}
-		else
-		{
-			ONION_INFO("found locals struct for script %s", script_path);
 
-			local_ctx = row->value;
-		}
 
-		/* run through sts */
+		/* setup stsml ctx */
+
+		stsml_ctx->req = req;
+		stsml_ctx->res = res;
+		stsml_ctx->request_path = onion_request_get_path(req);
+		stsml_ctx->request_query = NULL;
+
 
-		if(!(stsml_ctx->script->script = sts_parse(stsml_ctx->script, NULL, parsed_stsml, script_path, &offset, &line)))
+		if(stsml_ctx_response_init(stsml_ctx))
 		{
-			ONION_ERROR("could not parse script %s", script_path);
-			free(script_file);
-			free(parsed_stsml);
+			ONION_ERROR("could not initialize stsml ctx");
 
-			
-			onion_response_set_code(res, 500);
-			onion_response_printf(res, "could not parse script '%s', line: %u, character offset: %u", script_path, line, offset);
+			if(leader)
+				stsml_cache_flight_end(cache_key, NULL);
 
-			return OCS_PROCESSED;
+			free(cache_key);
+			return OCS_NOT_PROCESSED;
 		}
 
-		free(script_file);
-		free(parsed_stsml);
-
-		if(!(ret_val = sts_eval(stsml_ctx->script, stsml_ctx->script->script, local_ctx->locals, NULL, 0, 0)))
+		switch(stsml_render(stsml_ctx, script_path, &stsml_ctx->script->script, &error))
 		{
-			ONION_ERROR("could not eval script %s", script_path);
+			case -1:
+				stsml_ctx_response_cleanup(stsml_ctx, script_path);
 
-			sts_ast_delete(stsml_ctx->script, stsml_ctx->script->script);
+				if(leader)
+					stsml_cache_flight_end(cache_key, NULL);
 
-			
-			onion_response_set_code(res, 500);
-			onion_response_printf(res, "could not eval script '%s'", script_path);
+				free(cache_key);
 
-			return OCS_PROCESSED;
+				return OCS_NOT_PROCESSED;
+			case 1:
+				/* TODO make custom error responses */
+				onion_response_set_code(res, 500);
+				onion_response_printf(res, "%s", error ? error : "could not render script");
+
+				stsml_ctx_response_cleanup(stsml_ctx, script_path);
+
+				if(leader)
+					stsml_cache_flight_end(cache_key, NULL);
+
+				free(cache_key);
+				free(error);
+
+				return OCS_PROCESSED;
 		}
-		
-		if(!sts_value_reference_decrement(stsml_ctx->script, ret_val))
-			ONION_ERROR("could not refdec return value for script %s", script_path);
-		
+
 
 		/* respond */
 
 		onion_response_set_code(res, stsml_ctx->http_status);
 
+		/* a page that just started calling http-cache is stored from now on. A render stopped early for a 304 may not have reached http-cache, so it says nothing about the ttl */
+		if((onion_request_get_flags(req) & OR_METHODS) == OR_GET && !stsml_ctx->not_modified)
+		{
+			stsml_cache_path_set(script_path, stsml_ctx->cache_ttl);
+
+			if(!cache_key && stsml_ctx->cache_ttl > 0.0)
+				cache_key = stsml_cache_key(req);
+		}
+
+		if(stsml_ctx->http_status == 200)
+			stsml_ctx_etag(stsml_ctx);
+
+		/* the page is built before responding so its gzipped copy is also what this client gets */
+		if(cache_key)
+			page = stsml_cache_page_from_ctx(stsml_ctx);
+
+		if(!stsml_ctx->respond_redirect->string.length && !stsml_ctx->response_file->string.length)
+			encoding = stsml_response_encoding(req, res, stsml_ctx_header_get(stsml_ctx, "Content-Type"), stsml_ctx_header_get(stsml_ctx, "Content-Encoding"), stsml_ctx->response_str->string.length);
+
 
 		if(stsml_ctx->respond_redirect->string.length)
 			redirect = sts_memdup(stsml_ctx->respond_redirect->string.data, stsml_ctx->respond_redirect->string.length);
 		else if(stsml_ctx->response_file->string.length)
-			onion_shortcut_response_file(stsml_ctx->response_file->string.data, req, res);
-		else if(stsml_ctx->response_str->string.length)
-			onion_response_write(res, stsml_ctx->response_str->string.data, stsml_ctx->response_str->string.length);
+		{
+			if(stsml_respond_file(stsml_ctx->response_file->string.data, req, res, stsml_ctx->http_status == 200) == OCS_NOT_PROCESSED)
+				onion_shortcut_response_file(stsml_ctx->response_file->string.data, req, res);
+		}
+		else if(stsml_ctx->http_status == 200 && stsml_respond_validators(req, res, stsml_etag_encoding(stsml_ctx->etag, encoding, etag, sizeof(etag)), stsml_ctx->last_modified))
+			ONION_DEBUG("client already has %s", script_path);
 		else
-			onion_response_write(res, "", 0);
+			stsml_respond_body(res, encoding, stsml_ctx->response_str->string.data, stsml_ctx->response_str->string.length, page ? page->gzip : NULL, page ? page->gzip_size : 0);
 
 
-		/* cleanup */
+		if(cache_key)
+		{
+			/* waiters get the page even if storing it fails */
+			if(leader)
+				stsml_cache_flight_end(cache_key, page);
 
-		if(!sts_value_reference_decrement(stsml_ctx->script, stsml_ctx->response_file))
-			ONION_ERROR("could not refdec file response string value for script %s", script_path);
-		
-		if(!sts_value_reference_decrement(stsml_ctx->script, stsml_ctx->response_str))
-			ONION_ERROR("could not refdec response string value for script %s", script_path);
+			if(page)
+				stsml_cache_put(cache_key, page, stsml_ctx->cache_ttl, stsml_ctx->cache_stale);
+		}
 
-		if(!sts_value_reference_decrement(stsml_ctx->script, stsml_ctx->respond_redirect))
-			ONION_ERROR("could not refdec redirect string value for script %s", script_path);
 
-		if(!sts_value_reference_decrement(stsml_ctx->script, stsml_ctx->cleanup))
-			ONION_ERROR("could not refdec cleanup array value for script %s", script_path);
+		/* cleanup */
+
+		stsml_ctx_response_cleanup(stsml_ctx, script_path);
+		free(cache_key);
 
 
 		/* unfortunately have to do this because the stsml ctx will be reused. Obviously theres a much better way to do this, but I just want something that works well enough */
@@ -414,225 +785,1895 @@ onion_connection_status respond_last_resort(void *data, onion_request *req, onio
 	return OCS_NOT_PROCESSED;
 }
 
-void *start_task(stsml_task_args_t *args_pass)
+const char *stsml_query_get(stsml_ctx_t *ctx, const char *key)
 {
-	char *script_path = args_pass->script_path;
-	sts_value_t *args = args_pass->args;
-	unsigned long script_text_size = 0, offset = 0, line = 0;
-	char *script_text = NULL;
-	stsml_parser_ctx_t parser;
-	stsml_ctx_t ctx;
-	sts_value_t *res = NULL;
-	sts_script_t script;
+	if(ctx->req)
+		return onion_request_get_query(ctx->req, key);
 
+	return ctx->request_query ? onion_dict_get(ctx->request_query, key) : NULL;
+}
 
-	ONION_INFO("starting new task from script '%s'", script_path);
+int stsml_ctx_response_init(stsml_ctx_t *ctx)
+{
+	unsigned int i;
 
-	/* initialize the script */
 
-	memset(&script, 0, sizeof(sts_script_t));
+	/* the previous page and fragment asts are only needed until the next render */
 
-	/* set a read file callback */
-	script.read_file = &read_file;
+	if(ctx->script->script)
+	{
+		sts_ast_delete(ctx->script, ctx->script->script);
+		ctx->script->script = NULL;
+	}
 
-	/* initialize the router */
-	script.router = &server_actions;
+	for(i = 0; i < ctx->fragment_asts_size; ++i)
+		sts_ast_delete(ctx->script, ctx->fragment_asts[i]);
 
-	script.import_file = &stsml_import;
+	ctx->fragment_asts_size = 0;
 
-	script.userdata = &ctx;
 
-	/* initialize the stsml_ctx */
+	ctx->http_status = 200;
+	ctx->cache_ttl = 0.0;
+	ctx->cache_stale = 0.0;
+
+	free(ctx->etag);
+	ctx->etag = NULL;
+	ctx->last_modified = 0;
+	ctx->not_modified = 0;
+
+	ctx->redis_memo.active = 1;
+
+	if(!(ctx->response_str = sts_value_create(ctx->script, STS_STRING)))
+		return 1;
+
+	if(!(ctx->response_file = sts_value_create(ctx->script, STS_STRING)))
+		return 1;
+
+	if(!(ctx->respond_redirect = sts_value_create(ctx->script, STS_STRING)))
+		return 1;
+
+	if(!(ctx->cleanup = sts_value_create(ctx->script, STS_ARRAY)))
+		return 1;
+
+	if(!(ctx->response_headers = sts_value_create(ctx->script, STS_ARRAY)))
+		return 1;
+
+	return 0;
+}
+
+void stsml_ctx_response_cleanup(stsml_ctx_t *ctx, char *script_path)
+{
+	stsml_redis_memo_clear(&ctx->redis_memo);
+	ctx->redis_memo.active = 0;
+
+	if(!sts_value_reference_decrement(ctx->script, ctx->response_file))
+		ONION_ERROR("could not refdec file response string value for script %s", script_path);
+
+	if(!sts_value_reference_decrement(ctx->script, ctx->response_str))
+		ONION_ERROR("could not refdec response string value for script %s", script_path);
 
-	memset(&ctx, 0, sizeof(stsml_ctx_t));
+	if(!sts_value_reference_decrement(ctx->script, ctx->respond_redirect))
+		ONION_ERROR("could not refdec redirect string value for script %s", script_path);
 
-	ctx.parser = &parser;
-	ctx.script = &script;
+	if(!sts_value_reference_decrement(ctx->script, ctx->cleanup))
+		ONION_ERROR("could not refdec cleanup array value for script %s", script_path);
 
-	if(!(script_text = read_file(&script, script_path, &script_text_size)))
+	if(!sts_value_reference_decrement(ctx->script, ctx->response_headers))
+		ONION_ERROR("could not refdec header array value for script %s", script_path);
+
+	ctx->response_str = ctx->response_file = ctx->respond_redirect = ctx->cleanup = ctx->response_headers = NULL;
+}
+
+/* renders an stsml file into the response values of the ctx. Returns -1 if the file could not be read, 1 with a message for the client if anything else failed, and 0 on success */
+int stsml_render(stsml_ctx_t *ctx, char *script_path, sts_node_t **ast, char **error)
+{
+	unsigned int size = 0, line = 0, offset = 0;
+	char *script_file = NULL, *parsed_stsml = NULL, *temp_str = NULL;
+	sts_value_t *ret_val = NULL;
+	sts_map_row_t *row = NULL;
+	stsml_script_t *local_ctx = NULL;
+
+
+	/* read script file */
+
+	if(!(script_file = read_file(ctx->script, script_path, &size)))
 	{
-		ONION_ERROR("could not read script '%s' in new task", script_path);
-		goto cleanup;
+		ONION_ERROR("could not read script file at %s", script_path);
+		return -1;
 	}
 
+	/* parse stsml into sts */
 
-	if(!(script.script = sts_parse(&script, NULL, script_text, script_path, &offset, &line)))
+	stsml_parser_init(ctx->parser);
+
+	if(!(temp_str = stsml_parser_pwd_from_file(script_path)))
 	{
-		ONION_ERROR("could not parse script '%s' in new task", script_path);
-		goto cleanup;
-	}
+		ONION_ERROR("could not parse stsml into sts script %s", script_path);
+		free(script_file);
 
-	/* add the arguments to the explicitly created global scope */
+		stsml_asprintf(error, "could not parse stsml '%s' into sts script", script_path);
+
+		return 1;
+	}
 
-	if(!(script.globals = sts_scope_push(&script, NULL)))
+	if(stsml_parser_run(ctx->parser, script_file, temp_str))
 	{
-		ONION_ERROR("could not create global scope level in new task");
-		goto cleanup;
+		ONION_ERROR("could not parse stsml into sts script %s", script_path);
+		free(script_file);
+		free(temp_str);
+
+		stsml_asprintf(error, "could not parse stsml '%s' into sts script", script_path);
+
+		return 1;
 	}
 
+	free(temp_str);
+
 
-	if(!sts_map_add_set(&script.globals->locals, "args", strlen("args"), args))
+	parsed_stsml = ctx->parser->assembled;
+
+	/* printf("DEBUG PARSED VIEW: '%s' '%s'\n", script_file, parsed_stsml); */
+
+	/* look for local struct */
+
+	if(!ctx->script_locals || !(row = sts_map_get(&ctx->script_locals, script_path, strlen(script_path))))
 	{
-		ONION_ERROR("could not create args in global scope level in new task");
-		goto cleanup;
-	}
+		/* if it does not exist, make a new one */
+		ONION_INFO("creating new locals struct for script %s", script_path);
 
-	/* evaluate script */
+		if(!(local_ctx = calloc(1, sizeof(stsml_script_t))))
+		{
+			ONION_ERROR("could not create locals for %s", script_path);
+			free(script_file);
+			free(parsed_stsml);
 
-	if(!(res = sts_eval(&script, script.script, NULL, NULL, 0, 0)))
+			stsml_asprintf(error, "could not parse script '%s', line: %u, character offset: %u", script_path, line, offset);
+
+			return 1;
+		}
+
+		if(!(row = sts_map_add_set(&ctx->script_locals, script_path, strlen(script_path), local_ctx)))
+		{
+			ONION_ERROR("could not add new locals to stsml locals for %s", script_path);
+			free(script_file);
+			free(parsed_stsml);
+			free(local_ctx);
+
+			stsml_asprintf(error, "could not parse script '%s', line: %u, character offset: %u", script_path, line, offset);
+
+			return 1;
+		}
+
+		row->type = STS_ROW_VOID;
+
+		/* need to make globals the uplevel */
+		if(!(local_ctx->locals = sts_scope_push(ctx->script, ctx->script->globals)))
+		{
+			ONION_ERROR("could not push new locals to stsml locals for %s", script_path);
+			free(script_file);
+			free(parsed_stsml);
+
+			stsml_asprintf(error, "could not parse script '%s', line: %u, character offset: %u", script_path, line, offset);
+
+			return 1;
+		}
+	}
+	else
 	{
-		ONION_ERROR("could not eval script in new task");
-		goto cleanup;
+		ONION_INFO("found locals struct for script %s", script_path);
+
+		local_ctx = row->value;
 	}
 
+	/* run through sts */
 
-	/* cleanup */
-cleanup:
+	if(!(*ast = sts_parse(ctx->script, NULL, parsed_stsml, script_path, &offset, &line)))
+	{
+		ONION_ERROR("could not parse script %s", script_path);
+		free(script_file);
+		free(parsed_stsml);
 
-	if(ctx.redis_ctx)
-		redisFree(ctx.redis_ctx);
+		stsml_asprintf(error, "could not parse script '%s', line: %u, character offset: %u", script_path, line, offset);
 
-	if(res)
-		sts_value_reference_decrement(&script, res);
+		return 1;
+	}
 
-	sts_destroy(&script);
+	free(script_file);
+	free(parsed_stsml);
 
-	if(script_text)
-		free(script_text);
+	if(!(ret_val = sts_eval(ctx->script, *ast, local_ctx->locals, NULL, 0, 0)))
+	{
+		/* http-etag or http-last-modified stopped the script, a 304 goes out instead */
+		if(ctx->not_modified)
+			return 0;
 
-	free(args_pass->script_path);
-	/* dont need to free the args array because the global scope owns it */
+		ONION_ERROR("could not eval script %s", script_path);
 
-	free(args_pass);
+		sts_ast_delete(ctx->script, *ast);
+		*ast = NULL;
 
-	pthread_detach(pthread_self());
+		stsml_asprintf(error, "could not eval script '%s'", script_path);
 
-	return NULL;
+		return 1;
+	}
+
+	if(!sts_value_reference_decrement(ctx->script, ret_val))
+		ONION_ERROR("could not refdec return value for script %s", script_path);
+
+	return 0;
 }
 
-sts_value_t *server_actions(sts_script_t *script, sts_value_t *action, sts_node_t *args, sts_scope_t *locals, sts_value_t **previous)
+/* hashes the response unless the script already set a validator */
+void stsml_ctx_etag(stsml_ctx_t *ctx)
 {
-	sts_value_t *ret = NULL, *eval_value = NULL, *temp_value = NULL, *first_arg_value = NULL, *second_arg_value = NULL;
-	FILE *proc_pipe = NULL, *file = NULL;
-	char *temp_str = NULL;
-	unsigned int i = 0, size = 0, total = 0, temp_uint = 0;
-	stsml_ctx_t *stsml_ctx = NULL;
-	onion_block *data;
-	stsml_task_args_t *task_args = NULL;
-	pthread_t id;
-	redisReply *reply = NULL;
-	size_t redis_args_size[1024], redis_args_cleanup[1024];
-	char *redis_args[1024];
+	if(ctx->etag || ctx->last_modified > 0)
+		return;
+
+	stsml_asprintf(&ctx->etag, "\"%016llx\"", stsml_hash(ctx->response_str->string.data, ctx->response_str->string.length));
+}
 
+/* copies the rendered response into a page for the cache, NULL if the response should not be cached */
+stsml_cache_page_t *stsml_cache_page_from_ctx(stsml_ctx_t *ctx)
+{
+	stsml_cache_page_t *page = NULL;
+	unsigned int i;
 
 
-	#define STS_ARRAY_RESIZE(value_ptr, size) do{	\
-			if(!((value_ptr)->array.data = realloc((value_ptr)->array.data, (size) * sizeof(sts_value_t **)))) {fprintf(stderr, "could not resize array");}	\
-			else (value_ptr)->array.allocated = (size);	\
-		}while(0)
+	/* only plain successful renders are worth keeping */
+	if(ctx->cache_ttl <= 0.0 || ctx->http_status != 200 || ctx->not_modified || ctx->respond_redirect->string.length || ctx->response_file->string.length)
+		return NULL;
 
-	#define STS_ARRAY_APPEND_INSERT(value_ptr, value_insert, position) do{	\
-			if((value_ptr)->array.length + 1 > (value_ptr)->array.allocated) STS_ARRAY_RESIZE((value_ptr), (value_ptr)->array.length + 1);	\
-			if(position >= (value_ptr)->array.length) (value_ptr)->array.data[(value_ptr)->array.length] = (value_insert);	\
-			else{ memmove(&(value_ptr)->array.data[position + 1], &(value_ptr)->array.data[position], ((value_ptr)->array.length - position) * sizeof(sts_value_t **)); (value_ptr)->array.data[position] = (value_insert);}	\
-			(value_ptr)->array.length++;	\
-		}while(0)
+	if(!(page = stsml_cache_page_new(ctx->response_str->string.data, ctx->response_str->string.length, ctx->http_status)))
+		return NULL;
 
-	#define STS_STRING_ASSEMBLE(dest, current_size, middle_str, middle_size, end_str, end_size) do{	\
-			if(!((dest) = realloc((dest), (current_size) + (middle_size) + (end_size) + 1))) fprintf(stderr, "could not resize assembled string");	\
-			memmove(&(dest)[current_size], (middle_str), (middle_size));	\
-			memmove(&(dest)[current_size + (middle_size)], (end_str), (end_size));	\
-			(dest)[current_size + (middle_size) + (end_size)] = 0x0;	\
-			current_size += (middle_size) + (end_size);	\
-		}while(0)
-	
-	#ifdef STS_GOTO_JIT
-		#define GOTO_LABEL_CAT_(a, b) a ## b
-		#define GOTO_LABEL_CAT(a, b) GOTO_LABEL_CAT_(a, b)
-		#define GOTO_SET(id) do{args->label = && GOTO_LABEL_CAT(sts_jit_, __LINE__); args->router_id = (void *)(id); GOTO_LABEL_CAT(sts_jit_, __LINE__):;}while(0)
-		#define GOTO_JMP(id) do{if(args->router_id == (void *)(id)){goto *(args->label);}}while(0)
-		#define GOTO_ACTIVATED (args->router_id)
-	#else
-		#define GOTO_SET(id)
-		#define GOTO_JMP(id)
-		#define GOTO_ACTIVATED
-	#endif
+	stsml_ctx_etag(ctx);
 
+	if(ctx->etag && !(page->etag = strdup(ctx->etag)))
+	{
+		stsml_cache_page_release(page);
+		return NULL;
+	}
 
+	page->last_modified = ctx->last_modified;
 
-	stsml_ctx = script->userdata;
+	/* compress once here instead of on every hit */
+	if(!stsml_ctx_header_get(ctx, "Content-Encoding") && stsml_compress_negotiate("gzip", stsml_ctx_header_get(ctx, "Content-Type"), page->size) == STSML_ENCODING_GZIP)
+		page->gzip = stsml_compress(STSML_ENCODING_GZIP, page->body, page->size, &page->gzip_size);
 
-	/* printf("=========== %p %p %s\n", script->globals, locals, action->string.data); */
-	GOTO_JMP(&server_actions);
-	if(!GOTO_ACTIVATED && action->type == STS_STRING)
+	for(i = 0; i + 1 < ctx->response_headers->array.length; i += 2)
 	{
-		if(!strcmp("http-write", action->string.data))
+		if(stsml_cache_page_header_add(page, ctx->response_headers->array.data[i]->string.data, ctx->response_headers->array.data[i + 1]->string.data))
 		{
-			GOTO_SET(&server_actions);
-			if(args->next)
-			{
-				if(!(eval_value = sts_eval(script, args->next, locals, previous, 1, 0)))
-				{
-					fprintf(stderr, "could not eval argument in http-write\n");
-					return NULL;
-				}
-				else if(eval_value->type != STS_STRING)
-				{
-					fprintf(stderr, "first argument in http-write is not a string\n");
-					return NULL;
-				}
-				else
-				{
-					STS_STRING_ASSEMBLE(stsml_ctx->response_str->string.data, stsml_ctx->response_str->string.length, eval_value->string.data, eval_value->string.length, "", 0);
+			stsml_cache_page_release(page);
+			return NULL;
+		}
+	}
 
-					if(!(ret = sts_value_from_number(script, 1.0)))
-					{
-						fprintf(stderr, "could not create new ret number\n");
+	return page;
+}
 
-						if(!sts_value_reference_decrement(script, eval_value))
-							fprintf(stderr, "could not refdec the argument\n");
-							
-						return NULL;
-					}
-				}
+void stsml_render_job_free(stsml_render_job_t *job)
+{
+	free(job->key);
+	free(job->script_path);
+	free(job->path);
 
-				/* === */
-				if(eval_value)
-					if(!sts_value_reference_decrement(script, eval_value))
-						fprintf(stderr, "could not refdec the argument\n");
-			}
-			else
-			{
-				fprintf(stderr, "http-write requires 1 string argument\n");
-				return NULL;
-			}
+	if(job->query)
+		onion_dict_free(job->query);
+
+	free(job);
+}
+
+void *stsml_render_thread(void *data)
+{
+	stsml_render_queue_t *queue = data;
+	stsml_render_job_t *job = NULL;
+	stsml_cache_page_t *page = NULL;
+	stsml_parser_ctx_t parser;
+	stsml_ctx_t ctx;
+	sts_script_t script;
+	char *error = NULL;
+	int failed = 0;
+
+
+	ONION_INFO("starting render thread");
+
+	if((failed = stsml_ctx_setup(&ctx, &script, &parser, queue->onion, queue->init_path)))
+		ONION_ERROR("could not initialize the render thread, stale pages will not be refreshed");
+
+	ctx.render_queue = queue;
+
+	for(;;)
+	{
+		pthread_mutex_lock(&queue->lock);
+
+		while(!queue->head && !queue->stop)
+			pthread_cond_wait(&queue->cond, &queue->lock);
+
+		if(queue->stop)
+		{
+			pthread_mutex_unlock(&queue->lock);
+			break;
 		}
-		else if(!strcmp("http-clear", action->string.data))
+
+		job = queue->head;
+
+		if(!(queue->head = job->next))
+			queue->tail = NULL;
+
+		pthread_mutex_unlock(&queue->lock);
+
+
+		ONION_INFO("re-rendering %s in the background", job->key);
+
+		ctx.req = NULL;
+		ctx.res = NULL;
+		ctx.request_path = job->path;
+		ctx.request_query = job->query;
+
+		if(failed || stsml_ctx_response_init(&ctx))
+			stsml_cache_abandon(job->key);
+		else
 		{
-			GOTO_SET(&server_actions);
-			if(stsml_ctx->response_str->string.length)
+			/* fragments know their lifetime up front, pages set it again with http-cache */
+			ctx.cache_ttl = job->ttl;
+			ctx.cache_stale = job->stale;
+
+			if(stsml_cache_flight_begin(job->key, &page) != STSML_CACHE_FLIGHT_LEADER)
 			{
-				stsml_ctx->response_str->string.data[0] = 0x0;
-				stsml_ctx->response_str->string.length = 0;
+				/* a request is already rendering this key and will store it */
+				if(page)
+					stsml_cache_page_release(page);
+
+				stsml_cache_abandon(job->key);
 			}
-			
-			if(!(ret = sts_value_from_number(script, 1.0)))
+			else
 			{
-				fprintf(stderr, "could not create new ret number\n");
-				return NULL;
+				page = NULL;
+
+				if(!stsml_render(&ctx, job->script_path, &script.script, &error))
+					page = stsml_cache_page_from_ctx(&ctx);
+
+				stsml_cache_flight_end(job->key, page);
+
+				if(page)
+					stsml_cache_put(job->key, page, ctx.cache_ttl, ctx.cache_stale);
+				else
+				{
+					ONION_ERROR("could not re-render %s, the stale copy will be kept", job->key);
+					stsml_cache_abandon(job->key);
+				}
 			}
+
+			stsml_ctx_response_cleanup(&ctx, job->script_path);
 		}
-		else if(!strcmp("http-method-get", action->string.data))
-		{
-			GOTO_SET(&server_actions);
-			#define METHOD_CASE(m) case OR_##m : if(!(ret = sts_value_from_string(script, #m)))	\
-			{	\
-				fprintf(stderr, "could not create new ret string\n");	\
-				return NULL;	\
-			} break
 
-			switch(onion_request_get_flags(stsml_ctx->req) & OR_METHODS)
-			{
+		free(error);
+		error = NULL;
+
+		stsml_render_job_free(job);
+	}
+
+	if(!failed)
+		stsml_ctx_teardown(&ctx);
+
+	return NULL;
+}
+
+int stsml_render_queue_push(stsml_render_queue_t *queue, const char *key, const char *script_path, const char *path, const onion_dict *query, double ttl, double stale)
+{
+	stsml_render_job_t *job = NULL;
+
+
+	if(!queue)
+		return 1;
+
+	if(!(job = calloc(1, sizeof(stsml_render_job_t))))
+	{
+		ONION_ERROR("could not allocate render job");
+		return 1;
+	}
+
+	job->ttl = ttl;
+	job->stale = stale;
+
+	if(!(job->key = strdup(key)) || !(job->script_path = strdup(script_path)) || !(job->path = strdup(path ? path : "")) || (query && !(job->query = onion_dict_hard_dup((onion_dict *)query))))
+	{
+		ONION_ERROR("could not copy render job");
+		stsml_render_job_free(job);
+		return 1;
+	}
+
+
+	pthread_mutex_lock(&queue->lock);
+
+	/* the render thread is only started once something goes stale */
+	if(!queue->started)
+	{
+		if(pthread_create(&queue->thread, NULL, &stsml_render_thread, queue))
+		{
+			pthread_mutex_unlock(&queue->lock);
+
+			ONION_ERROR("could not start render thread");
+			stsml_render_job_free(job);
+
+			return 1;
+		}
+
+		queue->started = 1;
+	}
+
+	if(queue->tail)
+		queue->tail->next = job;
+	else
+		queue->head = job;
+
+	queue->tail = job;
+
+	pthread_cond_signal(&queue->cond);
+	pthread_mutex_unlock(&queue->lock);
+
+	return 0;
+}
+
+void stsml_render_queue_stop(stsml_render_queue_t *queue)
+{
+	stsml_render_job_t *job = NULL;
+
+
+	pthread_mutex_lock(&queue->lock);
+
+	queue->stop = 1;
+	pthread_cond_broadcast(&queue->cond);
+
+	pthread_mutex_unlock(&queue->lock);
+
+	if(queue->started)
+		pthread_join(queue->thread, NULL);
+
+	while((job = queue->head))
+	{
+		queue->head = job->next;
+		stsml_render_job_free(job);
+	}
+
+	queue->tail = NULL;
+}
+
+/* sets up an interpreter to serve pages with and runs the startup script in it */
+int stsml_ctx_setup(stsml_ctx_t *ctx, sts_script_t *script, stsml_parser_ctx_t *parser, onion *on, char *init_path)
+{
+	unsigned int script_text_size = 0, offset = 0, line = 0;
+	char *script_text = NULL;
+	sts_value_t *res = NULL;
+
+
+	/* initialize the script */
+
+	memset(script, 0, sizeof(sts_script_t));
+
+	/* set a read file callback */
+	script->read_file = &read_file;
+
+	/* initialize the router */
+	script->router = &server_actions;
+
+	script->import_file = &stsml_import;
+
+	script->userdata = ctx;
+
+
+	/* initialize the stsml_ctx */
+
+	memset(ctx, 0, sizeof(stsml_ctx_t));
+
+	ctx->parser = parser;
+	ctx->script = script;
+	ctx->onion = on;
+
+	if(!(script->globals = sts_scope_push(script, NULL)))
+	{
+		ONION_ERROR("could not create global scope level");
+		return 1;
+	}
+
+	/* if specified, run an initializer script */
+
+	if(init_path)
+	{
+		if(!(ctx->cleanup = sts_value_create(script, STS_ARRAY)))
+		{
+			ONION_ERROR("could not initialize stsml ctx");
+			goto fail;
+		}
+
+		if(!(script_text = read_file(script, init_path, &script_text_size)))
+		{
+			ONION_ERROR("could not initialize stsml ctx");
+			goto fail;
+		}
+
+		/* parse */
+
+		if(!(script->script = sts_parse(script, NULL, script_text, init_path, &offset, &line)))
+		{
+			ONION_ERROR("could not parse startup script at '%s'", init_path);
+			free(script_text);
+
+			goto fail;
+		}
+
+		free(script_text);
+
+		if(!(res = sts_eval(script, script->script, NULL, NULL, 0, 0)))
+		{
+			ONION_ERROR("could not parse startup script at '%s'", init_path);
+			sts_ast_delete(script, script->script);
+			script->script = NULL;
+
+			goto fail;
+		}
+		else
+			sts_value_reference_decrement(script, res);
+
+		sts_ast_delete(script, script->script);
+		script->script = NULL;
+
+
+		if(!sts_value_reference_decrement(script, ctx->cleanup))
+		{
+			ONION_ERROR("could not refdec stsml ctx cleanup values");
+			ctx->cleanup = NULL;
+
+			goto fail;
+		}
+
+		ctx->cleanup = NULL;
+	}
+
+	return 0;
+
+fail:
+
+	/* callers treat a failed ctx as never set up, so free whatever the init script left behind */
+	if(ctx->cleanup)
+	{
+		sts_value_reference_decrement(script, ctx->cleanup);
+		ctx->cleanup = NULL;
+	}
+
+	stsml_ctx_teardown(ctx);
+
+	return 1;
+}
+
+void stsml_ctx_teardown(stsml_ctx_t *ctx)
+{
+	sts_map_row_t *temp_row = NULL;
+	stsml_script_t *temp_stript_locals = NULL;
+	unsigned int i;
+
+
+	/* destroy all locals */
+
+	while(ctx->script_locals)
+	{
+		if((temp_stript_locals = ctx->script_locals->value))
+		{
+			if(!sts_destroy_map(ctx->script, temp_stript_locals->locals->locals))
+				ONION_ERROR("could not destroy local map for %d", ctx->script_locals->hash);
+
+			free(temp_stript_locals->locals);
+		}
+
+		temp_row = ctx->script_locals;
+		ctx->script_locals = ctx->script_locals->next;
+
+		free(temp_row->value);
+		free(temp_row);
+	}
+
+	for(i = 0; i < ctx->fragment_asts_size; ++i)
+		sts_ast_delete(ctx->script, ctx->fragment_asts[i]);
+
+	free(ctx->fragment_asts);
+	free(ctx->etag);
+
+	stsml_redis_memo_clear(&ctx->redis_memo);
+
+
+	sts_destroy(ctx->script);
+
+	if(ctx->redis_ctx) redisFree(ctx->redis_ctx);
+
+	stsml_redis_shards_destroy(ctx->redis_shards);
+	stsml_redis_release(ctx->redis);
+}
+
+/* the interpreter for the calling thread, NULL if a new one could not be set up */
+stsml_ctx_t *stsml_worker_ctx(stsml_ctx_t *ctx)
+{
+	stsml_workers_t *workers = ctx->workers;
+	stsml_worker_t *worker = NULL;
+
+
+	if(!workers || pthread_equal(workers->main_thread, pthread_self()))
+		return ctx;
+
+	if((worker = pthread_getspecific(workers->key)))
+		return &worker->ctx;
+
+	if(!(worker = calloc(1, sizeof(stsml_worker_t))))
+	{
+		ONION_ERROR("could not allocate worker");
+		return NULL;
+	}
+
+	ONION_INFO("starting a worker interpreter");
+
+	if(stsml_ctx_setup(&worker->ctx, &worker->script, &worker->parser, ctx->onion, workers->init_path))
+	{
+		free(worker);
+		return NULL;
+	}
+
+	worker->ctx.last_resort = ctx->last_resort;
+	worker->ctx.render_queue = ctx->render_queue;
+
+	pthread_setspecific(workers->key, worker);
+
+	pthread_mutex_lock(&workers->lock);
+
+	worker->next = workers->head;
+	workers->head = worker;
+
+	pthread_mutex_unlock(&workers->lock);
+
+	return &worker->ctx;
+}
+
+void stsml_workers_teardown(stsml_workers_t *workers)
+{
+	stsml_worker_t *worker = NULL;
+
+
+	while((worker = workers->head))
+	{
+		workers->head = worker->next;
+
+		stsml_ctx_teardown(&worker->ctx);
+		free(worker);
+	}
+
+	pthread_key_delete(workers->key);
+}
+
+/* sends commands on the script's own connection, or one borrowed from the pool. Replies that could not be read are NULL. Returns 1 if there is no connection to use */
+int stsml_redis_run(stsml_ctx_t *ctx, stsml_redis_args_t *commands, unsigned int count, redisReply **replies)
+{
+	stsml_redis_conn_t *conn = NULL;
+	int ret;
+
+
+	/* the async connection only puts this thread to sleep, other workers keep serving */
+	if(ctx->redis)
+		return stsml_redis_pipeline(ctx->redis, commands, count, replies);
+
+	if(ctx->redis_shards)
+		return stsml_redis_shards_pipeline(ctx->redis_shards, commands, count, replies);
+
+	if(ctx->redis_ctx)
+	{
+		stsml_redis_context_check(&ctx->redis_ctx);
+		return stsml_redis_context_pipeline(ctx->redis_ctx, commands, count, replies);
+	}
+
+	memset(replies, 0, count * sizeof(redisReply *));
+
+	if(!(conn = stsml_redis_pool_checkout()))
+		return 1;
+
+	ret = stsml_redis_context_pipeline(conn->context, commands, count, replies);
+
+	stsml_redis_pool_checkin(conn);
+
+	return ret;
+}
+
+static int stsml_reply_is_text(redisReply *reply)
+{
+	return reply->type == REDIS_REPLY_STRING || reply->type == REDIS_REPLY_STATUS || reply->type == REDIS_REPLY_VERB;
+}
+
+/* appends a text reply, or the text elements of an array reply joined together, straight to the response. The buffer grows once, so a cached fragment costs a single copy. Returns how many bytes were written */
+size_t stsml_ctx_write_reply(stsml_ctx_t *ctx, redisReply *reply)
+{
+	sts_value_t *response = ctx->response_str;
+	char *data = NULL, number[32];
+	size_t size = 0, i;
+
+
+	if(reply->type == REDIS_REPLY_INTEGER)
+		size = snprintf(number, sizeof(number), "%lld", reply->integer);
+	else if(stsml_reply_is_text(reply))
+		size = reply->len;
+	else if(reply->type == REDIS_REPLY_ARRAY)
+	{
+		for(i = 0; i < reply->elements; ++i)
+			if(stsml_reply_is_text(reply->element[i]))
+				size += reply->element[i]->len;
+	}
+
+	if(!size)
+		return 0;
+
+	if(!(data = realloc(response->string.data, response->string.length + size + 1)))
+	{
+		fprintf(stderr, "could not grow the response for a redis reply\n");
+		return 0;
+	}
+
+	response->string.data = data;
+
+	if(reply->type == REDIS_REPLY_INTEGER)
+		memcpy(&data[response->string.length], number, size);
+	else if(stsml_reply_is_text(reply))
+		memcpy(&data[response->string.length], reply->str, size);
+	else
+	{
+		for(i = 0, size = 0; i < reply->elements; ++i)
+		{
+			if(!stsml_reply_is_text(reply->element[i]))
+				continue;
+
+			memcpy(&data[response->string.length + size], reply->element[i]->str, reply->element[i]->len);
+			size += reply->element[i]->len;
+		}
+	}
+
+	response->string.length += size;
+	data[response->string.length] = 0x0;
+
+	return size;
+}
+
+/* gives a task pool worker a clean interpreter, nothing from the last job carries over */
+void stsml_task_worker_reset(stsml_worker_t *worker)
+{
+	/* initialize the script */
+
+	memset(&worker->script, 0, sizeof(sts_script_t));
+
+	/* set a read file callback */
+	worker->script.read_file = &read_file;
+
+	/* initialize the router */
+	worker->script.router = &server_actions;
+
+	worker->script.import_file = &stsml_import;
+
+	worker->script.userdata = &worker->ctx;
+
+	/* initialize the stsml_ctx */
+
+	memset(&worker->ctx, 0, sizeof(stsml_ctx_t));
+
+	worker->ctx.parser = &worker->parser;
+	worker->ctx.script = &worker->script;
+}
+
+void *stsml_task_worker_init(void)
+{
+	stsml_worker_t *worker = NULL;
+
+
+	if(!(worker = calloc(1, sizeof(stsml_worker_t))))
+	{
+		ONION_ERROR("could not allocate task worker");
+		return NULL;
+	}
+
+	stsml_task_worker_reset(worker);
+
+	return worker;
+}
+
+void stsml_task_worker_destroy(void *data)
+{
+	stsml_worker_t *worker = data;
+	stsml_task_ast_t *entry = NULL;
+
+
+	while((entry = worker->task_asts))
+	{
+		worker->task_asts = entry->next;
+
+		sts_ast_delete(&worker->script, entry->ast);
+		free(entry->path);
+		free(entry);
+	}
+
+	free(worker);
+}
+
+/* the parsed task script, from the worker's cache unless the file changed since it was parsed. The ast stays owned by the cache */
+sts_node_t *stsml_task_ast(stsml_worker_t *worker, char *script_path)
+{
+	stsml_task_ast_t *entry = NULL;
+	unsigned int script_text_size = 0, offset = 0, line = 0;
+	char *script_text = NULL;
+	sts_node_t *ast = NULL;
+	struct stat st;
+
+
+	if(stat(script_path, &st))
+	{
+		ONION_ERROR("could not read script '%s' in new task", script_path);
+		return NULL;
+	}
+
+	for(entry = worker->task_asts; entry; entry = entry->next)
+	{
+		if(!strcmp(entry->path, script_path))
+			break;
+	}
+
+	if(entry && entry->mtime == st.st_mtime && entry->size == st.st_size)
+		return entry->ast;
+
+
+	if(!(script_text = read_file(&worker->script, script_path, &script_text_size)))
+	{
+		ONION_ERROR("could not read script '%s' in new task", script_path);
+		return NULL;
+	}
+
+	if(!(ast = sts_parse(&worker->script, NULL, script_text, script_path, &offset, &line)))
+	{
+		ONION_ERROR("could not parse script '%s' in new task, line: %u, character offset: %u", script_path, line, offset);
+		free(script_text);
+
+		return NULL;
+	}
+
+	free(script_text);
+
+	if(!entry)
+	{
+		if(!(entry = calloc(1, sizeof(stsml_task_ast_t))) || !(entry->path = strdup(script_path)))
+		{
+			ONION_ERROR("could not cache script '%s' in task worker", script_path);
+			sts_ast_delete(&worker->script, ast);
+			free(entry);
+
+			return NULL;
+		}
+
+		entry->next = worker->task_asts;
+		worker->task_asts = entry;
+	}
+	else
+		sts_ast_delete(&worker->script, entry->ast);
+
+	entry->ast = ast;
+	entry->mtime = st.st_mtime;
+	entry->size = st.st_size;
+
+	return ast;
+}
+
+/* a value that was handed over to a channel or a future but never taken */
+void stsml_value_discard(void *data)
+{
+	sts_script_t script;
+
+
+	memset(&script, 0, sizeof(sts_script_t));
+
+	sts_value_reference_decrement(&script, data);
+}
+
+/* a task that never got to run. The args were never handed to an interpreter, so they are freed here */
+void stsml_task_discard(void *data)
+{
+	stsml_task_args_t *args_pass = data;
+	sts_script_t script;
+
+
+	memset(&script, 0, sizeof(sts_script_t));
+
+	if(args_pass->args)
+		sts_value_reference_decrement(&script, args_pass->args);
+
+	if(args_pass->future)
+		stsml_future_complete(args_pass->future, NULL);
+
+	if(args_pass->timer)
+		stsml_timer_done(args_pass->timer);
+
+	free(args_pass->script_path);
+	free(args_pass);
+}
+
+void stsml_timer_task_discard(void *data)
+{
+	stsml_timer_task_t *timer = data;
+
+
+	if(timer->args)
+		stsml_value_discard(timer->args);
+
+	if(timer->singleton)
+		stsml_singleton_release(timer->singleton);
+
+	free(timer->singleton);
+	free(timer->script_path);
+	free(timer);
+}
+
+/* called from the timer thread, queues a run of the timer's task on the pool. Returns 1 if it could not */
+int stsml_timer_task_fire(unsigned long long id, void *data)
+{
+	stsml_timer_task_t *timer = data;
+	stsml_task_args_t *task_args = NULL;
+	sts_script_t script;
+
+
+	memset(&script, 0, sizeof(sts_script_t));
+
+	if(!(task_args = calloc(1, sizeof(stsml_task_args_t))) || !(task_args->script_path = strdup(timer->script_path)))
+	{
+		ONION_ERROR("could not allocate timed task '%s'", timer->script_path);
+		free(task_args);
+
+		return 1;
+	}
+
+	if(timer->once)
+	{
+		task_args->args = timer->args;
+		timer->args = NULL;
+	}
+	else
+	{
+		task_args->timer = id;
+
+		if(!(task_args->args = sts_value_create(&script, STS_NIL)) || sts_value_copy(&script, task_args->args, timer->args, 1))
+		{
+			ONION_ERROR("could not copy the args of timed task '%s'", timer->script_path);
+			task_args->timer = 0;
+			stsml_task_discard(task_args);
+
+			return 1;
+		}
+	}
+
+	/* the timer thread never waits on the pool or runs a task itself, every other timer would be late */
+	if(stsml_executor_try_submit(&stsml_task_run, task_args))
+	{
+		ONION_WARNING("task queue is full, this run of timed task '%s' is skipped", timer->script_path);
+		task_args->timer = 0;
+		stsml_task_discard(task_args);
+
+		return 1;
+	}
+
+	return 0;
+}
+
+/* evaluates the rest of a builtin's arguments into a new array, to be handed to a task. NULL on failure */
+sts_value_t *stsml_task_args_eval(sts_script_t *script, sts_node_t *args, sts_scope_t *locals, sts_value_t **previous)
+{
+	sts_value_t *ret = NULL, *eval_value = NULL;
+
+
+	if(!(ret = sts_value_create(script, STS_ARRAY)))
+	{
+		fprintf(stderr, "could not create temporary stash of arguments\n");
+		return NULL;
+	}
+
+	for(; args; args = args->next)
+	{
+		if(!(eval_value = sts_eval(script, args, locals, previous, 1, 0)))
+		{
+			fprintf(stderr, "could not eval task argument\n");
+			sts_value_reference_decrement(script, ret);
+
+			return NULL;
+		}
+
+		sts_array_append_insert(script, ret, eval_value, ret->array.length);
+	}
+
+	return stsml_value_transfer(script, ret);
+}
+
+/* wipes a pool worker's interpreter after a job, the parsed scripts stay cached */
+void stsml_task_worker_finish(stsml_worker_t *worker)
+{
+	if(worker->ctx.redis_ctx)
+		redisFree(worker->ctx.redis_ctx);
+
+	stsml_redis_shards_destroy(worker->ctx.redis_shards);
+	stsml_redis_release(worker->ctx.redis);
+
+	/* the ast belongs to the worker's cache */
+	worker->script.script = NULL;
+
+	sts_destroy(&worker->script);
+
+	stsml_task_worker_reset(worker);
+}
+
+/* runs one task-create job on a pool worker */
+void stsml_task_run(void *worker_pass, void *data)
+{
+	stsml_worker_t *worker = worker_pass;
+	stsml_task_args_t *args_pass = data;
+	char *script_path = args_pass->script_path;
+	sts_value_t *args = args_pass->args;
+	sts_value_t *res = NULL;
+	sts_script_t *script = &worker->script;
+
+
+	ONION_INFO("starting new task from script '%s'", script_path);
+
+	if(!(script->script = stsml_task_ast(worker, script_path)))
+		goto cleanup;
+
+	/* add the arguments to the explicitly created global scope */
+
+	if(!(script->globals = sts_scope_push(script, NULL)))
+	{
+		ONION_ERROR("could not create global scope level in new task");
+		goto cleanup;
+	}
+
+
+	if(!sts_map_add_set(&script->globals->locals, "args", strlen("args"), args))
+	{
+		ONION_ERROR("could not create args in global scope level in new task");
+		goto cleanup;
+	}
+
+	/* the global scope owns the args now */
+	args = NULL;
+
+	/* evaluate script */
+
+	if(!(res = sts_eval(script, script->script, NULL, NULL, 0, 0)))
+	{
+		ONION_ERROR("could not eval script in new task");
+		goto cleanup;
+	}
+
+
+	/* cleanup */
+cleanup:
+
+	/* the return value outlives this interpreter, a failed task gives nil */
+	if(res && args_pass->future)
+		res = stsml_value_transfer(script, res);
+	else if(res)
+	{
+		sts_value_reference_decrement(script, res);
+		res = NULL;
+	}
+
+	if(args_pass->future)
+		stsml_future_complete(args_pass->future, res);
+
+	if(args_pass->timer)
+		stsml_timer_done(args_pass->timer);
+
+	if(args)
+		sts_value_reference_decrement(script, args);
+
+	free(args_pass->script_path);
+	free(args_pass);
+
+	stsml_task_worker_finish(worker);
+}
+
+/* sets up a long-lived task interpreter the same way as stsml_task_run, with the script parsed and a global scope. Returns 1 on failure */
+int stsml_task_setup(sts_script_t *script, stsml_ctx_t *ctx, stsml_parser_ctx_t *parser, char *script_path, char **script_text)
+{
+	unsigned int size = 0, offset = 0, line = 0;
+
+
+	memset(script, 0, sizeof(sts_script_t));
+
+	script->read_file = &read_file;
+	script->router = &server_actions;
+	script->import_file = &stsml_import;
+	script->userdata = ctx;
+
+	memset(ctx, 0, sizeof(stsml_ctx_t));
+
+	ctx->parser = parser;
+	ctx->script = script;
+
+	if(!(*script_text = read_file(script, script_path, &size)))
+	{
+		ONION_ERROR("could not read task script '%s'", script_path);
+		return 1;
+	}
+
+	if(!(script->script = sts_parse(script, NULL, *script_text, script_path, &offset, &line)))
+	{
+		ONION_ERROR("could not parse task script '%s'", script_path);
+		return 1;
+	}
+
+	if(!(script->globals = sts_scope_push(script, NULL)))
+	{
+		ONION_ERROR("could not create global scope level in task");
+		return 1;
+	}
+
+	return 0;
+}
+
+/* the parsed call "function $arg ...", evaluated in place of the script for every event a task handles */
+sts_node_t *stsml_task_call(sts_script_t *script, const char *function, const char *arguments, char *script_path, char **call_text)
+{
+	unsigned int offset = 0, line = 0;
+	sts_node_t *ret = NULL;
+
+
+	if(!(stsml_asprintf(call_text, "%s %s", function, arguments) >= 0 && *call_text && (ret = sts_parse(script, NULL, *call_text, script_path, &offset, &line))))
+		ONION_ERROR("could not parse the call to '%s' in task script '%s'", function, script_path);
+
+	return ret;
+}
+
+/* replaces a global of a task interpreter. The old value lives on if the script kept it somewhere */
+void stsml_task_global_set(sts_script_t *script, const char *name, sts_value_t *value)
+{
+	sts_map_row_t *row = NULL;
+
+
+	if(!value)
+	{
+		ONION_ERROR("could not create $%s in task", name);
+		return;
+	}
+
+	if((row = sts_map_get(&script->globals->locals, name, strlen(name))))
+	{
+		sts_value_reference_decrement(script, row->value);
+		row->value = value;
+	}
+	else if(!sts_map_add_set(&script->globals->locals, name, strlen(name), value))
+	{
+		ONION_ERROR("could not create $%s in task", name);
+		sts_value_reference_decrement(script, value);
+	}
+}
+
+/* a parallel-map chunk that never got to run */
+void stsml_map_chunk_discard(void *data)
+{
+	stsml_map_chunk_t *job = data;
+
+
+	stsml_value_discard(job->chunk);
+	stsml_future_complete(job->future, NULL);
+
+	free(job->script_path);
+	free(job->function);
+	free(job);
+}
+
+/* maps every item of a chunk on a pool worker. $item and $index are set for each one, then the function is called or the script runs again. An item that fails maps to nil */
+void stsml_map_chunk_run(void *worker_pass, void *data)
+{
+	stsml_worker_t *worker = worker_pass;
+	stsml_map_chunk_t *job = data;
+	sts_script_t *script = &worker->script;
+	sts_value_t *results = NULL, *res = NULL;
+	sts_node_t *call = NULL;
+	char *call_text = NULL;
+	unsigned int i;
+
+
+	if(!(script->script = stsml_task_ast(worker, job->script_path)))
+		goto cleanup;
+
+	if(!(script->globals = sts_scope_push(script, NULL)))
+	{
+		ONION_ERROR("could not create global scope level in parallel-map");
+		goto cleanup;
+	}
+
+	stsml_task_global_set(script, "item", sts_value_create(script, STS_NIL));
+	stsml_task_global_set(script, "index", sts_value_create(script, STS_NIL));
+
+	/* with a function, the script runs once per chunk to define it */
+	if(job->function)
+	{
+		if(!(res = sts_eval(script, script->script, NULL, NULL, 0, 0)))
+		{
+			ONION_ERROR("could not eval parallel-map script '%s'", job->script_path);
+			goto cleanup;
+		}
+
+		sts_value_reference_decrement(script, res);
+		res = NULL;
+
+		if(!(call = stsml_task_call(script, job->function, "$item $index", job->script_path, &call_text)))
+			goto cleanup;
+	}
+
+	if(!(results = sts_value_create(script, STS_ARRAY)))
+	{
+		ONION_ERROR("could not create parallel-map results");
+		goto cleanup;
+	}
+
+	for(i = 0; i < job->chunk->array.length; ++i)
+	{
+		/* the chunk keeps its reference too */
+		job->chunk->array.data[i]->references++;
+
+		stsml_task_global_set(script, "item", job->chunk->array.data[i]);
+		stsml_task_global_set(script, "index", sts_value_from_number(script, (double)(job->offset + i)));
+
+		if(!(res = sts_eval(script, call ? call : script->script, NULL, NULL, 0, 0)))
+		{
+			ONION_ERROR("could not map item %u in parallel-map script '%s'", job->offset + i, job->script_path);
+
+			if(!(res = sts_value_create(script, STS_NIL)))
+			{
+				sts_value_reference_decrement(script, results);
+				results = NULL;
+
+				goto cleanup;
+			}
+		}
+
+		sts_array_append_insert(script, results, res, results->array.length);
+	}
+
+	/* results often are the items themselves, those get copied before the chunk goes away */
+	results = stsml_value_transfer(script, results);
+
+
+	/* cleanup */
+cleanup:
+
+	stsml_future_complete(job->future, results);
+
+	if(call)
+		sts_ast_delete(script, call);
+
+	free(call_text);
+
+	sts_value_reference_decrement(script, job->chunk);
+
+	free(job->script_path);
+	free(job->function);
+	free(job);
+
+	stsml_task_worker_finish(worker);
+}
+
+/* splits an array the caller owns into chunks for the task pool and gathers the results back in order. A chunk the pool does not take runs right here on a worker of its own. On a pool thread every chunk runs right here, since waiting on chunks queued behind this task could deadlock the pool. NULL on failure, the array is gone either way */
+sts_value_t *stsml_parallel_map(sts_script_t *script, sts_value_t *array, const char *script_path, const char *function, unsigned int chunk_size)
+{
+	stsml_map_chunk_t *job = NULL;
+	unsigned long long *futures = NULL;
+	unsigned int *lengths = NULL, count = 0, i, j;
+	sts_value_t *ret = NULL, *result = NULL;
+	void *worker = NULL;
+	int in_pool = stsml_executor_in_worker();
+
+
+	/* about one chunk per pool thread by default */
+	if(!chunk_size)
+		chunk_size = (array->array.length + stsml_executor_workers() - 1) / stsml_executor_workers();
+
+	if(!chunk_size)
+		chunk_size = 1;
+
+	count = (array->array.length + chunk_size - 1) / chunk_size;
+
+	if(!(ret = sts_value_create(script, STS_ARRAY)) || (count && (!(futures = calloc(count, sizeof(unsigned long long))) || !(lengths = calloc(count, sizeof(unsigned int))))))
+	{
+		fprintf(stderr, "could not allocate parallel-map chunks\n");
+		goto fail;
+	}
+
+	for(i = 0; i < count; ++i)
+	{
+		if(!(job = calloc(1, sizeof(stsml_map_chunk_t))) || !(job->script_path = strdup(script_path)) || (function && !(job->function = strdup(function))) || !(job->chunk = sts_value_create(script, STS_ARRAY)))
+		{
+			fprintf(stderr, "could not allocate parallel-map chunk\n");
+
+			if(job)
+			{
+				free(job->script_path);
+				free(job->function);
+			}
+
+			free(job);
+
+			goto fail;
+		}
+
+		job->offset = i * chunk_size;
+		lengths[i] = array->array.length - job->offset < chunk_size ? array->array.length - job->offset : chunk_size;
+
+		/* the items move into the chunk, the array gives up its references */
+		for(j = 0; j < lengths[i]; ++j)
+		{
+			sts_array_append_insert(script, job->chunk, array->array.data[job->offset + j], j);
+			array->array.data[job->offset + j] = NULL;
+		}
+
+		if(!(futures[i] = job->future = stsml_future_create(&stsml_value_discard)))
+		{
+			stsml_map_chunk_discard(job);
+			goto fail;
+		}
+
+		if(in_pool || stsml_executor_submit(&stsml_map_chunk_run, job))
+		{
+			/* one worker runs all the chunks that stay here, it is wiped between them like a pool thread's */
+			if(!worker && !(worker = stsml_task_worker_init()))
+			{
+				stsml_map_chunk_discard(job);
+				goto fail;
+			}
+
+			stsml_map_chunk_run(worker, job);
+		}
+	}
+
+	if(worker)
+	{
+		stsml_task_worker_destroy(worker);
+		worker = NULL;
+	}
+
+	array->array.length = 0;
+	sts_value_reference_decrement(script, array);
+	array = NULL;
+
+	/* a failed chunk gives nil for every item in it */
+	for(i = 0; i < count; ++i)
+	{
+		stsml_future_await(futures[i], -1.0, (void **)&result);
+
+		for(j = 0; j < lengths[i]; ++j)
+		{
+			if(result && j < result->array.length)
+			{
+				sts_array_append_insert(script, ret, result->array.data[j], ret->array.length);
+				result->array.data[j] = NULL;
+			}
+			else
+				sts_array_append_insert(script, ret, sts_value_create(script, STS_NIL), ret->array.length);
+		}
+
+		if(result)
+		{
+			result->array.length = 0;
+			sts_value_reference_decrement(script, result);
+			result = NULL;
+		}
+	}
+
+	free(futures);
+	free(lengths);
+
+	return ret;
+
+
+fail:
+
+	/* chunks already queued still finish, their results expire unclaimed */
+	if(array)
+	{
+		/* items that already moved into a chunk are NULL */
+		for(j = 0, i = 0; i < array->array.length; ++i)
+		{
+			if(array->array.data[i])
+				array->array.data[j++] = array->array.data[i];
+		}
+
+		array->array.length = j;
+		sts_value_reference_decrement(script, array);
+	}
+
+	if(ret)
+		sts_value_reference_decrement(script, ret);
+
+	if(worker)
+		stsml_task_worker_destroy(worker);
+
+	free(futures);
+	free(lengths);
+
+	return NULL;
+}
+
+/* a task that sleeps on its own redis connection until a message is published. Each message sets the globals $pattern, $channel and $message, then calls the function or runs the script again */
+void *start_subscriber(stsml_subscriber_args_t *args_pass)
+{
+	static const char *names[] = {"pattern", "channel", "message"};
+	char *script_text = NULL, *call_text = NULL;
+	stsml_parser_ctx_t parser;
+	stsml_ctx_t ctx;
+	sts_value_t *res = NULL;
+	sts_node_t *call = NULL;
+	sts_script_t script;
+	redisContext *context = NULL;
+	redisReply *reply = NULL;
+	double backoff = STSML_REDIS_BACKOFF_MIN;
+	unsigned int i;
+
+
+	pthread_detach(pthread_self());
+
+	ONION_INFO("subscribing script '%s' to redis channels '%s'", args_pass->script_path, args_pass->pattern);
+
+	if(stsml_task_setup(&script, &ctx, &parser, args_pass->script_path, &script_text))
+		goto cleanup;
+
+	for(i = 0; i < 3; ++i)
+		stsml_task_global_set(&script, names[i], sts_value_create(&script, STS_NIL));
+
+	/* with a function, the script runs once to define it and the call is parsed once */
+	if(args_pass->function)
+	{
+		if(!(res = sts_eval(&script, script.script, NULL, NULL, 0, 0)))
+		{
+			ONION_ERROR("could not eval subscriber script '%s'", args_pass->script_path);
+			goto cleanup;
+		}
+
+		sts_value_reference_decrement(&script, res);
+		res = NULL;
+
+		if(!(call = stsml_task_call(&script, args_pass->function, "$pattern $channel $message", args_pass->script_path, &call_text)))
+			goto cleanup;
+	}
+
+	/* messages published while the connection is down are lost, that is how redis pub/sub works */
+	while(1)
+	{
+		if(!context)
+		{
+			if(!(context = stsml_redis_subscribe(args_pass->host, args_pass->port, args_pass->pattern)))
+			{
+				usleep((useconds_t)(backoff * 1000000.0));
+				backoff = backoff * 2.0 > STSML_REDIS_BACKOFF_MAX ? STSML_REDIS_BACKOFF_MAX : backoff * 2.0;
+
+				continue;
+			}
+
+			backoff = STSML_REDIS_BACKOFF_MIN;
+		}
+
+		if(redisGetReply(context, (void **)&reply) != REDIS_OK)
+		{
+			ONION_WARNING("lost subscriber connection for '%s': %s", args_pass->pattern, context->errstr);
+
+			redisFree(context);
+			context = NULL;
+
+			continue;
+		}
+
+		/* [pmessage pattern channel message] */
+		if((reply->type == REDIS_REPLY_ARRAY || reply->type == REDIS_REPLY_PUSH) && reply->elements == 4 && reply->element[0]->str && !strcmp(reply->element[0]->str, "pmessage"))
+		{
+			for(i = 0; i < 3; ++i)
+				stsml_task_global_set(&script, names[i], sts_value_from_nstring(&script, reply->element[i + 1]->str ? reply->element[i + 1]->str : "", reply->element[i + 1]->len));
+
+			if(!(res = sts_eval(&script, call ? call : script.script, NULL, NULL, 0, 0)))
+				ONION_ERROR("could not handle message on '%s' in subscriber script '%s'", reply->element[2]->str, args_pass->script_path);
+			else
+				sts_value_reference_decrement(&script, res);
+
+			res = NULL;
+		}
+
+		freeReplyObject(reply);
+	}
+
+
+	/* cleanup */
+cleanup:
+
+	if(call)
+		sts_ast_delete(&script, call);
+
+	if(ctx.redis_ctx)
+		redisFree(ctx.redis_ctx);
+
+	stsml_redis_shards_destroy(ctx.redis_shards);
+
+	sts_destroy(&script);
+
+	free(script_text);
+	free(call_text);
+
+	free(args_pass->script_path);
+	free(args_pass->function);
+	free(args_pass->pattern);
+	free(args_pass->host);
+	free(args_pass);
+
+	return NULL;
+}
+
+/* how many times a pending job was handed out, counting the claim that just took it. 0 if redis could not tell */
+static long long stsml_stream_deliveries(redisContext *context, stsml_stream_worker_args_t *args, const char *id)
+{
+	redisReply *reply = NULL;
+	long long ret = 0;
+
+
+	/* [[id consumer idle deliveries]] */
+	if((reply = redisCommand(context, "XPENDING %s %s %s %s 1", args->stream, args->group, id, id)))
+	{
+		if(reply->type == REDIS_REPLY_ARRAY && reply->elements == 1 && reply->element[0]->type == REDIS_REPLY_ARRAY && reply->element[0]->elements == 4 && reply->element[0]->element[3]->type == REDIS_REPLY_INTEGER)
+			ret = reply->element[0]->element[3]->integer;
+
+		freeReplyObject(reply);
+	}
+
+	return ret;
+}
+
+/* runs one job from a stream entry [id [field value ...]] and acknowledges it if the function returned. A job whose function failed stays pending and is retried once it has been idle for min_idle, until it was handed out max_deliveries times */
+static void stsml_stream_job(sts_script_t *script, sts_node_t *call, redisContext *context, stsml_stream_worker_args_t *args, redisReply *entry, int claimed)
+{
+	sts_value_t *res = NULL;
+	redisReply *reply = NULL;
+	long long deliveries = 0;
+
+
+	if(entry->type != REDIS_REPLY_ARRAY || entry->elements != 2 || !entry->element[0]->str)
+		return;
+
+	/* acknowledged without running, the entry itself stays in the stream to look at */
+	if(claimed && (deliveries = stsml_stream_deliveries(context, args, entry->element[0]->str)) > args->max_deliveries)
+		ONION_ERROR("job %s on stream '%s' was handed out %lld times and never finished, dropping it", entry->element[0]->str, args->stream, deliveries);
+	/* the entry was deleted from the stream while it was pending, there is nothing to run */
+	else if(entry->element[1]->type == REDIS_REPLY_ARRAY)
+	{
+		stsml_task_global_set(script, "job_id", sts_value_from_nstring(script, entry->element[0]->str, entry->element[0]->len));
+		stsml_task_global_set(script, "job", stsml_value_from_redis_map(script, entry->element[1]));
+
+		if(!(res = sts_eval(script, call, NULL, NULL, 0, 0)))
+		{
+			ONION_ERROR("job %s on stream '%s' failed in '%s', it will be retried", entry->element[0]->str, args->stream, args->function);
+			return;
+		}
+
+		sts_value_reference_decrement(script, res);
+	}
+
+	if((reply = redisCommand(context, "XACK %s %s %s", args->stream, args->group, entry->element[0]->str)))
+		freeReplyObject(reply);
+}
+
+/* a task that pulls jobs for a consumer group from a redis stream and calls a function for each of them */
+void *start_stream_worker(stsml_stream_worker_args_t *args_pass)
+{
+	char *script_text = NULL, *call_text = NULL, consumer[384], hostname[256];
+	stsml_parser_ctx_t parser;
+	stsml_ctx_t ctx;
+	sts_value_t *res = NULL;
+	sts_node_t *call = NULL;
+	sts_script_t script;
+	redisContext *context = NULL;
+	redisReply *reply = NULL;
+	double backoff = STSML_REDIS_BACKOFF_MIN, last_claim = 0.0;
+	char cursor[64] = "0-0";
+	size_t i;
+	int claim = 1;
+
+
+	pthread_detach(pthread_self());
+
+	/* unique per server and worker, but the same after a restart with the same flags, so a restarted worker picks its own pending jobs back up. Servers on one host tell each other apart by port or -stream_consumer */
+	if(gethostname(hostname, sizeof(hostname)))
+		strcpy(hostname, "stsml");
+
+	hostname[sizeof(hostname) - 1] = 0x0;
+	snprintf(consumer, sizeof(consumer), "%s-%s-%s-%u", hostname, stream_consumer, args_pass->script_path, args_pass->index);
+
+	ONION_INFO("stream worker %s pulling jobs from '%s' group '%s'", consumer, args_pass->stream, args_pass->group);
+
+	if(stsml_task_setup(&script, &ctx, &parser, args_pass->script_path, &script_text))
+		goto cleanup;
+
+	stsml_task_global_set(&script, "job_id", sts_value_create(&script, STS_NIL));
+	stsml_task_global_set(&script, "job", sts_value_create(&script, STS_NIL));
+
+	/* the script runs once to define the function */
+	if(!(res = sts_eval(&script, script.script, NULL, NULL, 0, 0)))
+	{
+		ONION_ERROR("could not eval stream worker script '%s'", args_pass->script_path);
+		goto cleanup;
+	}
+
+	sts_value_reference_decrement(&script, res);
+	res = NULL;
+
+	if(!(call = stsml_task_call(&script, args_pass->function, "$job_id $job", args_pass->script_path, &call_text)))
+		goto cleanup;
+
+	while(1)
+	{
+		if(!context)
+		{
+			if(!(context = stsml_redis_context_blocking(args_pass->host, args_pass->port)))
+			{
+				usleep((useconds_t)(backoff * 1000000.0));
+				backoff = backoff * 2.0 > STSML_REDIS_BACKOFF_MAX ? STSML_REDIS_BACKOFF_MAX : backoff * 2.0;
+
+				continue;
+			}
+
+			backoff = STSML_REDIS_BACKOFF_MIN;
+
+			/* every worker tries, only the first one creates the group. It starts at the beginning so jobs added before any worker ran are not skipped */
+			if((reply = redisCommand(context, "XGROUP CREATE %s %s 0 MKSTREAM", args_pass->stream, args_pass->group)))
+			{
+				if(reply->type == REDIS_REPLY_ERROR && strncmp(reply->str, "BUSYGROUP", 9))
+					ONION_ERROR("could not create consumer group '%s' on stream '%s': %s", args_pass->group, args_pass->stream, reply->str);
+
+				freeReplyObject(reply);
+			}
+		}
+
+		/* take over jobs that another consumer started and never acknowledged. A sweep over the pending list goes 100 at a time between reads, and the next one starts after min_idle */
+		if(claim && (strcmp(cursor, "0-0") || stsml_time_now() - last_claim >= args_pass->min_idle))
+		{
+			if(!strcmp(cursor, "0-0"))
+				last_claim = stsml_time_now();
+
+			if((reply = redisCommand(context, "XAUTOCLAIM %s %s %s %lld %s COUNT 100", args_pass->stream, args_pass->group, consumer, (long long)(args_pass->min_idle * 1000.0), cursor)))
+			{
+				/* [next_cursor [[id [field value ...]] ...] deleted_ids] */
+				if(reply->type == REDIS_REPLY_ERROR)
+				{
+					ONION_WARNING("could not reclaim jobs on stream '%s', XAUTOCLAIM needs redis 6.2: %s", args_pass->stream, reply->str);
+					claim = 0;
+				}
+				else if(reply->type == REDIS_REPLY_ARRAY && reply->elements >= 2 && reply->element[1]->type == REDIS_REPLY_ARRAY)
+				{
+					if(reply->element[0]->str && reply->element[0]->len < sizeof(cursor))
+						memcpy(cursor, reply->element[0]->str, reply->element[0]->len + 1);
+					else
+						strcpy(cursor, "0-0");
+
+					for(i = 0; i < reply->element[1]->elements; ++i)
+						stsml_stream_job(&script, call, context, args_pass, reply->element[1]->element[i], 1);
+				}
+
+				freeReplyObject(reply);
+			}
+		}
+
+		/* waits on the server for up to a second so reclaiming still happens on a quiet stream */
+		if(!(reply = redisCommand(context, "XREADGROUP GROUP %s %s COUNT 16 BLOCK 1000 STREAMS %s >", args_pass->group, consumer, args_pass->stream)))
+		{
+			ONION_WARNING("lost stream worker connection for '%s': %s", args_pass->stream, context->errstr);
+
+			redisFree(context);
+			context = NULL;
+
+			continue;
+		}
+
+		/* [[stream [[id [field value ...]] ...]]], nil when nothing came in */
+		if(reply->type == REDIS_REPLY_ERROR)
+		{
+			/* the stream or group was deleted, the group is made again on reconnect */
+			ONION_ERROR("could not read jobs from stream '%s': %s", args_pass->stream, reply->str);
+
+			redisFree(context);
+			context = NULL;
+
+			sleep(1);
+		}
+		else if(reply->type == REDIS_REPLY_ARRAY && reply->elements && reply->element[0]->type == REDIS_REPLY_ARRAY && reply->element[0]->elements == 2 && reply->element[0]->element[1]->type == REDIS_REPLY_ARRAY)
+		{
+			for(i = 0; i < reply->element[0]->element[1]->elements; ++i)
+				stsml_stream_job(&script, call, context, args_pass, reply->element[0]->element[1]->element[i], 0);
+		}
+
+		freeReplyObject(reply);
+	}
+
+
+	/* cleanup */
+cleanup:
+
+	if(call)
+		sts_ast_delete(&script, call);
+
+	if(ctx.redis_ctx)
+		redisFree(ctx.redis_ctx);
+
+	stsml_redis_shards_destroy(ctx.redis_shards);
+
+	sts_destroy(&script);
+
+	free(script_text);
+	free(call_text);
+
+	free(args_pass->stream);
+	free(args_pass->group);
+	free(args_pass->script_path);
+	free(args_pass->function);
+	free(args_pass->host);
+	free(args_pass);
+
+	return NULL;
+}
+
+/* the server this script talks to, for things that need a connection of their own. Returns 1 if the script has no redis server */
+int stsml_ctx_redis_endpoint(stsml_ctx_t *ctx, char **host, int *port)
+{
+	if(ctx->redis_ctx && ctx->redis_ctx->tcp.host)
+	{
+		*port = ctx->redis_ctx->tcp.port;
+		return !(*host = strdup(ctx->redis_ctx->tcp.host));
+	}
+
+	if(ctx->redis)
+		return !(*host = strdup(stsml_redis_host(ctx->redis, port)));
+
+	return stsml_redis_pool_endpoint(host, port);
+}
+
+sts_value_t *server_actions(sts_script_t *script, sts_value_t *action, sts_node_t *args, sts_scope_t *locals, sts_value_t **previous)
+{
+	sts_value_t *ret = NULL, *eval_value = NULL, *temp_value = NULL, *first_arg_value = NULL, *second_arg_value = NULL;
+	sts_node_t *arg_node = NULL;
+	FILE *proc_pipe = NULL, *file = NULL;
+	char *temp_str = NULL, *once_key = NULL;
+	unsigned int i = 0, size = 0, total = 0, temp_uint = 0;
+	size_t script_size = 0;
+	stsml_ctx_t *stsml_ctx = NULL;
+	onion_block *data;
+	stsml_task_args_t *task_args = NULL;
+	stsml_subscriber_args_t *subscriber_args = NULL;
+	stsml_stream_worker_args_t *stream_args = NULL;
+	stsml_channel_t *stsml_channel = NULL;
+	unsigned long long id_number = 0;
+	stsml_timer_task_t *timer_task = NULL;
+	pthread_t id;
+	redisReply *reply = NULL;
+	stsml_redis_args_t redis_command, *redis_commands = NULL;
+	redisReply **redis_replies = NULL;
+	double pool_settings[4];
+	stsml_cache_page_t *page = NULL;
+	stsml_cache_stats_t cache_stats;
+	stsml_redis_cache_entry_t *cache_entry = NULL;
+	stsml_redis_cache_stats_t redis_cache_stats;
+	unsigned long long cache_epoch = 0;
+	char script_sha[41], script_numkeys[24];
+	int temp_int = 0;
+
+
+
+	#define STS_ARRAY_RESIZE(value_ptr, size) do{	\
+			if(!((value_ptr)->array.data = realloc((value_ptr)->array.data, (size) * sizeof(sts_value_t **)))) {fprintf(stderr, "could not resize array");}	\
+			else (value_ptr)->array.allocated = (size);	\
+		}while(0)
+
+	#define STS_ARRAY_APPEND_INSERT(value_ptr, value_insert, position) do{	\
+			if((value_ptr)->array.length + 1 > (value_ptr)->array.allocated) STS_ARRAY_RESIZE((value_ptr), (value_ptr)->array.length + 1);	\
+			if(position >= (value_ptr)->array.length) (value_ptr)->array.data[(value_ptr)->array.length] = (value_insert);	\
+			else{ memmove(&(value_ptr)->array.data[position + 1], &(value_ptr)->array.data[position], ((value_ptr)->array.length - position) * sizeof(sts_value_t **)); (value_ptr)->array.data[position] = (value_insert);}	\
+			(value_ptr)->array.length++;	\
+		}while(0)
+
+	#define STS_STRING_ASSEMBLE(dest, current_size, middle_str, middle_size, end_str, end_size) do{	\
+			if(!((dest) = realloc((dest), (current_size) + (middle_size) + (end_size) + 1))) fprintf(stderr, "could not resize assembled string");	\
+			memmove(&(dest)[current_size], (middle_str), (middle_size));	\
+			memmove(&(dest)[current_size + (middle_size)], (end_str), (end_size));	\
+			(dest)[current_size + (middle_size) + (end_size)] = 0x0;	\
+			current_size += (middle_size) + (end_size);	\
+		}while(0)
+	
+	#ifdef STS_GOTO_JIT
+		#define GOTO_LABEL_CAT_(a, b) a ## b
+		#define GOTO_LABEL_CAT(a, b) GOTO_LABEL_CAT_(a, b)
+		#define GOTO_SET(id) do{args->label = && GOTO_LABEL_CAT(sts_jit_, __LINE__); args->router_id = (void *)(id); GOTO_LABEL_CAT(sts_jit_, __LINE__):;}while(0)
+		#define GOTO_JMP(id) do{if(args->router_id == (void *)(id)){goto *(args->label);}}while(0)
+		#define GOTO_ACTIVATED (args->router_id)
+	#else
+		#define GOTO_SET(id)
+		#define GOTO_JMP(id)
+		#define GOTO_ACTIVATED
+	#endif
+
+
+
+	stsml_ctx = script->userdata;
+
+	/* printf("=========== %p %p %s\n", script->globals, locals, action->string.data); */
+	GOTO_JMP(&server_actions);
+	if(!GOTO_ACTIVATED && action->type == STS_STRING)
+	{
+		if(!strcmp("http-write", action->string.data))
+		{
+			GOTO_SET(&server_actions);
+			if(args->next)
+			{
+				if(!(eval_value = sts_eval(script, args->next, locals, previous, 1, 0)))
+				{
+					fprintf(stderr, "could not eval argument in http-write\n");
+					return NULL;
+				}
+				else if(eval_value->type != STS_STRING)
+				{
+					fprintf(stderr, "first argument in http-write is not a string\n");
+					return NULL;
+				}
+				else
+				{
+					STS_STRING_ASSEMBLE(stsml_ctx->response_str->string.data, stsml_ctx->response_str->string.length, eval_value->string.data, eval_value->string.length, "", 0);
+
+					if(!(ret = sts_value_from_number(script, 1.0)))
+					{
+						fprintf(stderr, "could not create new ret number\n");
+
+						if(!sts_value_reference_decrement(script, eval_value))
+							fprintf(stderr, "could not refdec the argument\n");
+							
+						return NULL;
+					}
+				}
+
+				/* === */
+				if(eval_value)
+					if(!sts_value_reference_decrement(script, eval_value))
+						fprintf(stderr, "could not refdec the argument\n");
+			}
+			else
+			{
+				fprintf(stderr, "http-write requires 1 string argument\n");
+				return NULL;
+			}
+		}
+		else if(!strcmp("http-clear", action->string.data))
+		{
+			GOTO_SET(&server_actions);
+			if(stsml_ctx->response_str->string.length)
+			{
+				stsml_ctx->response_str->string.data[0] = 0x0;
+				stsml_ctx->response_str->string.length = 0;
+			}
+			
+			if(!(ret = sts_value_from_number(script, 1.0)))
+			{
+				fprintf(stderr, "could not create new ret number\n");
+				return NULL;
+			}
+		}
+		else if(!strcmp("http-method-get", action->string.data))
+		{
+			GOTO_SET(&server_actions);
+			#define METHOD_CASE(m) case OR_##m : if(!(ret = sts_value_from_string(script, #m)))	\
+			{	\
+				fprintf(stderr, "could not create new ret string\n");	\
+				return NULL;	\
+			} break
+
+			/* background renders only ever refresh GET requests */
+			switch(stsml_ctx->req ? (onion_request_get_flags(stsml_ctx->req) & OR_METHODS) : OR_GET)
+			{
 				METHOD_CASE(GET);
 				METHOD_CASE(POST);
 				METHOD_CASE(HEAD);
@@ -649,821 +2690,2482 @@ sts_value_t *server_actions(sts_script_t *script, sts_value_t *action, sts_node_
 					return NULL;
 			}
 		}
-		else if(!strcmp("http-path-get", action->string.data))
+		else if(!strcmp("http-path-get", action->string.data))
+		{
+			GOTO_SET(&server_actions);
+			if(!(ret = sts_value_from_string(script, stsml_ctx->req ? onion_request_get_path(stsml_ctx->req) : (stsml_ctx->request_path ? stsml_ctx->request_path : ""))))
+			{
+				fprintf(stderr, "could not create new ret string\n");
+				return NULL;
+			}
+		}
+		else if(!strcmp("http-body-get", action->string.data))
+		{
+			GOTO_SET(&server_actions);
+			if(stsml_ctx->req && (data = onion_request_get_data(stsml_ctx->req)))
+			{
+				if(!(ret = sts_value_from_nstring(script, onion_block_data(data), onion_block_size(data))))
+				{
+					fprintf(stderr, "could not create new ret string\n");
+					return NULL;
+				}
+			}
+			else
+			{
+				if(!(ret = sts_value_create(script, STS_NIL)))
+				{
+					fprintf(stderr, "could not create new ret nil\n");
+					return NULL;
+				}
+			}
+		}
+		else if(!strcmp("http-post-get", action->string.data))
+		{
+			GOTO_SET(&server_actions);
+			if(args->next)
+			{
+				if(!(eval_value = sts_eval(script, args->next, locals, previous, 1, 0)))
+				{
+					fprintf(stderr, "could not eval argument in http-post-get\n");
+					return NULL;
+				}
+				else if(eval_value->type != STS_STRING)
+				{
+					fprintf(stderr, "first argument in http-post-get is not a string\n");
+					return NULL;
+				}
+				else if(stsml_ctx->req && onion_request_get_post(stsml_ctx->req, eval_value->string.data))
+				{
+					if(!(ret = sts_value_from_string(script, onion_request_get_post(stsml_ctx->req, eval_value->string.data))))
+					{
+						fprintf(stderr, "could not create new ret string\n");
+
+						if(!sts_value_reference_decrement(script, eval_value))
+							fprintf(stderr, "could not refdec the argument\n");
+							
+						return NULL;
+					}
+				}
+				else
+				{
+					if(!(ret = sts_value_create(script, STS_NIL)))
+					{
+						fprintf(stderr, "could not create new ret nil\n");
+
+						if(!sts_value_reference_decrement(script, eval_value))
+							fprintf(stderr, "could not refdec the argument\n");
+							
+						return NULL;
+					}
+				}
+
+				/* === */
+				if(eval_value)
+					if(!sts_value_reference_decrement(script, eval_value))
+						fprintf(stderr, "could not refdec the argument\n");
+			}
+			else
+			{
+				fprintf(stderr, "http-post-get requires 1 string argument\n");
+				return NULL;
+			}
+		}
+		else if(!strcmp("http-query-get", action->string.data))
+		{
+			GOTO_SET(&server_actions);
+			if(args->next)
+			{
+				if(!(eval_value = sts_eval(script, args->next, locals, previous, 1, 0)))
+				{
+					fprintf(stderr, "could not eval argument in http-query-get\n");
+					return NULL;
+				}
+				else if(eval_value->type != STS_STRING)
+				{
+					fprintf(stderr, "first argument in http-query-get is not a string\n");
+					return NULL;
+				}
+				else if(stsml_query_get(stsml_ctx, eval_value->string.data))
+				{
+					if(!(ret = sts_value_from_string(script, stsml_query_get(stsml_ctx, eval_value->string.data))))
+					{
+						fprintf(stderr, "could not create new ret string\n");
+
+						if(!sts_value_reference_decrement(script, eval_value))
+							fprintf(stderr, "could not refdec the argument\n");
+							
+						return NULL;
+					}
+				}
+				else
+				{
+					if(!(ret = sts_value_create(script, STS_NIL)))
+					{
+						fprintf(stderr, "could not create new ret nil\n");
+
+						if(!sts_value_reference_decrement(script, eval_value))
+							fprintf(stderr, "could not refdec the argument\n");
+							
+						return NULL;
+					}
+				}
+
+				/* === */
+				if(eval_value)
+					if(!sts_value_reference_decrement(script, eval_value))
+						fprintf(stderr, "could not refdec the argument\n");
+			}
+			else
+			{
+				fprintf(stderr, "http-query-get requires 1 string argument\n");
+				return NULL;
+			}
+		}
+		else if(!strcmp("http-file-get", action->string.data))
+		{
+			GOTO_SET(&server_actions);
+			if(args->next)
+			{
+				if(!(eval_value = sts_eval(script, args->next, locals, previous, 1, 0)))
+				{
+					fprintf(stderr, "could not eval argument in http-file-get\n");
+					return NULL;
+				}
+				else if(eval_value->type != STS_STRING)
+				{
+					fprintf(stderr, "first argument in http-file-get is not a string\n");
+					return NULL;
+				}
+				else if(stsml_ctx->req && onion_request_get_file(stsml_ctx->req, eval_value->string.data))
+				{
+					if(!(ret = sts_value_from_string(script, onion_request_get_file(stsml_ctx->req, eval_value->string.data))))
+					{
+						fprintf(stderr, "could not create new ret string\n");
+
+						if(!sts_value_reference_decrement(script, eval_value))
+							fprintf(stderr, "could not refdec the argument\n");
+							
+						return NULL;
+					}
+				}
+				else
+				{
+					if(!(ret = sts_value_create(script, STS_NIL)))
+					{
+						fprintf(stderr, "could not create new ret nil\n");
+
+						if(!sts_value_reference_decrement(script, eval_value))
+							fprintf(stderr, "could not refdec the argument\n");
+							
+						return NULL;
+					}
+				}
+
+				/* === */
+				if(eval_value)
+					if(!sts_value_reference_decrement(script, eval_value))
+						fprintf(stderr, "could not refdec the argument\n");
+			}
+			else
+			{
+				fprintf(stderr, "http-file-get requires 1 string argument\n");
+				return NULL;
+			}
+		}
+		else if(!strcmp("http-cookie-get", action->string.data))
+		{
+			GOTO_SET(&server_actions);
+			if(args->next)
+			{
+				if(!(eval_value = sts_eval(script, args->next, locals, previous, 1, 0)))
+				{
+					fprintf(stderr, "could not eval argument in http-cookie-get\n");
+					return NULL;
+				}
+				else if(eval_value->type != STS_STRING)
+				{
+					fprintf(stderr, "first argument in http-cookie-get is not a string\n");
+					return NULL;
+				}
+				else if(stsml_ctx->req && onion_request_get_cookie(stsml_ctx->req, eval_value->string.data))
+				{
+					if(!(ret = sts_value_from_string(script, onion_request_get_cookie(stsml_ctx->req, eval_value->string.data))))
+					{
+						fprintf(stderr, "could not create new ret string\n");
+
+						if(!sts_value_reference_decrement(script, eval_value))
+							fprintf(stderr, "could not refdec the argument\n");
+							
+						return NULL;
+					}
+				}
+				else
+				{
+					if(!(ret = sts_value_create(script, STS_NIL)))
+					{
+						fprintf(stderr, "could not create new ret nil\n");
+
+						if(!sts_value_reference_decrement(script, eval_value))
+							fprintf(stderr, "could not refdec the argument\n");
+							
+						return NULL;
+					}
+				}
+
+				/* === */
+				if(eval_value)
+					if(!sts_value_reference_decrement(script, eval_value))
+						fprintf(stderr, "could not refdec the argument\n");
+			}
+			else
+			{
+				fprintf(stderr, "http-cookie-get requires 1 string argument\n");
+				return NULL;
+			}
+		}
+		/* http-cookie-put string name, string value, number time_valid(added to current time, if 0 expire now, if -1 never expire), number flags */
+		else if(!strcmp("http-cookie-put", action->string.data))
+		{
+			GOTO_SET(&server_actions);
+			if(args->next && args->next->next && args->next->next->next && args->next->next->next->next)
+			{
+				if(!(first_arg_value = sts_eval(script, args->next, locals, previous, 1, 0)))
+				{
+					fprintf(stderr, "could not eval argument in http-cookie-put\n");
+					return NULL;
+				}
+				else if(first_arg_value->type != STS_STRING)
+				{
+					fprintf(stderr, "first argument in http-cookie-put is not a string\n");
+					return NULL;
+				}
+
+				if(!(second_arg_value = sts_eval(script, args->next->next, locals, previous, 1, 0)))
+				{
+					fprintf(stderr, "could not eval argument in http-cookie-put\n");
+					return NULL;
+				}
+				else if(second_arg_value->type != STS_STRING)
+				{
+					fprintf(stderr, "second argument in http-cookie-put is not a string\n");
+					return NULL;
+				}
+
+				if(!(temp_value = sts_eval(script, args->next->next->next, locals, previous, 1, 0)))
+				{
+					fprintf(stderr, "could not eval argument in http-cookie-put\n");
+					return NULL;
+				}
+				else if(temp_value->type != STS_NUMBER)
+				{
+					fprintf(stderr, "third argument in http-cookie-put is not a number\n");
+					return NULL;
+				}
+
+				if(!(eval_value = sts_eval(script, args->next->next->next->next, locals, previous, 1, 0)))
+				{
+					fprintf(stderr, "could not eval argument in http-cookie-put\n");
+					return NULL;
+				}
+				else if(eval_value->type != STS_NUMBER)
+				{
+					fprintf(stderr, "fourth argument in http-cookie-put is not a number\n");
+					return NULL;
+				}
+
+				if(!(ret = sts_value_from_number(script, stsml_ctx->res ? (double)onion_response_add_cookie(stsml_ctx->res, first_arg_value->string.data, second_arg_value->string.data, (long)temp_value->number, NULL, NULL, (int)eval_value->number) : 0.0 )))
+				{
+					fprintf(stderr, "could not create new ret number\n");
+
+					if(!sts_value_reference_decrement(script, first_arg_value))
+						fprintf(stderr, "could not refdec the argument\n");
+					
+					if(!sts_value_reference_decrement(script, second_arg_value))
+						fprintf(stderr, "could not refdec the argument\n");
+					
+					if(!sts_value_reference_decrement(script, temp_value))
+						fprintf(stderr, "could not refdec the argument\n");
+
+					if(!sts_value_reference_decrement(script, eval_value))
+						fprintf(stderr, "could not refdec the argument\n");
+						
+					return NULL;
+				}
+
+				/* add to cleanup array because the reference needs to be +1 until the http body is sent */
+				STS_ARRAY_APPEND_INSERT(stsml_ctx->cleanup, first_arg_value, 0);
+				STS_ARRAY_APPEND_INSERT(stsml_ctx->cleanup, second_arg_value, 0);
+
+				first_arg_value->references++;
+				second_arg_value->references++;
+
+
+				if(!sts_value_reference_decrement(script, first_arg_value))
+						fprintf(stderr, "could not refdec the argument\n");
+					
+				if(!sts_value_reference_decrement(script, second_arg_value))
+					fprintf(stderr, "could not refdec the argument\n");
+				
+				if(!sts_value_reference_decrement(script, temp_value))
+					fprintf(stderr, "could not refdec the argument\n");
+
+				if(!sts_value_reference_decrement(script, eval_value))
+					fprintf(stderr, "could not refdec the argument\n");
+			}
+			else
+			{
+				fprintf(stderr, "http-cookie-put requires 2 string arguments and 2 number arguments\n");
+				return NULL;
+			}
+		}
+		else if(!strcmp("http-header-get", action->string.data))
+		{
+			GOTO_SET(&server_actions);
+			if(args->next)
+			{
+				if(!(eval_value = sts_eval(script, args->next, locals, previous, 1, 0)))
+				{
+					fprintf(stderr, "could not eval argument in http-header-get\n");
+					return NULL;
+				}
+				else if(eval_value->type != STS_STRING)
+				{
+					fprintf(stderr, "first argument in http-header-get is not a string\n");
+					return NULL;
+				}
+				else if(stsml_ctx->req && onion_request_get_header(stsml_ctx->req, eval_value->string.data))
+				{
+					if(!(ret = sts_value_from_string(script, onion_request_get_header(stsml_ctx->req, eval_value->string.data))))
+					{
+						fprintf(stderr, "could not create new ret string\n");
+
+						if(!sts_value_reference_decrement(script, eval_value))
+							fprintf(stderr, "could not refdec the argument\n");
+							
+						return NULL;
+					}
+				}
+				else
+				{
+					if(!(ret = sts_value_create(script, STS_NIL)))
+					{
+						fprintf(stderr, "could not create new ret nil\n");
+
+						if(!sts_value_reference_decrement(script, eval_value))
+							fprintf(stderr, "could not refdec the argument\n");
+							
+						return NULL;
+					}
+				}
+
+				/* === */
+				if(eval_value)
+					if(!sts_value_reference_decrement(script, eval_value))
+						fprintf(stderr, "could not refdec the argument\n");
+			}
+			else
+			{
+				fprintf(stderr, "http-header-get requires 1 string argument\n");
+				return NULL;
+			}
+		}
+		else if(!strcmp("http-header-put", action->string.data))
+		{
+			GOTO_SET(&server_actions);
+			if(args->next && args->next->next)
+			{
+				if(!(first_arg_value = sts_eval(script, args->next, locals, previous, 1, 0)))
+				{
+					fprintf(stderr, "could not eval argument in http-header-put\n");
+					return NULL;
+				}
+				else if(first_arg_value->type != STS_STRING)
+				{
+					fprintf(stderr, "first argument in http-header-put is not a string\n");
+					return NULL;
+				}
+
+				if(!(eval_value = sts_eval(script, args->next->next, locals, previous, 1, 0)))
+				{
+					fprintf(stderr, "could not eval argument in http-header-put\n");
+					return NULL;
+				}
+				else if(eval_value->type != STS_STRING)
+				{
+					fprintf(stderr, "first argument in http-header-put is not a string\n");
+					return NULL;
+				}
+
+
+				if(stsml_ctx->res)
+					onion_response_set_header(stsml_ctx->res, first_arg_value->string.data, eval_value->string.data);
+
+
+				if(!(ret = sts_value_from_number(script, 1.0)))
+				{
+					fprintf(stderr, "could not create new ret number\n");
+
+					if(!sts_value_reference_decrement(script, first_arg_value))
+						fprintf(stderr, "could not refdec the argument\n");
+
+					if(!sts_value_reference_decrement(script, eval_value))
+						fprintf(stderr, "could not refdec the argument\n");
+						
+					return NULL;
+				}
+
+				/* add to cleanup array because the reference needs to be +1 until the http body is sent */
+				STS_ARRAY_APPEND_INSERT(stsml_ctx->cleanup, first_arg_value, 0);
+				STS_ARRAY_APPEND_INSERT(stsml_ctx->cleanup, eval_value, 0);
+
+				first_arg_value->references++;
+				eval_value->references++;
+
+				/* keep the header around in case the page gets cached */
+				if(stsml_ctx->response_headers)
+				{
+					STS_ARRAY_APPEND_INSERT(stsml_ctx->response_headers, first_arg_value, stsml_ctx->response_headers->array.length);
+					STS_ARRAY_APPEND_INSERT(stsml_ctx->response_headers, eval_value, stsml_ctx->response_headers->array.length);
+
+					first_arg_value->references++;
+					eval_value->references++;
+				}
+
+
+				if(first_arg_value)
+					if(!sts_value_reference_decrement(script, first_arg_value))
+						fprintf(stderr, "could not refdec the argument\n");
+				
+				if(eval_value)
+					if(!sts_value_reference_decrement(script, eval_value))
+						fprintf(stderr, "could not refdec the argument\n");
+			}
+			else
+			{
+				fprintf(stderr, "http-header-put requires 2 string arguments\n");
+				return NULL;
+			}
+		}
+		else if(!strcmp("http-write-file", action->string.data))
+		{
+			GOTO_SET(&server_actions);
+			if(args->next)
+			{
+				if(!(eval_value = sts_eval(script, args->next, locals, previous, 1, 0)))
+				{
+					fprintf(stderr, "could not eval argument in http-write-file\n");
+					return NULL;
+				}
+				else if(eval_value->type != STS_STRING)
+				{
+					fprintf(stderr, "first argument in http-write-file is not a string\n");
+					return NULL;
+				}
+				else
+				{
+					if(sts_value_copy(script, stsml_ctx->response_file, eval_value, 0))
+					{
+						fprintf(stderr, "could not set file path response string in http-write-file\n");
+						return NULL;
+					}
+
+
+					if(!(ret = sts_value_from_number(script, 1.0)))
+					{
+						fprintf(stderr, "could not create new ret number\n");
+
+						if(!sts_value_reference_decrement(script, eval_value))
+							fprintf(stderr, "could not refdec the argument\n");
+							
+						return NULL;
+					}
+				}
+
+				/* === */
+				if(eval_value)
+					if(!sts_value_reference_decrement(script, eval_value))
+						fprintf(stderr, "could not refdec the argument\n");
+			}
+			else
+			{
+				fprintf(stderr, "http-write-file requires 1 string argument\n");
+				return NULL;
+			}
+		}
+		else if(!strcmp("http-route", action->string.data))
+		{
+			GOTO_SET(&server_actions);
+			if(args->next)
+			{
+				if(!(eval_value = sts_eval(script, args->next, locals, previous, 1, 0)))
+				{
+					fprintf(stderr, "could not eval argument in http-route\n");
+					return NULL;
+				}
+				else if(eval_value->type != STS_STRING)
+				{
+					fprintf(stderr, "first argument in http-route is not a string\n");
+					return NULL;
+				}
+				else
+				{
+					if(sts_value_copy(script, stsml_ctx->respond_redirect, eval_value, 0))
+					{
+						fprintf(stderr, "could not set file path response string in http-route\n");
+						return NULL;
+					}
+
+					if(!(ret = sts_value_from_number(script, 1.0)))
+					{
+						fprintf(stderr, "could not create new ret number\n");
+
+						if(!sts_value_reference_decrement(script, eval_value))
+							fprintf(stderr, "could not refdec the argument\n");
+							
+						return NULL;
+					}
+				}
+
+				/* === */
+				if(eval_value)
+					if(!sts_value_reference_decrement(script, eval_value))
+						fprintf(stderr, "could not refdec the argument\n");
+			}
+			else
+			{
+				fprintf(stderr, "http-route requires 1 string argument\n");
+				return NULL;
+			}
+		}
+		else if(!strcmp("http-cache", action->string.data))
+		{
+			GOTO_SET(&server_actions);
+			if(args->next)
+			{
+				if(!(first_arg_value = sts_eval(script, args->next, locals, previous, 1, 0)))
+				{
+					fprintf(stderr, "could not eval argument in http-cache\n");
+					return NULL;
+				}
+				else if(first_arg_value->type != STS_NUMBER)
+				{
+					fprintf(stderr, "first argument in http-cache is not a number\n");
+					return NULL;
+				}
+
+				if(args->next->next)
+				{
+					if(!(eval_value = sts_eval(script, args->next->next, locals, previous, 1, 0)))
+					{
+						fprintf(stderr, "could not eval argument in http-cache\n");
+						return NULL;
+					}
+					else if(eval_value->type != STS_NUMBER)
+					{
+						fprintf(stderr, "second argument in http-cache is not a number\n");
+						return NULL;
+					}
+				}
+
+
+				stsml_ctx->cache_ttl = first_arg_value->number;
+				stsml_ctx->cache_stale = eval_value ? eval_value->number : 0.0;
+
+
+				if(!(ret = sts_value_from_number(script, 1.0)))
+				{
+					fprintf(stderr, "could not create new ret number\n");
+
+					if(!sts_value_reference_decrement(script, first_arg_value))
+						fprintf(stderr, "could not refdec the argument\n");
+
+					if(eval_value)
+						if(!sts_value_reference_decrement(script, eval_value))
+							fprintf(stderr, "could not refdec the argument\n");
+
+					return NULL;
+				}
+
+				/* === */
+				if(!sts_value_reference_decrement(script, first_arg_value))
+					fprintf(stderr, "could not refdec the argument\n");
+
+				if(eval_value)
+					if(!sts_value_reference_decrement(script, eval_value))
+						fprintf(stderr, "could not refdec the argument\n");
+			}
+			else
+			{
+				fprintf(stderr, "http-cache requires at least 1 number argument\n");
+				return NULL;
+			}
+		}
+		/* http-cache-fragment string key, number ttl, number stale, string stsml_path */
+		else if(!strcmp("http-cache-fragment", action->string.data))
+		{
+			GOTO_SET(&server_actions);
+			if(args->next && args->next->next && args->next->next->next && args->next->next->next->next)
+			{
+				if(!(first_arg_value = sts_eval(script, args->next, locals, previous, 1, 0)))
+				{
+					fprintf(stderr, "could not eval argument in http-cache-fragment\n");
+					return NULL;
+				}
+				else if(first_arg_value->type != STS_STRING)
+				{
+					fprintf(stderr, "first argument in http-cache-fragment is not a string\n");
+					return NULL;
+				}
+
+				if(!(second_arg_value = sts_eval(script, args->next->next, locals, previous, 1, 0)))
+				{
+					fprintf(stderr, "could not eval argument in http-cache-fragment\n");
+					return NULL;
+				}
+				else if(second_arg_value->type != STS_NUMBER)
+				{
+					fprintf(stderr, "second argument in http-cache-fragment is not a number\n");
+					return NULL;
+				}
+
+				if(!(temp_value = sts_eval(script, args->next->next->next, locals, previous, 1, 0)))
+				{
+					fprintf(stderr, "could not eval argument in http-cache-fragment\n");
+					return NULL;
+				}
+				else if(temp_value->type != STS_NUMBER)
+				{
+					fprintf(stderr, "third argument in http-cache-fragment is not a number\n");
+					return NULL;
+				}
+
+				if(!(eval_value = sts_eval(script, args->next->next->next->next, locals, previous, 1, 0)))
+				{
+					fprintf(stderr, "could not eval argument in http-cache-fragment\n");
+					return NULL;
+				}
+				else if(eval_value->type != STS_STRING)
+				{
+					fprintf(stderr, "fourth argument in http-cache-fragment is not a string\n");
+					return NULL;
+				}
+
+
+				stsml_asprintf(&temp_str, "fragment:%s", first_arg_value->string.data);
+
+				/* without a key the fragment can still be rendered, just not cached */
+				if(!temp_str)
+				{
+					fprintf(stderr, "could not allocate the key in http-cache-fragment, rendering it uncached\n");
+					temp_int = stsml_render_fragment(stsml_ctx, NULL, eval_value->string.data, 0.0, 0.0);
+				}
+				else
+				{
+					switch(stsml_cache_get(temp_str, &page, &temp_int))
+					{
+						case STSML_CACHE_STALE:
+							if(temp_int && stsml_render_queue_push(stsml_ctx->render_queue, temp_str, eval_value->string.data, stsml_ctx->req ? onion_request_get_path(stsml_ctx->req) : stsml_ctx->request_path, stsml_ctx->req ? onion_request_get_query_dict(stsml_ctx->req) : stsml_ctx->request_query, second_arg_value->number, temp_value->number))
+								stsml_cache_abandon(temp_str);
+						/* fall through */
+						case STSML_CACHE_FRESH:
+							if(page->size)
+								STS_STRING_ASSEMBLE(stsml_ctx->response_str->string.data, stsml_ctx->response_str->string.length, page->body, page->size, "", 0);
+
+							stsml_cache_page_release(page);
+
+							temp_int = 0;
+						break;
+						default:
+							temp_int = stsml_render_fragment(stsml_ctx, temp_str, eval_value->string.data, second_arg_value->number, temp_value->number);
+					}
+				}
+
+				free(temp_str);
+
+
+				if(!(ret = sts_value_from_number(script, temp_int ? 0.0 : 1.0)))
+				{
+					fprintf(stderr, "could not create new ret number\n");
+
+					if(!sts_value_reference_decrement(script, first_arg_value))
+						fprintf(stderr, "could not refdec the argument\n");
+
+					if(!sts_value_reference_decrement(script, second_arg_value))
+						fprintf(stderr, "could not refdec the argument\n");
+
+					if(!sts_value_reference_decrement(script, temp_value))
+						fprintf(stderr, "could not refdec the argument\n");
+
+					if(!sts_value_reference_decrement(script, eval_value))
+						fprintf(stderr, "could not refdec the argument\n");
+
+					return NULL;
+				}
+
+				/* === */
+				if(!sts_value_reference_decrement(script, first_arg_value))
+					fprintf(stderr, "could not refdec the argument\n");
+
+				if(!sts_value_reference_decrement(script, second_arg_value))
+					fprintf(stderr, "could not refdec the argument\n");
+
+				if(!sts_value_reference_decrement(script, temp_value))
+					fprintf(stderr, "could not refdec the argument\n");
+
+				if(!sts_value_reference_decrement(script, eval_value))
+					fprintf(stderr, "could not refdec the argument\n");
+			}
+			else
+			{
+				fprintf(stderr, "http-cache-fragment requires a string key, 2 number arguments and an stsml path\n");
+				return NULL;
+			}
+		}
+		else if(!strcmp("http-cache-stats", action->string.data))
+		{
+			GOTO_SET(&server_actions);
+			stsml_cache_stats(&cache_stats);
+
+			if(!(ret = sts_value_create(script, STS_ARRAY)))
+			{
+				fprintf(stderr, "could not create new ret array\n");
+				return NULL;
+			}
+
+			#define CACHE_STAT_APPEND(stat) do{	\
+				if(!(temp_value = sts_value_from_number(script, (double)(stat))))	\
+				{	\
+					fprintf(stderr, "could not create new cache stat number\n");	\
+					sts_value_reference_decrement(script, ret);	\
+					return NULL;	\
+				}	\
+				sts_array_append_insert(script, ret, temp_value, ret->array.length);	\
+			}while(0)
+
+			CACHE_STAT_APPEND(cache_stats.fresh);
+			CACHE_STAT_APPEND(cache_stats.stale);
+			CACHE_STAT_APPEND(cache_stats.miss);
+			CACHE_STAT_APPEND(cache_stats.renders_saved);
+			CACHE_STAT_APPEND(cache_stats.flight_timeouts);
+		}
+		else if(!strcmp("http-etag", action->string.data))
+		{
+			GOTO_SET(&server_actions);
+			if(args->next)
+			{
+				if(!(eval_value = sts_eval(script, args->next, locals, previous, 1, 0)))
+				{
+					fprintf(stderr, "could not eval argument in http-etag\n");
+					return NULL;
+				}
+				else if(eval_value->type != STS_STRING)
+				{
+					fprintf(stderr, "first argument in http-etag is not a string\n");
+					sts_value_reference_decrement(script, eval_value);
+					return NULL;
+				}
+
+
+				/* etags are quoted strings, but nobody wants to write the quotes in a script */
+				if(eval_value->string.data[0] == '\"' || !strncmp(eval_value->string.data, "W/", 2))
+					stsml_asprintf(&stsml_ctx->etag, "%s", eval_value->string.data);
+				else
+					stsml_asprintf(&stsml_ctx->etag, "\"%s\"", eval_value->string.data);
+
+				stsml_ctx->not_modified = stsml_request_not_modified(stsml_ctx->req, stsml_ctx->etag, stsml_ctx->last_modified);
+
+				/* the client already has this page. Stopping the script here skips the rest of the render, stsml_render knows this is not an error */
+				if(stsml_ctx->not_modified)
+				{
+					if(!sts_value_reference_decrement(script, eval_value))
+						fprintf(stderr, "could not refdec the argument\n");
+
+					return NULL;
+				}
+
+
+				if(!(ret = sts_value_from_number(script, 0.0)))
+				{
+					fprintf(stderr, "could not create new ret number\n");
+
+					if(!sts_value_reference_decrement(script, eval_value))
+						fprintf(stderr, "could not refdec the argument\n");
+
+					return NULL;
+				}
+
+				/* === */
+				if(eval_value)
+					if(!sts_value_reference_decrement(script, eval_value))
+						fprintf(stderr, "could not refdec the argument\n");
+			}
+			else
+			{
+				fprintf(stderr, "http-etag requires 1 string argument\n");
+				return NULL;
+			}
+		}
+		else if(!strcmp("http-last-modified", action->string.data))
+		{
+			GOTO_SET(&server_actions);
+			if(args->next)
+			{
+				if(!(eval_value = sts_eval(script, args->next, locals, previous, 1, 0)))
+				{
+					fprintf(stderr, "could not eval argument in http-last-modified\n");
+					return NULL;
+				}
+				else if(eval_value->type != STS_NUMBER)
+				{
+					fprintf(stderr, "first argument in http-last-modified is not a number\n");
+					sts_value_reference_decrement(script, eval_value);
+					return NULL;
+				}
+
+
+				stsml_ctx->last_modified = (time_t)eval_value->number;
+				stsml_ctx->not_modified = stsml_request_not_modified(stsml_ctx->req, stsml_ctx->etag, stsml_ctx->last_modified);
+
+				/* the client already has this page. Stopping the script here skips the rest of the render, stsml_render knows this is not an error */
+				if(stsml_ctx->not_modified)
+				{
+					if(!sts_value_reference_decrement(script, eval_value))
+						fprintf(stderr, "could not refdec the argument\n");
+
+					return NULL;
+				}
+
+
+				if(!(ret = sts_value_from_number(script, 0.0)))
+				{
+					fprintf(stderr, "could not create new ret number\n");
+
+					if(!sts_value_reference_decrement(script, eval_value))
+						fprintf(stderr, "could not refdec the argument\n");
+
+					return NULL;
+				}
+
+				/* === */
+				if(eval_value)
+					if(!sts_value_reference_decrement(script, eval_value))
+						fprintf(stderr, "could not refdec the argument\n");
+			}
+			else
+			{
+				fprintf(stderr, "http-last-modified requires 1 number argument\n");
+				return NULL;
+			}
+		}
+		else if(!strcmp("redis-connect", action->string.data))
+		{
+			GOTO_SET(&server_actions);
+			if(args->next && !args->next->next)
+			{
+				if(!(first_arg_value = sts_eval(script, args->next, locals, previous, 1, 0)))
+				{
+					fprintf(stderr, "could not eval argument in redis-connect\n");
+					return NULL;
+				}
+				else if(first_arg_value->type != STS_ARRAY)
+				{
+					fprintf(stderr, "argument in redis-connect is not an array of servers\n");
+					sts_value_reference_decrement(script, first_arg_value);
+					return NULL;
+				}
+
+				/* a list of servers shards keys across all of them, each one is "host:port" or [array host port] */
+				stsml_redis_shards_destroy(stsml_ctx->redis_shards);
+				temp_int = !(stsml_ctx->redis_shards = stsml_redis_shards_create());
+
+				for(i = 0; !temp_int && i < first_arg_value->array.length; ++i)
+				{
+					temp_value = first_arg_value->array.data[i];
+
+					if(temp_value->type == STS_STRING && (temp_str = strndup(temp_value->string.data, strrchr(temp_value->string.data, ':') ? (size_t)(strrchr(temp_value->string.data, ':') - temp_value->string.data) : temp_value->string.length)))
+					{
+						temp_int = stsml_redis_shards_add(stsml_ctx->redis_shards, temp_str, strrchr(temp_value->string.data, ':') ? atoi(strrchr(temp_value->string.data, ':') + 1) : 6379);
+						free(temp_str);
+					}
+					else if(temp_value->type == STS_ARRAY && temp_value->array.length == 2 && temp_value->array.data[0]->type == STS_STRING && temp_value->array.data[1]->type == STS_NUMBER)
+						temp_int = stsml_redis_shards_add(stsml_ctx->redis_shards, temp_value->array.data[0]->string.data, (int)temp_value->array.data[1]->number);
+					else
+						fprintf(stderr, "server %u in redis-connect is not a \"host:port\" string or a [host port] array\n", i);
+				}
+
+				temp_str = NULL;
+				temp_value = NULL;
+
+				if(!(ret = sts_value_from_number(script, (!temp_int && stsml_ctx->redis_shards && stsml_redis_shards_count(stsml_ctx->redis_shards)) ? 1.0 : 0.0)))
+					fprintf(stderr, "could not create new ret number\n");
+
+				if(!sts_value_reference_decrement(script, first_arg_value))
+					fprintf(stderr, "could not refdec the argument\n");
+
+				if(!ret)
+					return NULL;
+			}
+			else if(args->next && args->next->next)
+			{
+				if(!(first_arg_value = sts_eval(script, args->next, locals, previous, 1, 0)))
+				{
+					fprintf(stderr, "could not eval first argument in redis-connect\n");
+					return NULL;
+				}
+				else if(first_arg_value->type != STS_STRING)
+				{
+					fprintf(stderr, "first argument in redis-connect is not a string\n");
+					return NULL;
+				}
+
+				if(!(eval_value = sts_eval(script, args->next->next, locals, previous, 1, 0)))
+				{
+					fprintf(stderr, "could not eval second argument in redis-connect\n");
+					return NULL;
+				}
+				else if(eval_value->type != STS_NUMBER)
+				{
+					fprintf(stderr, "second argument in redis-connect is not a number\n");
+					return NULL;
+				}
+
+
+				if(stsml_ctx->redis_ctx)
+					redisFree(stsml_ctx->redis_ctx);
+
+				/* uses the redis-timeout timeouts, a broken connection is replaced by stsml_redis_run once the server is back */
+				stsml_ctx->redis_ctx = stsml_redis_context_connect(first_arg_value->string.data, (int)eval_value->number);
+				
+
+				if(!(ret = sts_value_from_number(script, (stsml_ctx->redis_ctx && !stsml_ctx->redis_ctx->err) ? 1.0 : 0.0)))
+				{
+					fprintf(stderr, "could not create new ret number\n");
+
+					if(!sts_value_reference_decrement(script, eval_value))
+						fprintf(stderr, "could not refdec the argument\n");
+					
+					if(!sts_value_reference_decrement(script, first_arg_value))
+						fprintf(stderr, "could not refdec the argument\n");
+						
+					return NULL;
+				}
+
+				/* === */
+				if(eval_value)
+					if(!sts_value_reference_decrement(script, eval_value))
+						fprintf(stderr, "could not refdec the argument\n");
+
+				if(eval_value)
+					if(!sts_value_reference_decrement(script, first_arg_value))
+						fprintf(stderr, "could not refdec the argument\n");
+			}
+			else
+			{
+				fprintf(stderr, "redis-connect requires a host string and a port number, or an array of servers\n");
+				return NULL;
+			}
+		}
+		else if(!strcmp("redis-timeout", action->string.data))
+		{
+			GOTO_SET(&server_actions);
+			if(args->next && args->next->next)
+			{
+				if(!(first_arg_value = sts_eval(script, args->next, locals, previous, 1, 0)))
+				{
+					fprintf(stderr, "could not eval first argument in redis-timeout\n");
+					return NULL;
+				}
+
+				if(!(second_arg_value = sts_eval(script, args->next->next, locals, previous, 1, 0)))
+				{
+					fprintf(stderr, "could not eval second argument in redis-timeout\n");
+					sts_value_reference_decrement(script, first_arg_value);
+					return NULL;
+				}
+
+				if(first_arg_value->type != STS_NUMBER || second_arg_value->type != STS_NUMBER)
+				{
+					fprintf(stderr, "redis-timeout requires a connect and a command timeout in seconds\n");
+					sts_value_reference_decrement(script, first_arg_value);
+					sts_value_reference_decrement(script, second_arg_value);
+					return NULL;
+				}
+
+				/* only connections made after this use the new timeouts */
+				stsml_redis_set_timeouts(first_arg_value->number, second_arg_value->number);
+
+				if(!sts_value_reference_decrement(script, first_arg_value))
+					fprintf(stderr, "could not refdec the argument\n");
+
+				if(!sts_value_reference_decrement(script, second_arg_value))
+					fprintf(stderr, "could not refdec the argument\n");
+
+				if(!(ret = sts_value_create(script, STS_NIL)))
+				{
+					fprintf(stderr, "could not create nil value\n");
+					return NULL;
+				}
+			}
+			else
+			{
+				fprintf(stderr, "redis-timeout requires a connect and a command timeout in seconds\n");
+				return NULL;
+			}
+		}
+		else if(!strcmp("redis-connect-async", action->string.data))
+		{
+			GOTO_SET(&server_actions);
+			if(args->next && args->next->next)
+			{
+				if(!(first_arg_value = sts_eval(script, args->next, locals, previous, 1, 0)))
+				{
+					fprintf(stderr, "could not eval first argument in redis-connect-async\n");
+					return NULL;
+				}
+				else if(first_arg_value->type != STS_STRING)
+				{
+					fprintf(stderr, "first argument in redis-connect-async is not a string\n");
+					sts_value_reference_decrement(script, first_arg_value);
+					return NULL;
+				}
+
+				if(!(eval_value = sts_eval(script, args->next->next, locals, previous, 1, 0)))
+				{
+					fprintf(stderr, "could not eval second argument in redis-connect-async\n");
+					sts_value_reference_decrement(script, first_arg_value);
+					return NULL;
+				}
+				else if(eval_value->type != STS_NUMBER)
+				{
+					fprintf(stderr, "second argument in redis-connect-async is not a number\n");
+					sts_value_reference_decrement(script, first_arg_value);
+					sts_value_reference_decrement(script, eval_value);
+					return NULL;
+				}
+
+
+				/* workers that connect to the same server share one connection */
+				stsml_redis_release(stsml_ctx->redis);
+
+				if(!(stsml_ctx->redis = stsml_redis_connect(first_arg_value->string.data, (int)eval_value->number)))
+					fprintf(stderr, "could not connect to redis server at '%s'\n", first_arg_value->string.data);
+
+
+				if(!(ret = sts_value_from_number(script, stsml_ctx->redis ? 1.0 : 0.0)))
+					fprintf(stderr, "could not create new ret number\n");
+
+				if(!sts_value_reference_decrement(script, eval_value))
+					fprintf(stderr, "could not refdec the argument\n");
+
+				if(!sts_value_reference_decrement(script, first_arg_value))
+					fprintf(stderr, "could not refdec the argument\n");
+
+				if(!ret)
+					return NULL;
+			}
+			else
+			{
+				fprintf(stderr, "redis-connect-async requires a host string and a port number\n");
+				return NULL;
+			}
+		}
+		else if(!strcmp("redis-pool", action->string.data))
+		{
+			GOTO_SET(&server_actions);
+			if(args->next && args->next->next)
+			{
+				if(!(first_arg_value = sts_eval(script, args->next, locals, previous, 1, 0)))
+				{
+					fprintf(stderr, "could not eval first argument in redis-pool\n");
+					return NULL;
+				}
+				else if(first_arg_value->type != STS_STRING)
+				{
+					fprintf(stderr, "first argument in redis-pool is not a string\n");
+					sts_value_reference_decrement(script, first_arg_value);
+					return NULL;
+				}
+
+				/* port, then the optional min, max and checkout timeout */
+				pool_settings[0] = 6379.0;
+				pool_settings[1] = STSML_REDIS_POOL_MIN;
+				pool_settings[2] = STSML_REDIS_POOL_MAX;
+				pool_settings[3] = STSML_REDIS_POOL_TIMEOUT;
+
+				for(arg_node = args->next->next, i = 0; arg_node && i < 4; arg_node = arg_node->next, ++i)
+				{
+					if(!(eval_value = sts_eval(script, arg_node, locals, previous, 1, 0)))
+					{
+						fprintf(stderr, "could not eval argument in redis-pool\n");
+						sts_value_reference_decrement(script, first_arg_value);
+						return NULL;
+					}
+
+					if(eval_value->type == STS_NUMBER)
+						pool_settings[i] = eval_value->number;
+					else
+						fprintf(stderr, "argument %u in redis-pool is not a number, using the default\n", i + 2);
+
+					if(!sts_value_reference_decrement(script, eval_value))
+						fprintf(stderr, "could not refdec the argument\n");
+				}
+
+				/* every worker runs the init script, only the first call that reaches the server sets the pool up */
+				if((temp_int = stsml_redis_pool_init(first_arg_value->string.data, (int)pool_settings[0], (unsigned int)pool_settings[1], (unsigned int)pool_settings[2], pool_settings[3], STSML_REDIS_POOL_HEALTH_INTERVAL)))
+					fprintf(stderr, "redis-pool could not connect to %s:%d\n", first_arg_value->string.data, (int)pool_settings[0]);
+
+				if(!(ret = sts_value_from_number(script, temp_int ? 0.0 : 1.0)))
+					fprintf(stderr, "could not create new ret number\n");
+
+				if(!sts_value_reference_decrement(script, first_arg_value))
+					fprintf(stderr, "could not refdec the argument\n");
+
+				if(!ret)
+					return NULL;
+			}
+			else
+			{
+				fprintf(stderr, "redis-pool requires a host string and a port number\n");
+				return NULL;
+			}
+		}
+		else if(!strcmp("redis-cache", action->string.data))
 		{
 			GOTO_SET(&server_actions);
-			if(!(ret = sts_value_from_string(script, onion_request_get_path(stsml_ctx->req))))
+			if(args->next && args->next->next && args->next->next->next)
 			{
-				fprintf(stderr, "could not create new ret string\n");
+				if(!(first_arg_value = sts_eval(script, args->next, locals, previous, 1, 0)))
+				{
+					fprintf(stderr, "could not eval first argument in redis-cache\n");
+					return NULL;
+				}
+				else if(first_arg_value->type != STS_STRING)
+				{
+					fprintf(stderr, "first argument in redis-cache is not a string\n");
+					sts_value_reference_decrement(script, first_arg_value);
+					return NULL;
+				}
+
+				/* port, then the memory cap in bytes */
+				pool_settings[0] = 6379.0;
+				pool_settings[1] = 0.0;
+
+				for(arg_node = args->next->next, i = 0; arg_node && i < 2; arg_node = arg_node->next, ++i)
+				{
+					if(!(eval_value = sts_eval(script, arg_node, locals, previous, 1, 0)))
+					{
+						fprintf(stderr, "could not eval argument in redis-cache\n");
+						sts_value_reference_decrement(script, first_arg_value);
+						return NULL;
+					}
+
+					if(eval_value->type == STS_NUMBER)
+						pool_settings[i] = eval_value->number;
+					else
+						fprintf(stderr, "argument %u in redis-cache is not a number\n", i + 2);
+
+					if(!sts_value_reference_decrement(script, eval_value))
+						fprintf(stderr, "could not refdec the argument\n");
+				}
+
+				/* every worker runs the init script, only the first call starts tracking */
+				if(!(ret = sts_value_from_number(script, pool_settings[1] > 0.0 && !stsml_redis_cache_init(first_arg_value->string.data, (int)pool_settings[0], (size_t)pool_settings[1]) ? 1.0 : 0.0)))
+					fprintf(stderr, "could not create new ret number\n");
+
+				if(!sts_value_reference_decrement(script, first_arg_value))
+					fprintf(stderr, "could not refdec the argument\n");
+
+				if(!ret)
+					return NULL;
+			}
+			else
+			{
+				fprintf(stderr, "redis-cache requires a host string, a port number and a size in bytes\n");
 				return NULL;
 			}
 		}
-		else if(!strcmp("http-body-get", action->string.data))
+		else if(!strcmp("redis-cache-pattern", action->string.data))
 		{
 			GOTO_SET(&server_actions);
-			if((data = onion_request_get_data(stsml_ctx->req)))
+			if(args->next && args->next->next)
 			{
-				if(!(ret = sts_value_from_nstring(script, onion_block_data(data), onion_block_size(data))))
+				if(!(first_arg_value = sts_eval(script, args->next, locals, previous, 1, 0)))
 				{
-					fprintf(stderr, "could not create new ret string\n");
+					fprintf(stderr, "could not eval first argument in redis-cache-pattern\n");
+					return NULL;
+				}
+				else if(first_arg_value->type != STS_STRING)
+				{
+					fprintf(stderr, "first argument in redis-cache-pattern is not a string\n");
+					sts_value_reference_decrement(script, first_arg_value);
+					return NULL;
+				}
+
+				if(!(second_arg_value = sts_eval(script, args->next->next, locals, previous, 1, 0)))
+				{
+					fprintf(stderr, "could not eval second argument in redis-cache-pattern\n");
+					sts_value_reference_decrement(script, first_arg_value);
+					return NULL;
+				}
+				else if(second_arg_value->type != STS_NUMBER)
+				{
+					fprintf(stderr, "second argument in redis-cache-pattern is not a number\n");
+					sts_value_reference_decrement(script, first_arg_value);
+					sts_value_reference_decrement(script, second_arg_value);
 					return NULL;
 				}
+
+				if(!(ret = sts_value_from_number(script, stsml_redis_cache_pattern(first_arg_value->string.data, second_arg_value->number) ? 0.0 : 1.0)))
+					fprintf(stderr, "could not create new ret number\n");
+
+				if(!sts_value_reference_decrement(script, first_arg_value))
+					fprintf(stderr, "could not refdec the argument\n");
+
+				if(!sts_value_reference_decrement(script, second_arg_value))
+					fprintf(stderr, "could not refdec the argument\n");
+
+				if(!ret)
+					return NULL;
 			}
 			else
 			{
-				if(!(ret = sts_value_create(script, STS_NIL)))
+				fprintf(stderr, "redis-cache-pattern requires a key pattern string and a ttl number\n");
+				return NULL;
+			}
+		}
+		else if(!strcmp("redis-cache-stats", action->string.data))
+		{
+			GOTO_SET(&server_actions);
+			stsml_redis_cache_stats(&redis_cache_stats);
+
+			if(!(ret = sts_value_create(script, STS_ARRAY)))
+			{
+				fprintf(stderr, "could not create new ret array\n");
+				return NULL;
+			}
+
+			CACHE_STAT_APPEND(redis_cache_stats.hits);
+			CACHE_STAT_APPEND(redis_cache_stats.misses);
+			CACHE_STAT_APPEND(redis_cache_stats.invalidations);
+			CACHE_STAT_APPEND(redis_cache_stats.evictions);
+			CACHE_STAT_APPEND(redis_cache_stats.bytes);
+		}
+		else if(!strcmp("redis-script-load", action->string.data))
+		{
+			GOTO_SET(&server_actions);
+			if(args->next && args->next->next)
+			{
+				if(!(first_arg_value = sts_eval(script, args->next, locals, previous, 1, 0)))
 				{
-					fprintf(stderr, "could not create new ret nil\n");
+					fprintf(stderr, "could not eval first argument in redis-script-load\n");
+					return NULL;
+				}
+				else if(first_arg_value->type != STS_STRING)
+				{
+					fprintf(stderr, "first argument in redis-script-load is not a string\n");
+					sts_value_reference_decrement(script, first_arg_value);
+					return NULL;
+				}
+
+				if(!(second_arg_value = sts_eval(script, args->next->next, locals, previous, 1, 0)))
+				{
+					fprintf(stderr, "could not eval second argument in redis-script-load\n");
+					sts_value_reference_decrement(script, first_arg_value);
+					return NULL;
+				}
+				else if(second_arg_value->type != STS_STRING)
+				{
+					fprintf(stderr, "second argument in redis-script-load is not a string\n");
+					sts_value_reference_decrement(script, first_arg_value);
+					sts_value_reference_decrement(script, second_arg_value);
+					return NULL;
+				}
+
+				temp_int = stsml_redis_script_load(first_arg_value->string.data, second_arg_value->string.data, second_arg_value->string.length, script_sha);
+
+				/* loading it now catches lua errors at startup. Without a connection it is loaded by the first redis-script call instead */
+				if(!temp_int)
+				{
+					stsml_redis_args_init(&redis_command);
+					stsml_redis_args_push(&redis_command, "SCRIPT", 6, 0);
+					stsml_redis_args_push(&redis_command, "LOAD", 4, 0);
+					stsml_redis_args_push(&redis_command, second_arg_value->string.data, second_arg_value->string.length, 0);
+
+					stsml_redis_run(stsml_ctx, &redis_command, 1, &reply);
+
+					if(reply && reply->type == REDIS_REPLY_ERROR)
+					{
+						fprintf(stderr, "could not load redis script %s: %s\n", first_arg_value->string.data, reply->str);
+						temp_int = 1;
+					}
+
+					if(reply)
+						freeReplyObject(reply);
+
+					stsml_redis_args_free(&redis_command);
+				}
+
+				if(!(ret = sts_value_from_number(script, temp_int ? 0.0 : 1.0)))
+					fprintf(stderr, "could not create new ret number\n");
+
+				if(!sts_value_reference_decrement(script, first_arg_value))
+					fprintf(stderr, "could not refdec the argument\n");
+
+				if(!sts_value_reference_decrement(script, second_arg_value))
+					fprintf(stderr, "could not refdec the argument\n");
+
+				if(!ret)
+					return NULL;
+			}
+			else
+			{
+				fprintf(stderr, "redis-script-load requires a name string and a lua source string\n");
+				return NULL;
+			}
+		}
+		else if(!strcmp("redis-script", action->string.data))
+		{
+			GOTO_SET(&server_actions);
+			if(args->next && args->next->next)
+			{
+				if(!(first_arg_value = sts_eval(script, args->next, locals, previous, 1, 0)))
+				{
+					fprintf(stderr, "could not eval first argument in redis-script\n");
+					return NULL;
+				}
+				else if(first_arg_value->type != STS_STRING || stsml_redis_script_get(first_arg_value->string.data, script_sha, NULL, NULL))
+				{
+					fprintf(stderr, "first argument in redis-script is not the name of a script from redis-script-load\n");
+					sts_value_reference_decrement(script, first_arg_value);
+					return NULL;
+				}
+
+				if(!(temp_value = sts_value_create(script, STS_ARRAY)))
+				{
+					fprintf(stderr, "could not create temporary stash of arguments\n");
+					sts_value_reference_decrement(script, first_arg_value);
+					return NULL;
+				}
+
+				/* EVALSHA sha numkeys keys... args..., the key count is filled in once the keys are spread */
+				stsml_redis_args_init(&redis_command);
+				stsml_redis_args_push(&redis_command, "EVALSHA", 7, 0);
+				stsml_redis_args_push(&redis_command, script_sha, 40, 0);
+				stsml_redis_args_push(&redis_command, "0", 1, 0);
+
+				for(args = args->next->next, i = 0; args; args = args->next, ++i)
+				{
+					if(!(eval_value = sts_eval(script, args, locals, previous, 1, 0)))
+					{
+						fprintf(stderr, "could not eval argument in redis-script\n");
+						stsml_redis_args_free(&redis_command);
+						sts_value_reference_decrement(script, temp_value);
+						sts_value_reference_decrement(script, first_arg_value);
+						return NULL;
+					}
+
+					STS_ARRAY_APPEND_INSERT(temp_value, eval_value, temp_value->array.length);
+
+					if(stsml_redis_args_append(&redis_command, eval_value))
+					{
+						fprintf(stderr, "could not add argument in redis-script\n");
+						stsml_redis_args_free(&redis_command);
+						sts_value_reference_decrement(script, temp_value);
+						sts_value_reference_decrement(script, first_arg_value);
+						return NULL;
+					}
+
+					/* the first argument holds the keys, a string for one key or an array for several */
+					if(!i)
+						stsml_redis_args_set(&redis_command, 2, script_numkeys, snprintf(script_numkeys, sizeof(script_numkeys), "%d", redis_command.argc - 3), 0);
+				}
+
+				/* scripts can write, so this page forgets what it has read */
+				stsml_redis_memo_clear(&stsml_ctx->redis_memo);
+
+				stsml_redis_run(stsml_ctx, &redis_command, 1, &reply);
+
+				/* the server was restarted or flushed its scripts, EVAL loads it again and later calls go back to EVALSHA */
+				if(reply && reply->type == REDIS_REPLY_ERROR && !strncmp(reply->str, "NOSCRIPT", 8) && !stsml_redis_script_get(first_arg_value->string.data, script_sha, &temp_str, &script_size))
+				{
+					freeReplyObject(reply);
+					reply = NULL;
+
+					stsml_redis_args_set(&redis_command, 0, "EVAL", 4, 0);
+					stsml_redis_args_set(&redis_command, 1, temp_str, script_size, 1);
+
+					stsml_redis_run(stsml_ctx, &redis_command, 1, &reply);
+				}
+
+				if(reply)
+				{
+					if(reply->type == REDIS_REPLY_ERROR)
+						fprintf(stderr, "redis-script %s failed: %s\n", first_arg_value->string.data, reply->str);
+
+					if(!(ret = stsml_value_from_redis(script, reply)))
+						fprintf(stderr, "could not create value from redis reply\n");
+
+					freeReplyObject(reply);
+				}
+				else if(!(ret = sts_value_create(script, STS_NIL)))
+					fprintf(stderr, "reply error in redis-script\n");
+
+				stsml_redis_args_free(&redis_command);
+
+				if(!sts_value_reference_decrement(script, temp_value))
+					fprintf(stderr, "could not clean up redis-script argument stash\n");
+
+				if(!sts_value_reference_decrement(script, first_arg_value))
+					fprintf(stderr, "could not refdec the argument\n");
+
+				if(!ret)
 					return NULL;
+			}
+			else
+			{
+				fprintf(stderr, "redis-script requires a script name and its keys\n");
+				return NULL;
+			}
+		}
+		else if(!strcmp("redis-pipeline", action->string.data))
+		{
+			GOTO_SET(&server_actions);
+			if(args->next)
+			{
+				if(!(first_arg_value = sts_eval(script, args->next, locals, previous, 1, 0)))
+				{
+					fprintf(stderr, "could not eval argument in redis-pipeline\n");
+					return NULL;
+				}
+				else if(first_arg_value->type != STS_ARRAY)
+				{
+					fprintf(stderr, "argument in redis-pipeline is not an array of commands\n");
+					sts_value_reference_decrement(script, first_arg_value);
+					return NULL;
+				}
+
+				temp_uint = first_arg_value->array.length;
+
+				if(!(redis_commands = calloc(temp_uint + 1, sizeof(stsml_redis_args_t))) || !(redis_replies = calloc(temp_uint + 1, sizeof(redisReply *))))
+				{
+					fprintf(stderr, "could not allocate redis-pipeline commands\n");
+
+					free(redis_commands);
+					sts_value_reference_decrement(script, first_arg_value);
+
+					return NULL;
+				}
+
+				/* the arguments point into the commands array, which is held until every reply is in */
+				for(i = 0; i < temp_uint; ++i)
+				{
+					stsml_redis_args_init(&redis_commands[i]);
+
+					if(first_arg_value->array.data[i]->type != STS_ARRAY)
+					{
+						fprintf(stderr, "command %u in redis-pipeline is not an array, it will return nil\n", i);
+						continue;
+					}
+
+					for(size = 0; size < first_arg_value->array.data[i]->array.length; ++size)
+						stsml_redis_args_append(&redis_commands[i], first_arg_value->array.data[i]->array.data[size]);
+				}
+
+				for(i = 0; i < temp_uint; ++i)
+				{
+					if(!stsml_redis_readonly(&redis_commands[i]))
+						stsml_redis_memo_clear(&stsml_ctx->redis_memo);
+				}
+
+				stsml_redis_run(stsml_ctx, redis_commands, temp_uint, redis_replies);
+
+
+				if(!(ret = sts_value_create(script, STS_ARRAY)))
+					fprintf(stderr, "could not create redis-pipeline results\n");
+
+				for(i = 0; i < temp_uint; ++i)
+				{
+					if(ret)
+					{
+						if(!(eval_value = redis_replies[i] ? stsml_value_from_redis(script, redis_replies[i]) : sts_value_create(script, STS_NIL)))
+						{
+							fprintf(stderr, "could not create value from redis reply\n");
+
+							sts_value_reference_decrement(script, ret);
+							ret = NULL;
+						}
+						else
+							STS_ARRAY_APPEND_INSERT(ret, eval_value, ret->array.length);
+					}
+
+					if(redis_replies[i])
+						freeReplyObject(redis_replies[i]);
+
+					stsml_redis_args_free(&redis_commands[i]);
 				}
+
+				free(redis_commands);
+				free(redis_replies);
+
+				redis_commands = NULL;
+				redis_replies = NULL;
+
+				if(!sts_value_reference_decrement(script, first_arg_value))
+					fprintf(stderr, "could not refdec the argument\n");
+
+				if(!ret)
+					return NULL;
+			}
+			else
+			{
+				fprintf(stderr, "redis-pipeline requires an array of commands\n");
+				return NULL;
 			}
 		}
-		else if(!strcmp("http-post-get", action->string.data))
+		else if(!strcmp("redis-hashmap", action->string.data))
 		{
 			GOTO_SET(&server_actions);
 			if(args->next)
 			{
-				if(!(eval_value = sts_eval(script, args->next, locals, previous, 1, 0)))
+				if(!(first_arg_value = sts_eval(script, args->next, locals, previous, 1, 0)))
 				{
-					fprintf(stderr, "could not eval argument in http-post-get\n");
+					fprintf(stderr, "could not eval first argument in redis-hashmap\n");
+					return NULL;
+				}
+				else if(first_arg_value->type != STS_ARRAY)
+				{
+					fprintf(stderr, "first argument in redis-hashmap is not a hashmap\n");
+					sts_value_reference_decrement(script, first_arg_value);
 					return NULL;
 				}
-				else if(eval_value->type != STS_STRING)
+
+				if(!(ret = sts_value_create(script, STS_ARRAY)))
 				{
-					fprintf(stderr, "first argument in http-post-get is not a string\n");
+					fprintf(stderr, "could not create new ret array\n");
+					sts_value_reference_decrement(script, first_arg_value);
 					return NULL;
 				}
-				else if(onion_request_get_post(stsml_ctx->req, eval_value->string.data))
+
+				/* [hash key value] rows become [key value] pairs, which spread into field/value arguments */
+				for(i = 0; i < first_arg_value->array.length; ++i)
 				{
-					if(!(ret = sts_value_from_string(script, onion_request_get_post(stsml_ctx->req, eval_value->string.data))))
-					{
-						fprintf(stderr, "could not create new ret string\n");
+					temp_value = first_arg_value->array.data[i];
 
-						if(!sts_value_reference_decrement(script, eval_value))
-							fprintf(stderr, "could not refdec the argument\n");
-							
+					if(temp_value->type != STS_ARRAY || temp_value->array.length != 3 || temp_value->array.data[1]->type != STS_STRING)
+					{
+						fprintf(stderr, "row %u in redis-hashmap is not a [hash key value] row\n", i);
+						sts_value_reference_decrement(script, first_arg_value);
+						sts_value_reference_decrement(script, ret);
 						return NULL;
 					}
-				}
-				else
-				{
-					if(!(ret = sts_value_create(script, STS_NIL)))
-					{
-						fprintf(stderr, "could not create new ret nil\n");
 
-						if(!sts_value_reference_decrement(script, eval_value))
-							fprintf(stderr, "could not refdec the argument\n");
-							
+					if(!(eval_value = sts_value_create(script, STS_ARRAY)))
+					{
+						fprintf(stderr, "could not create redis-hashmap pair\n");
+						sts_value_reference_decrement(script, first_arg_value);
+						sts_value_reference_decrement(script, ret);
 						return NULL;
 					}
+
+					temp_value->array.data[1]->references++;
+					temp_value->array.data[2]->references++;
+
+					sts_array_append_insert(script, eval_value, temp_value->array.data[1], 0);
+					sts_array_append_insert(script, eval_value, temp_value->array.data[2], 1);
+					sts_array_append_insert(script, ret, eval_value, ret->array.length);
 				}
 
-				/* === */
-				if(eval_value)
-					if(!sts_value_reference_decrement(script, eval_value))
-						fprintf(stderr, "could not refdec the argument\n");
+				temp_value = NULL;
+
+				if(!sts_value_reference_decrement(script, first_arg_value))
+					fprintf(stderr, "could not refdec the argument\n");
 			}
 			else
 			{
-				fprintf(stderr, "http-post-get requires 1 string argument\n");
+				fprintf(stderr, "redis-hashmap requires a hashmap\n");
 				return NULL;
 			}
 		}
-		else if(!strcmp("http-query-get", action->string.data))
+		else if(!strcmp("redis", action->string.data) || !strcmp("redis-map", action->string.data) || !strcmp("redis-write", action->string.data))
 		{
 			GOTO_SET(&server_actions);
 			if(args->next)
 			{
-				if(!(eval_value = sts_eval(script, args->next, locals, previous, 1, 0)))
-				{
-					fprintf(stderr, "could not eval argument in http-query-get\n");
-					return NULL;
-				}
-				else if(eval_value->type != STS_STRING)
+				/* the arguments point into the evaluated values, so they are stashed until the reply is in */
+
+				if(!(temp_value = sts_value_create(script, STS_ARRAY)))
 				{
-					fprintf(stderr, "first argument in http-query-get is not a string\n");
+					fprintf(stderr, "could not create temporary stash of arguments\n");
 					return NULL;
 				}
-				else if(onion_request_get_query(stsml_ctx->req, eval_value->string.data))
+
+				stsml_redis_args_init(&redis_command);
+
+				while((args = args->next))
 				{
-					if(!(ret = sts_value_from_string(script, onion_request_get_query(stsml_ctx->req, eval_value->string.data))))
+					if(!(eval_value = sts_eval(script, args, locals, previous, 1, 0)))
 					{
-						fprintf(stderr, "could not create new ret string\n");
+						fprintf(stderr, "could not eval argument in redis\n");
+						stsml_redis_args_free(&redis_command);
+						sts_value_reference_decrement(script, temp_value);
+						return NULL;
+					}
 
-						if(!sts_value_reference_decrement(script, eval_value))
-							fprintf(stderr, "could not refdec the argument\n");
-							
+					STS_ARRAY_APPEND_INSERT(temp_value, eval_value, temp_value->array.length);
+
+					/* arrays are spread into arguments, so a whole HSET or ZADD can be built in script as one command */
+					if(stsml_redis_args_append(&redis_command, eval_value))
+					{
+						fprintf(stderr, "could not add argument in redis\n");
+						stsml_redis_args_free(&redis_command);
+						sts_value_reference_decrement(script, temp_value);
 						return NULL;
 					}
 				}
+
+
+				/* reads of keys under a redis-cache-pattern are answered from memory until redis says they changed. The tracking connection only watches one server, so sharded reads never use the cache */
+				/* the same read twice in one page only goes out once, a write forgets what this page has read */
+				temp_int = 0;
+
+				if((reply = stsml_redis_memo_get(&stsml_ctx->redis_memo, &redis_command)))
+					temp_int = 1;
+				else if(!stsml_ctx->redis_shards && (cache_entry = stsml_redis_cache_get(&redis_command, &cache_epoch)))
+					reply = stsml_redis_cache_entry_reply(cache_entry);
 				else
 				{
-					if(!(ret = sts_value_create(script, STS_NIL)))
-					{
-						fprintf(stderr, "could not create new ret nil\n");
+					stsml_redis_run(stsml_ctx, &redis_command, 1, &reply);
 
-						if(!sts_value_reference_decrement(script, eval_value))
-							fprintf(stderr, "could not refdec the argument\n");
-							
-						return NULL;
-					}
+					if(reply && !stsml_ctx->redis_shards && (cache_entry = stsml_redis_cache_put(&redis_command, reply, cache_epoch)))
+						reply = stsml_redis_cache_entry_reply(cache_entry);
+					else if(reply)
+						temp_int = !stsml_redis_memo_put(&stsml_ctx->redis_memo, &redis_command, reply);
+				}
+
+				if(reply)
+				{
+					/* redis-map turns HGETALL style replies into [key value] pairs, redis-write skips making values at all */
+					if(!strcmp("redis-write", action->string.data))
+						ret = sts_value_from_number(script, (double)stsml_ctx_write_reply(stsml_ctx, reply));
+					else if(!strcmp("redis-map", action->string.data))
+						ret = stsml_value_from_redis_map(script, reply);
+					else
+						ret = stsml_value_from_redis(script, reply);
+
+					if(!ret)
+						fprintf(stderr, "could not create value from redis reply\n");
+
+					/* memoized replies are freed when the page is done */
+					if(cache_entry)
+						stsml_redis_cache_release(cache_entry);
+					else if(!temp_int)
+						freeReplyObject(reply);
+
+					cache_entry = NULL;
 				}
+				else if(!(ret = sts_value_create(script, STS_NIL)))
+					fprintf(stderr, "reply error in redis action\n");
+
+				/* cleanup */
+				stsml_redis_args_free(&redis_command);
+
+				if(!sts_value_reference_decrement(script, temp_value))
+					fprintf(stderr, "could not clean up redis argument stash\n");
+
+				if(!ret)
+					return NULL;
 
 				/* === */
-				if(eval_value)
-					if(!sts_value_reference_decrement(script, eval_value))
-						fprintf(stderr, "could not refdec the argument\n");
 			}
 			else
 			{
-				fprintf(stderr, "http-query-get requires 1 string argument\n");
+				fprintf(stderr, "redis requires at least 1 argument\n");
 				return NULL;
 			}
 		}
-		else if(!strcmp("http-file-get", action->string.data))
+		else if(!strcmp("redis-subscribe", action->string.data))
 		{
 			GOTO_SET(&server_actions);
-			if(args->next)
+			if(args->next && args->next->next)
 			{
-				if(!(eval_value = sts_eval(script, args->next, locals, previous, 1, 0)))
-				{
-					fprintf(stderr, "could not eval argument in http-file-get\n");
-					return NULL;
-				}
-				else if(eval_value->type != STS_STRING)
+				if(!(subscriber_args = calloc(1, sizeof(stsml_subscriber_args_t))))
 				{
-					fprintf(stderr, "first argument in http-file-get is not a string\n");
+					fprintf(stderr, "could not create subscriber args\n");
 					return NULL;
 				}
-				else if(onion_request_get_file(stsml_ctx->req, eval_value->string.data))
+
+				/* pattern, script path and the optional function name */
+				for(args = args->next, i = 0; args && i < 3; args = args->next, ++i)
 				{
-					if(!(ret = sts_value_from_string(script, onion_request_get_file(stsml_ctx->req, eval_value->string.data))))
+					if(!(eval_value = sts_eval(script, args, locals, previous, 1, 0)))
 					{
-						fprintf(stderr, "could not create new ret string\n");
-
-						if(!sts_value_reference_decrement(script, eval_value))
-							fprintf(stderr, "could not refdec the argument\n");
-							
-						return NULL;
+						fprintf(stderr, "could not eval argument in redis-subscribe\n");
+						break;
 					}
+
+					if(eval_value->type != STS_STRING)
+						fprintf(stderr, "argument %u in redis-subscribe is not a string\n", i + 1);
+					else if(!i)
+						subscriber_args->pattern = strdup(eval_value->string.data);
+					else if(i == 1)
+						subscriber_args->script_path = strdup(eval_value->string.data);
+					else
+						subscriber_args->function = strdup(eval_value->string.data);
+
+					if(!sts_value_reference_decrement(script, eval_value))
+						fprintf(stderr, "could not refdec the argument\n");
 				}
-				else
+
+				/* 1 if it failed, -1 if the same subscriber already runs */
+				temp_int = 1;
+
+				if(!subscriber_args->pattern || !subscriber_args->script_path)
+					fprintf(stderr, "redis-subscribe requires a channel pattern string and a script path string\n");
+				else if(stsml_ctx_redis_endpoint(stsml_ctx, &subscriber_args->host, &subscriber_args->port))
+					fprintf(stderr, "redis-subscribe needs redis-connect, redis-connect-async or redis-pool first\n");
+				else if(stsml_asprintf(&temp_str, "redis-subscribe\n%s\n%s\n%s", subscriber_args->pattern, subscriber_args->script_path, subscriber_args->function ? subscriber_args->function : "") < 0 || !temp_str)
+					fprintf(stderr, "could not create subscriber key\n");
+				/* the init script runs in every interpreter, only the first one subscribes */
+				else if(stsml_singleton_claim(temp_str, NULL))
+					temp_int = -1;
+				else if(pthread_create(&id, NULL, (void *(*)(void *))&start_subscriber, subscriber_args))
 				{
-					if(!(ret = sts_value_create(script, STS_NIL)))
-					{
-						fprintf(stderr, "could not create new ret nil\n");
+					fprintf(stderr, "could not start subscriber thread\n");
+					stsml_singleton_release(temp_str);
+				}
+				else
+					temp_int = 0;
 
-						if(!sts_value_reference_decrement(script, eval_value))
-							fprintf(stderr, "could not refdec the argument\n");
-							
-						return NULL;
-					}
+				free(temp_str);
+				temp_str = NULL;
+
+				if(temp_int)
+				{
+					free(subscriber_args->pattern);
+					free(subscriber_args->script_path);
+					free(subscriber_args->function);
+					free(subscriber_args->host);
+					free(subscriber_args);
 				}
 
-				/* === */
-				if(eval_value)
-					if(!sts_value_reference_decrement(script, eval_value))
-						fprintf(stderr, "could not refdec the argument\n");
+				subscriber_args = NULL;
+
+				if(!(ret = sts_value_from_number(script, temp_int > 0 ? 0.0 : 1.0)))
+				{
+					fprintf(stderr, "could not create new ret number\n");
+					return NULL;
+				}
 			}
 			else
 			{
-				fprintf(stderr, "http-file-get requires 1 string argument\n");
+				fprintf(stderr, "redis-subscribe requires a channel pattern and a script path\n");
 				return NULL;
 			}
 		}
-		else if(!strcmp("http-cookie-get", action->string.data))
+		else if(!strcmp("redis-stream-workers", action->string.data))
 		{
 			GOTO_SET(&server_actions);
-			if(args->next)
+			if(args->next && args->next->next && args->next->next->next && args->next->next->next->next)
 			{
-				if(!(eval_value = sts_eval(script, args->next, locals, previous, 1, 0)))
-				{
-					fprintf(stderr, "could not eval argument in http-cookie-get\n");
-					return NULL;
-				}
-				else if(eval_value->type != STS_STRING)
+				/* stream, group, script path and function, then the optional worker count, reclaim idle time and delivery cap */
+				pool_settings[0] = 1.0;
+				pool_settings[1] = STSML_STREAM_MIN_IDLE;
+				pool_settings[2] = STSML_STREAM_MAX_DELIVERIES;
+
+				if(!(temp_value = sts_value_create(script, STS_ARRAY)))
 				{
-					fprintf(stderr, "first argument in http-cookie-get is not a string\n");
+					fprintf(stderr, "could not create temporary stash of arguments\n");
 					return NULL;
 				}
-				else if(onion_request_get_cookie(stsml_ctx->req, eval_value->string.data))
+
+				for(args = args->next, i = 0; args && i < 7; args = args->next, ++i)
 				{
-					if(!(ret = sts_value_from_string(script, onion_request_get_cookie(stsml_ctx->req, eval_value->string.data))))
+					if(!(eval_value = sts_eval(script, args, locals, previous, 1, 0)))
 					{
-						fprintf(stderr, "could not create new ret string\n");
-
-						if(!sts_value_reference_decrement(script, eval_value))
-							fprintf(stderr, "could not refdec the argument\n");
-							
+						fprintf(stderr, "could not eval argument in redis-stream-workers\n");
+						sts_value_reference_decrement(script, temp_value);
 						return NULL;
 					}
+
+					if(i < 4 && eval_value->type != STS_STRING)
+						fprintf(stderr, "argument %u in redis-stream-workers is not a string\n", i + 1);
+					else if(i >= 4 && eval_value->type == STS_NUMBER)
+						pool_settings[i - 4] = eval_value->number;
+
+					STS_ARRAY_APPEND_INSERT(temp_value, eval_value, temp_value->array.length);
 				}
-				else
+
+				temp_int = 0;
+
+				for(i = 0; i < 4; ++i)
 				{
-					if(!(ret = sts_value_create(script, STS_NIL)))
+					if(temp_value->array.data[i]->type != STS_STRING)
+						temp_int = 1;
+				}
+
+				if(temp_int)
+				{
+					fprintf(stderr, "redis-stream-workers requires a stream, a group, a script path and a function name\n");
+					temp_int = -1;
+				}
+				else if(stsml_ctx_redis_endpoint(stsml_ctx, &temp_str, &temp_int))
+				{
+					fprintf(stderr, "redis-stream-workers needs redis-connect, redis-connect-async or redis-pool first\n");
+					temp_int = -1;
+				}
+				/* the init script runs in every interpreter, only the first one starts workers for this stream, group, script and function */
+				else if(stsml_asprintf(&once_key, "redis-stream-workers\n%s\n%s\n%s\n%s", temp_value->array.data[0]->string.data, temp_value->array.data[1]->string.data, temp_value->array.data[2]->string.data, temp_value->array.data[3]->string.data) < 0 || !once_key)
+				{
+					fprintf(stderr, "could not create stream worker key\n");
+					temp_int = -1;
+				}
+				else if(stsml_singleton_claim(once_key, NULL))
+					temp_int = -2;
+
+				/* temp_int is the port from here on */
+				for(size = 0; temp_int >= 0 && size < (unsigned int)pool_settings[0]; ++size)
+				{
+					if(!(stream_args = calloc(1, sizeof(stsml_stream_worker_args_t))))
 					{
-						fprintf(stderr, "could not create new ret nil\n");
+						fprintf(stderr, "could not create stream worker args\n");
+						break;
+					}
 
-						if(!sts_value_reference_decrement(script, eval_value))
-							fprintf(stderr, "could not refdec the argument\n");
-							
-						return NULL;
+					stream_args->stream = strdup(temp_value->array.data[0]->string.data);
+					stream_args->group = strdup(temp_value->array.data[1]->string.data);
+					stream_args->script_path = strdup(temp_value->array.data[2]->string.data);
+					stream_args->function = strdup(temp_value->array.data[3]->string.data);
+					stream_args->host = strdup(temp_str);
+					stream_args->port = temp_int;
+					stream_args->index = size;
+					stream_args->min_idle = pool_settings[1];
+					stream_args->max_deliveries = pool_settings[2] > 0.0 ? (unsigned int)pool_settings[2] : STSML_STREAM_MAX_DELIVERIES;
+
+					if(!stream_args->stream || !stream_args->group || !stream_args->script_path || !stream_args->function || !stream_args->host || pthread_create(&id, NULL, (void *(*)(void *))&start_stream_worker, stream_args))
+					{
+						fprintf(stderr, "could not start stream worker\n");
+
+						free(stream_args->stream);
+						free(stream_args->group);
+						free(stream_args->script_path);
+						free(stream_args->function);
+						free(stream_args->host);
+						free(stream_args);
+
+						break;
 					}
 				}
 
-				/* === */
-				if(eval_value)
-					if(!sts_value_reference_decrement(script, eval_value))
-						fprintf(stderr, "could not refdec the argument\n");
+				/* none started, the next call may try again */
+				if(temp_int >= 0 && !size)
+					stsml_singleton_release(once_key);
+
+				free(once_key);
+				once_key = NULL;
+				free(temp_str);
+				temp_str = NULL;
+				stream_args = NULL;
+
+				if(!sts_value_reference_decrement(script, temp_value))
+					fprintf(stderr, "could not clean up redis-stream-workers argument stash\n");
+
+				/* how many workers started, or were asked for when another interpreter already started them */
+				if(!(ret = sts_value_from_number(script, temp_int >= 0 ? (double)size : (temp_int == -2 ? (double)(unsigned int)pool_settings[0] : 0.0))))
+				{
+					fprintf(stderr, "could not create new ret number\n");
+					return NULL;
+				}
 			}
 			else
 			{
-				fprintf(stderr, "http-cookie-get requires 1 string argument\n");
+				fprintf(stderr, "redis-stream-workers requires a stream, a group, a script path and a function name\n");
 				return NULL;
 			}
 		}
-		/* http-cookie-put string name, string value, number time_valid(added to current time, if 0 expire now, if -1 never expire), number flags */
-		else if(!strcmp("http-cookie-put", action->string.data))
+		else if(!strcmp("task-create", action->string.data))
 		{
 			GOTO_SET(&server_actions);
-			if(args->next && args->next->next && args->next->next->next && args->next->next->next->next)
+			if(args->next)
 			{
 				if(!(first_arg_value = sts_eval(script, args->next, locals, previous, 1, 0)))
 				{
-					fprintf(stderr, "could not eval argument in http-cookie-put\n");
+					fprintf(stderr, "could not eval first argument in task-create\n");
 					return NULL;
 				}
 				else if(first_arg_value->type != STS_STRING)
 				{
-					fprintf(stderr, "first argument in http-cookie-put is not a string\n");
+					fprintf(stderr, "first argument in task-create is not a string\n");
 					return NULL;
 				}
 
-				if(!(second_arg_value = sts_eval(script, args->next->next, locals, previous, 1, 0)))
-				{
-					fprintf(stderr, "could not eval argument in http-cookie-put\n");
-					return NULL;
-				}
-				else if(second_arg_value->type != STS_STRING)
-				{
-					fprintf(stderr, "second argument in http-cookie-put is not a string\n");
-					return NULL;
-				}
 
-				if(!(temp_value = sts_eval(script, args->next->next->next, locals, previous, 1, 0)))
-				{
-					fprintf(stderr, "could not eval argument in http-cookie-put\n");
-					return NULL;
-				}
-				else if(temp_value->type != STS_NUMBER)
+				if(!(temp_value = sts_value_create(script, STS_ARRAY)))
 				{
-					fprintf(stderr, "third argument in http-cookie-put is not a number\n");
+					fprintf(stderr, "could not create temporary stash of arguments\n");
 					return NULL;
 				}
 
-				if(!(eval_value = sts_eval(script, args->next->next->next->next, locals, previous, 1, 0)))
-				{
-					fprintf(stderr, "could not eval argument in http-cookie-put\n");
-					return NULL;
-				}
-				else if(eval_value->type != STS_NUMBER)
+				args = args->next;
+
+				while(args && (args = args->next))
 				{
-					fprintf(stderr, "fourth argument in http-cookie-put is not a number\n");
-					return NULL;
+					if(!(eval_value = sts_eval(script, args, locals, previous, 1, 0)))
+					{
+						fprintf(stderr, "could not eval argument in task-create\n");
+						sts_value_reference_decrement(script, temp_value);
+						return NULL;
+					}
+
+
+					sts_array_append_insert(script, temp_value, eval_value, temp_value->array.length);
 				}
 
-				if(!(ret = sts_value_from_number(script, (double)onion_response_add_cookie(stsml_ctx->res, first_arg_value->string.data, second_arg_value->string.data, (long)temp_value->number, NULL, NULL, (int)eval_value->number) )))
+
+				/* create a new thread for the task */
+
+				if(!(task_args = calloc(1, sizeof(stsml_task_args_t))))
 				{
-					fprintf(stderr, "could not create new ret number\n");
+					fprintf(stderr, "could not create task args\n");
 
-					if(!sts_value_reference_decrement(script, first_arg_value))
-						fprintf(stderr, "could not refdec the argument\n");
-					
-					if(!sts_value_reference_decrement(script, second_arg_value))
-						fprintf(stderr, "could not refdec the argument\n");
-					
 					if(!sts_value_reference_decrement(script, temp_value))
 						fprintf(stderr, "could not refdec the argument\n");
-
-					if(!sts_value_reference_decrement(script, eval_value))
+					
+					if(!sts_value_reference_decrement(script, first_arg_value))
 						fprintf(stderr, "could not refdec the argument\n");
 						
 					return NULL;
 				}
 
-				/* add to cleanup array because the reference needs to be +1 until the http body is sent */
-				STS_ARRAY_APPEND_INSERT(stsml_ctx->cleanup, first_arg_value, 0);
-				STS_ARRAY_APPEND_INSERT(stsml_ctx->cleanup, second_arg_value, 0);
+				task_args->script_path = sts_memdup(first_arg_value->string.data, first_arg_value->string.length);
 
-				first_arg_value->references++;
-				second_arg_value->references++;
+				/* args the page still holds are copied to prevent race conditions, anything built just for the task moves over without a copy */
 
+				temp_value = stsml_value_transfer(script, temp_value);
 
-				if(!sts_value_reference_decrement(script, first_arg_value))
+				if(!task_args->script_path || !temp_value)
+				{
+					fprintf(stderr, "could not hand task args over\n");
+
+					task_args->args = temp_value;
+					stsml_task_discard(task_args);
+
+					if(!sts_value_reference_decrement(script, first_arg_value))
 						fprintf(stderr, "could not refdec the argument\n");
-					
-				if(!sts_value_reference_decrement(script, second_arg_value))
-					fprintf(stderr, "could not refdec the argument\n");
-				
-				if(!sts_value_reference_decrement(script, temp_value))
-					fprintf(stderr, "could not refdec the argument\n");
 
-				if(!sts_value_reference_decrement(script, eval_value))
-					fprintf(stderr, "could not refdec the argument\n");
-			}
-			else
-			{
-				fprintf(stderr, "http-cookie-put requires 2 string arguments and 2 number arguments\n");
-				return NULL;
-			}
-		}
-		else if(!strcmp("http-header-get", action->string.data))
-		{
-			GOTO_SET(&server_actions);
-			if(args->next)
-			{
-				if(!(eval_value = sts_eval(script, args->next, locals, previous, 1, 0)))
-				{
-					fprintf(stderr, "could not eval argument in http-header-get\n");
 					return NULL;
 				}
-				else if(eval_value->type != STS_STRING)
+
+				task_args->args = temp_value;
+				temp_value = NULL;
+
+
+				/* queue the task on the pool. The handle is 0 if the pool is full or stopped */
+
+				if(!(task_args->future = stsml_future_create(&stsml_value_discard)))
 				{
-					fprintf(stderr, "first argument in http-header-get is not a string\n");
+					stsml_task_discard(task_args);
+
+					if(!sts_value_reference_decrement(script, first_arg_value))
+						fprintf(stderr, "could not refdec the argument\n");
+
 					return NULL;
 				}
-				else if(onion_request_get_header(stsml_ctx->req, eval_value->string.data))
+
+				id_number = task_args->future;
+
+				if(stsml_executor_submit(&stsml_task_run, task_args))
 				{
-					if(!(ret = sts_value_from_string(script, onion_request_get_header(stsml_ctx->req, eval_value->string.data))))
-					{
-						fprintf(stderr, "could not create new ret string\n");
+					fprintf(stderr, "task pool did not take task '%s'\n", task_args->script_path);
+					stsml_task_discard(task_args);
 
-						if(!sts_value_reference_decrement(script, eval_value))
-							fprintf(stderr, "could not refdec the argument\n");
-							
-						return NULL;
-					}
+					id_number = 0;
 				}
-				else
+
+				task_args = NULL;
+
+				if(!(ret = sts_value_from_number(script, (double)id_number)))
 				{
-					if(!(ret = sts_value_create(script, STS_NIL)))
-					{
-						fprintf(stderr, "could not create new ret nil\n");
+					fprintf(stderr, "could not create new ret number\n");
 
-						if(!sts_value_reference_decrement(script, eval_value))
-							fprintf(stderr, "could not refdec the argument\n");
-							
-						return NULL;
-					}
+					if(!sts_value_reference_decrement(script, first_arg_value))
+						fprintf(stderr, "could not refdec the argument\n");
+						
+					return NULL;
+				}
+				
+
+				if(!sts_value_reference_decrement(script, first_arg_value))
+				{
+					fprintf(stderr, "could not clean up task-create first argument\n");
+					return NULL;
 				}
 
 				/* === */
-				if(eval_value)
-					if(!sts_value_reference_decrement(script, eval_value))
-						fprintf(stderr, "could not refdec the argument\n");
 			}
 			else
 			{
-				fprintf(stderr, "http-header-get requires 1 string argument\n");
+				fprintf(stderr, "task-create requires at least 1 argument\n");
 				return NULL;
 			}
 		}
-		else if(!strcmp("http-header-put", action->string.data))
+		else if(!strcmp("parallel-map", action->string.data))
 		{
 			GOTO_SET(&server_actions);
 			if(args->next && args->next->next)
 			{
 				if(!(first_arg_value = sts_eval(script, args->next, locals, previous, 1, 0)))
 				{
-					fprintf(stderr, "could not eval argument in http-header-put\n");
+					fprintf(stderr, "could not eval first argument in parallel-map\n");
 					return NULL;
 				}
-				else if(first_arg_value->type != STS_STRING)
+				else if(first_arg_value->type != STS_ARRAY)
 				{
-					fprintf(stderr, "first argument in http-header-put is not a string\n");
+					fprintf(stderr, "first argument in parallel-map is not an array\n");
+					sts_value_reference_decrement(script, first_arg_value);
 					return NULL;
 				}
 
-				if(!(eval_value = sts_eval(script, args->next->next, locals, previous, 1, 0)))
+				if(!(second_arg_value = sts_eval(script, args->next->next, locals, previous, 1, 0)))
 				{
-					fprintf(stderr, "could not eval argument in http-header-put\n");
+					fprintf(stderr, "could not eval second argument in parallel-map\n");
+					sts_value_reference_decrement(script, first_arg_value);
 					return NULL;
 				}
-				else if(eval_value->type != STS_STRING)
+				else if(second_arg_value->type != STS_STRING)
 				{
-					fprintf(stderr, "first argument in http-header-put is not a string\n");
+					fprintf(stderr, "second argument in parallel-map is not a script path\n");
+					sts_value_reference_decrement(script, first_arg_value);
+					sts_value_reference_decrement(script, second_arg_value);
 					return NULL;
 				}
 
+				/* then an optional function name and an optional chunk size, in any order */
+				temp_value = NULL;
+				temp_uint = 0;
 
-				onion_response_set_header(stsml_ctx->res, first_arg_value->string.data, eval_value->string.data);
+				for(args = args->next->next->next, i = 0; args && i < 2; args = args->next, ++i)
+				{
+					if(!(eval_value = sts_eval(script, args, locals, previous, 1, 0)))
+					{
+						fprintf(stderr, "could not eval argument in parallel-map\n");
+						sts_value_reference_decrement(script, first_arg_value);
+						sts_value_reference_decrement(script, second_arg_value);
 
+						if(temp_value)
+							sts_value_reference_decrement(script, temp_value);
 
-				if(!(ret = sts_value_from_number(script, 1.0)))
-				{
-					fprintf(stderr, "could not create new ret number\n");
+						return NULL;
+					}
 
-					if(!sts_value_reference_decrement(script, first_arg_value))
-						fprintf(stderr, "could not refdec the argument\n");
+					if(eval_value->type == STS_NUMBER && eval_value->number >= 1.0)
+						temp_uint = (unsigned int)eval_value->number;
+					else if(eval_value->type == STS_STRING && !temp_value)
+					{
+						temp_value = eval_value;
+						continue;
+					}
 
-					if(!sts_value_reference_decrement(script, eval_value))
-						fprintf(stderr, "could not refdec the argument\n");
-						
-					return NULL;
+					sts_value_reference_decrement(script, eval_value);
 				}
 
-				/* add to cleanup array because the reference needs to be +1 until the http body is sent */
-				STS_ARRAY_APPEND_INSERT(stsml_ctx->cleanup, first_arg_value, 0);
-				STS_ARRAY_APPEND_INSERT(stsml_ctx->cleanup, eval_value, 0);
+				/* items the page still holds are copied, the workers change reference counts */
+				if(!(first_arg_value = stsml_value_transfer(script, first_arg_value)) || !(ret = stsml_parallel_map(script, first_arg_value, second_arg_value->string.data, temp_value ? temp_value->string.data : NULL, temp_uint)))
+					fprintf(stderr, "could not run parallel-map with script '%s'\n", second_arg_value->string.data);
 
-				first_arg_value->references++;
-				eval_value->references++;
+				if(!sts_value_reference_decrement(script, second_arg_value))
+					fprintf(stderr, "could not refdec the argument\n");
+
+				if(temp_value && !sts_value_reference_decrement(script, temp_value))
+					fprintf(stderr, "could not refdec the argument\n");
 
+				temp_value = NULL;
 
-				if(first_arg_value)
-					if(!sts_value_reference_decrement(script, first_arg_value))
-						fprintf(stderr, "could not refdec the argument\n");
-				
-				if(eval_value)
-					if(!sts_value_reference_decrement(script, eval_value))
-						fprintf(stderr, "could not refdec the argument\n");
+				if(!ret)
+					return NULL;
 			}
 			else
 			{
-				fprintf(stderr, "http-header-put requires 2 string arguments\n");
+				fprintf(stderr, "parallel-map requires an array and a script path\n");
 				return NULL;
 			}
 		}
-		else if(!strcmp("http-write-file", action->string.data))
+		else if(!strcmp("task-every", action->string.data) || !strcmp("task-at", action->string.data))
 		{
 			GOTO_SET(&server_actions);
-			if(args->next)
+			if(args->next && args->next->next)
 			{
-				if(!(eval_value = sts_eval(script, args->next, locals, previous, 1, 0)))
+				/* task-every takes an interval or [interval jitter allow_overlap], task-at a unix time */
+				if(!(first_arg_value = sts_eval(script, args->next, locals, previous, 1, 0)))
 				{
-					fprintf(stderr, "could not eval argument in http-write-file\n");
+					fprintf(stderr, "could not eval first argument in %s\n", action->string.data);
 					return NULL;
 				}
-				else if(eval_value->type != STS_STRING)
+
+				if(!(second_arg_value = sts_eval(script, args->next->next, locals, previous, 1, 0)))
 				{
-					fprintf(stderr, "first argument in http-write-file is not a string\n");
+					fprintf(stderr, "could not eval second argument in %s\n", action->string.data);
+					sts_value_reference_decrement(script, first_arg_value);
 					return NULL;
 				}
-				else
+
+				pool_settings[0] = 0.0;
+				pool_settings[1] = 0.0;
+				pool_settings[2] = 0.0;
+
+				if(first_arg_value->type == STS_NUMBER)
+					pool_settings[0] = first_arg_value->number;
+				else if(first_arg_value->type == STS_ARRAY)
 				{
-					if(sts_value_copy(script, stsml_ctx->response_file, eval_value, 0))
+					for(i = 0; i < first_arg_value->array.length && i < 3; ++i)
 					{
-						fprintf(stderr, "could not set file path response string in http-write-file\n");
-						return NULL;
+						if(first_arg_value->array.data[i]->type == STS_NUMBER)
+							pool_settings[i] = first_arg_value->array.data[i]->number;
 					}
+				}
 
+				temp_int = !strcmp("task-at", action->string.data);
 
-					if(!(ret = sts_value_from_number(script, 1.0)))
-					{
-						fprintf(stderr, "could not create new ret number\n");
+				if(second_arg_value->type != STS_STRING || (!temp_int && pool_settings[0] < STSML_TIMER_TICK))
+				{
+					fprintf(stderr, "%s requires a %s and a script path\n", action->string.data, temp_int ? "unix time" : "interval of at least 0.01 seconds");
+					sts_value_reference_decrement(script, first_arg_value);
+					sts_value_reference_decrement(script, second_arg_value);
+					return NULL;
+				}
 
-						if(!sts_value_reference_decrement(script, eval_value))
-							fprintf(stderr, "could not refdec the argument\n");
-							
-						return NULL;
-					}
+				id_number = 0;
+
+				if(!(timer_task = calloc(1, sizeof(stsml_timer_task_t))) || !(timer_task->script_path = strdup(second_arg_value->string.data)) || !(timer_task->args = stsml_task_args_eval(script, args->next->next->next, locals, previous)))
+				{
+					fprintf(stderr, "could not set up the task for %s\n", action->string.data);
+
+					if(timer_task)
+						stsml_timer_task_discard(timer_task);
+
+					timer_task = NULL;
+				}
+				else if(stsml_asprintf(&once_key, "%s\n%s\n%g\n%g\n%g\n%016llx", action->string.data, timer_task->script_path, pool_settings[0], pool_settings[1], pool_settings[2], stsml_value_hash(timer_task->args)) < 0 || !once_key)
+				{
+					fprintf(stderr, "could not create the timer key for %s\n", action->string.data);
+					stsml_timer_task_discard(timer_task);
+					timer_task = NULL;
+				}
+				/* the init script runs in every interpreter, the same timer is only scheduled once and the others get its handle */
+				else if(stsml_singleton_claim(once_key, &id_number))
+				{
+					stsml_timer_task_discard(timer_task);
+					timer_task = NULL;
+				}
+				else if(!(timer_task->singleton = strdup(once_key)))
+				{
+					fprintf(stderr, "could not copy the timer key for %s\n", action->string.data);
+					stsml_singleton_release(once_key);
+					stsml_timer_task_discard(timer_task);
+					timer_task = NULL;
 				}
+				else if(temp_int)
+				{
+					timer_task->once = 1;
+					id_number = stsml_timer_add(pool_settings[0] - (double)time(NULL), 0.0, 0.0, 0, &stsml_timer_task_fire, &stsml_timer_task_discard, timer_task);
+				}
+				else
+					id_number = stsml_timer_add(pool_settings[0], pool_settings[0], pool_settings[1], pool_settings[2] == 0.0, &stsml_timer_task_fire, &stsml_timer_task_discard, timer_task);
 
-				/* === */
-				if(eval_value)
-					if(!sts_value_reference_decrement(script, eval_value))
-						fprintf(stderr, "could not refdec the argument\n");
+				/* timer_task is only left set when it was handed to the timers, which may have already freed it. One that could not be added released its key with the task */
+				if(timer_task && id_number)
+					stsml_singleton_set(once_key, id_number);
+
+				free(once_key);
+				once_key = NULL;
+				timer_task = NULL;
+
+				if(!sts_value_reference_decrement(script, first_arg_value))
+					fprintf(stderr, "could not refdec the argument\n");
+
+				if(!sts_value_reference_decrement(script, second_arg_value))
+					fprintf(stderr, "could not refdec the argument\n");
+
+				/* the handle for task-cancel, 0 if nothing was scheduled */
+				if(!(ret = sts_value_from_number(script, (double)id_number)))
+				{
+					fprintf(stderr, "could not create new ret number\n");
+					return NULL;
+				}
 			}
 			else
 			{
-				fprintf(stderr, "http-write-file requires 1 string argument\n");
+				fprintf(stderr, "%s requires a time and a script path\n", action->string.data);
 				return NULL;
 			}
 		}
-		else if(!strcmp("http-route", action->string.data))
+		else if(!strcmp("task-cancel", action->string.data))
 		{
 			GOTO_SET(&server_actions);
 			if(args->next)
 			{
-				if(!(eval_value = sts_eval(script, args->next, locals, previous, 1, 0)))
+				if(!(first_arg_value = sts_eval(script, args->next, locals, previous, 1, 0)))
 				{
-					fprintf(stderr, "could not eval argument in http-route\n");
+					fprintf(stderr, "could not eval first argument in task-cancel\n");
 					return NULL;
 				}
-				else if(eval_value->type != STS_STRING)
+				else if(first_arg_value->type != STS_NUMBER)
 				{
-					fprintf(stderr, "first argument in http-route is not a string\n");
+					fprintf(stderr, "first argument in task-cancel is not a timer handle\n");
+					sts_value_reference_decrement(script, first_arg_value);
 					return NULL;
 				}
-				else
-				{
-					if(sts_value_copy(script, stsml_ctx->respond_redirect, eval_value, 0))
-					{
-						fprintf(stderr, "could not set file path response string in http-route\n");
-						return NULL;
-					}
 
-					if(!(ret = sts_value_from_number(script, 1.0)))
-					{
-						fprintf(stderr, "could not create new ret number\n");
+				temp_int = first_arg_value->number >= 1.0 ? stsml_timer_cancel((unsigned long long)first_arg_value->number) : 1;
 
-						if(!sts_value_reference_decrement(script, eval_value))
-							fprintf(stderr, "could not refdec the argument\n");
-							
-						return NULL;
-					}
-				}
+				if(!sts_value_reference_decrement(script, first_arg_value))
+					fprintf(stderr, "could not refdec the argument\n");
 
-				/* === */
-				if(eval_value)
-					if(!sts_value_reference_decrement(script, eval_value))
-						fprintf(stderr, "could not refdec the argument\n");
+				if(!(ret = sts_value_from_number(script, temp_int ? 0.0 : 1.0)))
+				{
+					fprintf(stderr, "could not create new ret number\n");
+					return NULL;
+				}
 			}
 			else
 			{
-				fprintf(stderr, "http-route requires 1 string argument\n");
+				fprintf(stderr, "task-cancel requires a timer handle\n");
 				return NULL;
 			}
 		}
-		else if(!strcmp("redis-connect", action->string.data))
+		else if(!strcmp("task-await", action->string.data))
 		{
 			GOTO_SET(&server_actions);
-			if(args->next && args->next->next)
+			if(args->next)
 			{
 				if(!(first_arg_value = sts_eval(script, args->next, locals, previous, 1, 0)))
 				{
-					fprintf(stderr, "could not eval first argument in redis-connect\n");
+					fprintf(stderr, "could not eval first argument in task-await\n");
 					return NULL;
 				}
-				else if(first_arg_value->type != STS_STRING)
+				else if(first_arg_value->type != STS_NUMBER)
 				{
-					fprintf(stderr, "first argument in redis-connect is not a string\n");
+					fprintf(stderr, "first argument in task-await is not a task handle\n");
+					sts_value_reference_decrement(script, first_arg_value);
 					return NULL;
 				}
 
-				if(!(eval_value = sts_eval(script, args->next->next, locals, previous, 1, 0)))
-				{
-					fprintf(stderr, "could not eval second argument in redis-connect\n");
-					return NULL;
-				}
-				else if(eval_value->type != STS_NUMBER)
+				/* waits until the task is done without a timeout */
+				pool_settings[0] = -1.0;
+
+				if(args->next->next)
 				{
-					fprintf(stderr, "second argument in redis-connect is not a number\n");
-					return NULL;
+					if(!(second_arg_value = sts_eval(script, args->next->next, locals, previous, 1, 0)))
+					{
+						fprintf(stderr, "could not eval second argument in task-await\n");
+						sts_value_reference_decrement(script, first_arg_value);
+						return NULL;
+					}
+
+					if(second_arg_value->type == STS_NUMBER)
+						pool_settings[0] = second_arg_value->number;
+
+					sts_value_reference_decrement(script, second_arg_value);
 				}
 
+				id_number = (unsigned long long)first_arg_value->number;
 
-				if(stsml_ctx->redis_ctx)
-					redisFree(stsml_ctx->redis_ctx);
+				if(!sts_value_reference_decrement(script, first_arg_value))
+					fprintf(stderr, "could not refdec the argument\n");
 
-				if(!(stsml_ctx->redis_ctx = redisConnect(first_arg_value->string.data, (int)eval_value->number)) || stsml_ctx->redis_ctx->err)
-					fprintf(stderr, "could not connect to redis server at '%s'\n", first_arg_value->string.data);
-				
+				/* a handle of 0 is a task the pool never took */
+				if(id_number && stsml_future_await(id_number, pool_settings[0], (void **)&ret) < 0)
+					fprintf(stderr, "no task with handle %llu, it was already awaited or its result expired\n", id_number);
 
-				if(!(ret = sts_value_from_number(script, (stsml_ctx->redis_ctx && !stsml_ctx->redis_ctx->err) ? 1.0 : 0.0)))
+				/* nil on timeout or if the task failed */
+				if(!ret && !(ret = sts_value_create(script, STS_NIL)))
 				{
-					fprintf(stderr, "could not create new ret number\n");
-
-					if(!sts_value_reference_decrement(script, eval_value))
-						fprintf(stderr, "could not refdec the argument\n");
-					
-					if(!sts_value_reference_decrement(script, first_arg_value))
-						fprintf(stderr, "could not refdec the argument\n");
-						
+					fprintf(stderr, "could not create nil value\n");
 					return NULL;
 				}
-
-				/* === */
-				if(eval_value)
-					if(!sts_value_reference_decrement(script, eval_value))
-						fprintf(stderr, "could not refdec the argument\n");
-
-				if(eval_value)
-					if(!sts_value_reference_decrement(script, first_arg_value))
-						fprintf(stderr, "could not refdec the argument\n");
 			}
 			else
 			{
-				fprintf(stderr, "redis-connect requires 1 string argument\n");
+				fprintf(stderr, "task-await requires a task handle\n");
 				return NULL;
 			}
 		}
-		else if(!strcmp("redis", action->string.data))
+		else if(!strcmp("channel-create", action->string.data))
 		{
 			GOTO_SET(&server_actions);
 			if(args->next)
 			{
-				/* have to stash all arguments in a temporary array and destroy this at the end */
-
-				if(!(temp_value = sts_value_create(script, STS_ARRAY)))
+				if(!(first_arg_value = sts_eval(script, args->next, locals, previous, 1, 0)))
 				{
-					fprintf(stderr, "could not create temporary stash of arguments\n");
+					fprintf(stderr, "could not eval first argument in channel-create\n");
 					return NULL;
 				}
-
-				while((args = args->next))
+				else if(first_arg_value->type != STS_STRING)
 				{
-					if(!(eval_value = sts_eval(script, args, locals, previous, 1, 0)))
-					{
-						fprintf(stderr, "could not eval argument in redis\n");
-						sts_value_reference_decrement(script, temp_value);
-						return NULL;
-					}
-
-
-					switch(eval_value->type)
-					{
-						case STS_STRING:
-							sts_array_append_insert(script, temp_value, eval_value, 0);
-
-							redis_args[i] = eval_value->string.data;
-							redis_args_size[i] = eval_value->string.length;
-
-							redis_args_cleanup[i] = 0;
-
-							if(++i == 1024) break; /* limit to 1024 arguments, this limit still feels too large */
-						break;
-						case STS_NUMBER:
-							redis_args[i] = NULL;
-
-							stsml_asprintf(&redis_args[i], "%lld", (long)eval_value->number);
-							redis_args_size[i] = strlen(redis_args[i]);
-
-							redis_args_cleanup[i] = 1;
-
-							sts_value_reference_decrement(script, eval_value);
-
-							if(++i == 1024) break; /* limit to 1024 arguments, this limit still feels too large */
-						break;
-					}
-
-					/* printf("redis debug === %u '%s' %llu %llu\n", i - 1, redis_args[i - 1], redis_args_size[i - 1], redis_args_cleanup[i - 1]); */
-
+					fprintf(stderr, "first argument in channel-create is not a string\n");
+					sts_value_reference_decrement(script, first_arg_value);
+					return NULL;
 				}
 
-				temp_uint = i;
+				temp_uint = STSML_CHANNEL_CAPACITY;
 
-
-				if((reply = redisCommandArgv(stsml_ctx->redis_ctx, temp_uint, (const char **)redis_args, redis_args_size)))
+				if(args->next->next)
 				{
-					if(!(ret = stsml_value_from_redis(script, reply)))
+					if(!(second_arg_value = sts_eval(script, args->next->next, locals, previous, 1, 0)))
 					{
-						fprintf(stderr, "could not create value from redis reply\n");
+						fprintf(stderr, "could not eval second argument in channel-create\n");
+						sts_value_reference_decrement(script, first_arg_value);
 						return NULL;
 					}
 
-					freeReplyObject(reply);	
-				}
-				else
-				{
-					if(!(ret = sts_value_create(script, STS_NIL)))
-					{
-						fprintf(stderr, "reply error in redis action\n");
-						return NULL;
-					}
-				}
+					if(second_arg_value->type == STS_NUMBER && second_arg_value->number >= 1.0)
+						temp_uint = (unsigned int)second_arg_value->number;
 
-				/* cleanup */
-				for(i = 0; i < temp_uint; ++i)
-				{
-					if(redis_args_cleanup[i])
-						free(redis_args[i]);
+					sts_value_reference_decrement(script, second_arg_value);
 				}
 
-				if(!sts_value_reference_decrement(script, temp_value))
+				/* a channel that already exists keeps its capacity */
+				temp_int = stsml_channel_create(first_arg_value->string.data, temp_uint);
+
+				if(!sts_value_reference_decrement(script, first_arg_value))
+					fprintf(stderr, "could not refdec the argument\n");
+
+				if(!(ret = sts_value_from_number(script, temp_int ? 0.0 : 1.0)))
 				{
-					fprintf(stderr, "could not clean up redis argument stash\n");
+					fprintf(stderr, "could not create new ret number\n");
 					return NULL;
 				}
-
-				/* === */
 			}
 			else
 			{
-				fprintf(stderr, "redis requires at least 1 argument\n");
+				fprintf(stderr, "channel-create requires a channel name\n");
 				return NULL;
 			}
 		}
-		else if(!strcmp("task-create", action->string.data))
+		else if(!strcmp("channel-send", action->string.data))
 		{
 			GOTO_SET(&server_actions);
-			if(args->next)
+			if(args->next && args->next->next)
 			{
 				if(!(first_arg_value = sts_eval(script, args->next, locals, previous, 1, 0)))
 				{
-					fprintf(stderr, "could not eval first argument in task-create\n");
+					fprintf(stderr, "could not eval first argument in channel-send\n");
 					return NULL;
 				}
 				else if(first_arg_value->type != STS_STRING)
 				{
-					fprintf(stderr, "first argument in task-create is not a string\n");
+					fprintf(stderr, "first argument in channel-send is not a string\n");
+					sts_value_reference_decrement(script, first_arg_value);
 					return NULL;
 				}
 
-
-				if(!(temp_value = sts_value_create(script, STS_ARRAY)))
+				if(!(second_arg_value = sts_eval(script, args->next->next, locals, previous, 1, 0)))
 				{
-					fprintf(stderr, "could not create temporary stash of arguments\n");
+					fprintf(stderr, "could not eval second argument in channel-send\n");
+					sts_value_reference_decrement(script, first_arg_value);
 					return NULL;
 				}
 
-				args = args->next;
+				pool_settings[0] = 0.0;
 
-				while(args && (args = args->next))
+				if(args->next->next->next)
 				{
-					if(!(eval_value = sts_eval(script, args, locals, previous, 1, 0)))
+					if(!(temp_value = sts_eval(script, args->next->next->next, locals, previous, 1, 0)))
 					{
-						fprintf(stderr, "could not eval argument in task-create\n");
-						sts_value_reference_decrement(script, temp_value);
+						fprintf(stderr, "could not eval third argument in channel-send\n");
+						sts_value_reference_decrement(script, first_arg_value);
+						sts_value_reference_decrement(script, second_arg_value);
 						return NULL;
 					}
 
+					if(temp_value->type == STS_NUMBER)
+						pool_settings[0] = temp_value->number;
 
-					sts_array_append_insert(script, temp_value, eval_value, temp_value->array.length);
+					sts_value_reference_decrement(script, temp_value);
 				}
 
+				temp_int = 1;
 
-				/* create a new thread for the task */
-
-				if(!(task_args = calloc(1, sizeof(stsml_task_args_t))))
+				if(!(stsml_channel = stsml_channel_get(first_arg_value->string.data)))
 				{
-					fprintf(stderr, "could not create task args\n");
-
-					if(!sts_value_reference_decrement(script, temp_value))
-						fprintf(stderr, "could not refdec the argument\n");
-					
-					if(!sts_value_reference_decrement(script, first_arg_value))
-						fprintf(stderr, "could not refdec the argument\n");
-						
-					return NULL;
+					fprintf(stderr, "no channel named '%s', make it with channel-create first\n", first_arg_value->string.data);
+					sts_value_reference_decrement(script, second_arg_value);
 				}
-
-				task_args->script_path = sts_memdup(first_arg_value->string.data, first_arg_value->string.length);
-
-				if(!(task_args->args = sts_value_create(script, STS_NIL)))
+				else if((second_arg_value = stsml_value_transfer(script, second_arg_value)))
 				{
-					fprintf(stderr, "could not create task arg array\n");
-
-					if(!sts_value_reference_decrement(script, temp_value))
-						fprintf(stderr, "could not refdec the argument\n");
-					
-					if(!sts_value_reference_decrement(script, first_arg_value))
-						fprintf(stderr, "could not refdec the argument\n");
-						
-					return NULL;
+					/* the receiver owns the value from here on, unless the channel stayed full */
+					if((temp_int = stsml_channel_send(stsml_channel, second_arg_value, pool_settings[0])))
+						sts_value_reference_decrement(script, second_arg_value);
 				}
 
+				second_arg_value = NULL;
 
-				/* copy args to prevent race conditions */
-
+				if(!sts_value_reference_decrement(script, first_arg_value))
+					fprintf(stderr, "could not refdec the argument\n");
 
-				if(sts_value_copy(script, task_args->args, temp_value, 1))
+				if(!(ret = sts_value_from_number(script, temp_int ? 0.0 : 1.0)))
 				{
-					fprintf(stderr, "could not copy task arg array\n");
-
-					if(!sts_value_reference_decrement(script, temp_value))
-						fprintf(stderr, "could not refdec the argument\n");
-					
-					if(!sts_value_reference_decrement(script, first_arg_value))
-						fprintf(stderr, "could not refdec the argument\n");
-						
+					fprintf(stderr, "could not create new ret number\n");
 					return NULL;
 				}
-
-
-				/* create task thread */
-
-				if(!(ret = sts_value_from_number(script, (double)pthread_create(&id, NULL, &start_task, (void *)task_args))))
+			}
+			else
+			{
+				fprintf(stderr, "channel-send requires a channel name and a value\n");
+				return NULL;
+			}
+		}
+		else if(!strcmp("channel-recv", action->string.data))
+		{
+			GOTO_SET(&server_actions);
+			if(args->next)
+			{
+				if(!(first_arg_value = sts_eval(script, args->next, locals, previous, 1, 0)))
 				{
-					fprintf(stderr, "could not create new ret number\n");
-
-					if(!sts_value_reference_decrement(script, temp_value))
-						fprintf(stderr, "could not refdec the argument\n");
-					
-					if(!sts_value_reference_decrement(script, first_arg_value))
-						fprintf(stderr, "could not refdec the argument\n");
-						
+					fprintf(stderr, "could not eval first argument in channel-recv\n");
 					return NULL;
 				}
-				
-
-				if(!sts_value_reference_decrement(script, temp_value))
+				else if(first_arg_value->type != STS_STRING)
 				{
-					fprintf(stderr, "could not clean up task-create argument array\n");
+					fprintf(stderr, "first argument in channel-recv is not a string\n");
+					sts_value_reference_decrement(script, first_arg_value);
 					return NULL;
 				}
 
+				pool_settings[0] = 0.0;
+
+				if(args->next->next)
+				{
+					if(!(second_arg_value = sts_eval(script, args->next->next, locals, previous, 1, 0)))
+					{
+						fprintf(stderr, "could not eval second argument in channel-recv\n");
+						sts_value_reference_decrement(script, first_arg_value);
+						return NULL;
+					}
+
+					if(second_arg_value->type == STS_NUMBER)
+						pool_settings[0] = second_arg_value->number;
+
+					sts_value_reference_decrement(script, second_arg_value);
+				}
+
+				if(!(stsml_channel = stsml_channel_get(first_arg_value->string.data)))
+					fprintf(stderr, "no channel named '%s', make it with channel-create first\n", first_arg_value->string.data);
+				else
+					ret = stsml_channel_recv(stsml_channel, pool_settings[0]);
+
 				if(!sts_value_reference_decrement(script, first_arg_value))
+					fprintf(stderr, "could not refdec the argument\n");
+
+				/* nil when nothing came in before the timeout */
+				if(!ret && !(ret = sts_value_create(script, STS_NIL)))
 				{
-					fprintf(stderr, "could not clean up task-create first argument\n");
+					fprintf(stderr, "could not create nil value\n");
 					return NULL;
 				}
-
-				/* === */
 			}
 			else
 			{
-				fprintf(stderr, "task-create requires at least 1 argument\n");
+				fprintf(stderr, "channel-recv requires a channel name\n");
 				return NULL;
 			}
 		}
@@ -1487,6 +5189,90 @@ sts_value_t *server_actions(sts_script_t *script, sts_value_t *action, sts_node_
 	return ret;
 }
 
+/* renders an stsml file with the current interpreter, appends it to the response and caches it if a ttl is given */
+int stsml_render_fragment(stsml_ctx_t *ctx, const char *key, char *script_path, double ttl, double stale)
+{
+	sts_value_t *page_str = ctx->response_str;
+	sts_node_t *ast = NULL, **temp_asts = NULL;
+	stsml_cache_page_t *page = NULL;
+	double page_ttl = ctx->cache_ttl, page_stale = ctx->cache_stale;
+	char *error = NULL;
+	int ret = 0, leader = 0;
+
+
+	/* another thread may already be rendering the same fragment */
+	if(ttl > 0.0)
+	{
+		switch(stsml_cache_flight_begin(key, &page))
+		{
+			case STSML_CACHE_FLIGHT_SHARED:
+				if(page->size)
+					STS_STRING_ASSEMBLE(page_str->string.data, page_str->string.length, page->body, page->size, "", 0);
+
+				stsml_cache_page_release(page);
+
+				return 0;
+			case STSML_CACHE_FLIGHT_LEADER:
+				leader = 1;
+			break;
+		}
+	}
+
+	if(!(ctx->response_str = sts_value_create(ctx->script, STS_STRING)))
+	{
+		fprintf(stderr, "could not create fragment response string\n");
+		ctx->response_str = page_str;
+
+		if(leader)
+			stsml_cache_flight_end(key, NULL);
+
+		return 1;
+	}
+
+	if((ret = stsml_render(ctx, script_path, &ast, &error)))
+		fprintf(stderr, "could not render fragment '%s': %s\n", script_path, error ? error : "could not read file");
+	else
+	{
+		if(ctx->response_str->string.length)
+			STS_STRING_ASSEMBLE(page_str->string.data, page_str->string.length, ctx->response_str->string.data, ctx->response_str->string.length, "", 0);
+
+		if(ttl > 0.0)
+			page = stsml_cache_page_new(ctx->response_str->string.data, ctx->response_str->string.length, 200);
+	}
+
+	if(leader)
+		stsml_cache_flight_end(key, page);
+
+	if(page)
+		stsml_cache_put(key, page, ttl, stale);
+
+	/* the fragment ast lives until the next render just like the page ast */
+	if(ast)
+	{
+		if(!(temp_asts = realloc(ctx->fragment_asts, (ctx->fragment_asts_size + 1) * sizeof(sts_node_t *))))
+		{
+			fprintf(stderr, "could not keep fragment ast\n");
+			sts_ast_delete(ctx->script, ast);
+		}
+		else
+		{
+			ctx->fragment_asts = temp_asts;
+			ctx->fragment_asts[ctx->fragment_asts_size++] = ast;
+		}
+	}
+
+	if(!sts_value_reference_decrement(ctx->script, ctx->response_str))
+		fprintf(stderr, "could not refdec fragment response string\n");
+
+	ctx->response_str = page_str;
+	ctx->cache_ttl = page_ttl;
+	ctx->cache_stale = page_stale;
+
+	free(error);
+
+	return ret ? 1 : 0;
+}
+
 char *stsml_import(sts_script_t *script, char *file)
 {
 	if(!strcmp(file, "stdlib.sts"))
@@ -1553,22 +5339,39 @@ char *get_arg_value(stsml_args_t *args, char *arg)
 
 int main(int argc, char **argv)
 {
-	unsigned long script_text_size = 0, offset = 0, line = 0;
-	char *script_text = NULL;
 	stsml_parser_ctx_t parser;
 	stsml_ctx_t ctx;
-	sts_value_t *res = NULL;
 	sts_script_t script;
-	sts_map_row_t *temp_row = NULL;
 	onion_handler *stsml_handler = NULL, *router_handler = NULL, *file_handler = NULL, *last_resort_handler = NULL;
-	stsml_script_t *temp_stript_locals = NULL;
 	onion *on = NULL;
+	stsml_render_queue_t render_queue = {.lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER};
+	stsml_workers_t workers = {.lock = PTHREAD_MUTEX_INITIALIZER, .head = NULL};
+	int worker_count, task_policy;
 	stsml_args_t args[] = {
 		{.name = "help", .description = "Prints this text.", .present = 0, .value = NULL},
 		{.name = "init", .description = "Run a script on startup to setup global values and connections.", .present = 0, .value = NULL},
 		{.name = "last_resort", .description = "Run a script when no script or file is found", .present = 0, .value = NULL},
 		{.name = "port", .description = "Set the port to run on. By default, it's 8080.", .present = 0, .value = "8080"},
 		{.name = "working_dir", .description = "Sets the working directory of stsml.", .present = 0, .value = NULL},
+		{.name = "coalesce_timeout", .description = "Seconds a request waits on an identical render of a cached page before rendering on its own. By default, it's 5.", .present = 0, .value = "5"},
+		{.name = "cache_max", .description = "Most bytes the page and fragment cache holds before the least recently used are dropped. By default, it's 67108864 (64MB).", .present = 0, .value = "67108864"},
+		{.name = "compress_level", .description = "Set the gzip/deflate level from 1 to 9, 0 turns compression off. By default, it's 6.", .present = 0, .value = "6"},
+		{.name = "compress_min_size", .description = "Responses smaller than this many bytes are not compressed. By default, it's 1024.", .present = 0, .value = "1024"},
+		{.name = "workers", .description = "Set how many threads serve requests, each with its own interpreter that runs the init script. By default, it's 1.", .present = 0, .value = "1"},
+		{.name = "redis_host", .description = "Set up the shared redis connection pool for this server at startup.", .present = 0, .value = NULL},
+		{.name = "redis_port", .description = "Port of the redis pool server. By default, it's 6379.", .present = 0, .value = "6379"},
+		{.name = "redis_pool_min", .description = "Connections the redis pool opens at startup. By default, it's 2.", .present = 0, .value = "2"},
+		{.name = "redis_pool_max", .description = "Most connections the redis pool will open. By default, it's 16.", .present = 0, .value = "16"},
+		{.name = "redis_connect_timeout", .description = "Seconds to wait when connecting to redis, 0 waits forever. By default, it's 1.", .present = 0, .value = "1"},
+		{.name = "redis_command_timeout", .description = "Seconds to wait for a redis reply before giving up on the connection, 0 waits forever. By default, it's 5.", .present = 0, .value = "5"},
+		{.name = "redis_pool_timeout", .description = "Seconds to wait for a free pooled redis connection. By default, it's 1.", .present = 0, .value = "1"},
+		{.name = "redis_health_interval", .description = "Seconds a pooled redis connection can be idle before it is pinged on checkout. By default, it's 30.", .present = 0, .value = "30"},
+		{.name = "redis_cache_max", .description = "Set to a size in bytes to cache redis reads of keys matching redis-cache-pattern patterns, invalidated by redis. Needs redis_host.", .present = 0, .value = NULL},
+		{.name = "stream_consumer", .description = "Name of this server in redis-stream-workers consumer groups, it has to differ between servers on one host. By default, it's the port.", .present = 0, .value = NULL},
+		{.name = "task_workers", .description = "Set how many threads run task-create tasks. A task that runs forever keeps its thread. By default, it's 4.", .present = 0, .value = "4"},
+		{.name = "task_queue", .description = "Set how many tasks can wait for a task thread. By default, it's 1024.", .present = 0, .value = "1024"},
+		{.name = "task_policy", .description = "What task-create does when the task queue is full: reject, block or inline. By default, it's reject.", .present = 0, .value = "reject"},
+		{.name = "minify", .description = "Set to 1 to collapse whitespace and drop comments in the html of stsml files when they are parsed. By default, it's 0.", .present = 0, .value = "0"},
 		{.name = NULL}
 	};
 
@@ -1581,103 +5384,78 @@ int main(int argc, char **argv)
 	if(get_arg_value(args, "working_dir"))
 		chdir(get_arg_value(args, "working_dir"));
 
+	stream_consumer = get_arg_value(args, "stream_consumer") ? get_arg_value(args, "stream_consumer") : get_arg_value(args, "port");
 
-	ONION_INFO("starting stsml server");
-
-	/* initialize the script */
-
-	memset(&script, 0, sizeof(sts_script_t));
-
-	/* set a read file callback */
-	script.read_file = &read_file;
-
-	/* initialize the router */
-	script.router = &server_actions;
 
-	script.import_file = &stsml_import;
+	ONION_INFO("starting stsml server");
 
-	script.userdata = &ctx;
+	worker_count = atoi(get_arg_value(args, "workers"));
 
+	/* the single event loop must never sleep on another render */
+	stsml_cache_init(worker_count > 1 ? atof(get_arg_value(args, "coalesce_timeout")) : 0.0, strtoul(get_arg_value(args, "cache_max"), NULL, 10));
+	stsml_parser_set_minify(atoi(get_arg_value(args, "minify")));
+	stsml_compress_init(atoi(get_arg_value(args, "compress_level")), strtoul(get_arg_value(args, "compress_min_size"), NULL, 10));
 
-	/* initialize the stsml_ctx */
+	stsml_redis_set_timeouts(atof(get_arg_value(args, "redis_connect_timeout")), atof(get_arg_value(args, "redis_command_timeout")));
 
-	memset(&ctx, 0, sizeof(stsml_ctx_t));
+	/* the pool is ready before any script runs, the init script can also set it up with redis-pool */
+	if(get_arg_value(args, "redis_host") && stsml_redis_pool_init(get_arg_value(args, "redis_host"), atoi(get_arg_value(args, "redis_port")), strtoul(get_arg_value(args, "redis_pool_min"), NULL, 10), strtoul(get_arg_value(args, "redis_pool_max"), NULL, 10), atof(get_arg_value(args, "redis_pool_timeout")), atof(get_arg_value(args, "redis_health_interval"))))
+		ONION_WARNING("could not open any redis connections at startup, will keep trying on checkout");
 
-	ctx.parser = &parser;
-	ctx.script = &script;
-	ctx.last_resort = get_arg_value(args, "last_resort");
+	if(get_arg_value(args, "redis_host") && get_arg_value(args, "redis_cache_max") && stsml_redis_cache_init(get_arg_value(args, "redis_host"), atoi(get_arg_value(args, "redis_port")), strtoul(get_arg_value(args, "redis_cache_max"), NULL, 10)))
+		ONION_WARNING("could not start the redis client side cache");
 
-	if(!(script.globals = sts_scope_push(&script, NULL)))
+	/* tasks run on a fixed set of threads, each reusing one interpreter */
+	if((task_policy = stsml_executor_policy(get_arg_value(args, "task_policy"))) < 0)
 	{
-		ONION_ERROR("could not create global scope level");
-		return 1;
+		ONION_WARNING("unknown task policy '%s', tasks will be rejected when the queue is full", get_arg_value(args, "task_policy"));
+		task_policy = STSML_EXECUTOR_REJECT;
 	}
 
+	if(stsml_executor_init(strtoul(get_arg_value(args, "task_workers"), NULL, 10), strtoul(get_arg_value(args, "task_queue"), NULL, 10), task_policy, &stsml_task_worker_init, &stsml_task_worker_destroy, &stsml_task_discard))
+		ONION_WARNING("could not start any task threads, task-create will fail");
 
 	/* initialize onion */
 
-	if(!(ctx.onion = on = onion_new(O_ONE_LOOP)))
+	if(!(on = onion_new(worker_count > 1 ? O_POOL : O_ONE_LOOP)))
 	{
 		ONION_ERROR("could not initialize onion");
 		return 1;
 	}
 
-	/* if specified, run an initializer script */
+	/* initialize the script and the stsml_ctx, and if specified, run an initializer script */
 
-	if(get_arg_value(args, "init"))
+	if(stsml_ctx_setup(&ctx, &script, &parser, on, get_arg_value(args, "init")))
 	{
-		if(!(ctx.cleanup = sts_value_create(&script, STS_ARRAY)))
-		{
-			ONION_ERROR("could not initialize stsml ctx");
-			onion_free(on);
+		onion_free(on);
 
-			return 1;
-		}
+		return 1;
+	}
 
-		if(!(script_text = read_file(&script, get_arg_value(args, "init"), &script_text_size)))
-		{
-			ONION_ERROR("could not initialize stsml ctx");
-			onion_free(on);
+	ctx.last_resort = get_arg_value(args, "last_resort");
 
-			return 1;
-		}
+	/* stale cached pages are refreshed by a render thread that runs the same startup script */
+	render_queue.onion = on;
+	render_queue.init_path = get_arg_value(args, "init");
 
-		/* parse */
+	ctx.render_queue = &render_queue;
 
-		if(!(script.script = sts_parse(&script, NULL, script_text, get_arg_value(args, "init"), &offset, &line)))
+	/* the rest of the pool threads set up their own interpreters when they first get a request */
+	if(worker_count > 1)
+	{
+		if(pthread_key_create(&workers.key, NULL))
 		{
-			ONION_ERROR("could not parse startup script at '%s'", get_arg_value(args, "init"));
+			ONION_ERROR("could not create worker key");
+			stsml_ctx_teardown(&ctx);
 			onion_free(on);
-			free(script_text);
-			
-			return 1;
-		}
 
-		free(script_text);
-
-		if(!(res = sts_eval(&script, script.script, NULL, NULL, 0, 0)))
-		{
-			ONION_ERROR("could not parse startup script at '%s'", get_arg_value(args, "init"));
-			onion_free(on);
-			sts_ast_delete(&script, script.script);
-			free(script_text);
-			
 			return 1;
 		}
-		else
-			sts_value_reference_decrement(&script, res);
 
-		sts_ast_delete(&script, script.script);
-		script.script = NULL;
+		workers.main_thread = pthread_self();
+		workers.init_path = get_arg_value(args, "init");
 
-
-		if(!sts_value_reference_decrement(&script, ctx.cleanup))
-		{
-			ONION_ERROR("could not refdec stsml ctx cleanup values");
-			onion_free(on);
-			
-			return 1;
-		}
+		ctx.workers = &workers;
 	}
 
 	/* initialize handlers */
@@ -1717,7 +5495,7 @@ int main(int argc, char **argv)
 
 	onion_set_hostname(on, "0.0.0.0");
 	onion_set_port(on, get_arg_value(args, "port"));
-	onion_set_max_threads(on, 0);
+	onion_set_max_threads(on, worker_count > 1 ? worker_count : 0);
 
 	onion_set_root_handler(on, router_handler);
 	onion_handler_add(router_handler, file_handler);
@@ -1731,29 +5509,24 @@ int main(int argc, char **argv)
 	ONION_INFO("exitting...");
 
 
-	/* destroy all locals */
-
-	while(ctx.script_locals)
-	{
-		if((temp_stript_locals = ctx.script_locals->value))
-		{
-			if(!sts_destroy_map(&script, temp_stript_locals->locals->locals))
-				ONION_ERROR("could not destroy local map for %d", ctx.script_locals->hash);
-			
-			free(temp_stript_locals->locals);
-		}
-
-		temp_row = ctx.script_locals;
-		ctx.script_locals = ctx.script_locals->next;
-
-		free(temp_row->value);
-		free(temp_row);
-	}
+	stsml_render_queue_stop(&render_queue);
+	stsml_timers_destroy();
+	stsml_executor_destroy();
+	stsml_futures_destroy();
+	stsml_channels_destroy(&stsml_value_discard);
+	stsml_singletons_destroy();
 
+	if(ctx.workers)
+		stsml_workers_teardown(&workers);
 
-	sts_destroy(&script);
+	stsml_ctx_teardown(&ctx);
 
-	if(ctx.redis_ctx) redisFree(ctx.redis_ctx);
+	stsml_redis_cache_destroy();
+	stsml_redis_pool_destroy();
+	stsml_redis_script_destroy();
+	stsml_redis_health_destroy();
+	stsml_cache_destroy();
+	stsml_compress_destroy();
 
 	onion_free(on);
 
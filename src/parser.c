@@ -30,6 +30,7 @@ For more information, please refer to <http://unlicense.org/>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <stdarg.h>
 #include <ctype.h>
 
@@ -41,11 +42,25 @@ enum internal_flags
 	PARSER_DIRECTIVE_PRINT = (1<<3)
 };
 
+/* elements whose whitespace matters, the minifier copies them untouched */
+static const char *raw_tags[] = {"pre", "textarea", "script", "style", NULL};
+
+static int minify = 0;
+
+
+/* every parser made after this minifies its static segments, includes too */
+void stsml_parser_set_minify(int enabled)
+{
+	minify = enabled;
+}
 
 int stsml_parser_init(stsml_parser_ctx_t *ctx)
 {
 	memset(ctx, 0, sizeof(stsml_parser_ctx_t));
 
+	if(minify)
+		ctx->flags |= STSML_PARSER_MINIFY;
+
 	return 0;
 }
 
@@ -85,6 +100,9 @@ int stsml_parser_run(stsml_parser_ctx_t *ctx, char *input, char *pwd)
 						return 1;
 					}
 
+					if(ctx->flags & STSML_PARSER_MINIFY)
+						stsml_parser_minify(ctx, temp_str);
+
 					if(!(escaped_str = stsml_parser_escape(temp_str)))
 					{
 						fprintf(stderr, "could not escape string\n");
@@ -231,6 +249,9 @@ int stsml_parser_run(stsml_parser_ctx_t *ctx, char *input, char *pwd)
 						return 1;
 					}
 
+					if(ctx->flags & STSML_PARSER_MINIFY)
+						stsml_parser_minify(ctx, temp_str);
+
 					if(!(escaped_str = stsml_parser_escape(temp_str)))
 					{
 						fprintf(stderr, "could not escape string\n");
@@ -269,6 +290,9 @@ int stsml_parser_run(stsml_parser_ctx_t *ctx, char *input, char *pwd)
 					return 1;
 				}
 
+				if(ctx->flags & STSML_PARSER_MINIFY)
+					stsml_parser_minify(ctx, temp_str);
+
 				if(!(escaped_str = stsml_parser_escape(temp_str)))
 				{
 					fprintf(stderr, "could not escape string\n");
@@ -368,6 +392,97 @@ char *stsml_parser_escape(char *string)
 	return ret;
 }
 
+/* collapses whitespace runs and drops comments in a static segment, in place since the result is never longer. Conditional comments, quoted attribute values and raw elements are kept as is */
+void stsml_parser_minify(stsml_parser_ctx_t *ctx, char *string)
+{
+	char *in = string, *out = string, *end = NULL;
+	size_t length;
+	unsigned int i;
+	int newline;
+
+
+	while(*in)
+	{
+		if(ctx->raw_tag)
+		{
+			length = strlen(ctx->raw_tag);
+
+			/* copy everything up to the closing tag, which is then handled like any other tag */
+			if(in[0] == '<' && in[1] == '/' && !strncasecmp(&in[2], ctx->raw_tag, length) && !isalnum(in[2 + length]))
+				ctx->raw_tag = NULL;
+			else
+			{
+				*out++ = *in++;
+				continue;
+			}
+		}
+
+		/* an attribute value is copied up to its closing quote */
+		if(ctx->quote)
+		{
+			if(*in == ctx->quote)
+				ctx->quote = 0;
+
+			*out++ = *in++;
+			continue;
+		}
+
+		if(ctx->in_tag)
+		{
+			if(*in == '"' || *in == '\'')
+				ctx->quote = *in;
+			else if(*in == '>')
+				ctx->in_tag = 0;
+		}
+		else if(!strncmp(in, "<!--", 4) && strncmp(in, "<!--[if", 7) && (end = strstr(in + 4, "-->")))
+		{
+			in = end + 3;
+			continue;
+		}
+
+		if(isspace(*in))
+		{
+			newline = 0;
+
+			for(; isspace(*in); ++in)
+				if(*in == '\n')
+					newline = 1;
+
+			/* a dropped comment can leave two runs next to each other */
+			if(out > string && isspace(out[-1]))
+			{
+				if(newline)
+					out[-1] = '\n';
+			}
+			else
+				*out++ = newline ? '\n' : ' ';
+
+			continue;
+		}
+
+		if(!ctx->in_tag && in[0] == '<' && isalpha(in[1]))
+		{
+			for(i = 0; raw_tags[i]; ++i)
+			{
+				length = strlen(raw_tags[i]);
+
+				if(!strncasecmp(&in[1], raw_tags[i], length) && !isalnum(in[1 + length]))
+				{
+					ctx->raw_tag = raw_tags[i];
+					break;
+				}
+			}
+
+			/* the rest of a raw element's opening tag is copied with its body */
+			ctx->in_tag = !ctx->raw_tag;
+		}
+
+		*out++ = *in++;
+	}
+
+	*out = 0x0;
+}
+
 char *stsml_parser_read_file(char *path, unsigned int *size)
 {
 	char *ret = NULL;
@@ -31,21 +31,34 @@ For more information, please refer to <http://unlicense.org/>
 enum
 {
 	STSML_PARSER_STRING_LITERAL = 1,
+	STSML_PARSER_MINIFY = (1<<1)
 };
 
 typedef struct
 {
 	char *pos, *assembled, *start;
 	unsigned int flags;
+
+	/* the whitespace sensitive element the minifier is inside of, it can span several static segments */
+	const char *raw_tag;
+
+	/* whether the minifier is inside a tag, and the quote of the attribute value it is in, 0 if none. A directive can split either */
+	int in_tag;
+	char quote;
 } stsml_parser_ctx_t;
 
 
+void stsml_parser_set_minify(int enabled);
+
+
 int stsml_parser_init(stsml_parser_ctx_t *ctx);
 
 int stsml_parser_run(stsml_parser_ctx_t *ctx, char *input, char *pwd);
 
 char *stsml_parser_escape(char *string);
 
+void stsml_parser_minify(stsml_parser_ctx_t *ctx, char *string);
+
 char *stsml_parser_read_file(char *path, unsigned int *size);
 
 short stsml_asprintf(char **string, const char *fmt, ...);
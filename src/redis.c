@@ -0,0 +1,1656 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+#include "redis.h"
+#include "util.h"
+
+#include <hiredis/async.h>
+
+#include <pthread.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+
+/* a command waiting for the i/o thread. It lives on the caller's stack, the caller sleeps until it is done */
+typedef struct stsml_redis_request_s
+{
+	int argc;
+	const char **argv;
+	const size_t *argv_size;
+
+	redisReply *reply;
+	int done;
+
+	pthread_cond_t cond;
+
+	struct stsml_redis_request_s *next;
+} stsml_redis_request_t;
+
+struct stsml_redis_s
+{
+	char *host;
+	int port;
+
+	/* only ever touched by the i/o thread once it is running */
+	redisAsyncContext *async;
+	int reading, writing;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+
+	/* the i/o thread sleeps in poll, writing to this wakes it up for new requests */
+	int wake[2];
+
+	/* connected stays set while the i/o thread is reconnecting in the background, established once the server answered */
+	int connected, established, stop;
+
+	/* commands handed to hiredis that have no reply yet, only touched by the i/o thread */
+	unsigned int pending;
+
+	/* when the connect started, the connection became busy or the last reply came in. A stall is timed from here, so steady traffic on other fds cannot hide it */
+	double progress;
+
+	/* seconds before the next reconnect, doubled after each attempt */
+	double backoff;
+
+	stsml_redis_request_t *head, *tail;
+
+	unsigned int references;
+
+	struct stsml_redis_s *next;
+};
+
+
+/* every worker runs the startup script, so connections to the same server are shared instead of made once per worker */
+static struct
+{
+	pthread_mutex_t lock;
+	stsml_redis_t *head;
+} redis_shared = {.lock = PTHREAD_MUTEX_INITIALIZER, .head = NULL};
+
+
+/* blocking connections shared by every worker and task. Connections are made when the pool is set up so pages don't pay for them */
+static struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	int configured;
+
+	char *host;
+	int port;
+
+	unsigned int min, max, total;
+
+	/* seconds to wait for a free connection, and how long one can sit idle before it is pinged on checkout */
+	double timeout, health_interval;
+
+	stsml_redis_conn_t *idle;
+} redis_pool = {.lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER, .configured = 0};
+
+
+/* lua scripts by name. Redis knows a script by the sha1 of its source, so the sha is worked out here and the source is only sent again when a server says it doesn't have it */
+typedef struct stsml_redis_script_s
+{
+	char *name, *source;
+	size_t source_size;
+
+	char sha[41];
+
+	struct stsml_redis_script_s *next;
+} stsml_redis_script_t;
+
+static struct
+{
+	pthread_mutex_t lock;
+	stsml_redis_script_t *head;
+} redis_scripts = {.lock = PTHREAD_MUTEX_INITIALIZER, .head = NULL};
+
+
+/* a server that could not be reached. Nobody connects to it again until a background probe gets through, so pages fail right away instead of each waiting out the connect timeout */
+typedef struct stsml_redis_endpoint_s
+{
+	char *host;
+	int port;
+
+	double retry_at, backoff;
+
+	struct stsml_redis_endpoint_s *next;
+} stsml_redis_endpoint_t;
+
+static struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+
+	int started, stop;
+
+	/* for every connection, 0 waits forever */
+	double connect_timeout, command_timeout;
+
+	stsml_redis_endpoint_t *down;
+} redis_health = {.lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER, .started = 0, .connect_timeout = STSML_REDIS_CONNECT_TIMEOUT, .command_timeout = STSML_REDIS_COMMAND_TIMEOUT};
+
+
+static struct timeval stsml_redis_timeval(double seconds)
+{
+	struct timeval tv;
+
+
+	tv.tv_sec = (time_t)seconds;
+	tv.tv_usec = (suseconds_t)((seconds - (double)tv.tv_sec) * 1000000.0);
+
+	return tv;
+}
+
+static stsml_redis_endpoint_t *stsml_redis_endpoint_find(const char *host, int port)
+{
+	stsml_redis_endpoint_t *endpoint = NULL;
+
+
+	for(endpoint = redis_health.down; endpoint; endpoint = endpoint->next)
+	{
+		if(endpoint->port == port && !strcmp(endpoint->host, host))
+			break;
+	}
+
+	return endpoint;
+}
+
+/* a plain connection with the configured timeouts, or NULL */
+static redisContext *stsml_redis_context_open(const char *host, int port)
+{
+	redisContext *ret = NULL;
+	double connect_timeout, command_timeout;
+
+
+	pthread_mutex_lock(&redis_health.lock);
+	connect_timeout = redis_health.connect_timeout;
+	command_timeout = redis_health.command_timeout;
+	pthread_mutex_unlock(&redis_health.lock);
+
+	if(connect_timeout > 0.0)
+		ret = redisConnectWithTimeout(host, port, stsml_redis_timeval(connect_timeout));
+	else
+		ret = redisConnect(host, port);
+
+	if(!ret || ret->err)
+	{
+		if(ret)
+			redisFree(ret);
+
+		return NULL;
+	}
+
+	/* a stalled server makes a command fail after this long instead of holding the thread forever */
+	if(command_timeout > 0.0)
+		redisSetTimeout(ret, stsml_redis_timeval(command_timeout));
+
+	redisEnableKeepAlive(ret);
+
+	return ret;
+}
+
+/* a server is up again once it answers a PING in time */
+static int stsml_redis_endpoint_probe(const char *host, int port)
+{
+	redisContext *context = NULL;
+	redisReply *reply = NULL;
+	int ret = 0;
+
+
+	if(!(context = stsml_redis_context_open(host, port)))
+		return 0;
+
+	if((reply = redisCommand(context, "PING")))
+	{
+		ret = reply->type == REDIS_REPLY_STATUS;
+		freeReplyObject(reply);
+	}
+
+	redisFree(context);
+
+	return ret;
+}
+
+static void *stsml_redis_health_thread(void *data)
+{
+	stsml_redis_endpoint_t *endpoint = NULL, **link = NULL;
+	struct timespec deadline;
+	double now, earliest;
+	int up;
+
+
+	pthread_mutex_lock(&redis_health.lock);
+
+	while(!redis_health.stop)
+	{
+		now = stsml_time_now();
+		earliest = 0.0;
+
+		for(link = &redis_health.down; *link;)
+		{
+			endpoint = *link;
+
+			if(endpoint->retry_at > now)
+			{
+				if(!earliest || endpoint->retry_at < earliest)
+					earliest = endpoint->retry_at;
+
+				link = &endpoint->next;
+				continue;
+			}
+
+			/* only this thread removes endpoints, so it stays valid while unlocked */
+			pthread_mutex_unlock(&redis_health.lock);
+			up = stsml_redis_endpoint_probe(endpoint->host, endpoint->port);
+			pthread_mutex_lock(&redis_health.lock);
+
+			now = stsml_time_now();
+
+			if(up)
+			{
+				fprintf(stderr, "redis server at '%s:%d' is back\n", endpoint->host, endpoint->port);
+
+				*link = endpoint->next;
+
+				free(endpoint->host);
+				free(endpoint);
+
+				continue;
+			}
+
+			endpoint->backoff = endpoint->backoff * 2.0 > STSML_REDIS_BACKOFF_MAX ? STSML_REDIS_BACKOFF_MAX : endpoint->backoff * 2.0;
+			endpoint->retry_at = now + endpoint->backoff;
+
+			if(!earliest || endpoint->retry_at < earliest)
+				earliest = endpoint->retry_at;
+
+			link = &endpoint->next;
+		}
+
+		if(redis_health.stop)
+			break;
+
+		if(earliest)
+		{
+			stsml_deadline(&deadline, earliest - now);
+			pthread_cond_timedwait(&redis_health.cond, &redis_health.lock, &deadline);
+		}
+		else
+			pthread_cond_wait(&redis_health.cond, &redis_health.lock);
+	}
+
+	pthread_mutex_unlock(&redis_health.lock);
+
+	return NULL;
+}
+
+
+/* event hooks for hiredis, these only record what the next poll should wait for */
+
+static void stsml_redis_add_read(void *data)
+{
+	((stsml_redis_t *)data)->reading = 1;
+}
+
+static void stsml_redis_del_read(void *data)
+{
+	((stsml_redis_t *)data)->reading = 0;
+}
+
+static void stsml_redis_add_write(void *data)
+{
+	((stsml_redis_t *)data)->writing = 1;
+}
+
+static void stsml_redis_del_write(void *data)
+{
+	((stsml_redis_t *)data)->writing = 0;
+}
+
+static void stsml_redis_cleanup(void *data)
+{
+	stsml_redis_t *redis = data;
+
+
+	redis->reading = 0;
+	redis->writing = 0;
+}
+
+static void stsml_redis_wake(stsml_redis_t *redis)
+{
+	/* a full pipe already means a wakeup is pending */
+	if(write(redis->wake[1], "", 1) < 0 && errno != EAGAIN)
+		fprintf(stderr, "could not wake redis i/o thread\n");
+}
+
+static void stsml_redis_finish(stsml_redis_t *redis, stsml_redis_request_t *request, redisReply *reply)
+{
+	pthread_mutex_lock(&redis->lock);
+
+	request->reply = reply;
+	request->done = 1;
+
+	pthread_cond_signal(&request->cond);
+	pthread_mutex_unlock(&redis->lock);
+}
+
+/* replies are not freed by hiredis, the waiting caller owns them */
+static void stsml_redis_reply(redisAsyncContext *async, void *reply, void *data)
+{
+	((stsml_redis_t *)async->data)->pending--;
+	((stsml_redis_t *)async->data)->progress = stsml_time_now();
+
+	stsml_redis_finish(async->data, data, reply);
+}
+
+static void stsml_redis_connected_callback(const redisAsyncContext *async, int status)
+{
+	stsml_redis_t *redis = async->data;
+
+
+	if(status != REDIS_OK)
+	{
+		fprintf(stderr, "could not connect to redis server at '%s:%d', retrying in %.1f seconds\n", redis->host, redis->port, redis->backoff);
+
+		/* hiredis frees the context after this returns */
+		redis->async = NULL;
+		return;
+	}
+
+	if(redis->backoff > STSML_REDIS_BACKOFF_MIN)
+		fprintf(stderr, "reconnected to redis server at '%s:%d'\n", redis->host, redis->port);
+
+	redis->established = 1;
+	redis->progress = stsml_time_now();
+	redis->backoff = STSML_REDIS_BACKOFF_MIN;
+}
+
+static void stsml_redis_disconnected(const redisAsyncContext *async, int status)
+{
+	stsml_redis_t *redis = async->data;
+
+
+	if(status != REDIS_OK)
+		fprintf(stderr, "lost connection to redis server at '%s:%d'\n", redis->host, redis->port);
+
+	/* hiredis frees the context after this returns, the i/o thread reconnects */
+	redis->async = NULL;
+}
+
+/* starts a non-blocking connect, it finishes on the i/o thread. Returns 1 if it could not even be started */
+static int stsml_redis_async_open(stsml_redis_t *redis)
+{
+	double command_timeout;
+
+
+	if(!(redis->async = redisAsyncConnect(redis->host, redis->port)) || redis->async->err)
+	{
+		if(redis->async)
+			redisAsyncFree(redis->async);
+
+		redis->async = NULL;
+
+		return 1;
+	}
+
+	redis->async->c.flags |= REDIS_NO_AUTO_FREE_REPLIES;
+	redis->async->data = redis;
+
+	redis->async->ev.data = redis;
+	redis->async->ev.addRead = &stsml_redis_add_read;
+	redis->async->ev.delRead = &stsml_redis_del_read;
+	redis->async->ev.addWrite = &stsml_redis_add_write;
+	redis->async->ev.delWrite = &stsml_redis_del_write;
+	redis->async->ev.cleanup = &stsml_redis_cleanup;
+
+	redisAsyncSetConnectCallback(redis->async, &stsml_redis_connected_callback);
+	redisAsyncSetDisconnectCallback(redis->async, &stsml_redis_disconnected);
+
+	pthread_mutex_lock(&redis_health.lock);
+	command_timeout = redis_health.command_timeout;
+	pthread_mutex_unlock(&redis_health.lock);
+
+	/* hiredis only applies this when stsml_redis_thread calls redisAsyncHandleTimeout */
+	if(command_timeout > 0.0)
+		redisAsyncSetTimeout(redis->async, stsml_redis_timeval(command_timeout));
+
+	/* the connect finishes when the socket becomes writable */
+	redis->reading = 0;
+	redis->writing = 1;
+	redis->established = 0;
+	redis->pending = 0;
+	redis->progress = stsml_time_now();
+
+	return 0;
+}
+
+/* seconds left before the connection counts as stalled. Connecting and waiting on replies are bounded by the timeouts, an idle connection never stalls and gets a negative value */
+static double stsml_redis_remaining(stsml_redis_t *redis)
+{
+	double timeout, left;
+
+
+	pthread_mutex_lock(&redis_health.lock);
+	timeout = !redis->established ? redis_health.connect_timeout : (redis->pending ? redis_health.command_timeout : 0.0);
+	pthread_mutex_unlock(&redis_health.lock);
+
+	if(timeout <= 0.0)
+		return -1.0;
+
+	left = redis->progress + timeout - stsml_time_now();
+
+	return left > 0.0 ? left : 0.0;
+}
+
+/* how long poll may wait, -1 for as long as it takes */
+static int stsml_redis_poll_timeout(stsml_redis_t *redis)
+{
+	double left = stsml_redis_remaining(redis);
+
+
+	return left < 0.0 ? -1 : (int)(left * 1000.0) + 1;
+}
+
+static void *stsml_redis_thread(void *data)
+{
+	stsml_redis_t *redis = data;
+	stsml_redis_request_t *request = NULL, *next = NULL;
+	struct pollfd fds[2];
+	char drain[64];
+	int stop;
+
+
+	while(1)
+	{
+		pthread_mutex_lock(&redis->lock);
+
+		stop = redis->stop;
+		request = redis->head;
+		redis->head = redis->tail = NULL;
+
+		pthread_mutex_unlock(&redis->lock);
+
+		/* hand new commands to hiredis, they are written once the socket is writable */
+		for(; request; request = next)
+		{
+			next = request->next;
+
+			if(!redis->async || !request->argc || redisAsyncCommandArgv(redis->async, &stsml_redis_reply, request, request->argc, request->argv, request->argv_size) != REDIS_OK)
+				stsml_redis_finish(redis, request, NULL);
+			else if(!redis->pending++)
+				redis->progress = stsml_time_now();
+		}
+
+		if(stop)
+			break;
+
+		/* the connection is gone. Callers fail right away while this waits out the backoff and tries again */
+		if(!redis->async)
+		{
+			pthread_mutex_lock(&redis->lock);
+			redis->connected = 0;
+			pthread_mutex_unlock(&redis->lock);
+
+			fds[0].fd = redis->wake[0];
+			fds[0].events = POLLIN;
+			fds[0].revents = 0;
+
+			if(poll(fds, 1, (int)(redis->backoff * 1000.0)) > 0)
+				while(read(redis->wake[0], drain, sizeof(drain)) > 0);
+
+			pthread_mutex_lock(&redis->lock);
+			stop = redis->stop;
+			pthread_mutex_unlock(&redis->lock);
+
+			if(stop)
+				break;
+
+			redis->backoff = redis->backoff * 2.0 > STSML_REDIS_BACKOFF_MAX ? STSML_REDIS_BACKOFF_MAX : redis->backoff * 2.0;
+
+			if(!stsml_redis_async_open(redis))
+			{
+				pthread_mutex_lock(&redis->lock);
+				redis->connected = 1;
+				pthread_mutex_unlock(&redis->lock);
+			}
+
+			continue;
+		}
+
+		fds[0].fd = redis->async->c.fd;
+		fds[0].events = (redis->reading ? POLLIN : 0) | (redis->writing ? POLLOUT : 0);
+		fds[0].revents = 0;
+
+		fds[1].fd = redis->wake[0];
+		fds[1].events = POLLIN;
+		fds[1].revents = 0;
+
+		if(poll(fds, 2, stsml_redis_poll_timeout(redis)) < 0)
+			continue;
+
+		if(fds[1].revents & POLLIN)
+			while(read(redis->wake[0], drain, sizeof(drain)) > 0);
+
+		if(fds[0].revents & (POLLIN | POLLERR | POLLHUP))
+			redisAsyncHandleRead(redis->async);
+
+		if(redis->async && (fds[0].revents & POLLOUT))
+			redisAsyncHandleWrite(redis->async);
+
+		/* checked after every poll, wakeups for new commands keep poll returning early while the oldest reply is still missing. hiredis fails every waiting command and drops the connection */
+		if(redis->async && stsml_redis_remaining(redis) == 0.0)
+		{
+			fprintf(stderr, "redis server at '%s:%d' timed out\n", redis->host, redis->port);
+			redisAsyncHandleTimeout(redis->async);
+		}
+	}
+
+	/* pending callbacks are called with no reply when the context goes away */
+	if(redis->async)
+		redisAsyncFree(redis->async);
+
+	redis->async = NULL;
+
+	pthread_mutex_lock(&redis->lock);
+
+	redis->connected = 0;
+	request = redis->head;
+	redis->head = redis->tail = NULL;
+
+	pthread_mutex_unlock(&redis->lock);
+
+	for(; request; request = next)
+	{
+		next = request->next;
+		stsml_redis_finish(redis, request, NULL);
+	}
+
+	return NULL;
+}
+
+static void stsml_redis_free(stsml_redis_t *redis)
+{
+	if(redis->async)
+		redisAsyncFree(redis->async);
+
+	if(redis->wake[0] >= 0)
+		close(redis->wake[0]);
+
+	if(redis->wake[1] >= 0)
+		close(redis->wake[1]);
+
+	pthread_mutex_destroy(&redis->lock);
+
+	free(redis->host);
+	free(redis);
+}
+
+/* returns the shared connection to host:port, making it if needed. Every call needs a stsml_redis_release */
+stsml_redis_t *stsml_redis_connect(const char *host, int port)
+{
+	stsml_redis_t *redis = NULL;
+
+
+	pthread_mutex_lock(&redis_shared.lock);
+
+	/* a connection that is down is still shared, its i/o thread keeps reconnecting */
+	for(redis = redis_shared.head; redis; redis = redis->next)
+	{
+		if(redis->port == port && !strcmp(redis->host, host))
+		{
+			redis->references++;
+			pthread_mutex_unlock(&redis_shared.lock);
+
+			return redis;
+		}
+	}
+
+	if(!(redis = calloc(1, sizeof(stsml_redis_t))))
+	{
+		fprintf(stderr, "could not allocate redis connection\n");
+		pthread_mutex_unlock(&redis_shared.lock);
+
+		return NULL;
+	}
+
+	redis->wake[0] = redis->wake[1] = -1;
+	redis->port = port;
+	redis->references = 1;
+	redis->backoff = STSML_REDIS_BACKOFF_MIN;
+
+	pthread_mutex_init(&redis->lock, NULL);
+
+	if(!(redis->host = strdup(host)))
+	{
+		fprintf(stderr, "could not allocate redis host\n");
+		goto fail;
+	}
+
+	if(pipe(redis->wake) || fcntl(redis->wake[0], F_SETFL, O_NONBLOCK) || fcntl(redis->wake[1], F_SETFL, O_NONBLOCK))
+	{
+		fprintf(stderr, "could not create redis wakeup pipe\n");
+		goto fail;
+	}
+
+	if(stsml_redis_async_open(redis))
+	{
+		fprintf(stderr, "could not connect to redis server at '%s:%d'\n", host, port);
+		goto fail;
+	}
+
+	redis->connected = 1;
+
+	if(pthread_create(&redis->thread, NULL, &stsml_redis_thread, redis))
+	{
+		fprintf(stderr, "could not start redis i/o thread\n");
+		goto fail;
+	}
+
+	redis->next = redis_shared.head;
+	redis_shared.head = redis;
+
+	pthread_mutex_unlock(&redis_shared.lock);
+
+	return redis;
+
+	fail:
+	stsml_redis_free(redis);
+	pthread_mutex_unlock(&redis_shared.lock);
+
+	return NULL;
+}
+
+void stsml_redis_release(stsml_redis_t *redis)
+{
+	stsml_redis_t **link = NULL;
+
+
+	if(!redis)
+		return;
+
+	pthread_mutex_lock(&redis_shared.lock);
+
+	if(--redis->references)
+	{
+		pthread_mutex_unlock(&redis_shared.lock);
+		return;
+	}
+
+	for(link = &redis_shared.head; *link; link = &(*link)->next)
+	{
+		if(*link == redis)
+		{
+			*link = redis->next;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&redis_shared.lock);
+
+
+	pthread_mutex_lock(&redis->lock);
+	redis->stop = 1;
+	pthread_mutex_unlock(&redis->lock);
+
+	stsml_redis_wake(redis);
+
+	pthread_join(redis->thread, NULL);
+
+	stsml_redis_free(redis);
+}
+
+const char *stsml_redis_host(stsml_redis_t *redis, int *port)
+{
+	*port = redis->port;
+
+	return redis->host;
+}
+
+int stsml_redis_connected(stsml_redis_t *redis)
+{
+	int ret;
+
+
+	pthread_mutex_lock(&redis->lock);
+	ret = redis->connected;
+	pthread_mutex_unlock(&redis->lock);
+
+	return ret;
+}
+
+/* sends a command and sleeps until its reply is in. The arguments are only read by the i/o thread while the caller waits, so nothing is copied. NULL if the connection is gone */
+redisReply *stsml_redis_command(stsml_redis_t *redis, int argc, const char **argv, const size_t *argv_size)
+{
+	stsml_redis_args_t command;
+	redisReply *ret = NULL;
+
+
+	stsml_redis_args_init(&command);
+
+	command.argc = argc;
+	command.argv = argv;
+	command.argv_size = (size_t *)argv_size;
+
+	stsml_redis_pipeline(redis, &command, 1, &ret);
+
+	return ret;
+}
+
+/* queues every command at once so they go out in as few writes as possible, then sleeps until all replies are in. Replies are NULL for commands that could not be sent. Returns 1 if the connection is gone */
+int stsml_redis_pipeline(stsml_redis_t *redis, stsml_redis_args_t *commands, unsigned int count, redisReply **replies)
+{
+	stsml_redis_request_t *requests = NULL;
+	unsigned int i;
+
+
+	if(!count)
+		return 0;
+
+	memset(replies, 0, count * sizeof(redisReply *));
+
+	if(!(requests = calloc(count, sizeof(stsml_redis_request_t))))
+	{
+		fprintf(stderr, "could not allocate redis requests\n");
+		return 1;
+	}
+
+	for(i = 0; i < count; ++i)
+	{
+		requests[i].argc = commands[i].argc;
+		requests[i].argv = commands[i].argv;
+		requests[i].argv_size = commands[i].argv_size;
+		requests[i].next = (i + 1 < count) ? &requests[i + 1] : NULL;
+
+		pthread_cond_init(&requests[i].cond, NULL);
+	}
+
+	pthread_mutex_lock(&redis->lock);
+
+	if(!redis->connected || redis->stop)
+	{
+		pthread_mutex_unlock(&redis->lock);
+
+		for(i = 0; i < count; ++i)
+			pthread_cond_destroy(&requests[i].cond);
+
+		free(requests);
+
+		return 1;
+	}
+
+	if(redis->tail)
+		redis->tail->next = requests;
+	else
+		redis->head = requests;
+
+	redis->tail = &requests[count - 1];
+
+	pthread_mutex_unlock(&redis->lock);
+
+	stsml_redis_wake(redis);
+
+	/* replies come back in order, so waiting on the last one is almost always all it takes */
+	pthread_mutex_lock(&redis->lock);
+
+	for(i = count; i > 0; --i)
+	{
+		while(!requests[i - 1].done)
+			pthread_cond_wait(&requests[i - 1].cond, &redis->lock);
+	}
+
+	pthread_mutex_unlock(&redis->lock);
+
+	for(i = 0; i < count; ++i)
+	{
+		replies[i] = requests[i].reply;
+		pthread_cond_destroy(&requests[i].cond);
+	}
+
+	free(requests);
+
+	return 0;
+}
+
+static redisContext *stsml_redis_pool_connect(void)
+{
+	return stsml_redis_context_connect(redis_pool.host, redis_pool.port);
+}
+
+/* a connection that sat idle for a while may have been dropped by the server or something in between */
+static int stsml_redis_pool_healthy(stsml_redis_conn_t *conn)
+{
+	redisReply *reply = NULL;
+	int ret;
+
+
+	if(conn->context->err)
+		return 0;
+
+	if(stsml_time_now() - conn->last_used < redis_pool.health_interval)
+		return 1;
+
+	if(!(reply = redisCommand(conn->context, "PING")))
+		return 0;
+
+	ret = reply->type == REDIS_REPLY_STATUS;
+
+	freeReplyObject(reply);
+
+	return ret;
+}
+
+/* sets the pool up once, later calls are ignored so every worker can run the same init script. Returns 1 if not even one connection could be made, the pool still tries again on checkout */
+int stsml_redis_pool_init(const char *host, int port, unsigned int min, unsigned int max, double timeout, double health_interval)
+{
+	stsml_redis_conn_t *conn = NULL;
+	unsigned int i;
+	int ret = 0;
+
+
+	pthread_mutex_lock(&redis_pool.lock);
+
+	if(redis_pool.configured)
+	{
+		pthread_mutex_unlock(&redis_pool.lock);
+		return 0;
+	}
+
+	if(!(redis_pool.host = strdup(host)))
+	{
+		fprintf(stderr, "could not allocate redis pool host\n");
+		pthread_mutex_unlock(&redis_pool.lock);
+
+		return 1;
+	}
+
+	redis_pool.port = port;
+	redis_pool.max = max ? max : 1;
+	redis_pool.min = min > redis_pool.max ? redis_pool.max : min;
+	redis_pool.timeout = timeout;
+	redis_pool.health_interval = health_interval;
+	redis_pool.configured = 1;
+
+	/* at least one connection is opened, even with a min of 0, so a server that is not there is noticed now */
+	for(i = 0; i < redis_pool.min || !i; ++i)
+	{
+		if(!(conn = calloc(1, sizeof(stsml_redis_conn_t))))
+		{
+			fprintf(stderr, "could not allocate redis pool connection\n");
+			break;
+		}
+
+		if(!(conn->context = stsml_redis_pool_connect()))
+		{
+			free(conn);
+			break;
+		}
+
+		conn->last_used = stsml_time_now();
+		conn->next = redis_pool.idle;
+
+		redis_pool.idle = conn;
+		redis_pool.total++;
+	}
+
+	/* nothing could connect, a later call can try again */
+	if(!redis_pool.total)
+	{
+		free(redis_pool.host);
+		redis_pool.host = NULL;
+		redis_pool.configured = 0;
+
+		ret = 1;
+	}
+
+	pthread_mutex_unlock(&redis_pool.lock);
+
+	return ret;
+}
+
+void stsml_redis_pool_destroy(void)
+{
+	stsml_redis_conn_t *conn = NULL;
+
+
+	pthread_mutex_lock(&redis_pool.lock);
+
+	while((conn = redis_pool.idle))
+	{
+		redis_pool.idle = conn->next;
+
+		redisFree(conn->context);
+		free(conn);
+	}
+
+	free(redis_pool.host);
+
+	redis_pool.host = NULL;
+	redis_pool.total = 0;
+	redis_pool.configured = 0;
+
+	pthread_mutex_unlock(&redis_pool.lock);
+}
+
+/* borrows an idle connection, makes a new one below the maximum, or waits for one up to the checkout timeout. NULL if there is no pool or nothing came free */
+stsml_redis_conn_t *stsml_redis_pool_checkout(void)
+{
+	stsml_redis_conn_t *conn = NULL;
+	struct timespec deadline;
+	int grow = 0;
+
+
+	pthread_mutex_lock(&redis_pool.lock);
+
+	if(!redis_pool.configured)
+	{
+		pthread_mutex_unlock(&redis_pool.lock);
+		return NULL;
+	}
+
+	stsml_deadline(&deadline, redis_pool.timeout);
+
+	while(1)
+	{
+		if((conn = redis_pool.idle))
+		{
+			redis_pool.idle = conn->next;
+			break;
+		}
+
+		if(redis_pool.total < redis_pool.max)
+		{
+			redis_pool.total++;
+			grow = 1;
+			break;
+		}
+
+		if(pthread_cond_timedwait(&redis_pool.cond, &redis_pool.lock, &deadline) == ETIMEDOUT)
+		{
+			pthread_mutex_unlock(&redis_pool.lock);
+			fprintf(stderr, "timed out waiting for a redis connection from the pool\n");
+
+			return NULL;
+		}
+	}
+
+	pthread_mutex_unlock(&redis_pool.lock);
+
+
+	if(grow && !(conn = calloc(1, sizeof(stsml_redis_conn_t))))
+		fprintf(stderr, "could not allocate redis pool connection\n");
+
+	/* a dead connection is replaced in place, the caller never sees it */
+	if(conn && !grow && !stsml_redis_pool_healthy(conn))
+	{
+		redisFree(conn->context);
+		conn->context = NULL;
+	}
+
+	if(conn && !conn->context && !(conn->context = stsml_redis_pool_connect()))
+	{
+		free(conn);
+		conn = NULL;
+	}
+
+	if(!conn)
+	{
+		pthread_mutex_lock(&redis_pool.lock);
+
+		redis_pool.total--;
+
+		pthread_cond_signal(&redis_pool.cond);
+		pthread_mutex_unlock(&redis_pool.lock);
+	}
+
+	return conn;
+}
+
+/* copies out the pool's server. Returns 1 if there is no pool */
+int stsml_redis_pool_endpoint(char **host, int *port)
+{
+	int ret = 1;
+
+
+	pthread_mutex_lock(&redis_pool.lock);
+
+	if(redis_pool.configured && (*host = strdup(redis_pool.host)))
+	{
+		*port = redis_pool.port;
+		ret = 0;
+	}
+
+	pthread_mutex_unlock(&redis_pool.lock);
+
+	return ret;
+}
+
+/* returns a connection to the pool. One that failed is closed so the next checkout makes a fresh one */
+void stsml_redis_pool_checkin(stsml_redis_conn_t *conn)
+{
+	if(!conn)
+		return;
+
+	pthread_mutex_lock(&redis_pool.lock);
+
+	if(conn->context->err || !redis_pool.configured)
+	{
+		redisFree(conn->context);
+		free(conn);
+
+		redis_pool.total--;
+	}
+	else
+	{
+		conn->last_used = stsml_time_now();
+		conn->next = redis_pool.idle;
+
+		redis_pool.idle = conn;
+	}
+
+	pthread_cond_signal(&redis_pool.cond);
+	pthread_mutex_unlock(&redis_pool.lock);
+}
+
+void stsml_redis_set_timeouts(double connect_timeout, double command_timeout)
+{
+	pthread_mutex_lock(&redis_health.lock);
+
+	redis_health.connect_timeout = connect_timeout;
+	redis_health.command_timeout = command_timeout;
+
+	pthread_mutex_unlock(&redis_health.lock);
+}
+
+/* takes a server out of use until the health thread can reach it again */
+void stsml_redis_endpoint_failed(const char *host, int port)
+{
+	stsml_redis_endpoint_t *endpoint = NULL;
+
+
+	if(!host)
+		return;
+
+	pthread_mutex_lock(&redis_health.lock);
+
+	if(stsml_redis_endpoint_find(host, port) || redis_health.stop)
+	{
+		pthread_mutex_unlock(&redis_health.lock);
+		return;
+	}
+
+	if(!(endpoint = calloc(1, sizeof(stsml_redis_endpoint_t))) || !(endpoint->host = strdup(host)))
+	{
+		fprintf(stderr, "could not allocate redis endpoint\n");
+		pthread_mutex_unlock(&redis_health.lock);
+
+		free(endpoint);
+
+		return;
+	}
+
+	fprintf(stderr, "redis server at '%s:%d' is down, commands to it fail until it answers again\n", host, port);
+
+	endpoint->port = port;
+	endpoint->backoff = STSML_REDIS_BACKOFF_MIN;
+	endpoint->retry_at = stsml_time_now() + endpoint->backoff;
+
+	endpoint->next = redis_health.down;
+	redis_health.down = endpoint;
+
+	if(!redis_health.started && !pthread_create(&redis_health.thread, NULL, &stsml_redis_health_thread, NULL))
+		redis_health.started = 1;
+
+	pthread_cond_signal(&redis_health.cond);
+	pthread_mutex_unlock(&redis_health.lock);
+}
+
+int stsml_redis_endpoint_up(const char *host, int port)
+{
+	int ret;
+
+
+	pthread_mutex_lock(&redis_health.lock);
+	ret = !stsml_redis_endpoint_find(host, port);
+	pthread_mutex_unlock(&redis_health.lock);
+
+	return ret;
+}
+
+/* a blocking connection with the configured timeouts. NULL right away if the server is known to be down */
+redisContext *stsml_redis_context_connect(const char *host, int port)
+{
+	redisContext *ret = NULL;
+
+
+	if(!stsml_redis_endpoint_up(host, port))
+		return NULL;
+
+	if(!(ret = stsml_redis_context_open(host, port)))
+	{
+		fprintf(stderr, "could not connect to redis server at '%s:%d'\n", host, port);
+		stsml_redis_endpoint_failed(host, port);
+	}
+
+	return ret;
+}
+
+/* replaces a broken connection once its server is reachable again. Returns 1 if it still can't be used */
+int stsml_redis_context_check(redisContext **context)
+{
+	redisContext *temp = NULL;
+
+
+	if(!(*context)->err)
+		return 0;
+
+	if(!(temp = stsml_redis_context_connect((*context)->tcp.host, (*context)->tcp.port)))
+		return 1;
+
+	redisFree(*context);
+	*context = temp;
+
+	return 0;
+}
+
+/* a connection for commands that block on the server, like XREADGROUP BLOCK or waiting on pub/sub messages, so it has no command timeout */
+redisContext *stsml_redis_context_blocking(const char *host, int port)
+{
+	redisContext *ret = NULL;
+
+
+	if((ret = stsml_redis_context_connect(host, port)))
+		redisSetTimeout(ret, stsml_redis_timeval(0.0));
+
+	return ret;
+}
+
+/* a connection subscribed to every channel matching pattern */
+redisContext *stsml_redis_subscribe(const char *host, int port, const char *pattern)
+{
+	redisContext *ret = NULL;
+	redisReply *reply = NULL;
+
+
+	if(!(ret = stsml_redis_context_blocking(host, port)))
+		return NULL;
+
+	if(!(reply = redisCommand(ret, "PSUBSCRIBE %s", pattern)) || reply->type != REDIS_REPLY_ARRAY)
+	{
+		fprintf(stderr, "could not subscribe to '%s' on redis server at '%s:%d'\n", pattern, host, port);
+
+		if(reply)
+			freeReplyObject(reply);
+
+		redisFree(ret);
+
+		return NULL;
+	}
+
+	freeReplyObject(reply);
+
+	return ret;
+}
+
+void stsml_redis_health_destroy(void)
+{
+	stsml_redis_endpoint_t *endpoint = NULL;
+
+
+	pthread_mutex_lock(&redis_health.lock);
+
+	redis_health.stop = 1;
+	pthread_cond_signal(&redis_health.cond);
+
+	pthread_mutex_unlock(&redis_health.lock);
+
+	if(redis_health.started)
+		pthread_join(redis_health.thread, NULL);
+
+	pthread_mutex_lock(&redis_health.lock);
+
+	while((endpoint = redis_health.down))
+	{
+		redis_health.down = endpoint->next;
+
+		free(endpoint->host);
+		free(endpoint);
+	}
+
+	redis_health.started = 0;
+
+	pthread_mutex_unlock(&redis_health.lock);
+}
+
+void stsml_redis_args_init(stsml_redis_args_t *args)
+{
+	memset(args, 0, sizeof(stsml_redis_args_t));
+}
+
+/* keeps data to be freed with the args */
+static int stsml_redis_args_own(stsml_redis_args_t *args, const char *data)
+{
+	char **owned_list = NULL;
+	unsigned int allocated;
+
+
+	if(args->owned_length == args->owned_allocated)
+	{
+		allocated = args->owned_allocated ? args->owned_allocated * 2 : 16;
+
+		if(!(owned_list = realloc(args->owned, allocated * sizeof(char *))))
+		{
+			fprintf(stderr, "could not grow owned redis arguments\n");
+			return 1;
+		}
+
+		args->owned = owned_list;
+		args->owned_allocated = allocated;
+	}
+
+	args->owned[args->owned_length++] = (char *)data;
+
+	return 0;
+}
+
+/* adds an argument, doubling the vectors when full. An owned argument is freed with the args */
+int stsml_redis_args_push(stsml_redis_args_t *args, const char *data, size_t size, int owned)
+{
+	const char **argv = NULL;
+	size_t *argv_size = NULL;
+	unsigned int allocated;
+
+
+	if((unsigned int)args->argc == args->allocated)
+	{
+		allocated = args->allocated ? args->allocated * 2 : 16;
+
+		if(!(argv = realloc(args->argv, allocated * sizeof(const char *))))
+		{
+			fprintf(stderr, "could not grow redis arguments\n");
+			return 1;
+		}
+
+		args->argv = argv;
+
+		if(!(argv_size = realloc(args->argv_size, allocated * sizeof(size_t))))
+		{
+			fprintf(stderr, "could not grow redis argument sizes\n");
+			return 1;
+		}
+
+		args->argv_size = argv_size;
+		args->allocated = allocated;
+	}
+
+	if(owned && stsml_redis_args_own(args, data))
+		return 1;
+
+	args->argv[args->argc] = data;
+	args->argv_size[args->argc] = size;
+	args->argc++;
+
+	return 0;
+}
+
+/* replaces an argument that was already pushed, like a count that is only known once the rest of the command is built */
+int stsml_redis_args_set(stsml_redis_args_t *args, int index, const char *data, size_t size, int owned)
+{
+	if(index >= args->argc || (owned && stsml_redis_args_own(args, data)))
+		return 1;
+
+	args->argv[index] = data;
+	args->argv_size[index] = size;
+
+	return 0;
+}
+
+void stsml_redis_args_free(stsml_redis_args_t *args)
+{
+	unsigned int i;
+
+
+	for(i = 0; i < args->owned_length; ++i)
+		free(args->owned[i]);
+
+	free(args->owned);
+	free(args->argv);
+	free(args->argv_size);
+
+	stsml_redis_args_init(args);
+}
+
+/* registers or replaces a script. Every worker runs the init script, loading the same source again changes nothing */
+int stsml_redis_script_load(const char *name, const char *source, size_t size, char sha[41])
+{
+	stsml_redis_script_t *script = NULL;
+	char *copy = NULL;
+
+
+	if(!(copy = malloc(size + 1)))
+	{
+		fprintf(stderr, "could not allocate redis script source\n");
+		return 1;
+	}
+
+	memcpy(copy, source, size);
+	copy[size] = 0x0;
+
+	pthread_mutex_lock(&redis_scripts.lock);
+
+	for(script = redis_scripts.head; script; script = script->next)
+	{
+		if(!strcmp(script->name, name))
+			break;
+	}
+
+	if(!script)
+	{
+		if(!(script = calloc(1, sizeof(stsml_redis_script_t))) || !(script->name = strdup(name)))
+		{
+			fprintf(stderr, "could not allocate redis script\n");
+			pthread_mutex_unlock(&redis_scripts.lock);
+
+			free(script);
+			free(copy);
+
+			return 1;
+		}
+
+		script->next = redis_scripts.head;
+		redis_scripts.head = script;
+	}
+
+	free(script->source);
+
+	script->source = copy;
+	script->source_size = size;
+	stsml_sha1_hex(copy, size, script->sha);
+
+	if(sha)
+		memcpy(sha, script->sha, sizeof(script->sha));
+
+	pthread_mutex_unlock(&redis_scripts.lock);
+
+	return 0;
+}
+
+/* copies out the sha of a loaded script, and its source if asked for. Returns 1 if there is no script by that name */
+int stsml_redis_script_get(const char *name, char sha[41], char **source, size_t *size)
+{
+	stsml_redis_script_t *script = NULL;
+	int ret = 1;
+
+
+	pthread_mutex_lock(&redis_scripts.lock);
+
+	for(script = redis_scripts.head; script; script = script->next)
+	{
+		if(!strcmp(script->name, name))
+			break;
+	}
+
+	if(script)
+	{
+		memcpy(sha, script->sha, sizeof(script->sha));
+		ret = 0;
+
+		if(source && !(*source = malloc(script->source_size + 1)))
+		{
+			fprintf(stderr, "could not allocate redis script source\n");
+			ret = 1;
+		}
+		else if(source)
+		{
+			memcpy(*source, script->source, script->source_size + 1);
+			*size = script->source_size;
+		}
+	}
+
+	pthread_mutex_unlock(&redis_scripts.lock);
+
+	return ret;
+}
+
+void stsml_redis_script_destroy(void)
+{
+	stsml_redis_script_t *script = NULL;
+
+
+	pthread_mutex_lock(&redis_scripts.lock);
+
+	while((script = redis_scripts.head))
+	{
+		redis_scripts.head = script->next;
+
+		free(script->name);
+		free(script->source);
+		free(script);
+	}
+
+	pthread_mutex_unlock(&redis_scripts.lock);
+}
+
+/* the command as one buffer with its name uppercased and every argument prefixed by its size, so equal commands compare equal with memcmp */
+char *stsml_redis_args_serialize(const stsml_redis_args_t *args, size_t *size)
+{
+	char *ret = NULL, *pos = NULL;
+	size_t i, j;
+
+
+	for(i = 0, *size = 0; i < (size_t)args->argc; ++i)
+		*size += sizeof(size_t) + args->argv_size[i];
+
+	if(!(ret = malloc(*size ? *size : 1)))
+	{
+		fprintf(stderr, "could not allocate serialized redis command\n");
+		return NULL;
+	}
+
+	for(i = 0, pos = ret; i < (size_t)args->argc; ++i)
+	{
+		memcpy(pos, &args->argv_size[i], sizeof(size_t));
+		pos += sizeof(size_t);
+
+		if(!i)
+		{
+			for(j = 0; j < args->argv_size[i]; ++j)
+				pos[j] = toupper((unsigned char)args->argv[i][j]);
+		}
+		else
+			memcpy(pos, args->argv[i], args->argv_size[i]);
+
+		pos += args->argv_size[i];
+	}
+
+	return ret;
+}
+
+/* commands that only read and always give the same reply while the data is unchanged. Anything not listed counts as a write */
+static const char *readonly_commands[] = {
+	"GET", "MGET", "STRLEN", "GETRANGE", "EXISTS", "TYPE", "GETBIT", "BITCOUNT",
+	"HGET", "HMGET", "HGETALL", "HKEYS", "HVALS", "HLEN", "HEXISTS", "HSTRLEN",
+	"LRANGE", "LINDEX", "LLEN",
+	"SMEMBERS", "SISMEMBER", "SMISMEMBER", "SCARD", "SINTER", "SUNION", "SDIFF",
+	"ZRANGE", "ZRANGEBYSCORE", "ZRANGEBYLEX", "ZREVRANGE", "ZREVRANGEBYSCORE", "ZSCORE", "ZMSCORE", "ZCARD", "ZRANK", "ZREVRANK", "ZCOUNT",
+	"XRANGE", "XREVRANGE", "XLEN",
+	NULL
+};
+
+int stsml_redis_readonly(const stsml_redis_args_t *args)
+{
+	unsigned int i;
+
+
+	if(!args->argc)
+		return 1;
+
+	for(i = 0; readonly_commands[i]; ++i)
+	{
+		if(strlen(readonly_commands[i]) == args->argv_size[0] && !strncasecmp(readonly_commands[i], args->argv[0], args->argv_size[0]))
+			return 1;
+	}
+
+	return 0;
+}
+
+/* the reply this page already got for the same read, still owned by the memo. Any other command is taken as a write and forgets everything */
+redisReply *stsml_redis_memo_get(stsml_redis_memo_t *memo, const stsml_redis_args_t *command)
+{
+	stsml_redis_memo_entry_t *entry = NULL;
+	unsigned long long hash;
+	char *serialized = NULL;
+	size_t size;
+
+
+	if(!memo->active || !command->argc)
+		return NULL;
+
+	if(!stsml_redis_readonly(command))
+	{
+		stsml_redis_memo_clear(memo);
+		return NULL;
+	}
+
+	if(!memo->length || !(serialized = stsml_redis_args_serialize(command, &size)))
+		return NULL;
+
+	hash = stsml_hash(serialized, size);
+
+	for(entry = memo->buckets[hash % STSML_REDIS_MEMO_BUCKETS]; entry; entry = entry->next)
+	{
+		if(entry->hash == hash && entry->command_size == size && !memcmp(entry->command, serialized, size))
+			break;
+	}
+
+	free(serialized);
+
+	return entry ? entry->reply : NULL;
+}
+
+/* keeps the reply to a read until the memo is cleared. Returns 0 if the memo took the reply, otherwise the caller still owns it */
+int stsml_redis_memo_put(stsml_redis_memo_t *memo, const stsml_redis_args_t *command, redisReply *reply)
+{
+	stsml_redis_memo_entry_t *entry = NULL;
+
+
+	if(!memo->active || !command->argc || memo->length >= STSML_REDIS_MEMO_MAX || reply->type == REDIS_REPLY_ERROR || !stsml_redis_readonly(command))
+		return 1;
+
+	if(!(entry = calloc(1, sizeof(stsml_redis_memo_entry_t))))
+	{
+		fprintf(stderr, "could not allocate redis memo entry\n");
+		return 1;
+	}
+
+	if(!(entry->command = stsml_redis_args_serialize(command, &entry->command_size)))
+	{
+		free(entry);
+		return 1;
+	}
+
+	entry->hash = stsml_hash(entry->command, entry->command_size);
+	entry->reply = reply;
+
+	entry->next = memo->buckets[entry->hash % STSML_REDIS_MEMO_BUCKETS];
+	memo->buckets[entry->hash % STSML_REDIS_MEMO_BUCKETS] = entry;
+
+	memo->length++;
+
+	return 0;
+}
+
+void stsml_redis_memo_clear(stsml_redis_memo_t *memo)
+{
+	stsml_redis_memo_entry_t *entry = NULL;
+	unsigned int i;
+
+
+	for(i = 0; i < STSML_REDIS_MEMO_BUCKETS && memo->length; ++i)
+	{
+		while((entry = memo->buckets[i]))
+		{
+			memo->buckets[i] = entry->next;
+
+			freeReplyObject(entry->reply);
+			free(entry->command);
+			free(entry);
+
+			memo->length--;
+		}
+	}
+}
+
+/* same as stsml_redis_pipeline for a blocking connection. Every command is buffered first and written in one go, then the replies are read back. Returns 1 if the connection failed */
+int stsml_redis_context_pipeline(redisContext *context, stsml_redis_args_t *commands, unsigned int count, redisReply **replies)
+{
+	unsigned int i, sent = 0;
+	void *reply = NULL;
+
+
+	memset(replies, 0, count * sizeof(redisReply *));
+
+	if(context->err)
+		return 1;
+
+	/* empty commands are skipped and get no reply */
+	for(sent = 0; sent < count; ++sent)
+	{
+		if(commands[sent].argc && redisAppendCommandArgv(context, commands[sent].argc, commands[sent].argv, commands[sent].argv_size) != REDIS_OK)
+			break;
+	}
+
+	/* whatever was buffered still has to be read back, or the connection would be out of sync */
+	for(i = 0; i < sent; ++i)
+	{
+		if(!commands[i].argc)
+			continue;
+
+		/* a dead or stalled server, later calls skip it until it answers again */
+		if(redisGetReply(context, &reply) != REDIS_OK)
+		{
+			fprintf(stderr, "redis command failed: %s\n", context->errstr);
+			stsml_redis_endpoint_failed(context->tcp.host, context->tcp.port);
+
+			return 1;
+		}
+
+		replies[i] = reply;
+	}
+
+	return sent < count;
+}
\ No newline at end of file
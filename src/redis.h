@@ -0,0 +1,165 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+#ifndef REDIS_H__
+#define REDIS_H__
+
+#include <hiredis/hiredis.h>
+
+#include <stddef.h>
+
+/* defaults for the blocking connection pool, used by the redis-pool builtin and the -redis_* flags */
+#define STSML_REDIS_POOL_MIN 2
+#define STSML_REDIS_POOL_MAX 16
+#define STSML_REDIS_POOL_TIMEOUT 1.0
+#define STSML_REDIS_POOL_HEALTH_INTERVAL 30.0
+
+/* every connection gives up on connecting or on a reply after these many seconds. A server that failed is retried in the background, starting after the minimum backoff and doubling up to the maximum */
+#define STSML_REDIS_CONNECT_TIMEOUT 1.0
+#define STSML_REDIS_COMMAND_TIMEOUT 5.0
+#define STSML_REDIS_BACKOFF_MIN 0.1
+#define STSML_REDIS_BACKOFF_MAX 30.0
+
+/* the arguments of one command. Strings normally point into script values that outlive the command, only formatted numbers are owned */
+typedef struct
+{
+	int argc;
+	unsigned int allocated;
+
+	const char **argv;
+	size_t *argv_size;
+
+	char **owned;
+	unsigned int owned_length, owned_allocated;
+} stsml_redis_args_t;
+
+/* replies to read-only commands already sent while rendering the current page, so includes asking for the same key don't go back to redis */
+#define STSML_REDIS_MEMO_BUCKETS 64
+#define STSML_REDIS_MEMO_MAX 256
+
+typedef struct stsml_redis_memo_entry_s
+{
+	char *command;
+	size_t command_size;
+	unsigned long long hash;
+
+	redisReply *reply;
+
+	struct stsml_redis_memo_entry_s *next;
+} stsml_redis_memo_entry_t;
+
+typedef struct
+{
+	int active;
+	unsigned int length;
+
+	stsml_redis_memo_entry_t *buckets[STSML_REDIS_MEMO_BUCKETS];
+} stsml_redis_memo_t;
+
+/* a shared non-blocking connection. hiredis' async api runs on its own i/o thread, a caller only waits for its own reply while every other thread keeps going */
+typedef struct stsml_redis_s stsml_redis_t;
+
+
+stsml_redis_t *stsml_redis_connect(const char *host, int port);
+
+void stsml_redis_release(stsml_redis_t *redis);
+
+int stsml_redis_connected(stsml_redis_t *redis);
+
+const char *stsml_redis_host(stsml_redis_t *redis, int *port);
+
+redisReply *stsml_redis_command(stsml_redis_t *redis, int argc, const char **argv, const size_t *argv_size);
+
+int stsml_redis_pipeline(stsml_redis_t *redis, stsml_redis_args_t *commands, unsigned int count, redisReply **replies);
+
+
+/* a blocking connection borrowed from the pool. Only the thread that checked it out may use it until it is checked back in */
+typedef struct stsml_redis_conn_s
+{
+	redisContext *context;
+
+	double last_used;
+
+	struct stsml_redis_conn_s *next;
+} stsml_redis_conn_t;
+
+
+int stsml_redis_pool_init(const char *host, int port, unsigned int min, unsigned int max, double timeout, double health_interval);
+
+void stsml_redis_pool_destroy(void);
+
+stsml_redis_conn_t *stsml_redis_pool_checkout(void);
+
+void stsml_redis_pool_checkin(stsml_redis_conn_t *conn);
+
+int stsml_redis_pool_endpoint(char **host, int *port);
+
+
+void stsml_redis_set_timeouts(double connect_timeout, double command_timeout);
+
+void stsml_redis_endpoint_failed(const char *host, int port);
+
+int stsml_redis_endpoint_up(const char *host, int port);
+
+redisContext *stsml_redis_context_connect(const char *host, int port);
+
+int stsml_redis_context_check(redisContext **context);
+
+redisContext *stsml_redis_context_blocking(const char *host, int port);
+
+redisContext *stsml_redis_subscribe(const char *host, int port, const char *pattern);
+
+void stsml_redis_health_destroy(void);
+
+
+void stsml_redis_args_init(stsml_redis_args_t *args);
+
+int stsml_redis_args_push(stsml_redis_args_t *args, const char *data, size_t size, int owned);
+
+int stsml_redis_args_set(stsml_redis_args_t *args, int index, const char *data, size_t size, int owned);
+
+void stsml_redis_args_free(stsml_redis_args_t *args);
+
+int stsml_redis_script_load(const char *name, const char *source, size_t size, char sha[41]);
+
+int stsml_redis_script_get(const char *name, char sha[41], char **source, size_t *size);
+
+void stsml_redis_script_destroy(void);
+
+char *stsml_redis_args_serialize(const stsml_redis_args_t *args, size_t *size);
+
+int stsml_redis_readonly(const stsml_redis_args_t *args);
+
+redisReply *stsml_redis_memo_get(stsml_redis_memo_t *memo, const stsml_redis_args_t *command);
+
+int stsml_redis_memo_put(stsml_redis_memo_t *memo, const stsml_redis_args_t *command, redisReply *reply);
+
+void stsml_redis_memo_clear(stsml_redis_memo_t *memo);
+
+int stsml_redis_context_pipeline(redisContext *context, stsml_redis_args_t *commands, unsigned int count, redisReply **replies);
+
+#endif
\ No newline at end of file
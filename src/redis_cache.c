@@ -0,0 +1,732 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+#include "redis_cache.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <sys/socket.h>
+#include <fnmatch.h>
+#include <errno.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define STSML_REDIS_CACHE_BUCKETS 4096
+
+/* how long to wait before connecting again after the tracking connection fails */
+#define STSML_REDIS_CACHE_RETRY 1.0
+
+
+struct stsml_redis_cache_entry_s
+{
+	/* from stsml_redis_args_serialize */
+	char *command;
+	size_t command_size;
+
+	char *key;
+	size_t key_size;
+
+	redisReply *reply;
+
+	/* roughly what the entry costs, counted against the memory cap */
+	size_t size;
+
+	double expires;
+
+	/* an invalidated entry leaves the table but lives on until the last reader lets go */
+	unsigned int references;
+	int removed;
+
+	struct stsml_redis_cache_entry_s *next, *lru_prev, *lru_next;
+};
+
+typedef struct stsml_redis_cache_pattern_s
+{
+	char *pattern;
+	double ttl;
+
+	struct stsml_redis_cache_pattern_s *next;
+} stsml_redis_cache_pattern_t;
+
+static struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+
+	int configured, stop, reconnect;
+
+	char *host;
+	int port;
+
+	/* entries are only stored while redis is pushing invalidations to this connection */
+	redisContext *tracking;
+	int active;
+
+	/* bumped by every invalidation and whenever tracking starts or stops. A reply is only stored if the epoch did not move between the lookup before the read and the store after it. 0 is never a valid epoch */
+	unsigned long long epoch;
+
+	stsml_redis_cache_pattern_t *patterns;
+
+	/* buckets are by key so an invalidation finds every cached command on that key */
+	stsml_redis_cache_entry_t *buckets[STSML_REDIS_CACHE_BUCKETS];
+	stsml_redis_cache_entry_t *lru_head, *lru_tail;
+
+	size_t max_bytes;
+
+	stsml_redis_cache_stats_t stats;
+} redis_cache = {.lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER, .configured = 0, .epoch = 1};
+
+/* single key reads, the key is always the first argument */
+static const char *cacheable_commands[] = {
+	"GET", "STRLEN", "GETRANGE", "EXISTS", "TYPE",
+	"HGET", "HMGET", "HGETALL", "HKEYS", "HVALS", "HLEN", "HEXISTS", "HSTRLEN",
+	"LRANGE", "LINDEX", "LLEN",
+	"SMEMBERS", "SISMEMBER", "SMISMEMBER", "SCARD",
+	"ZRANGE", "ZRANGEBYSCORE", "ZREVRANGE", "ZSCORE", "ZCARD", "ZRANK", "ZCOUNT",
+	NULL
+};
+
+
+static int stsml_redis_cache_cacheable(const stsml_redis_args_t *command)
+{
+	unsigned int i;
+
+
+	if(command->argc < 2 || (!strncasecmp(command->argv[0], "EXISTS", command->argv_size[0]) && command->argc != 2))
+		return 0;
+
+	for(i = 0; cacheable_commands[i]; ++i)
+	{
+		if(strlen(cacheable_commands[i]) == command->argv_size[0] && !strncasecmp(cacheable_commands[i], command->argv[0], command->argv_size[0]))
+			return 1;
+	}
+
+	return 0;
+}
+
+/* the ttl of the first matching pattern, 0 if the key is not cached */
+static double stsml_redis_cache_ttl(const char *key, size_t key_size)
+{
+	stsml_redis_cache_pattern_t *pattern = NULL;
+	char *temp_key = NULL;
+	double ret = 0.0;
+
+
+	if(!(temp_key = strndup(key, key_size)))
+		return 0.0;
+
+	for(pattern = redis_cache.patterns; pattern; pattern = pattern->next)
+	{
+		if(!fnmatch(pattern->pattern, temp_key, 0))
+		{
+			ret = pattern->ttl;
+			break;
+		}
+	}
+
+	free(temp_key);
+
+	return ret;
+}
+
+static size_t stsml_redis_cache_reply_size(redisReply *reply)
+{
+	size_t ret = sizeof(redisReply) + reply->len, i;
+
+
+	for(i = 0; i < reply->elements; ++i)
+		ret += sizeof(redisReply *) + stsml_redis_cache_reply_size(reply->element[i]);
+
+	return ret;
+}
+
+static void stsml_redis_cache_entry_free(stsml_redis_cache_entry_t *entry)
+{
+	freeReplyObject(entry->reply);
+	free(entry->command);
+	free(entry->key);
+	free(entry);
+}
+
+static void stsml_redis_cache_lru_unlink(stsml_redis_cache_entry_t *entry)
+{
+	if(entry->lru_prev)
+		entry->lru_prev->lru_next = entry->lru_next;
+	else
+		redis_cache.lru_head = entry->lru_next;
+
+	if(entry->lru_next)
+		entry->lru_next->lru_prev = entry->lru_prev;
+	else
+		redis_cache.lru_tail = entry->lru_prev;
+
+	entry->lru_prev = entry->lru_next = NULL;
+}
+
+static void stsml_redis_cache_lru_push(stsml_redis_cache_entry_t *entry)
+{
+	entry->lru_prev = NULL;
+	entry->lru_next = redis_cache.lru_head;
+
+	if(redis_cache.lru_head)
+		redis_cache.lru_head->lru_prev = entry;
+	else
+		redis_cache.lru_tail = entry;
+
+	redis_cache.lru_head = entry;
+}
+
+/* takes the entry out of the table, the lock must be held */
+static void stsml_redis_cache_remove(stsml_redis_cache_entry_t *entry)
+{
+	stsml_redis_cache_entry_t **link = NULL;
+
+
+	for(link = &redis_cache.buckets[stsml_hash(entry->key, entry->key_size) % STSML_REDIS_CACHE_BUCKETS]; *link; link = &(*link)->next)
+	{
+		if(*link == entry)
+		{
+			*link = entry->next;
+			break;
+		}
+	}
+
+	stsml_redis_cache_lru_unlink(entry);
+
+	redis_cache.stats.bytes -= entry->size;
+	entry->removed = 1;
+
+	if(!entry->references)
+		stsml_redis_cache_entry_free(entry);
+}
+
+static void stsml_redis_cache_invalidate(const char *key, size_t key_size)
+{
+	stsml_redis_cache_entry_t *entry = NULL, *next = NULL;
+
+
+	for(entry = redis_cache.buckets[stsml_hash(key, key_size) % STSML_REDIS_CACHE_BUCKETS]; entry; entry = next)
+	{
+		next = entry->next;
+
+		if(entry->key_size == key_size && !memcmp(entry->key, key, key_size))
+		{
+			stsml_redis_cache_remove(entry);
+			redis_cache.stats.invalidations++;
+		}
+	}
+}
+
+static void stsml_redis_cache_flush(void)
+{
+	while(redis_cache.lru_head)
+		stsml_redis_cache_remove(redis_cache.lru_head);
+}
+
+/* invalidation messages redis pushes to the tracking connection. A nil key list means everything is gone, like after a FLUSHALL */
+static void stsml_redis_cache_push(void *data, void *push_reply)
+{
+	redisReply *reply = push_reply;
+	size_t i;
+
+
+	if(reply->type == REDIS_REPLY_PUSH && reply->elements == 2 && reply->element[0]->str && !strcmp(reply->element[0]->str, "invalidate"))
+	{
+		pthread_mutex_lock(&redis_cache.lock);
+
+		redis_cache.epoch++;
+
+		if(reply->element[1]->type == REDIS_REPLY_ARRAY)
+		{
+			for(i = 0; i < reply->element[1]->elements; ++i)
+				stsml_redis_cache_invalidate(reply->element[1]->element[i]->str, reply->element[1]->element[i]->len);
+		}
+		else
+			stsml_redis_cache_flush();
+
+		pthread_mutex_unlock(&redis_cache.lock);
+	}
+
+	freeReplyObject(reply);
+}
+
+/* the literal start of a glob pattern, redis only has to tell us about keys starting with it */
+static size_t stsml_redis_cache_prefix(const char *pattern)
+{
+	return strcspn(pattern, "*?[\\");
+}
+
+/* switches to RESP3 and asks for invalidations of every key the patterns could match */
+static int stsml_redis_cache_track(redisContext *context)
+{
+	stsml_redis_cache_pattern_t *pattern = NULL;
+	stsml_redis_args_t command;
+	redisReply *reply = NULL;
+	int ret = 1, everything = 0;
+
+
+	if(!(reply = redisCommand(context, "HELLO 3")) || reply->type == REDIS_REPLY_ERROR)
+	{
+		fprintf(stderr, "redis server does not speak RESP3, client side caching is off\n");
+
+		if(reply)
+			freeReplyObject(reply);
+
+		return 1;
+	}
+
+	freeReplyObject(reply);
+
+	stsml_redis_args_init(&command);
+
+	stsml_redis_args_push(&command, "CLIENT", 6, 0);
+	stsml_redis_args_push(&command, "TRACKING", 8, 0);
+	stsml_redis_args_push(&command, "ON", 2, 0);
+	stsml_redis_args_push(&command, "BCAST", 5, 0);
+
+	pthread_mutex_lock(&redis_cache.lock);
+
+	for(pattern = redis_cache.patterns; pattern; pattern = pattern->next)
+		if(!stsml_redis_cache_prefix(pattern->pattern))
+			everything = 1;
+
+	for(pattern = redis_cache.patterns; pattern && !everything; pattern = pattern->next)
+	{
+		stsml_redis_args_push(&command, "PREFIX", 6, 0);
+		stsml_redis_args_push(&command, strndup(pattern->pattern, stsml_redis_cache_prefix(pattern->pattern)), stsml_redis_cache_prefix(pattern->pattern), 1);
+	}
+
+	pthread_mutex_unlock(&redis_cache.lock);
+
+	if((reply = redisCommandArgv(context, command.argc, command.argv, command.argv_size)))
+	{
+		if(reply->type == REDIS_REPLY_STATUS)
+			ret = 0;
+		else
+			fprintf(stderr, "could not turn on redis client tracking: %s\n", reply->str ? reply->str : "unknown error");
+
+		freeReplyObject(reply);
+	}
+
+	stsml_redis_args_free(&command);
+
+	return ret;
+}
+
+static int stsml_redis_cache_active(void)
+{
+	int ret;
+
+
+	pthread_mutex_lock(&redis_cache.lock);
+	ret = redis_cache.active;
+	pthread_mutex_unlock(&redis_cache.lock);
+
+	return ret;
+}
+
+static void *stsml_redis_cache_thread(void *data)
+{
+	redisContext *context = NULL;
+	struct timespec deadline;
+	void *reply = NULL;
+	int retry;
+
+
+	pthread_mutex_lock(&redis_cache.lock);
+
+	while(!redis_cache.stop)
+	{
+		redis_cache.reconnect = 0;
+
+		pthread_mutex_unlock(&redis_cache.lock);
+
+		if((context = redisConnect(redis_cache.host, redis_cache.port)) && !context->err)
+		{
+			redisSetPushCallback(context, &stsml_redis_cache_push);
+
+			if(!stsml_redis_cache_track(context))
+			{
+				pthread_mutex_lock(&redis_cache.lock);
+
+				redis_cache.tracking = context;
+				redis_cache.active = !redis_cache.stop && !redis_cache.reconnect;
+
+				/* reads that started while nothing was tracked could have missed a write */
+				redis_cache.epoch++;
+
+				pthread_mutex_unlock(&redis_cache.lock);
+
+				/* invalidations arrive through the push callback, this only returns once the connection is gone */
+				while(stsml_redis_cache_active() && redisGetReply(context, &reply) == REDIS_OK)
+				{
+					if(reply)
+						freeReplyObject(reply);
+				}
+			}
+		}
+		else
+			fprintf(stderr, "could not make the redis client side cache connection to '%s:%d'\n", redis_cache.host, redis_cache.port);
+
+		/* nothing can be trusted without invalidations */
+		pthread_mutex_lock(&redis_cache.lock);
+
+		redis_cache.tracking = NULL;
+		redis_cache.active = 0;
+		redis_cache.epoch++;
+
+		stsml_redis_cache_flush();
+
+		retry = !redis_cache.reconnect;
+
+		pthread_mutex_unlock(&redis_cache.lock);
+
+		if(context)
+			redisFree(context);
+
+		context = NULL;
+
+		pthread_mutex_lock(&redis_cache.lock);
+
+		if(retry && !redis_cache.stop)
+		{
+			stsml_deadline(&deadline, STSML_REDIS_CACHE_RETRY);
+			pthread_cond_timedwait(&redis_cache.cond, &redis_cache.lock, &deadline);
+		}
+	}
+
+	pthread_mutex_unlock(&redis_cache.lock);
+
+	return NULL;
+}
+
+/* drops the tracking connection so the thread makes a new one, the lock must be held */
+static void stsml_redis_cache_restart(void)
+{
+	redis_cache.reconnect = 1;
+	redis_cache.active = 0;
+
+	if(redis_cache.tracking)
+		shutdown(redis_cache.tracking->fd, SHUT_RDWR);
+
+	pthread_cond_signal(&redis_cache.cond);
+}
+
+/* turns on the client side cache. Only the first call does anything, so every worker can run the same init script. Nothing is cached until a pattern is added */
+int stsml_redis_cache_init(const char *host, int port, size_t max_bytes)
+{
+	pthread_mutex_lock(&redis_cache.lock);
+
+	if(redis_cache.configured)
+	{
+		pthread_mutex_unlock(&redis_cache.lock);
+		return 0;
+	}
+
+	if(!(redis_cache.host = strdup(host)))
+	{
+		fprintf(stderr, "could not allocate redis cache host\n");
+		pthread_mutex_unlock(&redis_cache.lock);
+
+		return 1;
+	}
+
+	redis_cache.port = port;
+	redis_cache.max_bytes = max_bytes;
+	redis_cache.stop = 0;
+
+	if(pthread_create(&redis_cache.thread, NULL, &stsml_redis_cache_thread, NULL))
+	{
+		fprintf(stderr, "could not start the redis cache thread\n");
+
+		free(redis_cache.host);
+		redis_cache.host = NULL;
+
+		pthread_mutex_unlock(&redis_cache.lock);
+
+		return 1;
+	}
+
+	redis_cache.configured = 1;
+
+	pthread_mutex_unlock(&redis_cache.lock);
+
+	return 0;
+}
+
+void stsml_redis_cache_destroy(void)
+{
+	stsml_redis_cache_pattern_t *pattern = NULL;
+
+
+	pthread_mutex_lock(&redis_cache.lock);
+
+	if(!redis_cache.configured)
+	{
+		pthread_mutex_unlock(&redis_cache.lock);
+		return;
+	}
+
+	redis_cache.stop = 1;
+	stsml_redis_cache_restart();
+
+	pthread_mutex_unlock(&redis_cache.lock);
+
+	pthread_join(redis_cache.thread, NULL);
+
+	pthread_mutex_lock(&redis_cache.lock);
+
+	while((pattern = redis_cache.patterns))
+	{
+		redis_cache.patterns = pattern->next;
+
+		free(pattern->pattern);
+		free(pattern);
+	}
+
+	free(redis_cache.host);
+
+	redis_cache.host = NULL;
+	redis_cache.configured = 0;
+
+	pthread_mutex_unlock(&redis_cache.lock);
+}
+
+/* caches reads of keys matching the glob pattern for up to ttl seconds. Setting an existing pattern only changes its ttl, a new one reconnects the tracking connection so redis knows about its prefix */
+int stsml_redis_cache_pattern(const char *pattern, double ttl)
+{
+	stsml_redis_cache_pattern_t *temp = NULL, **link = NULL;
+
+
+	pthread_mutex_lock(&redis_cache.lock);
+
+	for(link = &redis_cache.patterns; *link; link = &(*link)->next)
+	{
+		if(!strcmp((*link)->pattern, pattern))
+		{
+			(*link)->ttl = ttl;
+			pthread_mutex_unlock(&redis_cache.lock);
+
+			return 0;
+		}
+	}
+
+	if(!(temp = calloc(1, sizeof(stsml_redis_cache_pattern_t))) || !(temp->pattern = strdup(pattern)))
+	{
+		fprintf(stderr, "could not allocate redis cache pattern\n");
+
+		free(temp);
+		pthread_mutex_unlock(&redis_cache.lock);
+
+		return 1;
+	}
+
+	temp->ttl = ttl;
+
+	/* first added is first matched */
+	*link = temp;
+
+	if(redis_cache.configured)
+		stsml_redis_cache_restart();
+
+	pthread_mutex_unlock(&redis_cache.lock);
+
+	return 0;
+}
+
+/* a fresh cached reply for the command, or NULL. Epoch is set either way and has to be passed to stsml_redis_cache_put after a miss, it stays 0 when the reply must not be stored */
+stsml_redis_cache_entry_t *stsml_redis_cache_get(const stsml_redis_args_t *command, unsigned long long *epoch)
+{
+	stsml_redis_cache_entry_t *entry = NULL;
+	char *serialized = NULL;
+	size_t serialized_size;
+	int cached;
+
+
+	*epoch = 0;
+
+	if(!redis_cache.configured || !stsml_redis_cache_cacheable(command))
+		return NULL;
+
+	/* most keys match no pattern, those are turned away before anything is copied */
+	pthread_mutex_lock(&redis_cache.lock);
+
+	cached = redis_cache.active && stsml_redis_cache_ttl(command->argv[1], command->argv_size[1]) > 0.0;
+
+	pthread_mutex_unlock(&redis_cache.lock);
+
+	if(!cached || !(serialized = stsml_redis_args_serialize(command, &serialized_size)))
+		return NULL;
+
+	pthread_mutex_lock(&redis_cache.lock);
+
+	/* tracking may have stopped since, then nothing is looked up or stored */
+	if(!redis_cache.active)
+	{
+		pthread_mutex_unlock(&redis_cache.lock);
+		free(serialized);
+
+		return NULL;
+	}
+
+	*epoch = redis_cache.epoch;
+
+	for(entry = redis_cache.buckets[stsml_hash(command->argv[1], command->argv_size[1]) % STSML_REDIS_CACHE_BUCKETS]; entry; entry = entry->next)
+	{
+		if(entry->command_size == serialized_size && !memcmp(entry->command, serialized, serialized_size))
+			break;
+	}
+
+	if(entry && entry->expires <= stsml_time_now())
+	{
+		stsml_redis_cache_remove(entry);
+		entry = NULL;
+	}
+
+	if(entry)
+	{
+		entry->references++;
+
+		stsml_redis_cache_lru_unlink(entry);
+		stsml_redis_cache_lru_push(entry);
+
+		redis_cache.stats.hits++;
+	}
+	else
+		redis_cache.stats.misses++;
+
+	pthread_mutex_unlock(&redis_cache.lock);
+
+	free(serialized);
+
+	return entry;
+}
+
+/* stores a reply read after stsml_redis_cache_get missed. On success the cache owns the reply and the returned entry is referenced, otherwise NULL is returned and the caller still owns it */
+stsml_redis_cache_entry_t *stsml_redis_cache_put(const stsml_redis_args_t *command, redisReply *reply, unsigned long long epoch)
+{
+	stsml_redis_cache_entry_t *entry = NULL, *old = NULL, **bucket = NULL;
+	double ttl;
+
+
+	if(!epoch || !redis_cache.configured || reply->type == REDIS_REPLY_ERROR || !stsml_redis_cache_cacheable(command))
+		return NULL;
+
+	if(!(entry = calloc(1, sizeof(stsml_redis_cache_entry_t))))
+	{
+		fprintf(stderr, "could not allocate redis cache entry\n");
+		return NULL;
+	}
+
+	if(!(entry->command = stsml_redis_args_serialize(command, &entry->command_size)) || !(entry->key = malloc(command->argv_size[1] + 1)))
+	{
+		free(entry->command);
+		free(entry);
+
+		return NULL;
+	}
+
+	memcpy(entry->key, command->argv[1], command->argv_size[1]);
+	entry->key[command->argv_size[1]] = 0x0;
+	entry->key_size = command->argv_size[1];
+
+	entry->size = sizeof(stsml_redis_cache_entry_t) + entry->command_size + entry->key_size + stsml_redis_cache_reply_size(reply);
+	entry->references = 1;
+
+	pthread_mutex_lock(&redis_cache.lock);
+
+	/* something changed while the reply was on its way, or nobody is telling us about changes */
+	if(!redis_cache.active || epoch != redis_cache.epoch || (ttl = stsml_redis_cache_ttl(entry->key, entry->key_size)) <= 0.0 || entry->size > redis_cache.max_bytes)
+	{
+		pthread_mutex_unlock(&redis_cache.lock);
+
+		free(entry->command);
+		free(entry->key);
+		free(entry);
+
+		return NULL;
+	}
+
+	bucket = &redis_cache.buckets[stsml_hash(entry->key, entry->key_size) % STSML_REDIS_CACHE_BUCKETS];
+
+	/* another thread stored the same command first */
+	for(old = *bucket; old; old = old->next)
+	{
+		if(old->command_size == entry->command_size && !memcmp(old->command, entry->command, entry->command_size))
+		{
+			stsml_redis_cache_remove(old);
+			break;
+		}
+	}
+
+	entry->reply = reply;
+	entry->expires = stsml_time_now() + ttl;
+	entry->next = *bucket;
+	*bucket = entry;
+
+	stsml_redis_cache_lru_push(entry);
+	redis_cache.stats.bytes += entry->size;
+
+	while(redis_cache.stats.bytes > redis_cache.max_bytes && redis_cache.lru_tail != entry)
+	{
+		stsml_redis_cache_remove(redis_cache.lru_tail);
+		redis_cache.stats.evictions++;
+	}
+
+	pthread_mutex_unlock(&redis_cache.lock);
+
+	return entry;
+}
+
+redisReply *stsml_redis_cache_entry_reply(stsml_redis_cache_entry_t *entry)
+{
+	return entry->reply;
+}
+
+void stsml_redis_cache_release(stsml_redis_cache_entry_t *entry)
+{
+	if(!entry)
+		return;
+
+	pthread_mutex_lock(&redis_cache.lock);
+
+	if(!--entry->references && entry->removed)
+		stsml_redis_cache_entry_free(entry);
+
+	pthread_mutex_unlock(&redis_cache.lock);
+}
+
+void stsml_redis_cache_stats(stsml_redis_cache_stats_t *stats)
+{
+	pthread_mutex_lock(&redis_cache.lock);
+	*stats = redis_cache.stats;
+	pthread_mutex_unlock(&redis_cache.lock);
+}
\ No newline at end of file
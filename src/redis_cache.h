@@ -0,0 +1,63 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+#ifndef REDIS_CACHE_H__
+#define REDIS_CACHE_H__
+
+#include "redis.h"
+
+#include <hiredis/hiredis.h>
+
+#include <stddef.h>
+
+/* a cached reply. It stays valid while referenced, even if it gets invalidated in the meantime */
+typedef struct stsml_redis_cache_entry_s stsml_redis_cache_entry_t;
+
+typedef struct
+{
+	unsigned long hits, misses, invalidations, evictions;
+	size_t bytes;
+} stsml_redis_cache_stats_t;
+
+
+int stsml_redis_cache_init(const char *host, int port, size_t max_bytes);
+
+void stsml_redis_cache_destroy(void);
+
+int stsml_redis_cache_pattern(const char *pattern, double ttl);
+
+stsml_redis_cache_entry_t *stsml_redis_cache_get(const stsml_redis_args_t *command, unsigned long long *epoch);
+
+stsml_redis_cache_entry_t *stsml_redis_cache_put(const stsml_redis_args_t *command, redisReply *reply, unsigned long long epoch);
+
+redisReply *stsml_redis_cache_entry_reply(stsml_redis_cache_entry_t *entry);
+
+void stsml_redis_cache_release(stsml_redis_cache_entry_t *entry);
+
+void stsml_redis_cache_stats(stsml_redis_cache_stats_t *stats);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,569 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+#include "redis_shard.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+
+typedef struct
+{
+	char *host;
+	int port;
+
+	redisContext *context;
+} stsml_redis_shard_node_t;
+
+typedef struct
+{
+	unsigned long long hash;
+	unsigned int node;
+} stsml_redis_shard_point_t;
+
+struct stsml_redis_shards_s
+{
+	stsml_redis_shard_node_t *nodes;
+	unsigned int node_count;
+
+	/* sorted by hash, a key belongs to the first point at or after its own hash */
+	stsml_redis_shard_point_t *points;
+	unsigned int point_count;
+};
+
+/* how a command's keys are found and how the replies of its pieces are put back together */
+enum
+{
+	STSML_SHARD_ROUTE_KEY = 0,	/* one key, the first argument */
+	STSML_SHARD_ROUTE_NONE,	/* no key, goes to the first server */
+	STSML_SHARD_ROUTE_EVAL,	/* EVAL and EVALSHA, routed by their first key */
+	STSML_SHARD_ROUTE_GATHER,	/* every argument is a key, the array replies are put back in argument order */
+	STSML_SHARD_ROUTE_SUM,	/* every argument is a key, the integer replies are added up */
+	STSML_SHARD_ROUTE_PAIRS,	/* key value pairs, one status reply */
+	STSML_SHARD_ROUTE_ALL,	/* sent to every server, the first error or else the first reply */
+	STSML_SHARD_ROUTE_ALL_SUM,	/* sent to every server, the integer replies are added up */
+	STSML_SHARD_ROUTE_ALL_CONCAT	/* sent to every server, the array replies are joined */
+};
+
+/* a command sent to one server, either the whole command or the keys of a split one that live there */
+typedef struct
+{
+	unsigned int command, node;
+	int route, sent;
+
+	stsml_redis_args_t args;
+	int split;
+
+	/* for a split command, which key of the original each key here was */
+	unsigned int *positions;
+
+	redisReply *reply;
+} stsml_redis_shard_part_t;
+
+static const struct
+{
+	const char *name;
+	int route;
+} shard_routes[] = {
+	{"MGET", STSML_SHARD_ROUTE_GATHER},
+	{"DEL", STSML_SHARD_ROUTE_SUM},
+	{"UNLINK", STSML_SHARD_ROUTE_SUM},
+	{"EXISTS", STSML_SHARD_ROUTE_SUM},
+	{"TOUCH", STSML_SHARD_ROUTE_SUM},
+	{"MSET", STSML_SHARD_ROUTE_PAIRS},
+	{"EVAL", STSML_SHARD_ROUTE_EVAL},
+	{"EVALSHA", STSML_SHARD_ROUTE_EVAL},
+	{"EVAL_RO", STSML_SHARD_ROUTE_EVAL},
+	{"EVALSHA_RO", STSML_SHARD_ROUTE_EVAL},
+	{"SCRIPT", STSML_SHARD_ROUTE_ALL},
+	{"FLUSHALL", STSML_SHARD_ROUTE_ALL},
+	{"FLUSHDB", STSML_SHARD_ROUTE_ALL},
+	{"DBSIZE", STSML_SHARD_ROUTE_ALL_SUM},
+	{"KEYS", STSML_SHARD_ROUTE_ALL_CONCAT},
+	{"PING", STSML_SHARD_ROUTE_NONE},
+	{"ECHO", STSML_SHARD_ROUTE_NONE},
+	{"INFO", STSML_SHARD_ROUTE_NONE},
+	{"TIME", STSML_SHARD_ROUTE_NONE},
+	{"CLIENT", STSML_SHARD_ROUTE_NONE},
+	{"CONFIG", STSML_SHARD_ROUTE_NONE},
+	{"PUBLISH", STSML_SHARD_ROUTE_NONE},
+	{NULL, 0}
+};
+
+
+/* fnv spreads similar strings poorly, so the hash is mixed before it goes on the ring */
+static unsigned long long stsml_redis_shard_hash(const char *data, size_t size)
+{
+	unsigned long long hash = stsml_hash(data, size);
+
+
+	hash ^= hash >> 30;
+	hash *= 0xbf58476d1ce4e5b9ULL;
+	hash ^= hash >> 27;
+	hash *= 0x94d049bb133111ebULL;
+	hash ^= hash >> 31;
+
+	return hash;
+}
+
+static int stsml_redis_shard_point_compare(const void *a, const void *b)
+{
+	const stsml_redis_shard_point_t *first = a, *second = b;
+
+
+	return first->hash < second->hash ? -1 : first->hash > second->hash;
+}
+
+static int stsml_redis_shard_route(const stsml_redis_args_t *command)
+{
+	unsigned int i;
+
+
+	for(i = 0; shard_routes[i].name; ++i)
+	{
+		if(strlen(shard_routes[i].name) == command->argv_size[0] && !strncasecmp(shard_routes[i].name, command->argv[0], command->argv_size[0]))
+			return shard_routes[i].route;
+	}
+
+	return command->argc > 1 ? STSML_SHARD_ROUTE_KEY : STSML_SHARD_ROUTE_NONE;
+}
+
+static redisReply *stsml_redis_shard_reply(int type, size_t elements)
+{
+	redisReply *reply = NULL;
+
+
+	if(!(reply = calloc(1, sizeof(redisReply))))
+		return NULL;
+
+	reply->type = type;
+
+	if(elements && !(reply->element = calloc(elements, sizeof(redisReply *))))
+	{
+		free(reply);
+		return NULL;
+	}
+
+	reply->elements = elements;
+
+	return reply;
+}
+
+/* connects, or reconnects a server whose connection broke on an earlier command. A server that is down is skipped right away */
+static redisContext *stsml_redis_shard_context(stsml_redis_shard_node_t *node)
+{
+	if(node->context && !node->context->err)
+		return node->context;
+
+	if(node->context)
+		redisFree(node->context);
+
+	return (node->context = stsml_redis_context_connect(node->host, node->port));
+}
+
+static stsml_redis_shard_part_t *stsml_redis_shard_part(stsml_redis_shard_part_t **parts, unsigned int *length, unsigned int *allocated, unsigned int command, unsigned int node, int route)
+{
+	stsml_redis_shard_part_t *temp = NULL;
+
+
+	if(*length == *allocated)
+	{
+		if(!(temp = realloc(*parts, (*allocated ? *allocated * 2 : 16) * sizeof(stsml_redis_shard_part_t))))
+		{
+			fprintf(stderr, "could not grow redis shard commands\n");
+			return NULL;
+		}
+
+		*parts = temp;
+		*allocated = *allocated ? *allocated * 2 : 16;
+	}
+
+	temp = &(*parts)[(*length)++];
+	memset(temp, 0, sizeof(stsml_redis_shard_part_t));
+
+	temp->command = command;
+	temp->node = node;
+	temp->route = route;
+
+	stsml_redis_args_init(&temp->args);
+
+	return temp;
+}
+
+/* splits a multi key command into one command per server holding some of its keys */
+static int stsml_redis_shard_split(stsml_redis_shards_t *shards, stsml_redis_args_t *command, unsigned int index, int route, stsml_redis_shard_part_t **parts, unsigned int *length, unsigned int *allocated)
+{
+	stsml_redis_shard_part_t *part = NULL;
+	unsigned int *nodes = NULL, i, key, part_keys, step = route == STSML_SHARD_ROUTE_PAIRS ? 2 : 1, keys = (command->argc - 1) / step;
+	int ret = 0;
+
+
+	if(!keys || !(nodes = malloc(keys * sizeof(unsigned int))))
+		return 1;
+
+	for(key = 0; key < keys; ++key)
+		nodes[key] = stsml_redis_shards_node(shards, command->argv[1 + key * step], command->argv_size[1 + key * step]);
+
+	for(i = 0; i < shards->node_count && !ret; ++i)
+	{
+		part = NULL;
+		part_keys = 0;
+
+		for(key = 0; key < keys && !ret; ++key)
+		{
+			if(nodes[key] != i)
+				continue;
+
+			if(!part)
+			{
+				if(!(part = stsml_redis_shard_part(parts, length, allocated, index, i, route)) || !(part->positions = malloc(keys * sizeof(unsigned int))))
+				{
+					ret = 1;
+					break;
+				}
+
+				part->split = 1;
+				stsml_redis_args_push(&part->args, command->argv[0], command->argv_size[0], 0);
+			}
+
+			/* MSET has two arguments per key, so the argument count can't index the positions */
+			part->positions[part_keys++] = key;
+
+			stsml_redis_args_push(&part->args, command->argv[1 + key * step], command->argv_size[1 + key * step], 0);
+
+			if(step == 2)
+				stsml_redis_args_push(&part->args, command->argv[2 + key * step], command->argv_size[2 + key * step], 0);
+		}
+	}
+
+	free(nodes);
+
+	return ret;
+}
+
+/* puts the replies to the pieces of one command back into the reply the caller expects */
+static redisReply *stsml_redis_shard_gather(stsml_redis_shard_part_t *parts, unsigned int count, const stsml_redis_args_t *command)
+{
+	redisReply *ret = NULL, *error = NULL;
+	unsigned int i, j, position;
+	size_t elements = 0;
+	long long sum = 0;
+
+
+	for(i = 0; i < count; ++i)
+	{
+		if(!parts[i].reply)
+			return NULL;
+
+		if(parts[i].reply->type == REDIS_REPLY_ERROR && !error)
+			error = parts[i].reply;
+
+		if(parts[i].reply->type == REDIS_REPLY_ARRAY)
+			elements += parts[i].reply->elements;
+		else if(parts[i].reply->type == REDIS_REPLY_INTEGER)
+			sum += parts[i].reply->integer;
+	}
+
+	if(count == 1 || error)
+	{
+		ret = error ? error : parts[0].reply;
+
+		for(i = 0; i < count; ++i)
+		{
+			if(parts[i].reply == ret)
+				parts[i].reply = NULL;
+		}
+
+		return ret;
+	}
+
+	switch(parts[0].route)
+	{
+		case STSML_SHARD_ROUTE_SUM:
+		case STSML_SHARD_ROUTE_ALL_SUM:
+			if((ret = stsml_redis_shard_reply(REDIS_REPLY_INTEGER, 0)))
+				ret->integer = sum;
+		break;
+		case STSML_SHARD_ROUTE_GATHER:
+		case STSML_SHARD_ROUTE_ALL_CONCAT:
+			/* MGET puts every value back where its key was, KEYS just joins */
+			if(!(ret = stsml_redis_shard_reply(REDIS_REPLY_ARRAY, parts[0].route == STSML_SHARD_ROUTE_GATHER ? (size_t)(command->argc - 1) : elements)))
+				break;
+
+			for(i = 0, position = 0; i < count; ++i)
+			{
+				for(j = 0; parts[i].reply->type == REDIS_REPLY_ARRAY && j < parts[i].reply->elements; ++j)
+				{
+					if(parts[0].route == STSML_SHARD_ROUTE_GATHER && j < (unsigned int)parts[i].args.argc - 1)
+						ret->element[parts[i].positions[j]] = parts[i].reply->element[j];
+					else if(parts[0].route == STSML_SHARD_ROUTE_ALL_CONCAT)
+						ret->element[position++] = parts[i].reply->element[j];
+					else
+						continue;
+
+					parts[i].reply->element[j] = NULL;
+				}
+			}
+		break;
+		default:
+			ret = parts[0].reply;
+			parts[0].reply = NULL;
+		break;
+	}
+
+	return ret;
+}
+
+stsml_redis_shards_t *stsml_redis_shards_create(void)
+{
+	stsml_redis_shards_t *shards = NULL;
+
+
+	if(!(shards = calloc(1, sizeof(stsml_redis_shards_t))))
+		fprintf(stderr, "could not allocate redis shards\n");
+
+	return shards;
+}
+
+/* adds a server and its points to the ring. Only the keys that land on the new points move, about 1 / count of them. Returns 1 if it could not be added, not being able to connect yet is fine */
+int stsml_redis_shards_add(stsml_redis_shards_t *shards, const char *host, int port)
+{
+	stsml_redis_shard_node_t *nodes = NULL;
+	stsml_redis_shard_point_t *points = NULL;
+	char name[320];
+	unsigned int i;
+	int size;
+
+
+	if(!(nodes = realloc(shards->nodes, (shards->node_count + 1) * sizeof(stsml_redis_shard_node_t))))
+	{
+		fprintf(stderr, "could not grow redis shard servers\n");
+		return 1;
+	}
+
+	shards->nodes = nodes;
+
+	if(!(points = realloc(shards->points, (shards->point_count + STSML_REDIS_SHARD_POINTS) * sizeof(stsml_redis_shard_point_t))))
+	{
+		fprintf(stderr, "could not grow redis shard ring\n");
+		return 1;
+	}
+
+	shards->points = points;
+
+	if(!(nodes[shards->node_count].host = strdup(host)))
+	{
+		fprintf(stderr, "could not allocate redis shard host\n");
+		return 1;
+	}
+
+	nodes[shards->node_count].port = port;
+	nodes[shards->node_count].context = NULL;
+
+	/* points depend on the address, not the order servers are listed in, so every worker and process agrees */
+	for(i = 0; i < STSML_REDIS_SHARD_POINTS; ++i)
+	{
+		size = snprintf(name, sizeof(name), "%s:%d-%u", host, port, i);
+
+		points[shards->point_count].hash = stsml_redis_shard_hash(name, size < (int)sizeof(name) ? (size_t)size : sizeof(name) - 1);
+		points[shards->point_count].node = shards->node_count;
+		shards->point_count++;
+	}
+
+	qsort(shards->points, shards->point_count, sizeof(stsml_redis_shard_point_t), &stsml_redis_shard_point_compare);
+
+	stsml_redis_shard_context(&nodes[shards->node_count]);
+
+	shards->node_count++;
+
+	return 0;
+}
+
+void stsml_redis_shards_destroy(stsml_redis_shards_t *shards)
+{
+	unsigned int i;
+
+
+	if(!shards)
+		return;
+
+	for(i = 0; i < shards->node_count; ++i)
+	{
+		if(shards->nodes[i].context)
+			redisFree(shards->nodes[i].context);
+
+		free(shards->nodes[i].host);
+	}
+
+	free(shards->nodes);
+	free(shards->points);
+	free(shards);
+}
+
+unsigned int stsml_redis_shards_count(stsml_redis_shards_t *shards)
+{
+	return shards->node_count;
+}
+
+/* the server a key lives on. Like redis cluster, only the part inside {} is hashed when there is one, so related keys can be kept together */
+unsigned int stsml_redis_shards_node(stsml_redis_shards_t *shards, const char *key, size_t size)
+{
+	const char *open = NULL, *close = NULL;
+	unsigned long long hash;
+	unsigned int low = 0, high = shards->point_count;
+
+
+	if(!shards->point_count)
+		return 0;
+
+	if((open = memchr(key, '{', size)) && (close = memchr(open + 1, '}', size - (open + 1 - key))) && close > open + 1)
+	{
+		size = close - open - 1;
+		key = open + 1;
+	}
+
+	hash = stsml_redis_shard_hash(key, size);
+
+	while(low < high)
+	{
+		if(shards->points[(low + high) / 2].hash < hash)
+			low = (low + high) / 2 + 1;
+		else
+			high = (low + high) / 2;
+	}
+
+	return shards->points[low == shards->point_count ? 0 : low].node;
+}
+
+/* same as stsml_redis_context_pipeline, but every command goes to the server its key lives on. Multi key commands are split up and their replies put back together, so callers can't tell. Every server gets its share of the commands in one write before any replies are read. Returns 1 if any server could not be reached */
+int stsml_redis_shards_pipeline(stsml_redis_shards_t *shards, stsml_redis_args_t *commands, unsigned int count, redisReply **replies)
+{
+	stsml_redis_shard_part_t *parts = NULL, *part = NULL;
+	redisContext *context = NULL;
+	unsigned int length = 0, allocated = 0, i, j, node;
+	void *reply = NULL;
+	int ret = 0, route;
+
+
+	memset(replies, 0, count * sizeof(redisReply *));
+
+	if(!shards->node_count)
+		return 1;
+
+	for(i = 0; i < count; ++i)
+	{
+		if(!commands[i].argc)
+			continue;
+
+		switch((route = stsml_redis_shard_route(&commands[i])))
+		{
+			case STSML_SHARD_ROUTE_GATHER:
+			case STSML_SHARD_ROUTE_SUM:
+			case STSML_SHARD_ROUTE_PAIRS:
+				if(stsml_redis_shard_split(shards, &commands[i], i, route, &parts, &length, &allocated))
+					ret = 1;
+			break;
+			case STSML_SHARD_ROUTE_ALL:
+			case STSML_SHARD_ROUTE_ALL_SUM:
+			case STSML_SHARD_ROUTE_ALL_CONCAT:
+				for(node = 0; node < shards->node_count; ++node)
+				{
+					if(!stsml_redis_shard_part(&parts, &length, &allocated, i, node, route))
+						ret = 1;
+				}
+			break;
+			default:
+				node = 0;
+
+				if(route == STSML_SHARD_ROUTE_KEY)
+					node = stsml_redis_shards_node(shards, commands[i].argv[1], commands[i].argv_size[1]);
+				else if(route == STSML_SHARD_ROUTE_EVAL && commands[i].argc > 3 && strtoul(commands[i].argv[2], NULL, 10))
+					node = stsml_redis_shards_node(shards, commands[i].argv[3], commands[i].argv_size[3]);
+
+				if(!stsml_redis_shard_part(&parts, &length, &allocated, i, node, route))
+					ret = 1;
+			break;
+		}
+	}
+
+	/* everything is buffered per server first, then the replies are read back in the same order */
+	for(i = 0; i < length; ++i)
+	{
+		part = &parts[i];
+
+		if(!(context = stsml_redis_shard_context(&shards->nodes[part->node])))
+			continue;
+
+		if(part->split)
+			part->sent = redisAppendCommandArgv(context, part->args.argc, part->args.argv, part->args.argv_size) == REDIS_OK;
+		else
+			part->sent = redisAppendCommandArgv(context, commands[part->command].argc, commands[part->command].argv, commands[part->command].argv_size) == REDIS_OK;
+	}
+
+	for(i = 0; i < length; ++i)
+	{
+		if(!parts[i].sent)
+		{
+			ret = 1;
+			continue;
+		}
+
+		if(redisGetReply(shards->nodes[parts[i].node].context, &reply) != REDIS_OK)
+		{
+			stsml_redis_endpoint_failed(shards->nodes[parts[i].node].host, shards->nodes[parts[i].node].port);
+
+			ret = 1;
+			continue;
+		}
+
+		parts[i].reply = reply;
+	}
+
+	/* the pieces of one command are next to each other */
+	for(i = 0; i < length; i = j)
+	{
+		for(j = i + 1; j < length && parts[j].command == parts[i].command; ++j);
+
+		replies[parts[i].command] = stsml_redis_shard_gather(&parts[i], j - i, &commands[parts[i].command]);
+	}
+
+	for(i = 0; i < length; ++i)
+	{
+		if(parts[i].reply)
+			freeReplyObject(parts[i].reply);
+
+		stsml_redis_args_free(&parts[i].args);
+		free(parts[i].positions);
+	}
+
+	free(parts);
+
+	return ret;
+}
\ No newline at end of file
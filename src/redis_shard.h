@@ -0,0 +1,56 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+#ifndef REDIS_SHARD_H__
+#define REDIS_SHARD_H__
+
+#include "redis.h"
+
+#include <hiredis/hiredis.h>
+
+#include <stddef.h>
+
+/* points each server gets on the hash ring, more points spread keys more evenly */
+#define STSML_REDIS_SHARD_POINTS 160
+
+/* keys spread over several servers by consistent hashing. Connections are blocking and belong to one interpreter, like redis-connect */
+typedef struct stsml_redis_shards_s stsml_redis_shards_t;
+
+
+stsml_redis_shards_t *stsml_redis_shards_create(void);
+
+int stsml_redis_shards_add(stsml_redis_shards_t *shards, const char *host, int port);
+
+void stsml_redis_shards_destroy(stsml_redis_shards_t *shards);
+
+unsigned int stsml_redis_shards_count(stsml_redis_shards_t *shards);
+
+unsigned int stsml_redis_shards_node(stsml_redis_shards_t *shards, const char *key, size_t size);
+
+int stsml_redis_shards_pipeline(stsml_redis_shards_t *shards, stsml_redis_args_t *commands, unsigned int count, redisReply **replies);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,434 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+#include "timer.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+
+#define STSML_TIMER_BUCKETS 256
+
+typedef struct stsml_timer_s
+{
+	unsigned long long id;
+
+	/* the tick it is due on, and the time the current run was planned for before jitter, so periodic runs don't drift */
+	unsigned long long expires;
+	double planned;
+
+	double interval, jitter;
+	int skip_overlap, running, firing, cancelled;
+
+	stsml_timer_fire_t fire;
+	void (*discard)(void *data);
+	void *data;
+
+	/* the wheel slot list and the slot it is in, the id lookup chain, and the list of timers being fired */
+	struct stsml_timer_s *prev, *next, **slot, *hash_next, *fire_next;
+} stsml_timer_t;
+
+
+/* one thread turns the wheel, adding and removing timers never walks more than one slot */
+static struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+
+	int started, stop;
+
+	double start;
+	unsigned long long tick, next_id;
+	unsigned int seed;
+
+	stsml_timer_t *wheel[STSML_TIMER_LEVELS][STSML_TIMER_SLOTS];
+	stsml_timer_t *buckets[STSML_TIMER_BUCKETS];
+} timers = {.lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER, .started = 0, .next_id = 1};
+
+
+/* the level a timer goes in is picked by how far away it is, the slot by the bits of its tick at that level */
+static void stsml_timer_place(stsml_timer_t *timer)
+{
+	unsigned long long expires = timer->expires, delta;
+	unsigned int level;
+	stsml_timer_t **slot = NULL;
+
+
+	if(expires <= timers.tick)
+		expires = timers.tick + 1;
+
+	delta = expires - timers.tick;
+
+	for(level = 0; level < STSML_TIMER_LEVELS - 1 && delta >= (1ULL << (6 * (level + 1))); ++level);
+
+	/* too far out for the wheel, it is placed again when this slot cascades */
+	if(delta >= (1ULL << (6 * STSML_TIMER_LEVELS)))
+		expires = timers.tick + (1ULL << (6 * STSML_TIMER_LEVELS)) - 1;
+
+	slot = &timers.wheel[level][(expires >> (6 * level)) & (STSML_TIMER_SLOTS - 1)];
+
+	timer->prev = NULL;
+	timer->slot = slot;
+
+	if((timer->next = *slot))
+		timer->next->prev = timer;
+
+	*slot = timer;
+}
+
+static void stsml_timer_unplace(stsml_timer_t *timer)
+{
+	if(timer->prev)
+		timer->prev->next = timer->next;
+	else if(timer->slot)
+		*timer->slot = timer->next;
+
+	if(timer->next)
+		timer->next->prev = timer->prev;
+
+	timer->prev = timer->next = NULL;
+	timer->slot = NULL;
+}
+
+/* plans the next run at planned, plus up to jitter seconds so timers added together don't all fire on the same tick */
+static void stsml_timer_schedule(stsml_timer_t *timer, double planned)
+{
+	double at = planned;
+
+
+	timer->planned = planned;
+
+	if(timer->jitter > 0.0)
+		at += timer->jitter * ((double)rand_r(&timers.seed) / ((double)RAND_MAX + 1.0));
+
+	timer->expires = at <= timers.start ? 0 : (unsigned long long)((at - timers.start) / STSML_TIMER_TICK + 0.999999);
+
+	stsml_timer_place(timer);
+}
+
+static stsml_timer_t **stsml_timer_find(unsigned long long id)
+{
+	stsml_timer_t **timer = NULL;
+
+
+	for(timer = &timers.buckets[id % STSML_TIMER_BUCKETS]; *timer; timer = &(*timer)->hash_next)
+	{
+		if((*timer)->id == id)
+			break;
+	}
+
+	return timer;
+}
+
+/* takes a timer out of the lookup, the caller has already taken it off the wheel */
+static void stsml_timer_free(stsml_timer_t *timer)
+{
+	stsml_timer_t **found = stsml_timer_find(timer->id);
+
+
+	if(*found)
+		*found = timer->hash_next;
+
+	timer->discard(timer->data);
+	free(timer);
+}
+
+/* moves the timers of a higher level slot down now that they are close enough */
+static void stsml_timer_cascade(unsigned int level)
+{
+	stsml_timer_t *timer = NULL, *next = NULL;
+	unsigned int slot = (timers.tick >> (6 * level)) & (STSML_TIMER_SLOTS - 1);
+
+
+	timer = timers.wheel[level][slot];
+	timers.wheel[level][slot] = NULL;
+
+	for(; timer; timer = next)
+	{
+		next = timer->next;
+		stsml_timer_place(timer);
+	}
+
+	/* the next level only cascades when this one wrapped around */
+	if(!slot && level + 1 < STSML_TIMER_LEVELS)
+		stsml_timer_cascade(level + 1);
+}
+
+/* turns the wheel one tick and returns the timers that are due, marked as firing */
+static stsml_timer_t *stsml_timer_advance(void)
+{
+	stsml_timer_t *timer = NULL, *next = NULL, *due = NULL;
+	unsigned int slot;
+
+
+	timers.tick++;
+
+	slot = timers.tick & (STSML_TIMER_SLOTS - 1);
+
+	if(!slot)
+		stsml_timer_cascade(1);
+
+	timer = timers.wheel[0][slot];
+	timers.wheel[0][slot] = NULL;
+
+	for(; timer; timer = next)
+	{
+		next = timer->next;
+		timer->prev = timer->next = NULL;
+		timer->slot = NULL;
+
+		/* only timers that were too far out for the wheel land here early */
+		if(timer->expires > timers.tick)
+		{
+			stsml_timer_place(timer);
+			continue;
+		}
+
+		timer->firing = 1;
+		timer->fire_next = due;
+		due = timer;
+	}
+
+	return due;
+}
+
+static void *stsml_timer_thread(void *data)
+{
+	stsml_timer_t *due = NULL, *timer = NULL, *next = NULL;
+	unsigned long long target;
+	struct timespec deadline;
+
+
+	pthread_mutex_lock(&timers.lock);
+
+	while(!timers.stop)
+	{
+		target = (unsigned long long)((stsml_time_now() - timers.start) / STSML_TIMER_TICK);
+
+		while(timers.tick < target && !timers.stop)
+		{
+			due = stsml_timer_advance();
+
+			/* runs overlapping a run that is still going are skipped, the rest fire without the lock so a busy task pool can't hold up stsml_timer_done */
+			for(timer = due; timer; timer = timer->fire_next)
+			{
+				if(timer->skip_overlap && timer->running)
+					timer->firing = 2;
+				else
+					timer->running = 1;
+			}
+
+			pthread_mutex_unlock(&timers.lock);
+
+			for(timer = due; timer; timer = timer->fire_next)
+			{
+				if(timer->firing == 1 && timer->fire(timer->id, timer->data))
+					timer->firing = 3;
+			}
+
+			pthread_mutex_lock(&timers.lock);
+
+			for(timer = due; timer; timer = next)
+			{
+				next = timer->fire_next;
+
+				/* a run that did not start can't be done later */
+				if(timer->firing == 3)
+					timer->running = 0;
+
+				timer->firing = 0;
+
+				if(timer->cancelled || timer->interval <= 0.0)
+					stsml_timer_free(timer);
+				else
+				{
+					/* a wheel that fell behind skips the runs it missed instead of firing them all at once */
+					timer->planned += timer->interval;
+
+					if(timer->planned < stsml_time_now())
+						timer->planned = stsml_time_now() + timer->interval;
+
+					stsml_timer_schedule(timer, timer->planned);
+				}
+			}
+		}
+
+		stsml_deadline(&deadline, STSML_TIMER_TICK);
+		pthread_cond_timedwait(&timers.cond, &timers.lock, &deadline);
+	}
+
+	pthread_mutex_unlock(&timers.lock);
+
+	return NULL;
+}
+
+/* runs fire after delay seconds, then every interval seconds if it is above 0. The timer thread starts with the first timer. Returns the timer id, 0 on failure, and the data is discarded then */
+unsigned long long stsml_timer_add(double delay, double interval, double jitter, int skip_overlap, stsml_timer_fire_t fire, void (*discard)(void *data), void *data)
+{
+	stsml_timer_t *timer = NULL;
+	unsigned long long id;
+
+
+	if(!(timer = calloc(1, sizeof(stsml_timer_t))))
+	{
+		fprintf(stderr, "could not allocate timer\n");
+		discard(data);
+
+		return 0;
+	}
+
+	timer->interval = interval;
+	timer->jitter = jitter;
+	timer->skip_overlap = skip_overlap;
+	timer->fire = fire;
+	timer->discard = discard;
+	timer->data = data;
+
+	pthread_mutex_lock(&timers.lock);
+
+	if(!timers.started)
+	{
+		timers.start = stsml_time_now();
+		timers.tick = 0;
+		timers.stop = 0;
+		timers.seed = (unsigned int)time(NULL);
+
+		if(pthread_create(&timers.thread, NULL, &stsml_timer_thread, NULL))
+		{
+			pthread_mutex_unlock(&timers.lock);
+
+			fprintf(stderr, "could not start timer thread\n");
+			discard(data);
+			free(timer);
+
+			return 0;
+		}
+
+		timers.started = 1;
+	}
+
+	id = timer->id = timers.next_id++;
+
+	timer->hash_next = timers.buckets[id % STSML_TIMER_BUCKETS];
+	timers.buckets[id % STSML_TIMER_BUCKETS] = timer;
+
+	stsml_timer_schedule(timer, stsml_time_now() + (delay > 0.0 ? delay : 0.0));
+
+	pthread_mutex_unlock(&timers.lock);
+
+	return id;
+}
+
+/* a run started by fire finished, the next one may fire */
+void stsml_timer_done(unsigned long long id)
+{
+	stsml_timer_t *timer = NULL;
+
+
+	pthread_mutex_lock(&timers.lock);
+
+	if((timer = *stsml_timer_find(id)))
+		timer->running = 0;
+
+	pthread_mutex_unlock(&timers.lock);
+}
+
+/* stops a timer, a run already going finishes. Returns 1 if there is no such timer */
+int stsml_timer_cancel(unsigned long long id)
+{
+	stsml_timer_t *timer = NULL;
+
+
+	pthread_mutex_lock(&timers.lock);
+
+	if(!(timer = *stsml_timer_find(id)) || timer->cancelled)
+	{
+		pthread_mutex_unlock(&timers.lock);
+		return 1;
+	}
+
+	/* the timer thread is firing it right now and frees it after */
+	if(timer->firing)
+		timer->cancelled = 1;
+	else
+	{
+		stsml_timer_unplace(timer);
+		stsml_timer_free(timer);
+	}
+
+	pthread_mutex_unlock(&timers.lock);
+
+	return 0;
+}
+
+void stsml_timers_destroy(void)
+{
+	stsml_timer_t *timer = NULL;
+	unsigned int i;
+
+
+	pthread_mutex_lock(&timers.lock);
+
+	if(!timers.started)
+	{
+		pthread_mutex_unlock(&timers.lock);
+		return;
+	}
+
+	timers.stop = 1;
+	pthread_cond_broadcast(&timers.cond);
+
+	pthread_mutex_unlock(&timers.lock);
+
+	pthread_join(timers.thread, NULL);
+
+	pthread_mutex_lock(&timers.lock);
+
+	for(i = 0; i < STSML_TIMER_BUCKETS; ++i)
+	{
+		while((timer = timers.buckets[i]))
+		{
+			timers.buckets[i] = timer->hash_next;
+
+			timer->discard(timer->data);
+			free(timer);
+		}
+	}
+
+	memset(timers.wheel, 0, sizeof(timers.wheel));
+
+	timers.started = 0;
+
+	pthread_mutex_unlock(&timers.lock);
+}
\ No newline at end of file
@@ -0,0 +1,48 @@
+/*
+This is free and unencumbered software released into the public domain.
+
+Anyone is free to copy, modify, publish, use, compile, sell, or
+distribute this software, either in source code form or as a compiled
+binary, for any purpose, commercial or non-commercial, and by any
+means.
+
+In jurisdictions that recognize copyright laws, the author or authors
+of this software dedicate any and all copyright interest in the
+software to the public domain. We make this dedication for the benefit
+of the public at large and to the detriment of our heirs and
+successors. We intend this dedication to be an overt act of
+relinquishment in perpetuity of all present and future rights to this
+software under copyright law.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+OTHER DEALINGS IN THE SOFTWARE.
+
+For more information, please refer to <http://unlicense.org/>
+*/
+
+#ifndef TIMER_H__
+#define TIMER_H__
+
+/* the wheel turns every 10ms. Four levels of 64 slots reach about 46 hours ahead, timers further out wait in the last level and are placed again as they get closer */
+#define STSML_TIMER_TICK 0.01
+#define STSML_TIMER_LEVELS 4
+#define STSML_TIMER_SLOTS 64
+
+/* fire is called from the timer thread and returns 0 if it started a run. A timer that skips overlapping runs is not fired again until stsml_timer_done is called for that run. discard gets the data once the timer is gone */
+typedef int (*stsml_timer_fire_t)(unsigned long long id, void *data);
+
+
+unsigned long long stsml_timer_add(double delay, double interval, double jitter, int skip_overlap, stsml_timer_fire_t fire, void (*discard)(void *data), void *data);
+
+void stsml_timer_done(unsigned long long id);
+
+int stsml_timer_cancel(unsigned long long id);
+
+void stsml_timers_destroy(void);
+
+#endif
\ No newline at end of file
@@ -25,6 +25,9 @@ OTHER DEALINGS IN THE SOFTWARE.
 For more information, please refer to <http://unlicense.org/>
 */
 
+/* strptime and timegm */
+#define _GNU_SOURCE
+
 #include "util.h"
 
 #include "../lib/SimpleTinyScript/sts_embedding_extras.h"
@@ -42,67 +45,519 @@ For more information, please refer to <http://unlicense.org/>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <time.h>
+#include <ctype.h>
+#include <stdint.h>
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 
-sts_value_t *stsml_value_from_redis(sts_script_t *script, redisReply *reply)
+/* a container reply that is still being filled in */
+typedef struct
 {
-	sts_value_t *ret = NULL, *temp = NULL;
-	size_t i;
+	redisReply *reply;
+	sts_value_t *value;
+	size_t index;
+} stsml_redis_frame_t;
+
+
+static int stsml_redis_reply_is_container(redisReply *reply)
+{
+	return reply->type == REDIS_REPLY_ARRAY || reply->type == REDIS_REPLY_MAP || reply->type == REDIS_REPLY_SET || reply->type == REDIS_REPLY_PUSH;
+}
+
+/* converts one reply without its elements. Containers come back as arrays already sized for them */
+static sts_value_t *stsml_value_from_redis_single(sts_script_t *script, redisReply *reply)
+{
+	sts_value_t *ret = NULL;
+	sts_value_t **data = NULL;
 
 
 	switch(reply->type)
 	{
 		case REDIS_REPLY_INTEGER:
-			if(!(ret = sts_value_from_number(script, (double)reply->integer)))
+			ret = sts_value_from_number(script, (double)reply->integer);
+		break;
+		case REDIS_REPLY_DOUBLE:
+			ret = sts_value_from_number(script, reply->dval);
+		break;
+		case REDIS_REPLY_BOOL:
+			ret = sts_value_from_number(script, reply->integer ? 1.0 : 0.0);
+		break;
+		case REDIS_REPLY_STATUS:
+		case REDIS_REPLY_STRING:
+		case REDIS_REPLY_VERB:
+		case REDIS_REPLY_BIGNUM:
+			ret = sts_value_from_nstring(script, reply->str, reply->len);
+		break;
+		case REDIS_REPLY_ARRAY:
+		case REDIS_REPLY_MAP:
+		case REDIS_REPLY_SET:
+		case REDIS_REPLY_PUSH:
+			if(!(ret = sts_value_create(script, STS_ARRAY)))
+				break;
+
+			/* one allocation instead of growing with every element */
+			if(reply->elements > ret->array.allocated)
 			{
-				fprintf(stderr, "could not create new ret number\n");
-				return NULL;
+				if(!(data = realloc(ret->array.data, reply->elements * sizeof(sts_value_t *))))
+				{
+					fprintf(stderr, "could not size array for redis reply\n");
+					sts_value_reference_decrement(script, ret);
+
+					return NULL;
+				}
+
+				ret->array.data = data;
+				ret->array.allocated = reply->elements;
 			}
 		break;
 		case REDIS_REPLY_ERROR:
 			/* TODO set some local with the error message */
-		case REDIS_REPLY_NIL:
-			if(!(ret = sts_value_create(script, STS_NIL)))
+		default:
+			ret = sts_value_create(script, STS_NIL);
+	}
+
+	if(!ret)
+		fprintf(stderr, "could not create value from redis reply\n");
+
+	return ret;
+}
+
+/* converts a reply into script values. This walks the reply with its own stack instead of recursing, so deeply nested replies are fine. RESP3 maps become flat key, value arrays like HGETALL replies */
+sts_value_t *stsml_value_from_redis(sts_script_t *script, redisReply *reply)
+{
+	stsml_redis_frame_t *stack = NULL, *temp_stack = NULL;
+	size_t depth = 0, allocated = 0;
+	sts_value_t *ret = NULL, *value = NULL;
+	redisReply *element = NULL;
+
+
+	if(!(ret = stsml_value_from_redis_single(script, reply)) || !stsml_redis_reply_is_container(reply) || !reply->elements)
+		return ret;
+
+	if(!(stack = malloc((allocated = 16) * sizeof(stsml_redis_frame_t))))
+	{
+		fprintf(stderr, "could not allocate redis reply stack\n");
+		sts_value_reference_decrement(script, ret);
+
+		return NULL;
+	}
+
+	stack[depth].reply = reply;
+	stack[depth].value = ret;
+	stack[depth].index = 0;
+	depth++;
+
+	while(depth)
+	{
+		if(stack[depth - 1].index == stack[depth - 1].reply->elements)
+		{
+			depth--;
+			continue;
+		}
+
+		element = stack[depth - 1].reply->element[stack[depth - 1].index++];
+
+		/* appended right away, so freeing the top value on failure frees everything made so far */
+		if(!(value = stsml_value_from_redis_single(script, element)))
+		{
+			free(stack);
+			sts_value_reference_decrement(script, ret);
+
+			return NULL;
+		}
+
+		stack[depth - 1].value->array.data[stack[depth - 1].value->array.length++] = value;
+
+		if(!stsml_redis_reply_is_container(element) || !element->elements)
+			continue;
+
+		if(depth == allocated)
+		{
+			if(!(temp_stack = realloc(stack, (allocated * 2) * sizeof(stsml_redis_frame_t))))
 			{
-				fprintf(stderr, "could not create new ret nil value\n");
+				fprintf(stderr, "could not grow redis reply stack\n");
+
+				free(stack);
+				sts_value_reference_decrement(script, ret);
+
 				return NULL;
 			}
-		break;
-		case REDIS_REPLY_STATUS:
-		case REDIS_REPLY_STRING:
-			if(!(ret = sts_value_from_nstring(script, reply->str, reply->len)))
+
+			stack = temp_stack;
+			allocated *= 2;
+		}
+
+		stack[depth].reply = element;
+		stack[depth].value = value;
+		stack[depth].index = 0;
+		depth++;
+	}
+
+	free(stack);
+
+	return ret;
+}
+
+/* readies a value the caller owns for another interpreter. A value nothing else references moves over as is, a shared one is deep copied, since references are not counted atomically between threads. An array is only walked to find shared elements, so handing over a big freshly built array copies nothing. Returns the value to hand over, NULL on failure, and the caller's reference is gone either way */
+sts_value_t *stsml_value_transfer(sts_script_t *script, sts_value_t *value)
+{
+	sts_value_t *copy = NULL;
+	unsigned int i;
+
+
+	if(value->references > 1)
+	{
+		if(!(copy = sts_value_create(script, STS_NIL)) || sts_value_copy(script, copy, value, 1))
+		{
+			fprintf(stderr, "could not copy shared value\n");
+
+			if(copy)
+				sts_value_reference_decrement(script, copy);
+
+			copy = NULL;
+		}
+
+		sts_value_reference_decrement(script, value);
+
+		return copy;
+	}
+
+	if(value->type != STS_ARRAY)
+		return value;
+
+	for(i = 0; i < value->array.length; ++i)
+	{
+		if(!(value->array.data[i] = stsml_value_transfer(script, value->array.data[i])))
+		{
+			/* the rest of the array still gets freed normally */
+			memmove(&value->array.data[i], &value->array.data[i + 1], (value->array.length - i - 1) * sizeof(sts_value_t *));
+			value->array.length--;
+
+			sts_value_reference_decrement(script, value);
+
+			return NULL;
+		}
+	}
+
+	return value;
+}
+
+/* converts a RESP3 map or a flat HGETALL style key, value array into an array of [key value] pairs. Those spread back into field/value arguments when passed to redis. Any other reply converts as usual */
+sts_value_t *stsml_value_from_redis_map(sts_script_t *script, redisReply *reply)
+{
+	sts_value_t *ret = NULL, *pair = NULL, *value = NULL;
+	sts_value_t **data = NULL;
+	size_t i, j;
+
+
+	if((reply->type != REDIS_REPLY_MAP && reply->type != REDIS_REPLY_ARRAY) || reply->elements % 2)
+		return stsml_value_from_redis(script, reply);
+
+	if(!(ret = sts_value_create(script, STS_ARRAY)))
+	{
+		fprintf(stderr, "could not create new ret array\n");
+		return NULL;
+	}
+
+	if(reply->elements / 2 > ret->array.allocated)
+	{
+		if(!(data = realloc(ret->array.data, (reply->elements / 2) * sizeof(sts_value_t *))))
+		{
+			fprintf(stderr, "could not size array for redis map\n");
+			sts_value_reference_decrement(script, ret);
+
+			return NULL;
+		}
+
+		ret->array.data = data;
+		ret->array.allocated = reply->elements / 2;
+	}
+
+	for(i = 0; i < reply->elements; i += 2)
+	{
+		if(!(pair = sts_value_create(script, STS_ARRAY)))
+		{
+			fprintf(stderr, "could not create redis map pair\n");
+			sts_value_reference_decrement(script, ret);
+
+			return NULL;
+		}
+
+		ret->array.data[ret->array.length++] = pair;
+
+		for(j = 0; j < 2; ++j)
+		{
+			if(!(value = stsml_value_from_redis(script, reply->element[i + j])))
 			{
-				fprintf(stderr, "could not create new ret string\n");
+				sts_value_reference_decrement(script, ret);
 				return NULL;
 			}
-		break;
-		case REDIS_REPLY_ARRAY:
-			if(!(ret = sts_value_create(script, STS_ARRAY)))
+
+			sts_array_append_insert(script, pair, value, pair->array.length);
+		}
+	}
+
+	return ret;
+}
+
+/* adds a script value to a redis command. Strings are not copied, so the value has to outlive the command. Arrays are spread into their elements, a stdlib hashmap has to go through redis-hashmap first. Anything else is skipped */
+int stsml_redis_args_append(stsml_redis_args_t *args, sts_value_t *value)
+{
+	char buffer[32], *number = NULL;
+	size_t i;
+
+
+	switch(value->type)
+	{
+		case STS_STRING:
+			return stsml_redis_args_push(args, value->string.data, value->string.length, 0);
+		case STS_NUMBER:
+			if(value->number == (double)(long long)value->number)
+				snprintf(buffer, sizeof(buffer), "%lld", (long long)value->number);
+			else
+				snprintf(buffer, sizeof(buffer), "%.17g", value->number);
+
+			if(!(number = strdup(buffer)))
 			{
-				fprintf(stderr, "could not create new ret array\n");
-				return NULL;
+				fprintf(stderr, "could not format redis number argument\n");
+				return 1;
 			}
 
-			for(i = 0; i < reply->elements; ++i)
+			if(stsml_redis_args_push(args, number, strlen(number), 1))
 			{
-				if(!(temp = stsml_value_from_redis(script, reply->element[i])))
-				{
-					fprintf(stderr, "could not create a value from nested reply");
+				free(number);
+				return 1;
+			}
+		break;
+		case STS_ARRAY:
+			for(i = 0; i < value->array.length; ++i)
+			{
+				if(stsml_redis_args_append(args, value->array.data[i]))
+					return 1;
+			}
+		break;
+	}
 
-					if(ret)
-						sts_value_reference_decrement(script, ret);
+	return 0;
+}
 
-					return NULL;
-				}
+/* monotonic seconds, used for cache lifetimes */
+double stsml_time_now(void)
+{
+	struct timespec ts;
 
-				sts_array_append_insert(script, ret, temp, ret->array.length);
-			}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+/* an absolute CLOCK_REALTIME time this many seconds from now, for pthread_cond_timedwait */
+void stsml_deadline(struct timespec *deadline, double seconds)
+{
+	clock_gettime(CLOCK_REALTIME, deadline);
+
+	deadline->tv_sec += (time_t)seconds;
+	deadline->tv_nsec += (long)((seconds - (double)(time_t)seconds) * 1000000000.0);
+
+	if(deadline->tv_nsec >= 1000000000L)
+	{
+		deadline->tv_sec++;
+		deadline->tv_nsec -= 1000000000L;
+	}
+}
+
+/* 64 bit fnv-1a, used for etags */
+unsigned long long stsml_hash(const char *data, size_t size)
+{
+	unsigned long long hash = 14695981039346656037ULL;
+	size_t i;
+
+
+	for(i = 0; i < size; ++i)
+	{
+		hash ^= (unsigned char)data[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+/* hashes what a value holds, so equal values in different interpreters hash the same */
+unsigned long long stsml_value_hash(sts_value_t *value)
+{
+	unsigned long long hash = stsml_hash((const char *)&value->type, sizeof(value->type));
+	unsigned int i;
+
+
+	switch(value->type)
+	{
+		case STS_NUMBER:
+			hash ^= stsml_hash((const char *)&value->number, sizeof(value->number));
+		break;
+		case STS_STRING:
+			hash ^= stsml_hash(value->string.data, value->string.length);
+		break;
+		case STS_ARRAY:
+			for(i = 0; i < value->array.length; ++i)
+				hash = (hash * 1099511628211ULL) ^ stsml_value_hash(value->array.data[i]);
 		break;
 	}
 
-	return ret;
+	return hash;
+}
+
+#define SHA1_ROTATE(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
+
+static void stsml_sha1_block(uint32_t state[5], const unsigned char *block)
+{
+	uint32_t w[80], a, b, c, d, e, f, k, temp;
+	unsigned int i;
+
+
+	for(i = 0; i < 16; ++i)
+		w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 | (uint32_t)block[i * 4 + 2] << 8 | (uint32_t)block[i * 4 + 3];
+
+	for(; i < 80; ++i)
+		w[i] = SHA1_ROTATE(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+	a = state[0];
+	b = state[1];
+	c = state[2];
+	d = state[3];
+	e = state[4];
+
+	for(i = 0; i < 80; ++i)
+	{
+		if(i < 20)
+		{
+			f = (b & c) | (~b & d);
+			k = 0x5A827999;
+		}
+		else if(i < 40)
+		{
+			f = b ^ c ^ d;
+			k = 0x6ED9EBA1;
+		}
+		else if(i < 60)
+		{
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8F1BBCDC;
+		}
+		else
+		{
+			f = b ^ c ^ d;
+			k = 0xCA62C1D6;
+		}
+
+		temp = SHA1_ROTATE(a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = SHA1_ROTATE(b, 30);
+		b = a;
+		a = temp;
+	}
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+}
+
+/* the lowercase hex sha1 of data, which is what redis names a lua script by */
+void stsml_sha1_hex(const char *data, size_t size, char hex[41])
+{
+	uint32_t state[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+	unsigned char block[64];
+	unsigned long long bits = (unsigned long long)size * 8;
+	size_t i, remaining;
+
+
+	for(i = 0; i + 64 <= size; i += 64)
+		stsml_sha1_block(state, (const unsigned char *)data + i);
+
+	remaining = size - i;
+
+	memset(block, 0, sizeof(block));
+	memcpy(block, data + i, remaining);
+	block[remaining] = 0x80;
+
+	if(remaining >= 56)
+	{
+		stsml_sha1_block(state, block);
+		memset(block, 0, sizeof(block));
+	}
+
+	for(i = 0; i < 8; ++i)
+		block[63 - i] = (unsigned char)(bits >> (i * 8));
+
+	stsml_sha1_block(state, block);
+
+	for(i = 0; i < 5; ++i)
+		snprintf(&hex[i * 8], 9, "%08x", state[i]);
+}
+
+char *stsml_http_date(time_t time, char *buffer, size_t size)
+{
+	struct tm tm;
+
+
+	gmtime_r(&time, &tm);
+	strftime(buffer, size, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+
+	return buffer;
+}
+
+/* returns -1 if the date could not be parsed */
+time_t stsml_http_date_parse(const char *date)
+{
+	struct tm tm;
+
+
+	memset(&tm, 0, sizeof(struct tm));
+
+	if(!strptime(date, "%a, %d %b %Y %H:%M:%S GMT", &tm))
+		return -1;
+
+	return timegm(&tm);
+}
+
+/* checks an If-None-Match header against an etag. This is the weak comparison, which is what If-None-Match uses */
+int stsml_etag_match(const char *header, const char *etag)
+{
+	const char *start = NULL;
+	size_t size;
+
+
+	if(!strncmp(etag, "W/", 2))
+		etag += 2;
+
+	while(*header)
+	{
+		while(*header && (isspace(*header) || *header == ','))
+			++header;
+
+		if(*header == '*')
+			return 1;
+
+		if(!strncmp(header, "W/", 2))
+			header += 2;
+
+		start = header;
+
+		while(*header && *header != ',' && !isspace(*header))
+			++header;
+
+		size = header - start;
+
+		if(size && size == strlen(etag) && !strncmp(start, etag, size))
+			return 1;
+	}
+
+	return 0;
 }
\ No newline at end of file
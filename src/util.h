@@ -33,8 +33,34 @@ For more information, please refer to <http://unlicense.org/>
 #include <onion/onion.h>
 #include <hiredis/hiredis.h>
 
+#include "redis.h"
+
+#include <time.h>
+
 
 sts_value_t *stsml_value_from_redis(sts_script_t *script, redisReply *reply);
 
+sts_value_t *stsml_value_from_redis_map(sts_script_t *script, redisReply *reply);
+
+sts_value_t *stsml_value_transfer(sts_script_t *script, sts_value_t *value);
+
+int stsml_redis_args_append(stsml_redis_args_t *args, sts_value_t *value);
+
+double stsml_time_now(void);
+
+void stsml_deadline(struct timespec *deadline, double seconds);
+
+unsigned long long stsml_hash(const char *data, size_t size);
+
+unsigned long long stsml_value_hash(sts_value_t *value);
+
+void stsml_sha1_hex(const char *data, size_t size, char hex[41]);
+
+char *stsml_http_date(time_t time, char *buffer, size_t size);
+
+time_t stsml_http_date_parse(const char *date);
+
+int stsml_etag_match(const char *header, const char *etag);
+
 
 #endif
\ No newline at end of file